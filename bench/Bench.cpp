@@ -0,0 +1,695 @@
+﻿// Bench.cpp : Microbenchmarks for the renderer's hot paths, the accuracy of
+// the fast-math approximations (src/FastMath.h) and end-to-end throughput of
+// the built-in scenes. Results are written as JSON.
+//
+// Usage: rtnw_bench [--out file.json] [--min-time seconds] [--filter substring]
+//                   [--scene-width pixels] [--scene-spp samples] [--no-scenes]
+//
+// Exits with status 2 when an approximation exceeds the error bound FastMath.h
+// documents for it.
+
+#include "RTNW.h"
+#include "Camera.h"
+#include "Scenes.h"
+#include "Render.h"
+#include "Stats.h"
+#include "FastMath.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BenchOptions {
+	string outPath;
+	double minSeconds = 0.5;
+	string filter;
+	int sceneWidth = 64;
+	int sceneSpp = 4;
+	bool runScenes = true;
+};
+
+struct MicroResult {
+	string name;
+	long long operations;
+	double seconds;
+};
+
+struct AccuracyResult {
+	string name;
+	string domain;
+	double maxAbsError;
+	double maxRelError;
+	double absBound; // documented in FastMath.h
+	double relBound;
+
+	bool withinBounds() const { return maxAbsError <= absBound && maxRelError <= relBound; }
+};
+
+struct SceneResult {
+	int id;
+	string name;
+	double buildSeconds;
+	double bvhBuildSeconds;
+	int width, height, samplesPerPixel;
+	double renderSeconds;
+	long long primaryRays;
+	long long totalRays; // -1 unless built with RTNW_ENABLE_STATS
+};
+
+// Results are folded into this so the optimizer cannot drop the measured work.
+static volatile float benchSink = 0;
+
+typedef chrono::steady_clock BenchClock;
+
+inline double secondsSince(BenchClock::time_point start) {
+	return chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Call batch() until minSeconds have elapsed. Each call must perform
+// opsPerBatch operations and return a value depending on all of them.
+template <typename F>
+MicroResult runMicro(const string& name, int opsPerBatch, double minSeconds, F batch) {
+	// Warm up caches and branch predictors.
+	benchSink = benchSink + batch();
+
+	long long batches = 0;
+	float sink = 0;
+	BenchClock::time_point start = BenchClock::now();
+	double elapsed = 0;
+	do {
+		sink += batch();
+		batches++;
+		elapsed = secondsSince(start);
+	} while (elapsed < minSeconds);
+	benchSink = benchSink + sink;
+
+	cerr << name << ": " << 1e9 * elapsed / (batches * opsPerBatch) << " ns/op\n";
+	return MicroResult{ name, batches * opsPerBatch, elapsed };
+}
+
+// Rays starting on a sphere of radius 5 around the origin, aimed at points
+// inside [-1.5, 1.5]^3, so that roughly half of them hit a unit primitive.
+vector<Ray> makeRays(int count) {
+	vector<Ray> rays;
+	rays.reserve(count);
+	for (int ii = 0; ii < count; ii++) {
+		Point3 origin = 5 * randomUnitVector();
+		Point3 target = Vec3::random(-1.5, 1.5);
+		rays.push_back(Ray(origin, target - origin, random_float()));
+	}
+	return rays;
+}
+
+// Hit records on a unit sphere, used as inputs for material and texture benchmarks.
+vector<HitRecord> makeHitRecords(const vector<Ray>& rays, vector<Ray>& hitRays) {
+	Sphere sphere(Point3(0, 0, 0), 1, nullptr);
+	vector<HitRecord> records;
+	for (const Ray& ray : rays) {
+		HitRecord hitRecord;
+		if (sphere.hit(ray, 0.001, INF, hitRecord)) {
+			records.push_back(hitRecord);
+			hitRays.push_back(ray);
+		}
+	}
+	return records;
+}
+
+template <typename T>
+float sumHits(const T& obj, const vector<Ray>& rays) {
+	HitRecord hitRecord;
+	float sum = 0;
+	for (const Ray& ray : rays) {
+		if (obj.hit(ray, 0.001, INF, hitRecord)) sum += hitRecord.t;
+	}
+	return sum;
+}
+
+float sumScatter(const Material& mat, const vector<Ray>& rays, const vector<HitRecord>& records) {
+	float sum = 0;
+	Color attenuation;
+	Ray scattered;
+	for (size_t ii = 0; ii < records.size(); ii++) {
+		if (mat.scatter(rays[ii], records[ii], attenuation, scattered))
+			sum += scattered.direction().x() + attenuation.x();
+	}
+	return sum;
+}
+
+float sumTexture(const Texture& texture, const vector<HitRecord>& records) {
+	float sum = 0;
+	for (const HitRecord& rec : records) {
+		sum += texture.value(rec.u, rec.v, rec.p).x();
+	}
+	return sum;
+}
+
+void runMicroBenchmarks(const BenchOptions& options, vector<MicroResult>& results) {
+	seedRandom(1234);
+	const int rayCount = 4096;
+	vector<Ray> rays = makeRays(rayCount);
+	vector<Ray> hitRays;
+	vector<HitRecord> records = makeHitRecords(rays, hitRays);
+	const int recordCount = (int)records.size();
+
+	auto wanted = [&](const string& name) {
+		return options.filter.empty() || name.find(options.filter) != string::npos;
+	};
+	auto add = [&](const string& name, int ops, auto batch) {
+		if (wanted(name)) results.push_back(runMicro(name, ops, options.minSeconds, batch));
+	};
+
+	// Primitives
+	Sphere sphere(Point3(0, 0, 0), 1, nullptr);
+	add("sphere_hit", rayCount, [&]() { return sumHits(sphere, rays); });
+
+	add("sphere_uv", recordCount, [&]() {
+		float sum = 0;
+		for (const HitRecord& rec : records) {
+			float u, v;
+			Sphere::getSphereUV(rec.normal, u, v);
+			sum += u + v;
+		}
+		return sum;
+	});
+
+	MovingSphere movingSphere(Point3(0, -0.5, 0), Point3(0, 0.5, 0), 0, 1, 1, nullptr);
+	add("moving_sphere_hit", rayCount, [&]() { return sumHits(movingSphere, rays); });
+
+	AABB box(Point3(-1, -1, -1), Point3(1, 1, 1));
+	add("aabb_hit", rayCount, [&]() {
+		float sum = 0;
+		for (const Ray& ray : rays) sum += box.hit(ray, 0.001, INF) ? 1.0f : 0.0f;
+		return sum;
+	});
+
+	XYRect xyRect(-1, 1, -1, 1, 0, nullptr);
+	add("xy_rect_hit", rayCount, [&]() { return sumHits(xyRect, rays); });
+	YZRect yzRect(-1, 1, -1, 1, 0, nullptr);
+	add("yz_rect_hit", rayCount, [&]() { return sumHits(yzRect, rays); });
+	XZRect xzRect(-1, 1, -1, 1, 0, nullptr);
+	add("xz_rect_hit", rayCount, [&]() { return sumHits(xzRect, rays); });
+
+	Box unitBox(Point3(-1, -1, -1), Point3(1, 1, 1), nullptr);
+	add("box_hit", rayCount, [&]() { return sumHits(unitBox, rays); });
+
+	// BVH over a cloud of small spheres
+	const int bvhPrimitives = 1000;
+	HittableList cloud;
+	for (int ii = 0; ii < bvhPrimitives; ii++) {
+		cloud.add(make_shared<Sphere>(Vec3::random(-1.5, 1.5), 0.05, nullptr));
+	}
+	add("bvh_build_1000", 1, [&]() {
+		HittableList list = cloud;
+		BVHNode node(list, 0, 1);
+		AABB bbox;
+		node.boundingBox(0, 1, bbox);
+		return bbox.max().x();
+	});
+
+	add("bvh_build_arena_1000", 1, [&]() {
+		SceneArena arena;
+		HittableList list = cloud;
+		BVHNode node(list, 0, 1, arena);
+		AABB bbox;
+		node.boundingBox(0, 1, bbox);
+		return bbox.max().x();
+	});
+
+	// One animation frame: move every sphere a little, then refit (or rebuild) the tree.
+	HittableList animated;
+	vector<Sphere*> animatedSpheres;
+	for (int ii = 0; ii < bvhPrimitives; ii++) {
+		auto sphere = make_shared<Sphere>(Vec3::random(-1.5, 1.5), 0.05, nullptr);
+		animatedSpheres.push_back(sphere.get());
+		animated.add(sphere);
+	}
+	auto animate = [&]() {
+		for (Sphere* sphere : animatedSpheres) sphere->center += Vec3::random(-0.01, 0.01);
+	};
+	HittableList animatedList = animated;
+	BVHNode animatedBVH(animatedList, 0, 1);
+	add("bvh_refit_1000", 1, [&]() {
+		animate();
+		return animatedBVH.refit(0, 1).sahCost;
+	});
+	add("bvh_rebuild_frame_1000", 1, [&]() {
+		animate();
+		HittableList list = animated;
+		BVHNode node(list, 0, 1);
+		return node.sahCost();
+	});
+
+	BVHNode cloudBVH(cloud, 0, 1);
+	add("bvh_traverse_1000", rayCount, [&]() { return sumHits(cloudBVH, rays); });
+	add("bvh_intersect_resolve_1000", rayCount, [&]() {
+		HitRecord hitRecord;
+		float sum = 0;
+		for (const Ray& ray : rays) {
+			SurfaceHit surfaceHit;
+			if (!cloudBVH.intersect(ray, 0.001, INF, surfaceHit)) continue;
+			resolveHit(ray, surfaceHit, hitRecord);
+			sum += hitRecord.t;
+		}
+		return sum;
+	});
+	add("bvh_occluded_1000", rayCount, [&]() {
+		float sum = 0;
+		for (const Ray& ray : rays) sum += cloudBVH.occluded(ray, 0.001, INF) ? 1.0f : 0.0f;
+		return sum;
+	});
+	QuantizedBVH quantizedBVH(cloudBVH, 0, 1);
+	add("qbvh_traverse_1000", rayCount, [&]() { return sumHits(quantizedBVH, rays); });
+	add("qbvh_occluded_1000", rayCount, [&]() {
+		float sum = 0;
+		for (const Ray& ray : rays) sum += quantizedBVH.occluded(ray, 0.001, INF) ? 1.0f : 0.0f;
+		return sum;
+	});
+
+	// Large enough that the BVHNode tree (about 9 MB) outgrows the caches
+	const int largePrimitives = 100000;
+	HittableList largeCloud;
+	for (int ii = 0; ii < largePrimitives; ii++) {
+		largeCloud.add(make_shared<Sphere>(Vec3::random(-1.5, 1.5), 0.005, nullptr));
+	}
+	BVHNode largeBVH(largeCloud, 0, 1);
+	add("bvh_traverse_100k", rayCount, [&]() { return sumHits(largeBVH, rays); });
+	QuantizedBVH largeQuantizedBVH(largeBVH, 0, 1);
+	add("qbvh_traverse_100k", rayCount, [&]() { return sumHits(largeQuantizedBVH, rays); });
+
+	vector<Ray> listRays(rays.begin(), rays.begin() + rayCount / 16);
+	add("list_traverse_1000", (int)listRays.size(), [&]() { return sumHits(cloud, listRays); });
+
+	// Same cloud, but every sphere moves by up to 1 during the shutter
+	HittableList movingCloud;
+	for (int ii = 0; ii < bvhPrimitives; ii++) {
+		Point3 center = Vec3::random(-1.5, 1.5);
+		movingCloud.add(make_shared<MovingSphere>(center, center + Vec3::random(-0.5, 0.5), 0, 1, 0.05, nullptr));
+	}
+	BVHNode movingBVH(movingCloud, 0, 1);
+	add("bvh_traverse_moving_1000", rayCount, [&]() { return sumHits(movingBVH, rays); });
+	MotionBVHNode motionBVH(movingCloud, 0, 1);
+	add("motion_bvh_traverse_moving_1000", rayCount, [&]() { return sumHits(motionBVH, rays); });
+	MotionBVHNode temporalBVH(movingCloud, 0, 1, 2);
+	add("motion_bvh_temporal2_traverse_moving_1000", rayCount, [&]() { return sumHits(temporalBVH, rays); });
+
+	// Materials
+	Lambertian lambertian(Color(0.5, 0.5, 0.5));
+	add("lambertian_scatter", recordCount, [&]() { return sumScatter(lambertian, hitRays, records); });
+	Metal metal(Color(0.8, 0.8, 0.8), 0.3);
+	add("metal_scatter", recordCount, [&]() { return sumScatter(metal, hitRays, records); });
+	Dielectric dielectric(1.5);
+	add("dielectric_scatter", recordCount, [&]() { return sumScatter(dielectric, hitRays, records); });
+	Isotropic isotropic(Color(0.5, 0.5, 0.5));
+	add("isotropic_scatter", recordCount, [&]() { return sumScatter(isotropic, hitRays, records); });
+
+	// Samplers: one pixel sample of a camera ray plus four diffuse bounces.
+	for (SamplerType type : { SamplerIndependent, SamplerHalton, SamplerSobol, SamplerBlueNoise }) {
+		useSampler(type);
+		add(string("sampler_") + samplerName(type) + "_path_12d", 1024, [&]() {
+			Sampler& sampler = threadSampler();
+			float sum = 0;
+			for (int ii = 0; ii < 1024; ii++) {
+				sampler.startPixelSample(ii & 31, ii >> 5, ii);
+				for (int d = 0; d < 6; d++) {
+					Sample2D s = sampler.get2D();
+					sum += s.x + s.y;
+				}
+			}
+			return sum;
+		});
+	}
+	useSampler(SamplerIndependent);
+
+	// Sample warps, one sample at a time and as a batch.
+	const int warpCount = 4096;
+	vector<float> warpU1(warpCount), warpU2(warpCount), warpX(warpCount), warpY(warpCount), warpZ(warpCount);
+	for (int ii = 0; ii < warpCount; ii++) {
+		warpU1[ii] = random_float();
+		warpU2[ii] = random_float();
+	}
+	add("warp_cosine_hemisphere", warpCount, [&]() {
+		float sum = 0;
+		for (int ii = 0; ii < warpCount; ii++) sum += sampleCosineHemisphere(Sample2D{ warpU1[ii], warpU2[ii] }).z();
+		return sum;
+	});
+	add("warp_cosine_hemisphere_batch", warpCount, [&]() {
+		cosineHemisphereBatch(warpU1.data(), warpU2.data(), warpCount, warpX.data(), warpY.data(), warpZ.data());
+		return warpZ[0] + warpZ[warpCount - 1];
+	});
+	add("warp_uniform_sphere", warpCount, [&]() {
+		float sum = 0;
+		for (int ii = 0; ii < warpCount; ii++) sum += sampleUniformSphere(Sample2D{ warpU1[ii], warpU2[ii] }).z();
+		return sum;
+	});
+	add("warp_uniform_sphere_batch", warpCount, [&]() {
+		uniformSphereBatch(warpU1.data(), warpU2.data(), warpCount, warpX.data(), warpY.data(), warpZ.data());
+		return warpZ[0] + warpZ[warpCount - 1];
+	});
+
+	// Fast math: libm, the polynomial one value at a time, and as a batch.
+	vector<float> mathAngles(warpCount), mathCosines(warpCount), mathPositive(warpCount), mathOut(warpCount);
+	vector<float> mathAtanX(warpCount);
+	for (int ii = 0; ii < warpCount; ii++) {
+		mathAngles[ii] = random_float(-50, 50);
+		mathCosines[ii] = random_float(-1, 1);
+		mathPositive[ii] = random_float();
+		mathAtanX[ii] = warpU1[ii] - 0.5f;
+	}
+	auto mathMicros = [&](const string& name, const vector<float>& in, auto libm, auto approx, auto batch) {
+		add("math_" + name + "_libm", warpCount, [&]() {
+			float sum = 0;
+			for (float x : in) sum += libm(x);
+			return sum;
+		});
+		add("math_" + name + "_approx", warpCount, [&]() {
+			float sum = 0;
+			for (float x : in) sum += approx(x);
+			return sum;
+		});
+		add("math_" + name + "_approx_batch", warpCount, [&]() {
+			batch(in.data(), warpCount, mathOut.data());
+			return mathOut[0] + mathOut[warpCount - 1];
+		});
+	};
+	mathMicros("sin", mathAngles, [](float x) { return sinf(x); }, [](float x) { return approxSin(x); }, approxSinBatch);
+	mathMicros("acos", mathCosines, [](float x) { return acosf(x); }, [](float x) { return approxAcos(x); }, approxAcosBatch);
+	mathMicros("log", mathPositive, [](float x) { return logf(x); }, [](float x) { return approxLog(x); }, approxLogBatch);
+	add("math_atan2_libm", warpCount, [&]() {
+		float sum = 0;
+		for (int ii = 0; ii < warpCount; ii++) sum += atan2f(mathCosines[ii], mathAtanX[ii]);
+		return sum;
+	});
+	add("math_atan2_approx", warpCount, [&]() {
+		float sum = 0;
+		for (int ii = 0; ii < warpCount; ii++) sum += approxAtan2(mathCosines[ii], mathAtanX[ii]);
+		return sum;
+	});
+	add("math_atan2_approx_batch", warpCount, [&]() {
+		approxAtan2Batch(mathCosines.data(), mathAtanX.data(), warpCount, mathOut.data());
+		return mathOut[0] + mathOut[warpCount - 1];
+	});
+
+	// Environment map: lookups one direction at a time and as a batch, and importance samples.
+	EnvironmentMap daylight;
+	daylight.makeDaylight(Vec3(0.6, 0.5, 0.4), 2000);
+	vector<float> envR(warpCount), envG(warpCount), envB(warpCount);
+	uniformSphereBatch(warpU1.data(), warpU2.data(), warpCount, warpX.data(), warpY.data(), warpZ.data());
+	add("env_lookup", warpCount, [&]() {
+		float sum = 0;
+		for (int ii = 0; ii < warpCount; ii++) sum += daylight.lookup(Vec3(warpX[ii], warpY[ii], warpZ[ii])).x();
+		return sum;
+	});
+	add("env_lookup_batch", warpCount, [&]() {
+		daylight.lookupBatch(warpX.data(), warpY.data(), warpZ.data(), warpCount, envR.data(), envG.data(), envB.data());
+		return envR[0] + envR[warpCount - 1];
+	});
+	add("env_sample", warpCount, [&]() {
+		float sum = 0;
+		Vec3 direction;
+		Color radiance;
+		float pdf;
+		for (int ii = 0; ii < warpCount; ii++) {
+			if (daylight.sample(Sample2D{ warpU1[ii], warpU2[ii] }, direction, radiance, pdf)) sum += pdf;
+		}
+		return sum;
+	});
+
+	// Path guiding: a directional tree fitted to a bright spot over a dim sphere.
+	DirectionalTree guideTree;
+	Vec3 guideSpot = unitVector(Vec3(0.3, 0.5, 0.8));
+	for (int round = 0; round < 3; round++) {
+		if (round > 0) guideTree = guideTree.refined();
+		for (int ii = 0; ii < warpCount; ii++) {
+			Vec3 direction(warpX[ii], warpY[ii], warpZ[ii]);
+			guideTree.record(direction, dot(direction, guideSpot) > 0.97f ? 50.0f : 0.2f);
+		}
+		guideTree.finishRecording();
+	}
+	add("guide_tree_sample", warpCount, [&]() {
+		float sum = 0, pdf;
+		for (int ii = 0; ii < warpCount; ii++) sum += guideTree.sample(Sample2D{ warpU1[ii], warpU2[ii] }, pdf).z() + pdf;
+		return sum;
+	});
+	add("guide_tree_pdf", warpCount, [&]() {
+		float sum = 0;
+		for (int ii = 0; ii < warpCount; ii++) sum += guideTree.pdf(Vec3(warpX[ii], warpY[ii], warpZ[ii]));
+		return sum;
+	});
+
+	// Photon map: caustic photons on a floor, bunched towards a bright spot.
+	vector<Photon> floorPhotons(warpCount);
+	for (int ii = 0; ii < warpCount; ii++) {
+		float spread = warpU1[ii] * warpU1[ii];
+		floorPhotons[ii].position = Point3(100 * spread * warpX[ii], 0, 100 * spread * warpZ[ii]);
+		floorPhotons[ii].direction = Vec3(0, 1, 0);
+		floorPhotons[ii].power = Color(1, 1, 1);
+	}
+	PhotonMap photonMap;
+	photonMap.build(move(floorPhotons));
+	add("photon_gather", warpCount, [&]() {
+		float sum = 0;
+		for (int ii = 0; ii < warpCount; ii++) {
+			Point3 p(50 * warpU1[ii] - 25, 0, 50 * warpU2[ii] - 25);
+			photonMap.gather(p, 2.0f, [&](const Photon& photon) { sum += photon.power.x(); });
+		}
+		return sum;
+	});
+
+	// Textures
+	SolidColor solid(Color(0.2, 0.3, 0.4));
+	add("solid_texture_value", recordCount, [&]() { return sumTexture(solid, records); });
+	CheckerTexture checker(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+	add("checker_texture_value", recordCount, [&]() { return sumTexture(checker, records); });
+	NoiseTexture noise(4);
+	add("noise_texture_value", recordCount, [&]() { return sumTexture(noise, records); });
+
+	Perlin perlin;
+	add("perlin_turb_7", recordCount, [&]() {
+		float sum = 0;
+		for (const HitRecord& rec : records) sum += perlin.turb(4 * rec.p, 7);
+		return sum;
+	});
+}
+
+// Largest errors of approx against the double-precision reference on
+// 2^20 + 1 points from at to to, evenly spaced or, with logSpaced, evenly
+// spaced in log(x). Relative errors skip references below 1e-3.
+template <typename F, typename R>
+AccuracyResult measureAccuracy(const string& name, const string& domain, double from, double to, bool logSpaced,
+	double absBound, double relBound, F approx, R reference) {
+	const int steps = 1 << 20;
+	AccuracyResult result{ name, domain, 0, 0, absBound, relBound };
+	for (int ii = 0; ii <= steps; ii++) {
+		double s = double(ii) / steps;
+		float x = float(logSpaced ? from * pow(to / from, s) : from + (to - from) * s);
+		double expected = reference(double(x));
+		double error = fabs(double(approx(x)) - expected);
+		result.maxAbsError = fmax(result.maxAbsError, error);
+		if (fabs(expected) >= 1e-3) result.maxRelError = fmax(result.maxRelError, error / fabs(expected));
+	}
+	cerr << name << " on " << domain << ": max abs error " << result.maxAbsError
+		<< ", max rel error " << result.maxRelError
+		<< (result.withinBounds() ? "" : ", OUT OF BOUNDS") << "\n";
+	return result;
+}
+
+void runAccuracyChecks(vector<AccuracyResult>& results) {
+	auto sinRef = [](double x) { return sin(x); };
+	results.push_back(measureAccuracy("approxSin", "[-8192, 8192]", -8192, 8192, false, 2.1e-7, 2.1e-7,
+		[](float x) { return approxSin(x); }, sinRef));
+	results.push_back(measureAccuracy("approxSin", "[-pi, pi]", -PI, PI, false, 2.1e-7, 2.1e-7,
+		[](float x) { return approxSin(x); }, sinRef));
+	results.push_back(measureAccuracy("approxAcos", "[-1, 1]", -1, 1, false, 4.1e-7, 2.0e-7,
+		[](float x) { return approxAcos(x); }, [](double x) { return acos(x); }));
+	// atan2 of the unit circle's points covers every angle.
+	results.push_back(measureAccuracy("approxAtan2", "unit circle", -PI, PI, false, 2.7e-7, 2.2e-7,
+		[](float theta) { return approxAtan2(sinf(theta), cosf(theta)); },
+		[](double theta) { return atan2(double(sinf(float(theta))), double(cosf(float(theta)))); }));
+	results.push_back(measureAccuracy("approxLog", "[1e-6, 1e6]", 1e-6, 1e6, true, 5.4e-7, 2.1e-7,
+		[](float x) { return approxLog(x); }, [](double x) { return log(x); }));
+}
+
+void runSceneBenchmarks(const BenchOptions& options, vector<SceneResult>& results) {
+	// The sphere field scene writes its chunk file on first use. Give it a
+	// file of this run's own, so its build time always includes the write,
+	// and remove the file afterwards.
+	string sphereField = temporaryFilePath("rtnw-bench-" + to_string(random_device()()) + ".rtnwsph");
+	sceneFileOptions().sphereField = sphereField;
+
+	for (int sceneId : builtinSceneIds) {
+		string name = sceneName(sceneId);
+		if (!options.filter.empty() && ("scene_" + name).find(options.filter) == string::npos)
+			continue;
+
+		seedRandom(1234);
+		SceneArena arena;
+		HittableList world;
+		SceneSettings settings;
+
+		BenchClock::time_point buildStart = BenchClock::now();
+		loadScene(sceneId, world, settings, arena);
+		double buildSeconds = secondsSince(buildStart);
+
+		BenchClock::time_point bvhStart = BenchClock::now();
+		HittableList scene(arena.make<BVHNode>(world, 0, 1, arena));
+		double bvhBuildSeconds = secondsSince(bvhStart);
+		sceneLights().build(world);
+		sceneShadowMedia().collect(world);
+		useEnvironment(settings);
+
+		int imageWidth = options.sceneWidth;
+		settings.imageWidth = imageWidth;
+		int imageHeight = settings.imageHeight();
+		int samplesPerPixel = options.sceneSpp;
+
+		Camera camera(settings.lookFrom, settings.lookAt, settings.upVector, settings.vFOV, settings.aspectRatio,
+			settings.focalDistance, settings.aperture, 0, 1);
+
+#ifdef RTNW_ENABLE_STATS
+		resetStats();
+#endif
+		useSampler(settings.sampler);
+		float sink = 0;
+		BenchClock::time_point renderStart = BenchClock::now();
+		for (int h = 0; h < imageHeight; h++) {
+			for (int w = 0; w < imageWidth; w++) {
+				Color pixelColor = samplePixel(camera, scene, settings.backgroundColor, w, h,
+					imageWidth, imageHeight, samplesPerPixel, settings.maxDepth);
+				sink += pixelColor.x();
+			}
+		}
+		double renderSeconds = secondsSince(renderStart);
+		benchSink = benchSink + sink;
+
+		long long primaryRays = (long long)imageWidth * imageHeight * samplesPerPixel;
+#ifdef RTNW_ENABLE_STATS
+		long long totalRays = mergedStats().totalRays();
+#else
+		long long totalRays = -1;
+#endif
+		cerr << "scene_" << name << ": " << primaryRays / renderSeconds << " primary rays/s\n";
+		results.push_back(SceneResult{ sceneId, name, buildSeconds, bvhBuildSeconds, imageWidth, imageHeight,
+			samplesPerPixel, renderSeconds, primaryRays, totalRays });
+	}
+	remove(sphereField.c_str());
+}
+
+void writeJson(ostream& out, const vector<MicroResult>& micro, const vector<AccuracyResult>& accuracy,
+	const vector<SceneResult>& scenes) {
+#ifdef __OPTIMIZE__
+	const bool optimized = true;
+#else
+	const bool optimized = false;
+#endif
+#if defined(__clang__)
+	const string compiler = string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+	const string compiler = string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+	const string compiler = "msvc " + to_string(_MSC_VER);
+#else
+	const string compiler = "unknown";
+#endif
+
+	out << "{\n";
+	out << "  \"schema\": \"rtnw-bench/1\",\n";
+	out << "  \"compiler\": \"" << compiler << "\",\n";
+	out << "  \"optimized\": " << (optimized ? "true" : "false") << ",\n";
+
+	out << "  \"micro\": [";
+	for (size_t ii = 0; ii < micro.size(); ii++) {
+		const MicroResult& r = micro[ii];
+		out << (ii ? ",\n" : "\n")
+			<< "    {\"name\": \"" << r.name << "\""
+			<< ", \"operations\": " << r.operations
+			<< ", \"seconds\": " << r.seconds
+			<< ", \"ns_per_op\": " << 1e9 * r.seconds / r.operations
+			<< ", \"ops_per_sec\": " << r.operations / r.seconds << "}";
+	}
+	out << "\n  ],\n";
+
+	out << "  \"accuracy\": [";
+	for (size_t ii = 0; ii < accuracy.size(); ii++) {
+		const AccuracyResult& r = accuracy[ii];
+		out << (ii ? ",\n" : "\n")
+			<< "    {\"name\": \"" << r.name << "\""
+			<< ", \"domain\": \"" << r.domain << "\""
+			<< ", \"max_abs_error\": " << r.maxAbsError
+			<< ", \"max_rel_error\": " << r.maxRelError
+			<< ", \"abs_bound\": " << r.absBound
+			<< ", \"rel_bound\": " << r.relBound
+			<< ", \"within_bounds\": " << (r.withinBounds() ? "true" : "false") << "}";
+	}
+	out << "\n  ],\n";
+
+	out << "  \"scenes\": [";
+	for (size_t ii = 0; ii < scenes.size(); ii++) {
+		const SceneResult& r = scenes[ii];
+		out << (ii ? ",\n" : "\n")
+			<< "    {\"id\": " << r.id
+			<< ", \"name\": \"" << r.name << "\""
+			<< ", \"build_seconds\": " << r.buildSeconds
+			<< ", \"bvh_build_seconds\": " << r.bvhBuildSeconds
+			<< ", \"width\": " << r.width
+			<< ", \"height\": " << r.height
+			<< ", \"samples_per_pixel\": " << r.samplesPerPixel
+			<< ", \"render_seconds\": " << r.renderSeconds
+			<< ", \"primary_rays\": " << r.primaryRays
+			<< ", \"primary_rays_per_sec\": " << r.primaryRays / r.renderSeconds;
+		if (r.totalRays >= 0) {
+			out << ", \"rays\": " << r.totalRays
+				<< ", \"rays_per_sec\": " << r.totalRays / r.renderSeconds;
+		}
+		out << "}";
+	}
+	out << "\n  ]\n";
+	out << "}\n";
+}
+
+int main(int argc, char** argv) {
+	BenchOptions options;
+	for (int ii = 1; ii < argc; ii++) {
+		string arg = argv[ii];
+		bool hasValue = ii + 1 < argc;
+		if (arg == "--out" && hasValue) options.outPath = argv[++ii];
+		else if (arg == "--min-time" && hasValue) options.minSeconds = atof(argv[++ii]);
+		else if (arg == "--filter" && hasValue) options.filter = argv[++ii];
+		else if (arg == "--scene-width" && hasValue) options.sceneWidth = atoi(argv[++ii]);
+		else if (arg == "--scene-spp" && hasValue) options.sceneSpp = atoi(argv[++ii]);
+		else if (arg == "--no-scenes") options.runScenes = false;
+		else {
+			cerr << "Usage: rtnw_bench [--out file.json] [--min-time seconds] [--filter substring]\n"
+				<< "                  [--scene-width pixels] [--scene-spp samples] [--no-scenes]\n";
+			return 1;
+		}
+	}
+
+	vector<MicroResult> micro;
+	vector<AccuracyResult> accuracy;
+	vector<SceneResult> scenes;
+	runMicroBenchmarks(options, micro);
+	if (options.filter.empty() || string("accuracy").find(options.filter) != string::npos) runAccuracyChecks(accuracy);
+	if (options.runScenes) runSceneBenchmarks(options, scenes);
+
+	if (options.outPath.empty()) {
+		writeJson(cout, micro, accuracy, scenes);
+	}
+	else {
+		ofstream out(options.outPath);
+		writeJson(out, micro, accuracy, scenes);
+	}
+
+	for (const AccuracyResult& r : accuracy) {
+		if (!r.withinBounds()) {
+			cerr << "An approximation exceeds the error bound documented in src/FastMath.h.\n";
+			return 2;
+		}
+	}
+	return 0;
+}
@@ -22,7 +22,7 @@ public:
 		for (int ii = 0; ii < 3; ii++) {
 			float invD = 1 / d[ii];
 			float t0 = (pMin[ii] - o[ii]) * invD;
-			float t1 = (pMin[ii] - o[ii]) * invD;
+			float t1 = (pMax[ii] - o[ii]) * invD;
 			
 			if (invD < 0) {
 				float tmp = t0;
@@ -37,6 +37,11 @@ public:
 		}
 		return true;
 	}
+
+	float surfaceArea() const {
+		Vec3 extent = pMax - pMin;
+		return 2 * (extent.x() * extent.y() + extent.y() * extent.z() + extent.z() * extent.x());
+	}
 private:
 	Point3 pMin;
 	Point3 pMax;
@@ -50,13 +55,18 @@ inline AABB surroundingBox(const AABB& bbox1, const AABB& bbox2) {
 		);
 
 	Point3 pMax = Point3(
-		fmin(bbox1.max().x(), bbox2.max().x()),
-		fmin(bbox1.max().y(), bbox2.max().y()),
-		fmin(bbox1.max().z(), bbox2.max().z())
+		fmax(bbox1.max().x(), bbox2.max().x()),
+		fmax(bbox1.max().y(), bbox2.max().y()),
+		fmax(bbox1.max().z(), bbox2.max().z())
 		);
 
 	return AABB(pMin, pMax);
 
 }
 
+// Box at s in [0, 1] between bbox0 and bbox1.
+inline AABB lerpBox(const AABB& bbox0, const AABB& bbox1, float s) {
+	return AABB((1 - s) * bbox0.min() + s * bbox1.min(), (1 - s) * bbox0.max() + s * bbox1.max());
+}
+
 #endif // !AABB_H
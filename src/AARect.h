@@ -3,18 +3,32 @@
 
 #include "RTNW.h"
 #include "Hittable.h"
+#include "Stats.h"
 
-class XYRect : public Hittable {
+class XYRect final : public Hittable {
 public:
-	XYRect() {};
+	XYRect() : Hittable(HittableXYRect) {};
 	XYRect(float _x0, float _x1, float _y0, float _y1, float _k, shared_ptr<Material> mat)
-		: x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mat_ptr(mat){}
+		: Hittable(HittableXYRect), x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mat_ptr(mat){}
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+
+	// Keeps the in-plane hit coordinates (x, y) in surfaceHit.local.
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
+	virtual void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override;
+
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override;
 
+	// A rectangle encloses no volume.
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return 0;
+	}
+
 private:
+	friend class SceneCache;
+	friend class LightBVH;
 	shared_ptr<Material> mat_ptr;
 	float x0, x1, y0, y1, k;
 };
@@ -25,6 +39,15 @@ bool XYRect::boundingBox(float time0, float time1, AABB& bbox) const {
 }
 
 bool XYRect::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	SurfaceHit surfaceHit;
+	if (!intersect(ray, tMin, tMax, surfaceHit)) return false;
+	resolve(ray, surfaceHit, 0, hitRecord);
+	return true;
+}
+
+bool XYRect::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	RTNW_STATS_PRIMITIVE(StatsXYRect);
+
 	if (ray.direction().z() == 0) return false;
 	float t = (k - ray.origin().z()) / ray.direction().z();
 	if (t < tMin || t > tMax)
@@ -33,35 +56,65 @@ bool XYRect::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) c
 	float x = ray.origin().x() + t * ray.direction().x();
 	float y = ray.origin().y() + t * ray.direction().y();
 
-	if (x < x0 || x > x1 || y < y0 || y > y1) 
+	if (x < x0 || x > x1 || y < y0 || y > y1)
 		return false;
 
-	hitRecord.u = (x - x0) / (x1 - x0);
-	hitRecord.v = (y - y0) / (y1 - y0);
-	hitRecord.t = t;
+	setSurfaceHit(surfaceHit, this, t, x, y);
+	return true;
+}
+
+void XYRect::resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const {
+	hitRecord.u = (surfaceHit.local[0] - x0) / (x1 - x0);
+	hitRecord.v = (surfaceHit.local[1] - y0) / (y1 - y0);
+	hitRecord.t = surfaceHit.t;
 	hitRecord.materialPtr = mat_ptr;
 	Vec3 outwardNormal = Vec3(0, 0, 1);
 	setNormal(hitRecord, ray, outwardNormal);
-	hitRecord.p = ray.at(t);
-
-	if (Vec3::isNan(hitRecord.p)) 
+	hitRecord.p = ray.at(surfaceHit.t);
+	if (Vec3::isNan(hitRecord.p))
 		cout << "XYRect" << endl;
-	return true;
+}
+
+bool XYRect::occluded(const Ray& ray, float tMin, float tMax) const {
+	RTNW_STATS_PRIMITIVE(StatsXYRect);
+
+	if (ray.direction().z() == 0) return false;
+	float t = (k - ray.origin().z()) / ray.direction().z();
+	if (t < tMin || t > tMax)
+		return false;
+
+	float x = ray.origin().x() + t * ray.direction().x();
+	float y = ray.origin().y() + t * ray.direction().y();
+
+	return x >= x0 && x <= x1 && y >= y0 && y <= y1;
 }
 
 // ----------------------------------
 
-class YZRect : public Hittable {
+class YZRect final : public Hittable {
 public:
-	YZRect() {};
+	YZRect() : Hittable(HittableYZRect) {};
 	YZRect(float _y0, float _y1, float _z0, float _z1, float _k, shared_ptr<Material> mat)
-		: y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mat_ptr(mat) {}
+		: Hittable(HittableYZRect), y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mat_ptr(mat) {}
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+
+	// Keeps the in-plane hit coordinates (y, z) in surfaceHit.local.
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
+	virtual void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override;
+
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override;
 
+	// A rectangle encloses no volume.
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return 0;
+	}
+
 private:
+	friend class SceneCache;
+	friend class LightBVH;
 	shared_ptr<Material> mat_ptr;
 	float y0, y1, z0, z1, k;
 };
@@ -72,6 +125,15 @@ bool YZRect::boundingBox(float time0, float time1, AABB& bbox) const {
 }
 
 bool YZRect::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	SurfaceHit surfaceHit;
+	if (!intersect(ray, tMin, tMax, surfaceHit)) return false;
+	resolve(ray, surfaceHit, 0, hitRecord);
+	return true;
+}
+
+bool YZRect::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	RTNW_STATS_PRIMITIVE(StatsYZRect);
+
 	if (ray.direction().x() == 0) return false;
 	float t = (k - ray.origin().x()) / ray.direction().x();
 	if (t < tMin || t > tMax)
@@ -83,31 +145,62 @@ bool YZRect::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) c
 	if (y < y0 || y > y1 || z < z0 || z > z1)
 		return false;
 
-	hitRecord.u = (y - y0) / (y1 - y0);
-	hitRecord.v = (z - z0) / (z1 - z0);
-	hitRecord.t = t;
+	setSurfaceHit(surfaceHit, this, t, y, z);
+	return true;
+}
+
+void YZRect::resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const {
+	hitRecord.u = (surfaceHit.local[0] - y0) / (y1 - y0);
+	hitRecord.v = (surfaceHit.local[1] - z0) / (z1 - z0);
+	hitRecord.t = surfaceHit.t;
 	hitRecord.materialPtr = mat_ptr;
 	Vec3 outwardNormal = Vec3(1, 0, 0);
 	setNormal(hitRecord, ray, outwardNormal);
-	hitRecord.p = ray.at(t);
+	hitRecord.p = ray.at(surfaceHit.t);
 	if (Vec3::isNan(hitRecord.p))
 		cout << "YZRect" << endl;
-	return true;
+}
+
+bool YZRect::occluded(const Ray& ray, float tMin, float tMax) const {
+	RTNW_STATS_PRIMITIVE(StatsYZRect);
+
+	if (ray.direction().x() == 0) return false;
+	float t = (k - ray.origin().x()) / ray.direction().x();
+	if (t < tMin || t > tMax)
+		return false;
+
+	float y = ray.origin().y() + t * ray.direction().y();
+	float z = ray.origin().z() + t * ray.direction().z();
+
+	return y >= y0 && y <= y1 && z >= z0 && z <= z1;
 }
 
 // ----------------------------------
 
-class XZRect : public Hittable {
+class XZRect final : public Hittable {
 public:
-	XZRect() {};
+	XZRect() : Hittable(HittableXZRect) {};
 	XZRect(float _x0, float _x1, float _z0, float _z1, float _k, shared_ptr<Material> mat)
-		: x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mat_ptr(mat) {}
+		: Hittable(HittableXZRect), x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mat_ptr(mat) {}
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+
+	// Keeps the in-plane hit coordinates (x, z) in surfaceHit.local.
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
+	virtual void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override;
+
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override;
 
+	// A rectangle encloses no volume.
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return 0;
+	}
+
 private:
+	friend class SceneCache;
+	friend class LightBVH;
 	shared_ptr<Material> mat_ptr;
 	float x0, x1, z0, z1, k;
 };
@@ -118,6 +211,15 @@ bool XZRect::boundingBox(float time0, float time1, AABB& bbox) const {
 }
 
 bool XZRect::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	SurfaceHit surfaceHit;
+	if (!intersect(ray, tMin, tMax, surfaceHit)) return false;
+	resolve(ray, surfaceHit, 0, hitRecord);
+	return true;
+}
+
+bool XZRect::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	RTNW_STATS_PRIMITIVE(StatsXZRect);
+
 	if (ray.direction().y() == 0) return false;
 	float t = (k - ray.origin().y()) / ray.direction().y();
 	if (t < tMin || t > tMax)
@@ -129,16 +231,34 @@ bool XZRect::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) c
 	if (x < x0 || x > x1 || z < z0 || z > z1)
 		return false;
 
-	hitRecord.u = (x - x0) / (x1 - x0);
-	hitRecord.v = (z - z0) / (z1 - z0);
-	hitRecord.t = t;
+	setSurfaceHit(surfaceHit, this, t, x, z);
+	return true;
+}
+
+void XZRect::resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const {
+	hitRecord.u = (surfaceHit.local[0] - x0) / (x1 - x0);
+	hitRecord.v = (surfaceHit.local[1] - z0) / (z1 - z0);
+	hitRecord.t = surfaceHit.t;
 	hitRecord.materialPtr = mat_ptr;
 	Vec3 outwardNormal = Vec3(0, 1, 0);
 	setNormal(hitRecord, ray, outwardNormal);
-	hitRecord.p = ray.at(t);
+	hitRecord.p = ray.at(surfaceHit.t);
 	if (Vec3::isNan(hitRecord.p))
 		cout << "XZRect" << endl;
-	return true;
+}
+
+bool XZRect::occluded(const Ray& ray, float tMin, float tMax) const {
+	RTNW_STATS_PRIMITIVE(StatsXZRect);
+
+	if (ray.direction().y() == 0) return false;
+	float t = (k - ray.origin().y()) / ray.direction().y();
+	if (t < tMin || t > tMax)
+		return false;
+
+	float x = ray.origin().x() + t * ray.direction().x();
+	float z = ray.origin().z() + t * ray.direction().z();
+
+	return x >= x0 && x <= x1 && z >= z0 && z <= z1;
 }
 
 #endif // !AARECT_H
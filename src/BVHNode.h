@@ -5,26 +5,89 @@
 
 #include "RTNW.h"
 #include "HittableList.h"
+#include "Stats.h"
+#include "SceneArena.h"
 #include <algorithm>
 
-class BVHNode : public Hittable {
+// Outcome of BVHNode::refit().
+struct BVHRefitResult {
+	float sahCost;        // cost of the tree after the refit, see BVHNode::sahCost()
+	int subtreesRebuilt;  // 0: bounds were only updated
+	bool fullRebuild;     // the root itself was rebuilt
+};
+
+class BVHNode final : public Hittable {
 public:
-	BVHNode() {}
+	// Relative costs of visiting a node and of testing a primitive, for the SAH.
+	static constexpr float sahTraversalCost = 1.0f;
+	static constexpr float sahIntersectionCost = 1.0f;
+
+	// refit() leaves a degraded subtree alone unless its extra cost is at least
+	// this fraction of the whole tree's cost: small subtrees fluctuate a lot
+	// relative to their own cost but rebuilding them buys little.
+	static constexpr float refitMinRebuildShare = 0.01f;
+
+	BVHNode() : Hittable(HittableBVHNode) {}
 
 	BVHNode(HittableList& list, float time0, float time1) 
 		: BVHNode(list.objects, 0, list.objects.size(), time0, time1) {};
 
-	BVHNode(vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t end, float time0, float time1);
+	// Same, but the inner nodes are allocated from arena. Arena nodes are never
+	// destroyed individually, so they only keep non-owning references to the
+	// primitives: list (or the arena) has to keep those alive.
+	BVHNode(HittableList& list, float time0, float time1, SceneArena& arena)
+		: BVHNode(list.objects, 0, list.objects.size(), time0, time1, &arena) {};
+
+	BVHNode(vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t end, float time0, float time1, SceneArena* arena = nullptr);
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 
 	virtual bool boundingBox(float time0, float time1, AABB& outBBox) const override;
+
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override;
+
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
+
+	// Update the bounds bottom-up after primitives moved, in time linear in the
+	// size of the tree. The topology is kept, so the tree gets worse as objects
+	// drift apart; subtrees whose SAH cost grew past rebuildThreshold times their
+	// cost when they were built are rebuilt from their primitives, largest first
+	// (see refitMinRebuildShare).
+	// Pass the arena the tree was built with, if any: rebuilt nodes come from it
+	// (the replaced ones stay allocated until the arena goes away).
+	BVHRefitResult refit(float time0, float time1, float rebuildThreshold = 1.5f, SceneArena* arena = nullptr);
+
+	// Expected cost of a random ray that hits the root, relative to one node visit.
+	float sahCost() const { return cost / bbox.surfaceArea(); }
+
 private:
-	
+	friend class QuantizedBVH; // flattens the tree
+	friend class SceneCache;   // saves and restores it
+	friend class LightBVH;     // gathers the emitters
+	friend class ShadowMedia;  // gathers the grid media
+
+	// Bounds and cost of the subtree from its children; child BVHNodes are refit first.
+	float refitBounds(float time0, float time1);
+
+	// Rebuild the largest subtrees whose cost degraded; returns the new subtree cost.
+	float rebuildDegraded(float time0, float time1, float rebuildThreshold, float minGain, SceneArena* arena, int& rebuilt);
+
+	// Primitives below this node: the children of its leaves, whatever their
+	// kind, so a BVHNode added to the list as an object stays whole.
+	void collectPrimitives(vector<shared_ptr<Hittable>>& primitives) const;
+
+	// Subtree cost from the children's costs, weighted by surface area (not normalized).
+	float subtreeCost() const;
 
 	shared_ptr<Hittable> leftNode;
 	shared_ptr<Hittable> rightNode;
 	AABB bbox;
+	int axis = 0; // the children are ordered along this axis
+	bool isLeaf = false; // the children are primitives, not nodes of this tree
+	float cost = 0;      // current subtree cost, see subtreeCost()
+	float builtCost = 0; // subtree cost right after the subtree was built
 };
 
 bool BVHNode::boundingBox(float time0, float time1, AABB& outBBox) const {
@@ -33,16 +96,53 @@ bool BVHNode::boundingBox(float time0, float time1, AABB& outBBox) const {
 }
 
 bool BVHNode::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+
 	if (!bbox.hit(ray, tMin, tMax)) return false;
 
-	bool hitLeft = leftNode->hit(ray, tMin, tMax, hitRecord);
+	bool hitLeft = dispatchHit(*leftNode, ray, tMin, tMax, hitRecord);
 	// Need to check again
-	bool hitRight = rightNode->hit(ray, tMin, hitLeft ? hitRecord.t : tMax, hitRecord);
+	bool hitRight = dispatchHit(*rightNode, ray, tMin, hitLeft ? hitRecord.t : tMax, hitRecord);
 
 	return hitLeft || hitRight;
 }
 
 
+bool BVHNode::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+
+	if (!bbox.hit(ray, tMin, tMax)) return false;
+
+	bool hitLeft = dispatchIntersect(*leftNode, ray, tMin, tMax, surfaceHit);
+	bool hitRight = dispatchIntersect(*rightNode, ray, tMin, hitLeft ? surfaceHit.t : tMax, surfaceHit);
+
+	return hitLeft || hitRight;
+}
+
+bool BVHNode::occluded(const Ray& ray, float tMin, float tMax) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+
+	if (!bbox.hit(ray, tMin, tMax)) return false;
+
+	// Visit the child closer to the ray origin first: shadow rays are usually
+	// blocked near one of their ends, and any hit ends the query.
+	const Hittable& first = ray.direction()[axis] < 0 ? *rightNode : *leftNode;
+	const Hittable& second = ray.direction()[axis] < 0 ? *leftNode : *rightNode;
+
+	if (dispatchOccluded(first, ray, tMin, tMax)) return true;
+	return &second != &first && dispatchOccluded(second, ray, tMin, tMax);
+}
+
+int BVHNode::intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+	if (!bbox.hit(ray, tMin, tMax)) return 0;
+
+	int count = leftNode->intervals(ray, tMin, tMax, out, maxIntervals);
+	if (rightNode == leftNode) return count;
+	count += rightNode->intervals(ray, tMin, tMax, out + count, maxIntervals - count);
+	return mergeIntervals(out, count);
+}
+
 inline bool box_compare(const shared_ptr<Hittable> obj1, const shared_ptr<Hittable> obj2, int axis) {
 	AABB bbox1, bbox2;
 	if (!obj1->boundingBox(0, 0, bbox1) || !obj2->boundingBox(0, 0, bbox2)) {
@@ -63,36 +163,46 @@ bool box_compare_z(const shared_ptr<Hittable> obj1, const shared_ptr<Hittable> o
 	return box_compare(obj1, obj2, 2);
 }
 
-BVHNode::BVHNode(vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t end, float time0, float time1) {
-	auto objects = srcObjects;
-
-	int axis = random_int(0, 2);
+BVHNode::BVHNode(vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t end, float time0, float time1, SceneArena* arena) : Hittable(HittableBVHNode) {
+	axis = random_int(0, 2);
 	auto comparator = (axis == 0) ? box_compare_x
 					: (axis == 1) ? box_compare_y 
 								  : box_compare_z;
 
 	size_t range = end - start;
 
+	auto leaf = [arena](const shared_ptr<Hittable>& obj) {
+		return arena ? shared_ptr<Hittable>(shared_ptr<void>(), obj.get()) : obj;
+	};
+
 	if (range == 1) {
-		leftNode = rightNode = srcObjects[start];
+		leftNode = rightNode = leaf(srcObjects[start]);
+		isLeaf = true;
 	}
 
 	else if (range == 2) {
 		if (comparator(srcObjects[start], srcObjects[start + 1])) {
-			leftNode = srcObjects[start];
-			rightNode = srcObjects[start + 1];
+			leftNode = leaf(srcObjects[start]);
+			rightNode = leaf(srcObjects[start + 1]);
 		}
 		else {
-			leftNode = srcObjects[start + 1];
-			rightNode = srcObjects[start];
+			leftNode = leaf(srcObjects[start + 1]);
+			rightNode = leaf(srcObjects[start]);
 		}
+		isLeaf = true;
 	}
 	else {
 		std::sort(srcObjects.begin() + start, srcObjects.begin() + end, comparator);
 
 		auto mid = start + range / 2;
-		leftNode = make_shared<BVHNode>(srcObjects, start, mid, time0, time1);
-		rightNode = make_shared<BVHNode>(srcObjects, mid, end, time0, time1);
+		if (arena) {
+			leftNode = arena->make<BVHNode>(srcObjects, start, mid, time0, time1, arena);
+			rightNode = arena->make<BVHNode>(srcObjects, mid, end, time0, time1, arena);
+		}
+		else {
+			leftNode = make_shared<BVHNode>(srcObjects, start, mid, time0, time1);
+			rightNode = make_shared<BVHNode>(srcObjects, mid, end, time0, time1);
+		}
 	}
 
 
@@ -103,6 +213,68 @@ BVHNode::BVHNode(vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t
 	}
 	
 	bbox = surroundingBox(leftBox, rightBox);
+	cost = builtCost = subtreeCost();
+}
+
+float BVHNode::subtreeCost() const {
+	float area = bbox.surfaceArea();
+	float total = sahTraversalCost * area;
+	for (const Hittable* child : { leftNode.get(), rightNode.get() }) {
+		if (child->kind == HittableBVHNode) total += static_cast<const BVHNode*>(child)->cost;
+		else total += sahIntersectionCost * area; // tested whenever this node is entered
+		if (rightNode == leftNode) break;
+	}
+	return total;
+}
+
+float BVHNode::refitBounds(float time0, float time1) {
+	AABB leftBox, rightBox;
+	for (Hittable* child : { leftNode.get(), rightNode.get() }) {
+		if (child->kind == HittableBVHNode) static_cast<BVHNode*>(child)->refitBounds(time0, time1);
+		if (rightNode == leftNode) break;
+	}
+	if (!leftNode->boundingBox(time0, time1, leftBox) || !rightNode->boundingBox(time0, time1, rightBox)) {
+		cout << "NO bounding box is created in BVHNode::refit\n";
+	}
+	bbox = surroundingBox(leftBox, rightBox);
+	cost = subtreeCost();
+	return cost;
+}
+
+void BVHNode::collectPrimitives(vector<shared_ptr<Hittable>>& primitives) const {
+	for (const shared_ptr<Hittable>& child : { leftNode, rightNode }) {
+		if (!isLeaf) static_cast<const BVHNode&>(*child).collectPrimitives(primitives);
+		else primitives.push_back(child);
+		if (rightNode == leftNode) break;
+	}
+}
+
+float BVHNode::rebuildDegraded(float time0, float time1, float rebuildThreshold, float minGain, SceneArena* arena, int& rebuilt) {
+	if (cost > rebuildThreshold * builtCost && cost - builtCost >= minGain) {
+		vector<shared_ptr<Hittable>> primitives;
+		collectPrimitives(primitives);
+		*this = BVHNode(primitives, 0, primitives.size(), time0, time1, arena);
+		rebuilt++;
+		return cost;
+	}
+
+	for (Hittable* child : { leftNode.get(), rightNode.get() }) {
+		if (!isLeaf) static_cast<BVHNode*>(child)->rebuildDegraded(time0, time1, rebuildThreshold, minGain, arena, rebuilt);
+		if (rightNode == leftNode) break;
+	}
+	cost = subtreeCost();
+	return cost;
+}
+
+BVHRefitResult BVHNode::refit(float time0, float time1, float rebuildThreshold, SceneArena* arena) {
+	refitBounds(time0, time1);
+
+	BVHRefitResult result{ 0, 0, false };
+	bool degraded = cost > rebuildThreshold * builtCost;
+	rebuildDegraded(time0, time1, rebuildThreshold, refitMinRebuildShare * cost, arena, result.subtreesRebuilt);
+	result.fullRebuild = degraded;
+	result.sahCost = sahCost();
+	return result;
 }
 
 #endif // !BVH_NODE_H
@@ -4,21 +4,30 @@
 #include "RTNW.h"
 #include "HittableList.h"
 #include "AARect.h"
+#include "Stats.h"
 
-class Box : public Hittable {
+class Box final : public Hittable {
 public:
-	Box() {}
+	Box() : Hittable(HittableBox) {}
 	Box(const Point3& p0, const Point3& p1, shared_ptr<Material> mat);
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override;
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override;
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
 
 private:
+	friend class SceneCache;
+
+	// Entry and exit of the ray through the box, unclipped. False if it misses.
+	bool slabs(const Ray& ray, float& tEnter, float& tExit) const;
+
 	Point3 pMin, pMax;
 	HittableList sides;
 };
 
-Box::Box(const Point3& p0, const Point3& p1, shared_ptr<Material> mat) {
+Box::Box(const Point3& p0, const Point3& p1, shared_ptr<Material> mat) : Hittable(HittableBox) {
 	pMin = p0;
 	pMax = p1;
 
@@ -33,9 +42,47 @@ Box::Box(const Point3& p0, const Point3& p1, shared_ptr<Material> mat) {
 }
 
 bool Box::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	RTNW_STATS_PRIMITIVE(StatsBox);
 	return sides.hit(ray, tMin, tMax, hitRecord);
 }
 
+bool Box::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	RTNW_STATS_PRIMITIVE(StatsBox);
+	return sides.intersect(ray, tMin, tMax, surfaceHit);
+}
+
+bool Box::slabs(const Ray& ray, float& tEnter, float& tExit) const {
+	tEnter = -INF;
+	tExit = INF;
+	for (int ii = 0; ii < 3; ii++) {
+		float invD = 1 / ray.direction()[ii];
+		float t0 = (pMin[ii] - ray.origin()[ii]) * invD;
+		float t1 = (pMax[ii] - ray.origin()[ii]) * invD;
+		if (invD < 0) swap(t0, t1);
+
+		tEnter = t0 > tEnter ? t0 : tEnter;
+		tExit = t1 < tExit ? t1 : tExit;
+		if (tExit <= tEnter) return false;
+	}
+	return true;
+}
+
+int Box::intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const {
+	// Slab test against the box itself; the sides are not needed.
+	float tEnter, tExit;
+	if (!slabs(ray, tEnter, tExit)) return 0;
+	return appendInterval(tEnter, tExit, tMin, tMax, out, 0, maxIntervals);
+}
+
+bool Box::occluded(const Ray& ray, float tMin, float tMax) const {
+	RTNW_STATS_PRIMITIVE(StatsBox);
+
+	// The sides are hit where the ray enters or leaves the box.
+	float tEnter, tExit;
+	if (!slabs(ray, tEnter, tExit)) return false;
+	return (tEnter >= tMin && tEnter <= tMax) || (tExit >= tMin && tExit <= tMax);
+}
+
 bool Box::boundingBox(float time0, float time1, AABB& bbox) const {
 	bbox = AABB(pMin, pMax);
 	return true;
@@ -5,6 +5,8 @@
 
 #include "RTNW.h"
 #include "Ray.h"
+#include "Sampler.h"
+#include "Sampling.h"
 
 class Camera {
 public:
@@ -45,16 +47,16 @@ public:
 		time1 = _time1;
 	}
 
-	Ray getRay(float u, float v) {
+	Ray getRay(float u, float v) const {
 		// Cast a ray from the camera through a pixel point in the image plane.
 
 		// Defocus blur
-		Vec3 noise = lensRadius * randomInUnitDisk();
+		Vec3 noise = lensRadius * sampleConcentricDisk(sample2D());
 		Vec3 offset = noise.x() * xVector + noise.y() * yVector;
 
 		Point3 pixelPoint = u * horizontal + v * vertical + bottomLeftCorner;
 		Vec3 direction = (pixelPoint + offset) - origin;
-		float shootingTime = random_float(time0, time1);
+		float shootingTime = time0 + sample1D() * (time1 - time0);
 
 		Ray ray(origin, direction, shootingTime);
 
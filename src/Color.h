@@ -14,6 +14,11 @@ inline float clamp(float x, float xMin, float xMax) {
 	return x;
 }
 
+// Mean of the channels, for weighing colors against each other.
+inline float brightness(const Color& color) {
+	return (color.x() + color.y() + color.z()) / 3;
+}
+
 void writeColor(ostream& out, Color pixelColor, int samplesPerPixel) {
 	float r = clamp(pixelColor.x() / samplesPerPixel, 0, 1);
 	float g = clamp(pixelColor.y() / samplesPerPixel, 0, 1);
@@ -29,4 +34,19 @@ void writeColor(ostream& out, Color pixelColor, int samplesPerPixel) {
 		(int) (255.999 * b) << " " << endl;
 }
 
+// Same as writeColor, as three raw bytes (binary PPM, P6).
+void writeColorBytes(ostream& out, Color pixelColor, int samplesPerPixel) {
+	char rgb[3];
+	for (int ii = 0; ii < 3; ii++)
+		rgb[ii] = (char)(unsigned char)(255.999 * sqrtf(clamp(pixelColor[ii] / samplesPerPixel, 0, 1)));
+	out.write(rgb, 3);
+}
+
+// Write a color that is already in display space (no sample averaging or gamma), e.g. false-color debug output.
+void writeDisplayColor(ostream& out, Color displayColor) {
+	out << (int) (255.999 * clamp(displayColor.x(), 0, 1)) << " " <<
+		(int) (255.999 * clamp(displayColor.y(), 0, 1)) << " " <<
+		(int) (255.999 * clamp(displayColor.z(), 0, 1)) << " " << endl;
+}
+
 #endif // !COLOR_H
@@ -5,21 +5,29 @@
 #include "Hittable.h"
 #include "Material.h"
 #include "Texture.h"
+#include "Stats.h"
+#include "FastMath.h"
+#include "Sampler.h"
 
-class ConstantMedium : public Hittable {
+class ConstantMedium final : public Hittable {
 public:
 	ConstantMedium(shared_ptr<Hittable> obj, float density, shared_ptr<Material> mat)
-		: boundary(obj), negInvDensity(-1/density), phase_function(mat) {}
+		: Hittable(HittableConstantMedium), boundary(obj), negInvDensity(-1/density), phase_function(mat) {}
 	
 	ConstantMedium(shared_ptr<Hittable> obj, float density, Color c)
-		: boundary(obj), negInvDensity(-1 / density), phase_function(make_shared<Isotropic>(c)) {}
+		: Hittable(HittableConstantMedium), boundary(obj), negInvDensity(-1 / density), phase_function(make_shared<Isotropic>(c)) {}
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override {
 		return boundary->boundingBox(time0, time1, bbox);
 	}
+
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return boundary->intervals(ray, tMin, tMax, out, maxIntervals);
+	}
 private:
+	friend class SceneCache;
 	shared_ptr<Hittable> boundary;
 	shared_ptr<Material> phase_function;
 	float negInvDensity;
@@ -30,40 +38,34 @@ bool ConstantMedium::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitR
 	const bool enableDebug = false;
 	const bool debugging = enableDebug && random_float() < 0.0001;
 
-	HitRecord rec1, rec2;
+	RTNW_STATS_PRIMITIVE(StatsConstantMedium);
 
-	if (!boundary->hit(ray, -INF, INF, rec1)) {
-		return false;
-	}
-	if (!boundary->hit(ray, rec1.t + 0.0001, INF, rec2)) {
+	// Entry/exit pairs of the boundary, found in one traversal without shading.
+	const int maxIntervals = 8;
+	HitInterval inside[maxIntervals];
+	int count = boundary->intervals(ray, tMin > 0 ? tMin : 0, tMax, inside, maxIntervals);
+	if (count == 0)
 		return false;
-	}
-	
-	if (debugging) std::cerr << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n';
 	
-	if (rec1.t < tMin) rec1.t = tMin;
-	if (rec2.t > tMax) rec2.t = tMax;
-
-	if (rec1.t >= rec2.t)
-		return false;
-
-	if (rec1.t < 0)
-		rec1.t = 0;
+	if (debugging) std::cerr << "\nt_min=" << inside[0].tEnter << ", t_max=" << inside[count - 1].tExit << '\n';
 
 	const auto rayLength = ray.direction().length();
-	const auto distanceInsideBoundary = (rec2.t - rec1.t) * rayLength;
-	const auto hitDistance = negInvDensity * log(random_float());
-
-	if (hitDistance > distanceInsideBoundary) {
+	auto hitDistance = negInvDensity * fastLog(sample1D());
+
+	// Walk through the parts of the ray inside the boundary until the sampled
+	// distance is used up; past the last exit the ray leaves the medium.
+	int ii = 0;
+	for (; ii < count; ii++) {
+		const auto distanceInsideBoundary = (inside[ii].tExit - inside[ii].tEnter) * rayLength;
+		if (hitDistance <= distanceInsideBoundary) break;
+		hitDistance -= distanceInsideBoundary;
+	}
+	if (ii == count)
 		return false;
-		//Ray secondRay = Ray(ray.at(rec2.t + 0.0001), ray.direction(), ray.time());
 
-		//if(!hit(secondRay, tMin, tMax, hitRecord))
-		//	return false;
+	RTNW_STATS_INC(mediumScatterEvents);
 
-		//return true;
-	}
-	hitRecord.t = rec1.t + hitDistance / rayLength;
+	hitRecord.t = inside[ii].tEnter + hitDistance / rayLength;
 	hitRecord.p = ray.at(hitRecord.t);
 
 	if (debugging) {
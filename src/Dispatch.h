@@ -0,0 +1,117 @@
+#pragma once
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+// Static dispatch for the closed set of built-in Hittable types.
+//
+// Every built-in class is final and tags itself with a HittableKind, so a
+// switch on the tag can call the concrete hit(), occluded(), intersect() or
+// resolve() directly and let the compiler inline it, instead of going through
+// the vtable. Types unknown to the switch
+// (user extensions) fall back to the virtual call. Materials and textures do
+// the same in dispatchScatter()/dispatchEmitted() and dispatchValue().
+//
+// Enabled by the RTNW_STATIC_DISPATCH CMake option. Translation units that
+// render must include this header so the dispatch functions get defined.
+
+#include "RTNW.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "Sphere.h"
+#include "MovingSphere.h"
+#include "AARect.h"
+#include "Box.h"
+#include "ConstantMedium.h"
+#include "GridMedium.h"
+#include "BVHNode.h"
+#include "MotionBVHNode.h"
+#include "QuantizedBVH.h"
+#include "OutOfCore.h"
+#include "Instance.h"
+
+#ifdef RTNW_STATIC_DISPATCH
+bool dispatchHit(const Hittable& obj, const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) {
+	switch (obj.kind) {
+	case HittableSphere: return static_cast<const Sphere&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableMovingSphere: return static_cast<const MovingSphere&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableXYRect: return static_cast<const XYRect&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableYZRect: return static_cast<const YZRect&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableXZRect: return static_cast<const XZRect&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableBox: return static_cast<const Box&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableConstantMedium: return static_cast<const ConstantMedium&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableGridMedium: return static_cast<const GridMedium&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableListKind: return static_cast<const HittableList&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableBVHNode: return static_cast<const BVHNode&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableMotionBVHNode: return static_cast<const MotionBVHNode&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableQuantizedBVH: return static_cast<const QuantizedBVH&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableOutOfCoreSpheres: return static_cast<const OutOfCoreSpheres&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableSphereChunk: return static_cast<const SphereChunk&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableTranslate: return static_cast<const Translate&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableRotateY: return static_cast<const RotateY&>(obj).hit(ray, tMin, tMax, hitRecord);
+	case HittableInstance: return static_cast<const Instance&>(obj).hit(ray, tMin, tMax, hitRecord);
+	default: return obj.hit(ray, tMin, tMax, hitRecord);
+	}
+}
+
+bool dispatchOccluded(const Hittable& obj, const Ray& ray, float tMin, float tMax) {
+	switch (obj.kind) {
+	case HittableSphere: return static_cast<const Sphere&>(obj).occluded(ray, tMin, tMax);
+	case HittableMovingSphere: return static_cast<const MovingSphere&>(obj).occluded(ray, tMin, tMax);
+	case HittableXYRect: return static_cast<const XYRect&>(obj).occluded(ray, tMin, tMax);
+	case HittableYZRect: return static_cast<const YZRect&>(obj).occluded(ray, tMin, tMax);
+	case HittableXZRect: return static_cast<const XZRect&>(obj).occluded(ray, tMin, tMax);
+	case HittableBox: return static_cast<const Box&>(obj).occluded(ray, tMin, tMax);
+	case HittableConstantMedium: return static_cast<const ConstantMedium&>(obj).occluded(ray, tMin, tMax);
+	case HittableGridMedium: return static_cast<const GridMedium&>(obj).occluded(ray, tMin, tMax);
+	case HittableListKind: return static_cast<const HittableList&>(obj).occluded(ray, tMin, tMax);
+	case HittableBVHNode: return static_cast<const BVHNode&>(obj).occluded(ray, tMin, tMax);
+	case HittableMotionBVHNode: return static_cast<const MotionBVHNode&>(obj).occluded(ray, tMin, tMax);
+	case HittableQuantizedBVH: return static_cast<const QuantizedBVH&>(obj).occluded(ray, tMin, tMax);
+	case HittableOutOfCoreSpheres: return static_cast<const OutOfCoreSpheres&>(obj).occluded(ray, tMin, tMax);
+	case HittableSphereChunk: return static_cast<const SphereChunk&>(obj).occluded(ray, tMin, tMax);
+	case HittableTranslate: return static_cast<const Translate&>(obj).occluded(ray, tMin, tMax);
+	case HittableRotateY: return static_cast<const RotateY&>(obj).occluded(ray, tMin, tMax);
+	case HittableInstance: return static_cast<const Instance&>(obj).occluded(ray, tMin, tMax);
+	default: return obj.occluded(ray, tMin, tMax);
+	}
+}
+
+// Media keep the default intersect(), which calls their hit().
+bool dispatchIntersect(const Hittable& obj, const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) {
+	switch (obj.kind) {
+	case HittableSphere: return static_cast<const Sphere&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableMovingSphere: return static_cast<const MovingSphere&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableXYRect: return static_cast<const XYRect&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableYZRect: return static_cast<const YZRect&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableXZRect: return static_cast<const XZRect&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableBox: return static_cast<const Box&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableListKind: return static_cast<const HittableList&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableBVHNode: return static_cast<const BVHNode&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableMotionBVHNode: return static_cast<const MotionBVHNode&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableQuantizedBVH: return static_cast<const QuantizedBVH&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableOutOfCoreSpheres: return static_cast<const OutOfCoreSpheres&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableTranslate: return static_cast<const Translate&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableRotateY: return static_cast<const RotateY&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	case HittableInstance: return static_cast<const Instance&>(obj).intersect(ray, tMin, tMax, surfaceHit);
+	default: return obj.intersect(ray, tMin, tMax, surfaceHit);
+	}
+}
+
+// Only primitives and transforms are ever resolved.
+void dispatchResolve(const Hittable& obj, const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) {
+	switch (obj.kind) {
+	case HittableSphere: static_cast<const Sphere&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	case HittableMovingSphere: static_cast<const MovingSphere&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	case HittableXYRect: static_cast<const XYRect&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	case HittableYZRect: static_cast<const YZRect&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	case HittableXZRect: static_cast<const XZRect&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	case HittableTranslate: static_cast<const Translate&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	case HittableRotateY: static_cast<const RotateY&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	case HittableInstance: static_cast<const Instance&>(obj).resolve(ray, surfaceHit, level, hitRecord); return;
+	default: obj.resolve(ray, surfaceHit, level, hitRecord); return;
+	}
+}
+#endif
+
+#endif // !DISPATCH_H
@@ -0,0 +1,507 @@
+#pragma once
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+// Distributed tile rendering over sockets.
+//
+// A coordinator splits the image into tiles and hands them out, one at a time,
+// to worker processes; workers load the same scene, render the tile and send
+// back its unnormalized float sums, which the coordinator places in the image.
+// Workers are either spawned locally (RTNW --workers n) or started by hand
+// anywhere that can reach the coordinator (RTNW --worker tcp:host:port).
+//
+// Tiles are rendered with a seed derived from the tile id, so a tile gives the
+// same pixels on whichever worker renders it. That makes reassignment safe: a
+// tile held by a worker that disconnects goes back to the queue, and a tile
+// that takes much longer than the average is also given to an idle worker;
+// the first result wins and the other one is dropped. For a given tile size the
+// image does not depend on the number of workers.
+//
+// Addresses are unix:/path/to/socket or tcp:host:port. Messages are a fixed
+// header followed by a payload in host byte order, so coordinator and workers
+// must run on machines of the same endianness. Not available on Windows.
+
+#ifndef _WIN32
+
+#include "RTNW.h"
+#include "Render.h"
+#include "Scenes.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+enum DistributedMessage : uint32_t {
+	MessageHello = 1,      // worker -> coordinator, no payload
+	MessageSetup = 2,      // coordinator -> worker, WireSetup
+	MessageTile = 3,       // coordinator -> worker, WireTile
+	MessageTileResult = 4, // worker -> coordinator, WireTile + width * height * 3 floats
+	MessageShutdown = 5    // coordinator -> worker, no payload
+};
+
+struct WireHeader {
+	uint32_t magic;
+	uint32_t type;
+	uint32_t size; // payload bytes
+};
+
+struct WireSetup {
+	int32_t sceneId;
+	int32_t motionBVH;
+	int32_t temporalSplits;
+	int32_t quantizedBVH;
+	int32_t sampler;         // SamplerType
+	int32_t samplesPerPixel;
+	char environmentPath[256]; // read by each worker; empty for the scene's own background
+	float environmentScale;
+	char cloudGrid[256];       // sceneFileOptions().cloudGrid, read by each worker
+	char sphereField[256];     // sceneFileOptions().sphereField, read by each worker
+};
+
+struct WireTile {
+	int32_t tileId;
+	int32_t x0, y0, width, height;
+	uint32_t seed;
+};
+
+const uint32_t wireMagic = 0x57544e52; // "RNTW"
+
+struct DistributedOptions {
+	int sceneId = 8;
+	bool motionBVH = false;
+	int temporalSplits = 0;
+	bool quantizedBVH = false;
+	SamplerType sampler = SamplerSobol;
+	int samplesPerPixel = 100;
+	string environmentPath; // see useEnvironment(); workers need it at the same path
+	float environmentScale = 1;
+
+	int localWorkers = 0;  // processes to spawn on this machine
+	string listenAddress;  // empty: a unix socket in /tmp
+	string executable;     // binary started for local workers
+	int tileSize = 32;
+	float tileTimeout = 0; // seconds before a tile is also given to an idle worker; 0 derives it from finished tiles
+};
+
+// ----------------------------------------
+// Sockets
+
+bool sendAll(int fd, const void* data, size_t size) {
+	const char* bytes = static_cast<const char*>(data);
+	while (size > 0) {
+		ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+		if (sent <= 0) return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+bool recvAll(int fd, void* data, size_t size) {
+	char* bytes = static_cast<char*>(data);
+	while (size > 0) {
+		ssize_t received = recv(fd, bytes, size, 0);
+		if (received <= 0) return false;
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+bool sendMessage(int fd, uint32_t type, const void* payload = nullptr, size_t size = 0,
+	const void* extra = nullptr, size_t extraSize = 0) {
+	WireHeader header{ wireMagic, type, uint32_t(size + extraSize) };
+	return sendAll(fd, &header, sizeof(header)) && sendAll(fd, payload, size) && sendAll(fd, extra, extraSize);
+}
+
+// Messages with payloads over maxSize bytes are refused before anything is
+// allocated for them; the size comes from the peer.
+bool recvMessage(int fd, WireHeader& header, vector<char>& payload, size_t maxSize) {
+	if (!recvAll(fd, &header, sizeof(header)) || header.magic != wireMagic || header.size > maxSize) return false;
+	payload.resize(header.size);
+	return recvAll(fd, payload.data(), header.size);
+}
+
+// Split "unix:path" / "tcp:host:port". Returns false for anything else.
+bool parseAddress(const string& address, bool& isUnix, string& host, string& port) {
+	if (address.compare(0, 5, "unix:") == 0) {
+		isUnix = true;
+		host = address.substr(5);
+		return !host.empty();
+	}
+	if (address.compare(0, 4, "tcp:") == 0) {
+		size_t colon = address.rfind(':');
+		if (colon <= 3) return false;
+		isUnix = false;
+		host = address.substr(4, colon - 4);
+		port = address.substr(colon + 1);
+		return !port.empty();
+	}
+	return false;
+}
+
+// Returns a connected (connect = true) or listening socket, or -1.
+int openSocket(const string& address, bool connectTo) {
+	bool isUnix;
+	string host, port;
+	if (!parseAddress(address, isUnix, host, port)) {
+		cerr << "ERROR: Bad address '" << address << "'; use unix:path or tcp:host:port.\n";
+		return -1;
+	}
+
+	if (isUnix) {
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (host.size() >= sizeof(addr.sun_path)) return -1;
+		strcpy(addr.sun_path, host.c_str());
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		if (connectTo) {
+			if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return fd;
+		}
+		else {
+			unlink(host.c_str());
+			if (bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 64) == 0) return fd;
+		}
+		close(fd);
+		return -1;
+	}
+
+	addrinfo hints, *result = nullptr;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = connectTo ? 0 : AI_PASSIVE;
+	if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0) return -1;
+
+	int fd = -1;
+	for (addrinfo* ai = result; ai != nullptr && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) continue;
+		int one = 1;
+		if (connectTo) {
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+		}
+		else {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 64) == 0) break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(result);
+	return fd;
+}
+
+// ----------------------------------------
+// Worker
+
+// Render tile into out, width * height sample sums, rows top to bottom.
+void renderTile(const Camera& camera, const Hittable& world, const SceneSettings& settings, const WireTile& tile, vector<float>& out) {
+	int imageWidth = settings.imageWidth;
+	int imageHeight = settings.imageHeight();
+
+	seedRandom(tile.seed);
+	useSampler(settings.sampler);
+	out.resize(size_t(tile.width) * tile.height * 3);
+	for (int y = 0; y < tile.height; y++) {
+		for (int x = 0; x < tile.width; x++) {
+			Color c = samplePixel(camera, world, settings.backgroundColor, tile.x0 + x, tile.y0 + y,
+				imageWidth, imageHeight, settings.samplesPerPixel, settings.maxDepth);
+			float* dst = &out[(size_t(y) * tile.width + x) * 3];
+			dst[0] = c.x();
+			dst[1] = c.y();
+			dst[2] = c.z();
+		}
+	}
+}
+
+// Connect to the coordinator at address and render tiles until it says stop.
+int runWorker(const string& address) {
+	int fd = openSocket(address, true);
+	if (fd < 0) {
+		cerr << "ERROR: Worker could not connect to " << address << ".\n";
+		return 1;
+	}
+
+	WireHeader header;
+	vector<char> payload;
+	if (!sendMessage(fd, MessageHello) || !recvMessage(fd, header, payload, sizeof(WireSetup))
+		|| header.type != MessageSetup || payload.size() != sizeof(WireSetup)) {
+		cerr << "ERROR: Worker handshake with " << address << " failed.\n";
+		close(fd);
+		return 1;
+	}
+	WireSetup setup;
+	memcpy(&setup, payload.data(), sizeof(setup));
+	setup.cloudGrid[sizeof(setup.cloudGrid) - 1] = 0;
+	sceneFileOptions().cloudGrid = setup.cloudGrid;
+	setup.sphereField[sizeof(setup.sphereField) - 1] = 0;
+	sceneFileOptions().sphereField = setup.sphereField;
+
+	SceneArena arena;
+	HittableList world;
+	SceneSettings settings;
+	loadScene(setup.sceneId, world, settings, arena);
+	settings.sampler = SamplerType(setup.sampler);
+	settings.samplesPerPixel = setup.samplesPerPixel;
+	HittableList scene(buildSceneBVH(world, arena, setup.motionBVH != 0, setup.temporalSplits, setup.quantizedBVH != 0));
+	sceneLights().build(world);
+	sceneShadowMedia().collect(world);
+	setup.environmentPath[sizeof(setup.environmentPath) - 1] = 0;
+	if (!useEnvironment(settings, setup.environmentPath, setup.environmentScale)) {
+		close(fd);
+		return 1;
+	}
+	Camera camera = sceneCamera(settings);
+
+	vector<float> pixels;
+	while (recvMessage(fd, header, payload, sizeof(WireTile)) && header.type == MessageTile && payload.size() == sizeof(WireTile)) {
+		WireTile tile;
+		memcpy(&tile, payload.data(), sizeof(tile));
+		renderTile(camera, scene, settings, tile, pixels);
+		if (!sendMessage(fd, MessageTileResult, &tile, sizeof(tile), pixels.data(), pixels.size() * sizeof(float))) break;
+	}
+
+	close(fd);
+	return 0;
+}
+
+// ----------------------------------------
+// Coordinator
+
+// Render the image of options.sceneId on workers and store the per-pixel sample
+// sums in pixels. Returns false when no worker is left to finish the image.
+bool renderDistributed(const DistributedOptions& options, int imageWidth, int imageHeight, vector<Color>& pixels) {
+	using Clock = chrono::steady_clock;
+
+	if (options.environmentPath.size() >= sizeof(WireSetup::environmentPath)) {
+		cerr << "ERROR: The environment map path is too long to send to workers.\n";
+		return false;
+	}
+	const SceneFileOptions& files = sceneFileOptions();
+	if (files.cloudGrid.size() >= sizeof(WireSetup::cloudGrid)) {
+		cerr << "ERROR: The cloud grid path is too long to send to workers.\n";
+		return false;
+	}
+	if (files.sphereField.size() >= sizeof(WireSetup::sphereField)) {
+		cerr << "ERROR: The sphere field path is too long to send to workers.\n";
+		return false;
+	}
+
+	string address = options.listenAddress.empty()
+		? "unix:/tmp/rtnw-" + to_string(getpid()) + ".sock" : options.listenAddress;
+	int listenFd = openSocket(address, false);
+	if (listenFd < 0) {
+		cerr << "ERROR: Coordinator could not listen on " << address << ".\n";
+		return false;
+	}
+
+	vector<pid_t> children;
+	cout << flush;
+	for (int ii = 0; ii < options.localWorkers; ii++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			execlp(options.executable.c_str(), options.executable.c_str(), "--worker", address.c_str(), (char*)nullptr);
+			_exit(127);
+		}
+		if (pid > 0) children.push_back(pid);
+	}
+
+	struct TileState {
+		WireTile wire;
+		bool done = false;
+		int inFlight = 0;
+	};
+	struct Worker {
+		int fd;
+		bool ready = false;
+		int tile = -1;
+		Clock::time_point started;
+	};
+
+	vector<TileState> tiles;
+	for (int y0 = 0; y0 < imageHeight; y0 += options.tileSize) {
+		for (int x0 = 0; x0 < imageWidth; x0 += options.tileSize) {
+			TileState state;
+			state.wire = WireTile{ int32_t(tiles.size()), x0, y0,
+				min(options.tileSize, imageWidth - x0), min(options.tileSize, imageHeight - y0), uint32_t(tiles.size() + 1) };
+			tiles.push_back(state);
+		}
+	}
+
+	// The largest message a worker may send: the result of a full tile.
+	size_t maxResultSize = sizeof(WireTile) + size_t(options.tileSize) * options.tileSize * 3 * sizeof(float);
+
+	deque<int> pending;
+	for (size_t ii = 0; ii < tiles.size(); ii++) pending.push_back(int(ii));
+	size_t remaining = tiles.size();
+
+	vector<Worker> workers;
+	double finishedSeconds = 0;
+	int finishedTiles = 0;
+	pixels.assign(size_t(imageWidth) * imageHeight, Color(0, 0, 0));
+
+	WireSetup setup{ options.sceneId, options.motionBVH ? 1 : 0, options.temporalSplits, options.quantizedBVH ? 1 : 0, int32_t(options.sampler),
+		options.samplesPerPixel, {}, options.environmentScale };
+	memcpy(setup.environmentPath, options.environmentPath.c_str(), options.environmentPath.size() + 1);
+	memcpy(setup.cloudGrid, files.cloudGrid.c_str(), files.cloudGrid.size() + 1);
+	memcpy(setup.sphereField, files.sphereField.c_str(), files.sphereField.size() + 1);
+
+	auto dropWorker = [&](size_t index) {
+		Worker& worker = workers[index];
+		if (worker.tile >= 0 && --tiles[worker.tile].inFlight == 0 && !tiles[worker.tile].done) {
+			pending.push_front(worker.tile);
+		}
+		close(worker.fd);
+		workers.erase(workers.begin() + index);
+	};
+
+	auto assign = [&](Worker& worker, int tile) {
+		worker.tile = tile;
+		worker.started = Clock::now();
+		tiles[tile].inFlight++;
+		return sendMessage(worker.fd, MessageTile, &tiles[tile].wire, sizeof(WireTile));
+	};
+
+	while (remaining > 0) {
+		// Hand out work: queued tiles first, then stragglers to idle workers.
+		float timeout = options.tileTimeout > 0 ? options.tileTimeout
+			: (finishedTiles > 0 ? fmax(1.0, 4 * finishedSeconds / finishedTiles) : INF);
+		for (size_t ii = 0; ii < workers.size(); ii++) {
+			Worker& worker = workers[ii];
+			if (!worker.ready || worker.tile >= 0) continue;
+
+			int tile = -1;
+			while (!pending.empty() && tile < 0) {
+				tile = pending.front();
+				pending.pop_front();
+				if (tiles[tile].done) tile = -1;
+			}
+			if (tile < 0) {
+				for (const Worker& other : workers) {
+					if (other.tile >= 0 && tiles[other.tile].inFlight == 1 &&
+						chrono::duration<double>(Clock::now() - other.started).count() > timeout) {
+						tile = other.tile;
+						break;
+					}
+				}
+			}
+			if (tile >= 0 && !assign(worker, tile)) dropWorker(ii--);
+		}
+
+		// Give up when nobody can finish the image: all local workers exited and
+		// no one else can connect.
+		for (size_t ii = 0; ii < children.size(); ii++) {
+			if (waitpid(children[ii], nullptr, WNOHANG) == children[ii]) children.erase(children.begin() + ii--);
+		}
+		if (workers.empty() && children.empty() && options.listenAddress.empty()) {
+			cerr << "\nERROR: All workers are gone with " << remaining << " tiles left.\n";
+			break;
+		}
+
+		vector<pollfd> fds(1 + workers.size());
+		fds[0] = pollfd{ listenFd, POLLIN, 0 };
+		for (size_t ii = 0; ii < workers.size(); ii++) fds[ii + 1] = pollfd{ workers[ii].fd, POLLIN, 0 };
+		if (poll(fds.data(), fds.size(), 200) <= 0) continue;
+
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(listenFd, nullptr, nullptr);
+			if (fd >= 0) {
+				// A worker that stops talking mid-message is dropped instead of blocking the coordinator.
+				timeval recvTimeout{ 30, 0 };
+				setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
+				workers.push_back(Worker{ fd });
+			}
+		}
+
+		// Workers accepted in this iteration have no pollfd yet.
+		for (size_t ii = fds.size() - 1; ii >= 1; ii--) {
+			if (!(fds[ii].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+			size_t index = ii - 1;
+			Worker& worker = workers[index];
+
+			WireHeader header;
+			vector<char> payload;
+			if (!recvMessage(worker.fd, header, payload, maxResultSize)) {
+				dropWorker(index);
+				continue;
+			}
+
+			if (header.type == MessageHello) {
+				worker.ready = sendMessage(worker.fd, MessageSetup, &setup, sizeof(setup));
+				if (!worker.ready) dropWorker(index);
+				continue;
+			}
+
+			WireTile wire;
+			if (header.type != MessageTileResult || payload.size() < sizeof(WireTile) || worker.tile < 0) {
+				dropWorker(index);
+				continue;
+			}
+			memcpy(&wire, payload.data(), sizeof(wire));
+			// Where the pixels go is the coordinator's own record of the tile;
+			// the worker's copy only has to name it.
+			TileState& tile = tiles[worker.tile];
+			const WireTile& placed = tile.wire;
+			if (wire.tileId != placed.tileId
+				|| payload.size() != sizeof(WireTile) + size_t(placed.width) * placed.height * 3 * sizeof(float)) {
+				dropWorker(index);
+				continue;
+			}
+
+			tile.inFlight--;
+			worker.tile = -1;
+			if (tile.done) continue; // a duplicate of a reassigned tile
+
+			const float* data = reinterpret_cast<const float*>(payload.data() + sizeof(WireTile));
+			for (int y = 0; y < placed.height; y++) {
+				for (int x = 0; x < placed.width; x++) {
+					const float* src = data + (size_t(y) * placed.width + x) * 3;
+					pixels[size_t(placed.y0 + y) * imageWidth + placed.x0 + x] = Color(src[0], src[1], src[2]);
+				}
+			}
+			tile.done = true;
+			remaining--;
+			finishedTiles++;
+			finishedSeconds += chrono::duration<double>(Clock::now() - worker.started).count();
+			cout << "\rTiles remaining: " << remaining << " (" << workers.size() << " workers) " << flush;
+		}
+	}
+
+	for (Worker& worker : workers) {
+		sendMessage(worker.fd, MessageShutdown);
+		close(worker.fd);
+	}
+	for (pid_t pid : children) waitpid(pid, nullptr, 0);
+	close(listenFd);
+
+	bool isUnix;
+	string host, port;
+	if (parseAddress(address, isUnix, host, port) && isUnix) unlink(host.c_str());
+
+	return remaining == 0;
+}
+
+#endif // !_WIN32
+
+#endif // !DISTRIBUTED_H
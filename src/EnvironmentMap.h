@@ -0,0 +1,331 @@
+#pragma once
+
+#ifndef ENVIRONMENT_MAP_H
+#define ENVIRONMENT_MAP_H
+
+// Image-based background: radiance arriving from every direction, stored as
+// a latitude-longitude (equirectangular) image.
+//
+// Pixels are laid out like the texture of a Sphere seen from its center
+// (see Sphere::getSphereUV): the top row looks up (+y), the left column
+// towards -x. Radiance is constant over a pixel, so the density of a
+// direction is that of its pixel over the pixel's solid angle.
+//
+// sample() draws directions from an alias table (Walker; built with Vose's
+// method) over the pixels weighted by brightness times solid angle, in
+// constant time whatever the image size. lookupBatch() maps arrays of
+// directions to radiance in two loops: the first, all arithmetic, is
+// vectorized by the compiler as in Sampling.h; the second gathers the pixels.
+
+#include "RTNW.h"
+#include "Vec3.h"
+#include "Color.h"
+#include "FastMath.h"
+#include "Sampling.h"
+#include "rtnw_stb_image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class EnvironmentMap {
+public:
+	bool empty() const { return pixels.empty(); }
+	int width() const { return imageWidth; }
+	int height() const { return imageHeight; }
+
+	// Load a Portable Float Map (.pfm) or anything stbi_loadf() reads, such
+	// as Radiance .hdr, and multiply it by scale. Leaves the map empty and
+	// returns false when the file cannot be read.
+	bool load(const string& path, float scale = 1);
+
+	// Take rgb, width * height pixels of three floats, top row first.
+	void setImage(int width, int height, vector<float> rgb);
+
+	// Clear sky with a sun disk of angular radius sunDegrees towards
+	// sunDirection, whose radiance is sunIntensity, above a dark ground.
+	void makeDaylight(const Vec3& sunDirection, float sunIntensity, int width = 512, float sunDegrees = 1.5f);
+
+	void clear();
+
+	// Radiance arriving from direction, which need not be unit length.
+	Color lookup(const Vec3& direction) const {
+		return pixelColor(pixelIndex(direction.x(), direction.y(), direction.z()));
+	}
+
+	// lookup() for count directions, structure of arrays.
+	void lookupBatch(const float* x, const float* y, const float* z, int count, float* r, float* g, float* b) const;
+
+	// Draw a unit direction with u; false when the map is black.
+	bool sample(Sample2D u, Vec3& direction, Color& radiance, float& pdf) const;
+
+	// Solid angle density of sample() drawing direction (unit length).
+	float pdf(const Vec3& direction) const;
+
+private:
+	// Pixel seen along (x, y, z). Branch free: the clamps are min and max.
+	int pixelIndex(float x, float y, float z) const {
+		float length = sqrtf(x * x + y * y + z * z);
+		float inverse = length > 0 ? 1 / length : 0;
+		float u = (fastAtan2(-z * inverse, x * inverse) + PI) * (1 / (2 * PI));
+		float v = fastAcos(max(-1.0f, min(1.0f, -y * inverse))) * (1 / PI);
+		int column = min(imageWidth - 1, max(0, int(u * imageWidth)));
+		int row = min(imageHeight - 1, max(0, int((1 - v) * imageHeight)));
+		return row * imageWidth + column;
+	}
+
+	Color pixelColor(int index) const {
+		const float* pixel = &pixels[size_t(index) * 3];
+		return Color(pixel[0], pixel[1], pixel[2]);
+	}
+
+	// Sine of the polar angle at the middle of row.
+	float rowSine(int row) const { return sinf(PI * (row + 0.5f) / imageHeight); }
+
+	void buildAliasTable();
+
+	// One bin of the alias table: keep the bin's own pixel with probability
+	// keep, else take alias.
+	struct AliasBin {
+		float keep;
+		uint32_t alias;
+	};
+
+	int imageWidth = 0, imageHeight = 0;
+	vector<float> pixels;              // rgb, top row first
+	vector<AliasBin> aliasTable;       // one bin per pixel
+	vector<float> pixelProbability;    // chance that sample() lands in each pixel
+};
+
+// ----------------------------------------
+// Loading
+
+// Portable Float Map: "PF" (rgb) or "Pf" (gray), the size, a scale whose
+// sign gives the byte order, then rows of floats from the bottom up.
+inline bool readPortableFloatMap(const string& path, int& width, int& height, vector<float>& rgb) {
+	ifstream file(path, ios::binary);
+	string type;
+	float scale = 0;
+	if (!(file >> type >> width >> height >> scale) || (type != "PF" && type != "Pf") || width <= 0 || height <= 0)
+		return false;
+	file.get(); // the single whitespace before the data
+
+	int channels = type == "PF" ? 3 : 1;
+	vector<float> data(size_t(width) * height * channels);
+	if (!file.read(reinterpret_cast<char*>(data.data()), data.size() * sizeof(float))) return false;
+
+	uint32_t probe = 1;
+	bool littleEndianHost = *reinterpret_cast<const char*>(&probe) == 1;
+	if ((scale < 0) != littleEndianHost) {
+		for (float& value : data) {
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			bits = (bits >> 24) | ((bits >> 8) & 0xff00u) | ((bits << 8) & 0xff0000u) | (bits << 24);
+			memcpy(&value, &bits, sizeof(bits));
+		}
+	}
+
+	rgb.resize(size_t(width) * height * 3);
+	for (int row = 0; row < height; row++) {
+		const float* source = &data[size_t(height - 1 - row) * width * channels];
+		float* target = &rgb[size_t(row) * width * 3];
+		for (int column = 0; column < width; column++) {
+			for (int c = 0; c < 3; c++) target[column * 3 + c] = source[column * channels + (channels == 3 ? c : 0)];
+		}
+	}
+	return true;
+}
+
+bool EnvironmentMap::load(const string& path, float scale) {
+	int width = 0, height = 0;
+	vector<float> rgb;
+	bool pfm = path.size() >= 4 && (path.compare(path.size() - 4, 4, ".pfm") == 0 || path.compare(path.size() - 4, 4, ".PFM") == 0);
+	if (pfm) {
+		if (!readPortableFloatMap(path, width, height, rgb)) {
+			clear();
+			return false;
+		}
+	}
+	else {
+		int components = 3;
+		float* data = stbi_loadf(path.c_str(), &width, &height, &components, 3);
+		if (data == nullptr) {
+			clear();
+			return false;
+		}
+		rgb.assign(data, data + size_t(width) * height * 3);
+		stbi_image_free(data);
+	}
+
+	for (float& value : rgb) value = isfinite(value) ? max(0.0f, value * scale) : 0;
+	setImage(width, height, move(rgb));
+	return true;
+}
+
+void EnvironmentMap::setImage(int width, int height, vector<float> rgb) {
+	imageWidth = width;
+	imageHeight = height;
+	pixels = move(rgb);
+	buildAliasTable();
+}
+
+void EnvironmentMap::makeDaylight(const Vec3& sunDirection, float sunIntensity, int width, float sunDegrees) {
+	int height = width / 2;
+	Vec3 sun = unitVector(sunDirection);
+	float cosSun = cosf(degrees2radian(sunDegrees));
+	const Color zenith(0.25, 0.45, 0.95), horizon(0.85, 0.9, 1.0), ground(0.25, 0.23, 0.2);
+	const Color sunColor(1.0, 0.95, 0.85);
+
+	// Four samples per pixel smooth the sun's rim.
+	vector<float> rgb(size_t(width) * height * 3);
+	for (int row = 0; row < height; row++) {
+		for (int column = 0; column < width; column++) {
+			Color sum;
+			for (int s = 0; s < 4; s++) {
+				float u = (column + 0.25f + 0.5f * (s & 1)) / width;
+				float v = 1 - (row + 0.25f + 0.5f * (s >> 1)) / height;
+				float phi = 2 * PI * u - PI, theta = PI * v;
+				Vec3 direction(sinf(theta) * cosf(phi), -cosf(theta), -sinf(theta) * sinf(phi));
+
+				float up = direction.y();
+				float toSun = dot(direction, sun);
+				Color sky = up > 0 ? (1 - sqrtf(up)) * horizon + sqrtf(up) * zenith : ground;
+				// Brighter around the sun, as forward scattering makes it.
+				sky *= 1 + 2 * powf(max(0.0f, toSun), 16);
+				if (toSun > cosSun) sky += sunIntensity * sunColor;
+				sum += sky;
+			}
+			for (int c = 0; c < 3; c++) rgb[(size_t(row) * width + column) * 3 + c] = sum[c] / 4;
+		}
+	}
+	setImage(width, height, move(rgb));
+}
+
+void EnvironmentMap::clear() {
+	imageWidth = imageHeight = 0;
+	pixels.clear();
+	aliasTable.clear();
+	pixelProbability.clear();
+}
+
+// ----------------------------------------
+// Sampling
+
+void EnvironmentMap::buildAliasTable() {
+	size_t count = size_t(imageWidth) * imageHeight;
+	pixelProbability.assign(count, 0);
+	aliasTable.assign(count, AliasBin{ 1, 0 });
+
+	double total = 0;
+	for (int row = 0; row < imageHeight; row++) {
+		float sine = rowSine(row);
+		for (int column = 0; column < imageWidth; column++) {
+			size_t index = size_t(row) * imageWidth + column;
+			const float* pixel = &pixels[index * 3];
+			pixelProbability[index] = (pixel[0] + pixel[1] + pixel[2]) / 3 * sine;
+			total += pixelProbability[index];
+		}
+	}
+	if (!(total > 0)) {
+		// Black: nothing to sample.
+		aliasTable.clear();
+		return;
+	}
+	for (float& probability : pixelProbability) probability = float(probability / total);
+
+	// Vose: pair every bin below the average with one above it, which gives
+	// the rest of its share away.
+	vector<double> scaled(count);
+	vector<uint32_t> small, large;
+	for (size_t ii = 0; ii < count; ii++) {
+		scaled[ii] = double(pixelProbability[ii]) * count;
+		(scaled[ii] < 1 ? small : large).push_back(uint32_t(ii));
+	}
+	while (!small.empty() && !large.empty()) {
+		uint32_t less = small.back(), more = large.back();
+		small.pop_back();
+		aliasTable[less] = AliasBin{ float(scaled[less]), more };
+		scaled[more] -= 1 - scaled[less];
+		if (scaled[more] < 1) {
+			large.pop_back();
+			small.push_back(more);
+		}
+	}
+	// What is left is within rounding of 1.
+	for (uint32_t index : small) aliasTable[index] = AliasBin{ 1, index };
+	for (uint32_t index : large) aliasTable[index] = AliasBin{ 1, index };
+}
+
+bool EnvironmentMap::sample(Sample2D u, Vec3& direction, Color& radiance, float& pdf) const {
+	if (aliasTable.empty()) return false;
+
+	// u.x picks the bin, then what is left of it picks between the bin's
+	// pixel and its alias, and what is left after that is the horizontal
+	// position in the pixel.
+	const float oneMinusEpsilon = 0x1.fffffep-1f;
+	float scaled = u.x * aliasTable.size();
+	size_t bin = min(aliasTable.size() - 1, size_t(scaled));
+	float rest = scaled - bin;
+	const AliasBin& entry = aliasTable[bin];
+	size_t index;
+	float jitter;
+	if (rest < entry.keep) {
+		index = bin;
+		jitter = rest / entry.keep;
+	}
+	else {
+		index = entry.alias;
+		jitter = (rest - entry.keep) / (1 - entry.keep);
+	}
+	jitter = min(jitter, oneMinusEpsilon);
+
+	int row = int(index / imageWidth), column = int(index % imageWidth);
+	float phi = 2 * PI * (column + jitter) / imageWidth - PI;
+	float theta = PI * (1 - (row + u.y) / imageHeight);
+	float sinTheta = sinf(theta);
+	if (sinTheta <= 0) return false;
+
+	direction = Vec3(sinTheta * cosf(phi), -cosf(theta), -sinTheta * sinf(phi));
+	radiance = pixelColor(int(index));
+	// Pixel probability over its solid angle, (2 pi / width) (pi / height) sin(theta).
+	pdf = pixelProbability[index] * imageWidth * imageHeight / (2 * PI * PI * sinTheta);
+	return pdf > 0;
+}
+
+float EnvironmentMap::pdf(const Vec3& direction) const {
+	if (aliasTable.empty()) return 0;
+	float sinTheta = sqrtf(max(0.0f, 1 - direction.y() * direction.y()));
+	if (sinTheta <= 0) return 0;
+	int index = pixelIndex(direction.x(), direction.y(), direction.z());
+	return pixelProbability[index] * imageWidth * imageHeight / (2 * PI * PI * sinTheta);
+}
+
+void EnvironmentMap::lookupBatch(const float* x, const float* y, const float* z, int count, float* r, float* g, float* b) const {
+	// Blocks of indices, then the gathers.
+	const int blockSize = 256;
+	int indices[blockSize];
+	for (int start = 0; start < count; start += blockSize) {
+		int n = min(blockSize, count - start);
+		for (int ii = 0; ii < n; ii++) indices[ii] = pixelIndex(x[start + ii], y[start + ii], z[start + ii]);
+		for (int ii = 0; ii < n; ii++) {
+			const float* pixel = &pixels[size_t(indices[ii]) * 3];
+			r[start + ii] = pixel[0];
+			g[start + ii] = pixel[1];
+			b[start + ii] = pixel[2];
+		}
+	}
+}
+
+// Environment of the scene being rendered; empty when the scene has a
+// constant background. Set up with useEnvironment() (Scenes.h).
+inline EnvironmentMap& sceneEnvironment() {
+	static EnvironmentMap environment;
+	return environment;
+}
+
+#endif // !ENVIRONMENT_MAP_H
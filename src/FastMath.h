@@ -0,0 +1,141 @@
+#pragma once
+
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+// Polynomial approximations of the libm functions on the hit and shading
+// paths: acos and atan2 for sphere UVs, sin for the checker and marble
+// textures, log for free-flight distances in media.
+//
+// The approx* functions are always the polynomials. The fast* functions the
+// renderer calls are the polynomials when RTNW_FAST_MATH is defined (CMake
+// option of the same name) and plain libm otherwise. Every approximation is
+// branch free, and the *Batch forms are loops over arrays that the compiler
+// vectorizes, as in Sampling.h.
+//
+// Accuracy against double-precision libm, as measured by rtnw_bench (the
+// "accuracy" section of its JSON; 2^20 + 1 evenly spaced points per domain,
+// log-spaced for log). The errors are rounded up; rtnw_bench fails when one
+// exceeds these bounds:
+//
+//   function      domain            max abs error   max rel error
+//   approxSin     [-8192, 8192]     2.1e-07         2.1e-07
+//   approxSin     [-pi, pi]         2.1e-07         2.1e-07
+//   approxAcos    [-1, 1]           4.1e-07         2.0e-07
+//   approxAtan2   unit circle       2.7e-07         2.2e-07
+//   approxLog     [1e-6, 1e6]       5.4e-07         2.1e-07
+//
+// For comparison, one float ulp at 1 is 1.2e-07. The sine's range reduction
+// holds up to |x| = 65536 (error 1e-06) and degrades beyond; the textures
+// only evaluate it at scene coordinates times small factors.
+
+#include "RTNW.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+// ----------------------------------------
+// Scalar approximations
+
+// sin(x), accurate for |x| <= 65536. Reduced to r = x - k pi in [-pi/2, pi/2] with a
+// three-part pi, then a degree 11 Taylor polynomial (error below 6e-8 on
+// that interval) and the sign of k.
+inline float approxSin(float x) {
+	const float pi1 = 3.140625f, pi2 = 9.67502593994140625e-4f, pi3 = 1.509957990978376432e-7f;
+	const float roundMagic = 12582912.0f; // 1.5 * 2^23: adding and subtracting it rounds to an integer
+	float k = (x * (1 / PI) + roundMagic) - roundMagic;
+	float r = ((x - k * pi1) - k * pi2) - k * pi3;
+	float r2 = r * r;
+	float s = r * (1 + r2 * (-1.0f / 6 + r2 * (1.0f / 120 + r2 * (-1.0f / 5040 + r2 * (1.0f / 362880 + r2 * (-1.0f / 39916800))))));
+	return (int32_t(k) & 1) ? -s : s;
+}
+
+// acos(x) for x in [-1, 1] (Abramowitz and Stegun 4.4.46).
+inline float approxAcos(float x) {
+	float a = fabsf(x);
+	float p = 1.5707963050f + a * (-0.2145988016f + a * (0.0889789874f + a * (-0.0501743046f
+		+ a * (0.0308918810f + a * (-0.0170881256f + a * (0.0066700901f + a * -0.0012624911f))))));
+	float r = sqrtf(max(0.0f, 1 - a)) * p;
+	return x < 0 ? PI - r : r;
+}
+
+// atan(z) for z in [0, 1]: shifted by pi/4 above tan(pi/8), then the Cephes
+// atanf polynomial.
+inline float approxAtanUnit(float z) {
+	bool shifted = z > 0.41421356f;
+	float t = shifted ? (z - 1) / (z + 1) : z;
+	float t2 = t * t;
+	float r = (((8.05374449538e-2f * t2 - 1.38776856032e-1f) * t2 + 1.99777106478e-1f) * t2 - 3.33329491539e-1f) * t2 * t + t;
+	return shifted ? r + PI / 4 : r;
+}
+
+// atan2(y, x), in [-pi, pi].
+inline float approxAtan2(float y, float x) {
+	float ax = fabsf(x), ay = fabsf(y);
+	float largest = max(ax, ay);
+	float z = min(ax, ay) / (largest > 0 ? largest : 1);
+	float r = approxAtanUnit(z);
+	r = ay > ax ? PI / 2 - r : r;
+	r = x < 0 ? PI - r : r;
+	return copysignf(r, y);
+}
+
+// Natural log of a normal float. x = 2^e m with m in [sqrt(1/2), sqrt(2)),
+// and ln(m) = 2 atanh(s) for s = (m - 1) / (m + 1), |s| < 0.172, as a series.
+// Returns -infinity for x <= 0.
+inline float approxLog(float x) {
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	float e = float(int32_t((bits >> 23) & 0xff) - 127);
+	bits = (bits & 0x007fffffu) | 0x3f800000u;
+	float m;
+	memcpy(&m, &bits, sizeof(m));
+	bool high = m > 1.41421356f;
+	m = high ? 0.5f * m : m;
+	e = high ? e + 1 : e;
+
+	float s = (m - 1) / (m + 1);
+	float s2 = s * s;
+	float lnM = 2 * s * (1 + s2 * (1.0f / 3 + s2 * (1.0f / 5 + s2 * (1.0f / 7 + s2 * (1.0f / 9)))));
+	float r = e * 0.693359375f + (lnM + e * -2.12194440e-4f); // ln 2 split so e * ln2Hi is exact
+	return x > 0 ? r : -INF;
+}
+
+// ----------------------------------------
+// Batch approximations
+
+inline void approxSinBatch(const float* x, int count, float* out) {
+	for (int ii = 0; ii < count; ii++) out[ii] = approxSin(x[ii]);
+}
+
+inline void approxAcosBatch(const float* x, int count, float* out) {
+	for (int ii = 0; ii < count; ii++) out[ii] = approxAcos(x[ii]);
+}
+
+inline void approxAtan2Batch(const float* y, const float* x, int count, float* out) {
+	for (int ii = 0; ii < count; ii++) out[ii] = approxAtan2(y[ii], x[ii]);
+}
+
+inline void approxLogBatch(const float* x, int count, float* out) {
+	for (int ii = 0; ii < count; ii++) out[ii] = approxLog(x[ii]);
+}
+
+// ----------------------------------------
+// Build-time selection
+
+#ifdef RTNW_FAST_MATH
+inline float fastSin(float x) { return approxSin(x); }
+inline float fastAcos(float x) { return approxAcos(x); }
+inline float fastAtan2(float y, float x) { return approxAtan2(y, x); }
+inline float fastLog(float x) { return approxLog(x); }
+#else
+inline float fastSin(float x) { return sinf(x); }
+inline float fastAcos(float x) { return acosf(x); }
+inline float fastAtan2(float y, float x) { return atan2f(y, x); }
+inline float fastLog(float x) { return logf(x); }
+#endif
+
+#endif // !FAST_MATH_H
@@ -0,0 +1,425 @@
+#pragma once
+
+#ifndef GRID_MEDIUM_H
+#define GRID_MEDIUM_H
+
+// Heterogeneous participating medium whose density comes from a voxel grid.
+//
+// Free-flight distances are sampled with delta tracking against a majorant:
+// the grid is covered by a coarse supergrid whose cells store the largest
+// density they can return, and the ray walks those cells with a 3D-DDA. Each
+// cell uses its own majorant, so thin or empty regions produce few (or no)
+// null collisions while dense regions are still sampled without bias.
+// transmittance() estimates visibility through the medium with ratio tracking;
+// the next-event shadow rays of the renderer weigh their light with it for
+// the media sceneShadowMedia() collects, instead of testing for a collision.
+
+#include "RTNW.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "BVHNode.h"
+#include "Material.h"
+#include "Stats.h"
+#include "FastMath.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Scalar field of nx * ny * nz voxels. Sparse grids only store the 8^3 bricks
+// that contain a non-zero voxel.
+class VoxelGrid {
+public:
+	static const int brickSize = 8;
+
+	// values are laid out x fastest, then y, then z.
+	VoxelGrid(int nx, int ny, int nz, const vector<float>& values, bool sparseStorage = false);
+
+	// Read nx * ny * nz raw little-endian float32 values. Returns nullptr on failure.
+	static shared_ptr<VoxelGrid> loadRaw(const string& fileName, int nx, int ny, int nz, bool sparseStorage = false);
+
+	int size(int axis) const { return n[axis]; }
+	bool isSparse() const { return sparse; }
+	size_t bytesUsed() const { return (dense.size() + brickData.size()) * sizeof(float) + brickIndex.size() * sizeof(int); }
+
+	// Voxel value; 0 outside the grid.
+	float voxel(int x, int y, int z) const {
+		if (x < 0 || y < 0 || z < 0 || x >= n[0] || y >= n[1] || z >= n[2]) return 0;
+		if (!sparse) return dense[(size_t(z) * n[1] + y) * n[0] + x];
+
+		int brick = brickIndex[(size_t(z / brickSize) * bricks[1] + y / brickSize) * bricks[0] + x / brickSize];
+		if (brick < 0) return 0;
+		return brickData[size_t(brick) * brickSize * brickSize * brickSize +
+			((z % brickSize) * brickSize + (y % brickSize)) * brickSize + (x % brickSize)];
+	}
+
+	// Trilinear interpolation at continuous voxel coordinates; voxel (i, j, k) covers [i, i + 1).
+	float sample(float x, float y, float z) const {
+		x -= 0.5f; y -= 0.5f; z -= 0.5f;
+		int ix = (int)floorf(x), iy = (int)floorf(y), iz = (int)floorf(z);
+		float fx = x - ix, fy = y - iy, fz = z - iz;
+
+		float accum = 0;
+		for (int dz = 0; dz < 2; dz++)
+			for (int dy = 0; dy < 2; dy++)
+				for (int dx = 0; dx < 2; dx++)
+					accum += (dx ? fx : 1 - fx) * (dy ? fy : 1 - fy) * (dz ? fz : 1 - fz) * voxel(ix + dx, iy + dy, iz + dz);
+		return accum;
+	}
+
+	// Largest voxel value in [x0, x1] x [y0, y1] x [z0, z1] (inclusive, clamped to the grid).
+	float maxInRange(int x0, int y0, int z0, int x1, int y1, int z1) const {
+		float result = 0;
+		for (int z = max(z0, 0); z <= min(z1, n[2] - 1); z++)
+			for (int y = max(y0, 0); y <= min(y1, n[1] - 1); y++)
+				for (int x = max(x0, 0); x <= min(x1, n[0] - 1); x++)
+					result = fmax(result, voxel(x, y, z));
+		return result;
+	}
+
+private:
+	friend class SceneCache;
+	int n[3];
+	bool sparse;
+	vector<float> dense;
+
+	int bricks[3];
+	vector<int> brickIndex; // -1 for bricks that are entirely zero
+	vector<float> brickData;
+
+	string sourceName; // file loadRaw() read, if any
+};
+
+VoxelGrid::VoxelGrid(int nx, int ny, int nz, const vector<float>& values, bool sparseStorage)
+	: n{ nx, ny, nz }, sparse(sparseStorage), bricks{ 0, 0, 0 } {
+	if (!sparse) {
+		dense = values;
+		return;
+	}
+
+	for (int axis = 0; axis < 3; axis++) bricks[axis] = (n[axis] + brickSize - 1) / brickSize;
+	brickIndex.assign(size_t(bricks[0]) * bricks[1] * bricks[2], -1);
+
+	const int brickVoxels = brickSize * brickSize * brickSize;
+	for (int bz = 0; bz < bricks[2]; bz++) {
+		for (int by = 0; by < bricks[1]; by++) {
+			for (int bx = 0; bx < bricks[0]; bx++) {
+				vector<float> brick(brickVoxels, 0);
+				bool empty = true;
+				for (int z = 0; z < brickSize; z++) {
+					for (int y = 0; y < brickSize; y++) {
+						for (int x = 0; x < brickSize; x++) {
+							int gx = bx * brickSize + x, gy = by * brickSize + y, gz = bz * brickSize + z;
+							if (gx >= nx || gy >= ny || gz >= nz) continue;
+							float value = values[(size_t(gz) * ny + gy) * nx + gx];
+							brick[(z * brickSize + y) * brickSize + x] = value;
+							if (value != 0) empty = false;
+						}
+					}
+				}
+				if (empty) continue;
+
+				brickIndex[(size_t(bz) * bricks[1] + by) * bricks[0] + bx] = int(brickData.size() / brickVoxels);
+				brickData.insert(brickData.end(), brick.begin(), brick.end());
+			}
+		}
+	}
+}
+
+shared_ptr<VoxelGrid> VoxelGrid::loadRaw(const string& fileName, int nx, int ny, int nz, bool sparseStorage) {
+	vector<float> values(size_t(nx) * ny * nz);
+
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if (file == nullptr) {
+		std::cerr << "ERROR: Could not open volume file '" << fileName << "'.\n";
+		return nullptr;
+	}
+	size_t read = fread(values.data(), sizeof(float), values.size(), file);
+	fclose(file);
+
+	if (read != values.size()) {
+		std::cerr << "ERROR: Volume file '" << fileName << "' holds " << read << " of "
+			<< values.size() << " expected values.\n";
+		return nullptr;
+	}
+	auto grid = make_shared<VoxelGrid>(nx, ny, nz, values, sparseStorage);
+	grid->sourceName = fileName;
+	return grid;
+}
+
+// ----------------------------------------
+
+class GridMedium final : public Hittable {
+public:
+	// Voxel cells covered by one majorant cell along each axis.
+	static const int majorantCellVoxels = VoxelGrid::brickSize;
+
+	// The grid is stretched over bounds; density = densityScale * voxel value.
+	GridMedium(shared_ptr<VoxelGrid> grid, const AABB& bounds, float densityScale, shared_ptr<Material> phase);
+	GridMedium(shared_ptr<VoxelGrid> grid, const AABB& bounds, float densityScale, Color albedo)
+		: GridMedium(grid, bounds, densityScale, make_shared<Isotropic>(albedo)) {}
+
+	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
+
+	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override {
+		bbox = bounds;
+		return true;
+	}
+
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		float t0, t1;
+		if (!clipToBounds(ray, tMin, tMax, t0, t1)) return 0;
+		return appendInterval(t0, t1, tMin, tMax, out, 0, maxIntervals);
+	}
+
+	// A medium whose shadows are weighed lets shadow rays through; their
+	// caller multiplies the light by transmittance() (see ShadowMedia).
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override {
+		return !shadowsWeighed && Hittable::occluded(ray, tMin, tMax);
+	}
+	void weighShadows(bool weigh) { shadowsWeighed = weigh; }
+
+	// Probability that the ray passes [tMin, tMax] without colliding, estimated with ratio tracking.
+	float transmittance(const Ray& ray, float tMin, float tMax) const;
+
+	float density(const Point3& p) const {
+		return densityScale * grid->sample(
+			(p.x() - bounds.min().x()) * voxelsPerUnit[0],
+			(p.y() - bounds.min().y()) * voxelsPerUnit[1],
+			(p.z() - bounds.min().z()) * voxelsPerUnit[2]);
+	}
+
+private:
+	friend class SceneCache;
+
+	// Walks the majorant cells pierced by the ray inside the bounds and calls
+	// visit(tEnter, tExit, majorant) for each; stops early when visit returns false.
+	template <typename F>
+	void traverseMajorants(const Ray& ray, float t0, float t1, F visit) const;
+
+	bool clipToBounds(const Ray& ray, float tMin, float tMax, float& t0, float& t1) const {
+		t0 = tMin;
+		t1 = tMax;
+		for (int ii = 0; ii < 3; ii++) {
+			float invD = 1 / ray.direction()[ii];
+			float tNear = (bounds.min()[ii] - ray.origin()[ii]) * invD;
+			float tFar = (bounds.max()[ii] - ray.origin()[ii]) * invD;
+			if (invD < 0) swap(tNear, tFar);
+			t0 = tNear > t0 ? tNear : t0;
+			t1 = tFar < t1 ? tFar : t1;
+			if (t1 <= t0) return false;
+		}
+		return true;
+	}
+
+	shared_ptr<VoxelGrid> grid;
+	AABB bounds;
+	float densityScale;
+	shared_ptr<Material> phase_function;
+
+	float voxelsPerUnit[3];
+	int cells[3];
+	vector<float> majorants; // per majorant cell, already multiplied by densityScale
+	bool shadowsWeighed = false;
+};
+
+GridMedium::GridMedium(shared_ptr<VoxelGrid> g, const AABB& b, float scale, shared_ptr<Material> phase)
+	: Hittable(HittableGridMedium), grid(g), bounds(b), densityScale(scale), phase_function(phase) {
+	for (int axis = 0; axis < 3; axis++) {
+		voxelsPerUnit[axis] = grid->size(axis) / (bounds.max()[axis] - bounds.min()[axis]);
+		cells[axis] = (grid->size(axis) + majorantCellVoxels - 1) / majorantCellVoxels;
+	}
+
+	// Trilinear lookups inside a cell also read the voxels just outside of it.
+	majorants.resize(size_t(cells[0]) * cells[1] * cells[2]);
+	for (int z = 0; z < cells[2]; z++) {
+		for (int y = 0; y < cells[1]; y++) {
+			for (int x = 0; x < cells[0]; x++) {
+				float maxDensity = grid->maxInRange(
+					x * majorantCellVoxels - 1, y * majorantCellVoxels - 1, z * majorantCellVoxels - 1,
+					(x + 1) * majorantCellVoxels, (y + 1) * majorantCellVoxels, (z + 1) * majorantCellVoxels);
+				majorants[(size_t(z) * cells[1] + y) * cells[0] + x] = densityScale * maxDensity;
+			}
+		}
+	}
+}
+
+template <typename F>
+void GridMedium::traverseMajorants(const Ray& ray, float t0, float t1, F visit) const {
+	// Work in majorant cell coordinates.
+	Point3 o, d;
+	for (int axis = 0; axis < 3; axis++) {
+		float cellsPerUnit = voxelsPerUnit[axis] / majorantCellVoxels;
+		o[axis] = (ray.origin()[axis] - bounds.min()[axis]) * cellsPerUnit;
+		d[axis] = ray.direction()[axis] * cellsPerUnit;
+	}
+
+	int cell[3], step[3];
+	float tNext[3], tDelta[3];
+	for (int axis = 0; axis < 3; axis++) {
+		float p = o[axis] + t0 * d[axis];
+		cell[axis] = min(max((int)p, 0), cells[axis] - 1);
+		if (d[axis] > 0) {
+			step[axis] = 1;
+			tNext[axis] = t0 + (cell[axis] + 1 - p) / d[axis];
+			tDelta[axis] = 1 / d[axis];
+		}
+		else if (d[axis] < 0) {
+			step[axis] = -1;
+			tNext[axis] = t0 + (cell[axis] - p) / d[axis];
+			tDelta[axis] = -1 / d[axis];
+		}
+		else {
+			step[axis] = 0;
+			tNext[axis] = INF;
+			tDelta[axis] = INF;
+		}
+	}
+
+	float t = t0;
+	while (t < t1) {
+		int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		float tExit = fmin(tNext[axis], t1);
+
+		float majorant = majorants[(size_t(cell[2]) * cells[1] + cell[1]) * cells[0] + cell[0]];
+		if (!visit(t, tExit, majorant)) return;
+
+		t = tExit;
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= cells[axis]) return;
+		tNext[axis] += tDelta[axis];
+	}
+}
+
+bool GridMedium::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	RTNW_STATS_PRIMITIVE(StatsGridMedium);
+
+	float t0, t1;
+	if (!clipToBounds(ray, tMin, tMax, t0, t1)) return false;
+
+	const float rayLength = ray.direction().length();
+	bool scattered = false;
+	float tHit = 0;
+
+	// Delta tracking; the exponential distribution is memoryless, so sampling
+	// can restart at every cell boundary with that cell's majorant.
+	traverseMajorants(ray, t0, t1, [&](float tEnter, float tExit, float majorant) {
+		if (majorant <= 0) return true;
+
+		float t = tEnter;
+		while (true) {
+			t -= fastLog(1 - random_float()) / (majorant * rayLength);
+			if (t >= tExit) return true;
+
+			if (random_float() * majorant < density(ray.at(t))) {
+				scattered = true;
+				tHit = t;
+				return false;
+			}
+			RTNW_STATS_INC(mediumNullCollisions);
+		}
+	});
+
+	if (!scattered) return false;
+
+	RTNW_STATS_INC(mediumScatterEvents);
+
+	hitRecord.t = tHit;
+	hitRecord.p = ray.at(tHit);
+	hitRecord.normal = Vec3(1, 0, 0);  // arbitrary
+	hitRecord.frontFace = true;     // also arbitrary
+	hitRecord.materialPtr = phase_function;
+	hitRecord.u = hitRecord.v = 0;
+	return true;
+}
+
+float GridMedium::transmittance(const Ray& ray, float tMin, float tMax) const {
+	float t0, t1;
+	if (!clipToBounds(ray, tMin, tMax, t0, t1)) return 1;
+
+	const float rayLength = ray.direction().length();
+	float result = 1;
+
+	// Ratio tracking: every tentative collision scales the estimate by the null-collision probability.
+	traverseMajorants(ray, t0, t1, [&](float tEnter, float tExit, float majorant) {
+		if (majorant <= 0) return true;
+
+		float t = tEnter;
+		while (true) {
+			t -= fastLog(1 - random_float()) / (majorant * rayLength);
+			if (t >= tExit) return true;
+
+			result *= 1 - density(ray.at(t)) / majorant;
+			if (result <= 0) return false;
+		}
+	});
+
+	return result > 0 ? result : 0;
+}
+
+// ----------------------------------------
+
+// Grid media whose shadows are weighed by transmittance(). Only media placed
+// directly in the world, in lists and BVHs, are collected; one under a
+// transform keeps testing shadow rays for a collision, so it should not also
+// be placed directly.
+class ShadowMedia {
+public:
+	// Gather the grid media of world and have them let shadow rays through.
+	void collect(const HittableList& world);
+
+	bool empty() const { return media.empty(); }
+
+	// Product of the media's transmittance along ray in [tMin, tMax].
+	float transmittance(const Ray& ray, float tMin, float tMax) const {
+		float result = 1;
+		for (const GridMedium* medium : media) {
+			result *= medium->transmittance(ray, tMin, tMax);
+			if (result <= 0) return 0;
+		}
+		return result;
+	}
+
+private:
+	void collect(const shared_ptr<Hittable>& object);
+
+	vector<const GridMedium*> media;
+};
+
+void ShadowMedia::collect(const HittableList& world) {
+	media.clear();
+	for (const shared_ptr<Hittable>& object : world.objects) collect(object);
+}
+
+void ShadowMedia::collect(const shared_ptr<Hittable>& object) {
+	switch (object->kind) {
+	case HittableListKind:
+		for (const shared_ptr<Hittable>& child : static_cast<const HittableList&>(*object).objects) collect(child);
+		break;
+	case HittableBVHNode: {
+		vector<shared_ptr<Hittable>> primitives;
+		static_cast<const BVHNode&>(*object).collectPrimitives(primitives);
+		for (const shared_ptr<Hittable>& primitive : primitives) collect(primitive);
+		break;
+	}
+	case HittableGridMedium: {
+		GridMedium& medium = static_cast<GridMedium&>(*object);
+		medium.weighShadows(true);
+		media.push_back(&medium);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// Grid media of the scene being rendered; whoever loads the scene collects
+// them before rendering, as main does.
+inline ShadowMedia& sceneShadowMedia() {
+	static ShadowMedia media;
+	return media;
+}
+
+#endif // !GRID_MEDIUM_H
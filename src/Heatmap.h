@@ -0,0 +1,94 @@
+#pragma once
+
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+// False-color visualization of traversal cost: instead of shading, every pixel
+// shows how many BVH nodes or primitive intersection tests its rays needed.
+// The counts come from the render statistics, so the mode is only available
+// in builds with RTNW_ENABLE_STATS.
+
+#include "RTNW.h"
+#include "Color.h"
+#include "Render.h"
+#include "Stats.h"
+
+#include <vector>
+
+enum HeatmapMetric {
+	HeatmapNodes,      // BVH nodes visited
+	HeatmapPrimitives  // leaf primitive intersection tests
+};
+
+// Maps t in [0, 1] to a blue -> cyan -> green -> yellow -> red ramp.
+inline Color heatmapColor(float t) {
+	static const Color stops[] = {
+		Color(0.0, 0.0, 0.3),
+		Color(0.0, 0.3, 1.0),
+		Color(0.0, 0.9, 0.9),
+		Color(0.1, 0.9, 0.1),
+		Color(1.0, 0.9, 0.0),
+		Color(1.0, 0.1, 0.0)
+	};
+	const int segments = sizeof(stops) / sizeof(stops[0]) - 1;
+
+	t = clamp(t, 0, 1) * segments;
+	int index = (int)t;
+	if (index >= segments) return stops[segments];
+	float f = t - index;
+	return (1 - f) * stops[index] + f * stops[index + 1];
+}
+
+#ifdef RTNW_ENABLE_STATS
+
+inline long long traversalCount(HeatmapMetric metric) {
+	const RenderStats& stats = localStats();
+	if (metric == HeatmapNodes) return stats.bvhNodesVisited;
+
+	// Box and ConstantMedium only forward to their rects/boundary, which are counted themselves.
+	return stats.primitiveTests[StatsSphere] + stats.primitiveTests[StatsMovingSphere]
+		+ stats.primitiveTests[StatsXYRect] + stats.primitiveTests[StatsYZRect] + stats.primitiveTests[StatsXZRect]
+		+ stats.primitiveTests[StatsGridMedium];
+}
+
+// Average traversal cost per camera sample through pixel (w, h). With allBounces
+// the whole path is counted, otherwise only the closest-hit query of the camera ray.
+float heatmapPixel(const Camera& camera, const Hittable& world, const Color& backgroundColor,
+	int w, int h, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth,
+	HeatmapMetric metric, bool allBounces) {
+	long long before = traversalCount(metric);
+	Sampler& sampler = threadSampler();
+	for (int ii = 0; ii < samplesPerPixel; ii++) {
+		sampler.startPixelSample(w, h, ii);
+		Sample2D jitter = sampler.get2D();
+		float v = 1 - (h + jitter.y) / (imageHeight - 1.0);
+		float u = (w + jitter.x) / (imageWidth - 1.0);
+
+		Ray ray = camera.getRay(u, v);
+		if (allBounces) {
+			rayColor(ray, backgroundColor, world, maxDepth);
+		}
+		else {
+			SurfaceHit surfaceHit;
+			dispatchIntersect(world, ray, 0.001, INF, surfaceHit);
+		}
+	}
+	return float(traversalCount(metric) - before) / samplesPerPixel;
+}
+
+// Convert per-pixel costs to colors. maxCost <= 0 scales to the most expensive pixel.
+void heatmapToColors(const vector<float>& costs, float maxCost, vector<Color>& pixels) {
+	if (maxCost <= 0) {
+		for (float cost : costs) maxCost = fmax(maxCost, cost);
+		if (maxCost <= 0) maxCost = 1;
+	}
+
+	pixels.resize(costs.size());
+	for (size_t ii = 0; ii < costs.size(); ii++) {
+		pixels[ii] = heatmapColor(costs[ii] / maxCost);
+	}
+}
+
+#endif // RTNW_ENABLE_STATS
+
+#endif // !HEATMAP_H
@@ -17,29 +17,235 @@ typedef struct HitRecord {
 	float v; // Texturee Coordinate
 } HitRecord;
 
+// Deepest nesting of Translate/RotateY around a primitive that intersect() supports.
+const int maxHitTransforms = 8;
+
+// Closest hit found by Hittable::intersect(). Traversal only keeps what it
+// needs to compare hits and to shade the winner later: t, the primitive, the
+// primitive's local hit coordinates and the transforms (innermost first)
+// between the primitive and the object intersect() was called on. The
+// HitRecord, with its point, normal, texture coordinates and material, is
+// then made once, for the closest hit only, by resolveHit().
+struct SurfaceHit {
+	float t = INF;
+	const Hittable* primitive = nullptr;
+	float local[2] = { 0, 0 }; // meaning depends on the primitive
+	const Hittable* transforms[maxHitTransforms];
+	int transformCount = 0;
+	bool resolved = false; // record already holds the primitive's hit; see pushHitTransform()
+
+	// Types without their own intersect() fill this record in hit() and leave
+	// resolve() a no-op. Set it to the record resolveHit() will write.
+	HitRecord* record = nullptr;
+};
+
+// Part [tEnter, tExit] of a ray that lies inside a solid.
+struct HitInterval {
+	float tEnter;
+	float tExit;
+};
+
+// Sort intervals by entry and merge the overlapping ones. Returns the new count.
+inline int mergeIntervals(HitInterval* intervals, int count) {
+	for (int ii = 1; ii < count; ii++) {
+		HitInterval key = intervals[ii];
+		int jj = ii - 1;
+		while (jj >= 0 && intervals[jj].tEnter > key.tEnter) {
+			intervals[jj + 1] = intervals[jj];
+			jj--;
+		}
+		intervals[jj + 1] = key;
+	}
+
+	int merged = 0;
+	for (int ii = 0; ii < count; ii++) {
+		if (merged > 0 && intervals[ii].tEnter <= intervals[merged - 1].tExit) {
+			intervals[merged - 1].tExit = fmax(intervals[merged - 1].tExit, intervals[ii].tExit);
+		}
+		else {
+			intervals[merged++] = intervals[ii];
+		}
+	}
+	return merged;
+}
+
+// Clip [tEnter, tExit] to [tMin, tMax] and append it if something is left.
+inline int appendInterval(float tEnter, float tExit, float tMin, float tMax, HitInterval* intervals, int count, int maxIntervals) {
+	if (tEnter < tMin) tEnter = tMin;
+	if (tExit > tMax) tExit = tMax;
+	if (tEnter >= tExit || count >= maxIntervals) return count;
+	intervals[count] = HitInterval{ tEnter, tExit };
+	return count + 1;
+}
+
 inline void setNormal(HitRecord& hitRecord, const Ray& ray, const Vec3& outwardNormal) {
 	hitRecord.frontFace = dot(ray.direction(), outwardNormal) > 0 ? false : true;
 	hitRecord.normal = hitRecord.frontFace ? outwardNormal : -1 * outwardNormal;
 }
 
+// Concrete Hittable types known to the static dispatch path (see Dispatch.h).
+// Classes defined outside the renderer keep HittableUser and are called through the vtable.
+enum HittableKind {
+	HittableUser,
+	HittableSphere,
+	HittableMovingSphere,
+	HittableXYRect,
+	HittableYZRect,
+	HittableXZRect,
+	HittableBox,
+	HittableConstantMedium,
+	HittableGridMedium,
+	HittableListKind,
+	HittableBVHNode,
+	HittableMotionBVHNode,
+	HittableTranslate,
+	HittableRotateY,
+	HittableQuantizedBVH,
+	HittableOutOfCoreSpheres,
+	HittableSphereChunk,
+	HittableInstance
+};
+
 class Hittable {
 public:
+	explicit Hittable(HittableKind k = HittableUser) : kind(k) {}
+
 	// Find the closest intersection between a ray and surface and write to hitRecord, 
 	// eliminate the intersection if it's out of [tMin, tMax]
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const = 0;
 
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const = 0;
+
+	// Write the parts of the ray inside the object, clipped to [tMin, tMax], as
+	// sorted, disjoint intervals; at most maxIntervals of them. Returns the count.
+	// Only t values are computed: no normals, texture coordinates or materials.
+	// The default traces the closest entry and the following exit with hit(),
+	// which is only right for convex objects; built-in solids override it.
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const;
+
+	// Is there any intersection in [tMin, tMax]? Stops at the first one found and
+	// computes no hit attributes, which is all shadow and visibility rays need.
+	// The default falls back to hit(); built-in types override it.
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const;
+
+	// Same search as hit(), but only fills surfaceHit, and only when the hit
+	// is closer than what it holds; tMax must not exceed surfaceHit.t. Built-in
+	// types override it; the default calls hit() into surfaceHit.record.
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const;
+
+	// Fill hitRecord for surfaceHit, found by this object's intersect() with ray.
+	// Called on the primitive (level 0) or on the transform at
+	// surfaceHit.transforms[level]; level transforms remain below it. The
+	// default leaves hitRecord as hit() filled it.
+	virtual void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const {}
+
+	HittableKind kind;
 };
 
+int Hittable::intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const {
+	HitRecord rec1, rec2;
+	if (!hit(ray, -INF, INF, rec1)) return 0;
+	if (!hit(ray, rec1.t + 0.0001, INF, rec2)) return 0;
+	return appendInterval(rec1.t, rec2.t, tMin, tMax, out, 0, maxIntervals);
+}
+
+bool Hittable::occluded(const Ray& ray, float tMin, float tMax) const {
+	HitRecord hitRecord;
+	return hit(ray, tMin, tMax, hitRecord);
+}
+
+#ifdef RTNW_STATIC_DISPATCH
+// Same as obj.hit(), but the built-in types are called directly so the compiler
+// can inline them. Defined in Dispatch.h.
+bool dispatchHit(const Hittable& obj, const Ray& ray, float tMin, float tMax, HitRecord& hitRecord);
+bool dispatchOccluded(const Hittable& obj, const Ray& ray, float tMin, float tMax);
+bool dispatchIntersect(const Hittable& obj, const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit);
+void dispatchResolve(const Hittable& obj, const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord);
+#else
+inline bool dispatchHit(const Hittable& obj, const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) {
+	return obj.hit(ray, tMin, tMax, hitRecord);
+}
+inline bool dispatchOccluded(const Hittable& obj, const Ray& ray, float tMin, float tMax) {
+	return obj.occluded(ray, tMin, tMax);
+}
+inline bool dispatchIntersect(const Hittable& obj, const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) {
+	return obj.intersect(ray, tMin, tMax, surfaceHit);
+}
+inline void dispatchResolve(const Hittable& obj, const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) {
+	obj.resolve(ray, surfaceHit, level, hitRecord);
+}
+#endif
+
+bool Hittable::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	HitRecord scratch;
+	HitRecord& hitRecord = surfaceHit.record ? *surfaceHit.record : scratch;
+	if (!hit(ray, tMin, tMax, hitRecord)) return false;
+	surfaceHit.t = hitRecord.t;
+	surfaceHit.primitive = this;
+	surfaceHit.transformCount = 0;
+	surfaceHit.resolved = false;
+	return true;
+}
+
+// Record a hit on primitive at t; the caller has checked t against the range.
+inline void setSurfaceHit(SurfaceHit& surfaceHit, const Hittable* primitive, float t, float local0 = 0, float local1 = 0) {
+	surfaceHit.t = t;
+	surfaceHit.primitive = primitive;
+	surfaceHit.local[0] = local0;
+	surfaceHit.local[1] = local1;
+	surfaceHit.transformCount = 0;
+	surfaceHit.resolved = false;
+}
+
+// Add transform around the hit its child just recorded, for a ray that
+// reached transform as ray. Nested deeper than maxHitTransforms, the hit is
+// resolved into the record at once instead, as hit() would, and transform
+// stands for it as an already resolved primitive.
+inline void pushHitTransform(SurfaceHit& surfaceHit, const Hittable* transform, const Ray& ray) {
+	if (surfaceHit.transformCount < maxHitTransforms) {
+		surfaceHit.transforms[surfaceHit.transformCount++] = transform;
+		return;
+	}
+	HitRecord scratch;
+	dispatchResolve(*transform, ray, surfaceHit, maxHitTransforms, surfaceHit.record ? *surfaceHit.record : scratch);
+	surfaceHit.primitive = transform;
+	surfaceHit.transformCount = 0;
+	surfaceHit.resolved = true;
+}
+
+// Fill hitRecord for the hit found by intersect(ray, ...), applying the
+// transforms below level, outermost first, and then the primitive.
+inline void resolveHit(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) {
+	if (level > 0) dispatchResolve(*surfaceHit.transforms[level - 1], ray, surfaceHit, level - 1, hitRecord);
+	else if (!surfaceHit.resolved) dispatchResolve(*surfaceHit.primitive, ray, surfaceHit, 0, hitRecord);
+}
+
+inline void resolveHit(const Ray& ray, const SurfaceHit& surfaceHit, HitRecord& hitRecord) {
+	resolveHit(ray, surfaceHit, surfaceHit.transformCount, hitRecord);
+}
+
 // ----------------------------------------
 
-class Translate : public Hittable {
+class Translate final : public Hittable {
 public:
-	Translate(shared_ptr<Hittable> ptr, Vec3 t) : obj(ptr), offset(t) {}
+	Translate(shared_ptr<Hittable> ptr, Vec3 t) : Hittable(HittableTranslate), obj(ptr), offset(t) {}
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override;
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return obj->intervals(Ray(ray.origin() - offset, ray.direction(), ray.time()), tMin, tMax, out, maxIntervals);
+	}
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override {
+		return dispatchOccluded(*obj, Ray(ray.origin() - offset, ray.direction(), ray.time()), tMin, tMax);
+	}
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override {
+		if (!dispatchIntersect(*obj, Ray(ray.origin() - offset, ray.direction(), ray.time()), tMin, tMax, surfaceHit)) return false;
+		pushHitTransform(surfaceHit, this, ray);
+		return true;
+	}
+	virtual void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override;
 private:
+	friend class SceneCache;
 	shared_ptr<Hittable> obj;
 	Vec3 offset;
 };
@@ -47,10 +253,19 @@ private:
 bool Translate::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
 	Ray translated_ray = Ray(ray.origin() - offset, ray.direction(), ray.time());
 
-	if (!obj->hit(translated_ray, tMin, tMax, hitRecord)) {
+	if (!dispatchHit(*obj, translated_ray, tMin, tMax, hitRecord)) {
 		return false;
 	}
 
+	hitRecord.p += offset;
+	setNormal(hitRecord, translated_ray, hitRecord.normal);
+	return true;
+}
+
+void Translate::resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const {
+	Ray translated_ray = Ray(ray.origin() - offset, ray.direction(), ray.time());
+	resolveHit(translated_ray, surfaceHit, level, hitRecord);
+
 	hitRecord.p += offset;
 	setNormal(hitRecord, translated_ray, hitRecord.normal);
 }
@@ -69,20 +284,40 @@ bool Translate::boundingBox(float time0, float time1, AABB& bbox) const {
 
 // ----------------------------------------
 
-class RotateY : public Hittable {
+class RotateY final : public Hittable {
 public:
 	RotateY(shared_ptr<Hittable> ptr, float angle);
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override;
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return obj->intervals(inverseRotate(ray), tMin, tMax, out, maxIntervals);
+	}
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override {
+		return dispatchOccluded(*obj, inverseRotate(ray), tMin, tMax);
+	}
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override {
+		if (!dispatchIntersect(*obj, inverseRotate(ray), tMin, tMax, surfaceHit)) return false;
+		pushHitTransform(surfaceHit, this, ray);
+		return true;
+	}
+	virtual void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override;
 private:
+	friend class SceneCache;
+
+	// Ray in the object space of obj.
+	Ray inverseRotate(const Ray& ray) const;
+
+	// Rotate the point and normal of hitRecord from the object space of obj.
+	void rotateHit(const Ray& rotated_ray, HitRecord& hitRecord) const;
+
 	shared_ptr<Hittable> obj;
 	float cos_theta, sin_theta;
 	bool hasBox;
 	AABB bbox;
 };
 
-RotateY::RotateY(shared_ptr<Hittable> ptr, float angle) : obj (ptr) {
+RotateY::RotateY(shared_ptr<Hittable> ptr, float angle) : Hittable(HittableRotateY), obj (ptr) {
 	float radians = degrees2radian(angle);
 	cos_theta = cosf(radians);
 	sin_theta = sinf(radians);
@@ -114,7 +349,7 @@ RotateY::RotateY(shared_ptr<Hittable> ptr, float angle) : obj (ptr) {
 	bbox = AABB(pMin, pMax);
 }
 
-bool RotateY::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+Ray RotateY::inverseRotate(const Ray& ray) const {
 	Point3 origin = ray.origin();
 	Vec3 direction = ray.direction();
 
@@ -125,11 +360,26 @@ bool RotateY::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord)
 	direction[0] = cos_theta * ray.direction()[0] - sin_theta * ray.direction()[2];
 	direction[2] = sin_theta * ray.direction()[0] + cos_theta * ray.direction()[2];
 
-	Ray rotated_ray = Ray(origin, direction, ray.time());
+	return Ray(origin, direction, ray.time());
+}
+
+bool RotateY::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	Ray rotated_ray = inverseRotate(ray);
 
-	if (!obj->hit(rotated_ray, tMin, tMax, hitRecord))
+	if (!dispatchHit(*obj, rotated_ray, tMin, tMax, hitRecord))
 		return false;
 
+	rotateHit(rotated_ray, hitRecord);
+	return true;
+}
+
+void RotateY::resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const {
+	Ray rotated_ray = inverseRotate(ray);
+	resolveHit(rotated_ray, surfaceHit, level, hitRecord);
+	rotateHit(rotated_ray, hitRecord);
+}
+
+void RotateY::rotateHit(const Ray& rotated_ray, HitRecord& hitRecord) const {
 	Point3 p = hitRecord.p;
 	Vec3 normal = hitRecord.normal;
 
@@ -142,8 +392,6 @@ bool RotateY::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord)
 
 	hitRecord.p = p;
 	setNormal(hitRecord, rotated_ray, normal);
-
-	return true;
 }
 
 bool RotateY::boundingBox(float time0, float time1, AABB& o_bbox) const {
@@ -9,16 +9,19 @@
 
 using namespace std;
 
-class HittableList : public Hittable {
+class HittableList final : public Hittable {
 public:
-	HittableList (){}
-	HittableList(shared_ptr<Hittable> object) { objects.push_back(object); }
+	HittableList() : Hittable(HittableListKind) {}
+	HittableList(shared_ptr<Hittable> object) : Hittable(HittableListKind) { objects.push_back(object); }
 
 	void add(shared_ptr<Hittable> object) { objects.push_back(object); }
 	void clear() { objects.clear(); }
 
 	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
 	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override;
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override;
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
 
 	vector<shared_ptr<Hittable>> objects;
 };
@@ -29,7 +32,7 @@ bool HittableList::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRec
 	float tClosest = tMax;
 
 	for (const shared_ptr<Hittable>& obj : objects) {
-		if (obj->hit(ray, tMin, tClosest, tmp)) {
+		if (dispatchHit(*obj, ray, tMin, tClosest, tmp)) {
 			hitAnything = true;
 			tClosest = tmp.t;
 			hitRecord = tmp;
@@ -39,6 +42,29 @@ bool HittableList::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRec
 	return hitAnything;
 }
 
+bool HittableList::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	bool hitAnything = false;
+	for (const shared_ptr<Hittable>& obj : objects) {
+		if (dispatchIntersect(*obj, ray, tMin, hitAnything ? surfaceHit.t : tMax, surfaceHit)) hitAnything = true;
+	}
+	return hitAnything;
+}
+
+bool HittableList::occluded(const Ray& ray, float tMin, float tMax) const {
+	for (const shared_ptr<Hittable>& obj : objects) {
+		if (dispatchOccluded(*obj, ray, tMin, tMax)) return true;
+	}
+	return false;
+}
+
+int HittableList::intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const {
+	int count = 0;
+	for (const shared_ptr<Hittable>& obj : objects) {
+		count += obj->intervals(ray, tMin, tMax, out + count, maxIntervals - count);
+	}
+	return mergeIntervals(out, count);
+}
+
 bool HittableList::boundingBox(float time0, float time1, AABB& bbox) const {
 	if (objects.empty()) return false;
 
@@ -0,0 +1,210 @@
+#pragma once
+
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+// Instancing: one piece of geometry placed many times.
+//
+// An Instance refers to shared geometry, typically a BVH built once over an
+// asset (the bottom level), and places it with an affine transform and an
+// optional material that replaces the asset's own. A BVH over the instances
+// (the top level, e.g. from buildSceneBVH()) completes the two-level
+// structure. An instance costs the same few dozen bytes whatever it places,
+// so a million instances of an asset with a thousand primitives cost little
+// more than the asset and a million instances of a single sphere.
+//
+// Rays are carried into the asset's space without normalizing the direction,
+// so t is the same in both spaces and hits need no conversion of their range.
+
+#include "RTNW.h"
+#include "Hittable.h"
+#include "AABB.h"
+
+// Map x -> linear * x + translation, stored as a 3x4 row-major matrix.
+class Affine {
+public:
+	Affine() : m{ { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } {}
+
+	static Affine translation(const Vec3& offset);
+	static Affine scaling(float factor) { return scaling(Vec3(factor, factor, factor)); }
+	static Affine scaling(const Vec3& factors);
+	// Rotation by degrees around axis, counterclockwise looking down the axis.
+	static Affine rotation(const Vec3& axis, float degrees);
+
+	// Apply other first, then this.
+	Affine operator*(const Affine& other) const;
+
+	Point3 point(const Point3& p) const {
+		return Point3(row(0, p) + m[0][3], row(1, p) + m[1][3], row(2, p) + m[2][3]);
+	}
+	Vec3 vector(const Vec3& v) const { return Vec3(row(0, v), row(1, v), row(2, v)); }
+
+	// The linear part transposed times v; normals transform with the transposed inverse.
+	Vec3 transposedVector(const Vec3& v) const {
+		return Vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+			m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+			m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+	}
+
+	// Inverse map; the linear part must not be singular.
+	Affine inverse() const;
+
+	// Box around the image of box.
+	AABB bounds(const AABB& box) const;
+
+	float m[3][4];
+
+private:
+	float row(int ii, const Vec3& v) const { return m[ii][0] * v[0] + m[ii][1] * v[1] + m[ii][2] * v[2]; }
+};
+
+Affine Affine::translation(const Vec3& offset) {
+	Affine result;
+	for (int ii = 0; ii < 3; ii++) result.m[ii][3] = offset[ii];
+	return result;
+}
+
+Affine Affine::scaling(const Vec3& factors) {
+	Affine result;
+	for (int ii = 0; ii < 3; ii++) result.m[ii][ii] = factors[ii];
+	return result;
+}
+
+Affine Affine::rotation(const Vec3& axis, float degrees) {
+	Vec3 a = unitVector(axis);
+	float radians = degrees2radian(degrees);
+	float c = cosf(radians), s = sinf(radians), t = 1 - c;
+
+	Affine result;
+	result.m[0][0] = t * a[0] * a[0] + c;
+	result.m[0][1] = t * a[0] * a[1] - s * a[2];
+	result.m[0][2] = t * a[0] * a[2] + s * a[1];
+	result.m[1][0] = t * a[0] * a[1] + s * a[2];
+	result.m[1][1] = t * a[1] * a[1] + c;
+	result.m[1][2] = t * a[1] * a[2] - s * a[0];
+	result.m[2][0] = t * a[0] * a[2] - s * a[1];
+	result.m[2][1] = t * a[1] * a[2] + s * a[0];
+	result.m[2][2] = t * a[2] * a[2] + c;
+	return result;
+}
+
+Affine Affine::operator*(const Affine& other) const {
+	Affine result;
+	for (int ii = 0; ii < 3; ii++) {
+		for (int jj = 0; jj < 4; jj++) {
+			result.m[ii][jj] = m[ii][0] * other.m[0][jj] + m[ii][1] * other.m[1][jj] + m[ii][2] * other.m[2][jj];
+		}
+		result.m[ii][3] += m[ii][3];
+	}
+	return result;
+}
+
+Affine Affine::inverse() const {
+	// Adjugate over determinant for the linear part, then undo the translation.
+	float cof[3][3];
+	for (int ii = 0; ii < 3; ii++) {
+		for (int jj = 0; jj < 3; jj++) {
+			int r0 = (jj + 1) % 3, r1 = (jj + 2) % 3;
+			int c0 = (ii + 1) % 3, c1 = (ii + 2) % 3;
+			cof[ii][jj] = m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0];
+		}
+	}
+	float det = m[0][0] * cof[0][0] + m[0][1] * cof[1][0] + m[0][2] * cof[2][0];
+
+	Affine result;
+	for (int ii = 0; ii < 3; ii++)
+		for (int jj = 0; jj < 3; jj++)
+			result.m[ii][jj] = cof[ii][jj] / det;
+	Vec3 offset = result.vector(Vec3(m[0][3], m[1][3], m[2][3]));
+	for (int ii = 0; ii < 3; ii++) result.m[ii][3] = -offset[ii];
+	return result;
+}
+
+AABB Affine::bounds(const AABB& box) const {
+	// Per axis, the extremes come from picking the smaller or larger end
+	// of the box for each matrix entry.
+	Point3 lo, hi;
+	for (int ii = 0; ii < 3; ii++) {
+		lo[ii] = hi[ii] = m[ii][3];
+		for (int jj = 0; jj < 3; jj++) {
+			float a = m[ii][jj] * box.min()[jj];
+			float b = m[ii][jj] * box.max()[jj];
+			lo[ii] += fmin(a, b);
+			hi[ii] += fmax(a, b);
+		}
+	}
+	return AABB(lo, hi);
+}
+
+// ----------------------------------------
+
+class Instance final : public Hittable {
+public:
+	// Place geometry with toWorld. A non-null material replaces the materials of
+	// every surface of the geometry. Like arena objects, the instance does not
+	// own the geometry: it has to outlive every instance of it.
+	Instance(shared_ptr<Hittable> geometry, const Affine& toWorld, shared_ptr<Material> material = nullptr);
+
+	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override {
+		return dispatchOccluded(*geometry, toLocal(ray), tMin, tMax);
+	}
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return geometry->intervals(toLocal(ray), tMin, tMax, out, maxIntervals);
+	}
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override {
+		if (!dispatchIntersect(*geometry, toLocal(ray), tMin, tMax, surfaceHit)) return false;
+		pushHitTransform(surfaceHit, this, ray);
+		return true;
+	}
+	virtual void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override;
+
+	virtual bool boundingBox(float time0, float time1, AABB& outBBox) const override {
+		outBBox = bbox;
+		return hasBox;
+	}
+
+private:
+	friend class SceneCache;
+
+	Ray toLocal(const Ray& ray) const {
+		return Ray(worldToLocal.point(ray.origin()), worldToLocal.vector(ray.direction()), ray.time());
+	}
+
+	// Move a hit found with toLocal(ray) back to world space.
+	void toWorld(const Ray& ray, HitRecord& hitRecord) const;
+
+	shared_ptr<Hittable> geometry;
+	shared_ptr<Material> material;
+	Affine worldToLocal;
+	AABB bbox;
+	bool hasBox;
+};
+
+Instance::Instance(shared_ptr<Hittable> g, const Affine& toWorld, shared_ptr<Material> mat)
+	: Hittable(HittableInstance), geometry(g), material(mat), worldToLocal(toWorld.inverse()) {
+	AABB localBox;
+	hasBox = geometry->boundingBox(0, 1, localBox);
+	if (hasBox) bbox = toWorld.bounds(localBox);
+}
+
+bool Instance::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	if (!dispatchHit(*geometry, toLocal(ray), tMin, tMax, hitRecord)) return false;
+	toWorld(ray, hitRecord);
+	return true;
+}
+
+void Instance::resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const {
+	resolveHit(toLocal(ray), surfaceHit, level, hitRecord);
+	toWorld(ray, hitRecord);
+}
+
+void Instance::toWorld(const Ray& ray, HitRecord& hitRecord) const {
+	// t is shared by both spaces. The normal keeps its side: the transposed
+	// inverse preserves dot(normal, direction).
+	hitRecord.p = ray.at(hitRecord.t);
+	hitRecord.normal = unitVector(worldToLocal.transposedVector(hitRecord.normal));
+	if (material) hitRecord.materialPtr = material;
+}
+
+#endif // !INSTANCE_H
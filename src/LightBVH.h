@@ -0,0 +1,581 @@
+#pragma once
+
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+// Light hierarchy for next-event estimation (Conty Estevez and Kulla,
+// "Importance Sampling of Many Lights with Adaptive Tree Splitting", 2018).
+//
+// The emitters of a scene, spheres and rectangles with a DiffuseLight, are
+// kept in a binary tree. Every node bounds its emitters: a box, their total
+// power and a cone around the directions they face. sample() walks down from
+// the root and picks a child in proportion to a conservative estimate of
+// what its emitters can deliver to the shading point, so a light is found in
+// time logarithmic in their number, and near, bright, facing lights are
+// picked most.
+
+#include "RTNW.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "BVHNode.h"
+#include "Sphere.h"
+#include "AARect.h"
+#include "Material.h"
+#include "Sampling.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+// What the emitters under a light tree node look like from afar.
+struct LightBounds {
+	AABB box;
+	Vec3 axis = Vec3(0, 0, 1); // unit; the emitters face within acos(cosTheta) of it
+	float cosTheta = 1;        // -1: any direction
+	bool twoSided = false;     // they also face within acos(cosTheta) of -axis
+	float power = 0;
+
+	// Upper bound, up to a common factor, of the light the emitters send to a
+	// surface at p that takes light from the side normal faces. Zero only when
+	// none of it can arrive.
+	float importance(const Point3& p, const Vec3& normal) const;
+};
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of the angles.
+inline float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+	return cosA > cosB ? 1 : cosA * cosB + sinA * sinB;
+}
+
+inline float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+	return cosA > cosB ? 0 : sinA * cosB - cosA * sinB;
+}
+
+float LightBounds::importance(const Point3& p, const Vec3& normal) const {
+	Point3 center = 0.5 * (box.min() + box.max());
+	Vec3 toPoint = p - center;
+	float distance2 = toPoint.length2();
+	float radius2 = (box.max() - box.min()).length2() / 4;
+	Vec3 wi = distance2 > 0 ? toPoint / sqrtf(distance2) : axis;
+
+	// Angle between the axis and the point, less the cone's spread, less the
+	// angle the box's bounding sphere covers seen from p.
+	float cosW = dot(axis, wi);
+	if (twoSided) cosW = fabsf(cosW);
+	float sinW = sqrtf(fmax(0.0f, 1 - cosW * cosW));
+	float sinO = sqrtf(fmax(0.0f, 1 - cosTheta * cosTheta));
+	float cosB = -1, sinB = 0;
+	if (distance2 > radius2) {
+		float sin2B = radius2 / distance2;
+		cosB = sqrtf(1 - sin2B);
+		sinB = sqrtf(sin2B);
+	}
+	float cosX = cosSubClamped(sinW, cosW, sinO, cosTheta);
+	float sinX = sinSubClamped(sinW, cosW, sinO, cosTheta);
+	float cosP = cosSubClamped(sinX, cosX, sinB, cosB);
+	// Diffuse emitters send nothing along their surface or behind it.
+	if (cosP <= 0) return 0;
+
+	// Same at the receiver, whose normal has to face the emitters.
+	float cosI = -dot(wi, normal);
+	float sinI = sqrtf(fmax(0.0f, 1 - cosI * cosI));
+	float cosIP = cosSubClamped(sinI, cosI, sinB, cosB);
+	if (cosIP <= 0) return 0;
+
+	// Within the bounding sphere the distance is that of its surface, so
+	// close nodes do not take every sample.
+	return power * cosP * cosIP / fmax(distance2, radius2);
+}
+
+// Cone holding the cones (wa, cosA) and (wb, cosB).
+inline void uniteCones(const Vec3& wa, float cosA, const Vec3& wb, float cosB, Vec3& w, float& cosTheta) {
+	w = wa;
+	cosTheta = -1;
+	if (cosA <= -1 || cosB <= -1) return;
+
+	float thetaA = acosf(fmin(cosA, 1.0f));
+	float thetaB = acosf(fmin(cosB, 1.0f));
+	float thetaD = acosf(fmax(-1.0f, fmin(dot(wa, wb), 1.0f)));
+	if (fmin(thetaD + thetaB, PI) <= thetaA) {
+		cosTheta = cosA;
+		return;
+	}
+	if (fmin(thetaD + thetaA, PI) <= thetaB) {
+		w = wb;
+		cosTheta = cosB;
+		return;
+	}
+
+	float thetaO = (thetaA + thetaD + thetaB) / 2;
+	Vec3 rotationAxis = cross(wa, wb);
+	if (thetaO >= PI || rotationAxis.length2() == 0) return;
+
+	// Turn wa towards wb until the cone touches both.
+	float thetaR = thetaO - thetaA;
+	w = cosf(thetaR) * wa + sinf(thetaR) * cross(unitVector(rotationAxis), wa);
+	cosTheta = cosf(thetaO);
+}
+
+inline LightBounds uniteBounds(const LightBounds& a, const LightBounds& b) {
+	if (a.power <= 0) return b;
+	if (b.power <= 0) return a;
+
+	LightBounds result;
+	result.box = surroundingBox(a.box, b.box);
+	result.power = a.power + b.power;
+	result.twoSided = a.twoSided || b.twoSided;
+	// Two-sided cones are as good mirrored, so take b's copy on a's side.
+	Vec3 axisB = result.twoSided && dot(a.axis, b.axis) < 0 ? -1 * b.axis : b.axis;
+	uniteCones(a.axis, a.cosTheta, axisB, b.cosTheta, result.axis, result.cosTheta);
+	return result;
+}
+
+// Emitter picked for a shading point by LightBVH::sample().
+struct LightSample {
+	Vec3 direction;  // unit, from the shading point to the emitter
+	float distance;  // along direction
+	Color radiance;  // emitted towards the shading point
+	float pdf;       // solid angle density, the choice of the emitter included
+};
+
+class LightBVH {
+public:
+	// Gather the emitters of world and build the tree over them.
+	void build(const HittableList& world);
+
+	bool empty() const { return nodes.empty(); }
+	size_t lightCount() const { return lights.size(); }
+
+	// Pick an emitter with u and a point on it with uPoint, for a surface at
+	// p that takes light from the side normal faces. False when no emitter
+	// can light it.
+	bool sample(const Point3& p, const Vec3& normal, float time, float u, Sample2D uPoint, LightSample& lightSample) const;
+
+	// Density with which sample(p, normal, ...) gives the direction to the
+	// hit in hitRecord, found from the scene's top level as surfaceHit. Zero
+	// for surfaces sample() never picks.
+	float pdf(const Point3& p, const Vec3& normal, const SurfaceHit& surfaceHit, const HitRecord& hitRecord) const;
+
+	// Whether surfaceHit, found from the scene's top level, is an emitter of
+	// the tree.
+	bool contains(const SurfaceHit& surfaceHit) const {
+		return surfaceHit.transformCount == 0 && lightIndex.count(surfaceHit.primitive) > 0;
+	}
+
+	// Start a photon: an emitter picked by its power with u, a point on it
+	// picked uniformly with uPoint and a cosine-distributed direction out of
+	// it with uDirection. flux is the light the photon carries, the emitted
+	// radiance over the densities of those choices. False when the scene has
+	// no emitters.
+	bool samplePhoton(float u, Sample2D uPoint, Sample2D uDirection, float time, Ray& ray, Color& flux) const;
+
+private:
+	struct Light {
+		const Hittable* shape;
+		LightBounds bounds;
+		float area;
+		int node; // its leaf
+	};
+
+	// Light tree node; the first child directly follows its parent.
+	struct Node {
+		LightBounds bounds;
+		int parent = -1;
+		int secondChild = -1;
+		int light = -1; // leaves only
+	};
+
+	static const int splitBuckets = 12;
+
+	void collect(const Hittable& object);
+	void addLight(const Hittable* shape, const shared_ptr<Material>& material, const AABB& box, const Vec3& axis,
+		float cosTheta, bool twoSided, float area);
+
+	int buildNode(vector<int>& order, size_t start, size_t end, int parent);
+
+	// Cost of a node with bounds in the split heuristic: power times surface
+	// area times the solid angle the emitters can reach.
+	static float splitCost(const LightBounds& bounds);
+
+	// Probability that sample() picks light for p and normal.
+	float pickProbability(const Point3& p, const Vec3& normal, int light) const;
+
+	bool sampleShape(const Light& light, const Point3& p, float time, Sample2D u, LightSample& lightSample) const;
+
+	// Solid angle density of the point sampleShape() takes on light, seen from p.
+	float shapePdf(const Light& light, const Point3& p, const HitRecord& hitRecord) const;
+
+	vector<Light> lights;
+	vector<Node> nodes;
+	unordered_map<const Hittable*, int> lightIndex;
+	vector<float> powerSums; // running sums of the emitters' power, for samplePhoton()
+};
+
+void LightBVH::build(const HittableList& world) {
+	lights.clear();
+	nodes.clear();
+	lightIndex.clear();
+	powerSums.clear();
+	for (const shared_ptr<Hittable>& object : world.objects) collect(*object);
+	if (lights.empty()) return;
+
+	float sum = 0;
+	for (const Light& light : lights) powerSums.push_back(sum += light.bounds.power);
+
+	vector<int> order(lights.size());
+	for (size_t ii = 0; ii < order.size(); ii++) order[ii] = int(ii);
+	nodes.reserve(2 * lights.size() - 1);
+	buildNode(order, 0, order.size(), -1);
+}
+
+void LightBVH::collect(const Hittable& object) {
+	// Only untransformed spheres and rectangles are sampled; emitters under
+	// a transform or of other shapes are still found by the bounces.
+	switch (object.kind) {
+	case HittableListKind:
+		for (const shared_ptr<Hittable>& child : static_cast<const HittableList&>(object).objects) collect(*child);
+		break;
+	case HittableBVHNode: {
+		vector<shared_ptr<Hittable>> primitives;
+		static_cast<const BVHNode&>(object).collectPrimitives(primitives);
+		for (const shared_ptr<Hittable>& primitive : primitives) collect(*primitive);
+		break;
+	}
+	case HittableSphere: {
+		const Sphere& sphere = static_cast<const Sphere&>(object);
+		AABB box;
+		sphere.boundingBox(0, 1, box);
+		addLight(&sphere, sphere.materialPtr, box, Vec3(0, 0, 1), -1, false, 4 * PI * sphere.radius * sphere.radius);
+		break;
+	}
+	case HittableXYRect: {
+		const XYRect& rect = static_cast<const XYRect&>(object);
+		AABB box;
+		rect.boundingBox(0, 1, box);
+		addLight(&rect, rect.mat_ptr, box, Vec3(0, 0, 1), 1, true, (rect.x1 - rect.x0) * (rect.y1 - rect.y0));
+		break;
+	}
+	case HittableYZRect: {
+		const YZRect& rect = static_cast<const YZRect&>(object);
+		AABB box;
+		rect.boundingBox(0, 1, box);
+		addLight(&rect, rect.mat_ptr, box, Vec3(1, 0, 0), 1, true, (rect.y1 - rect.y0) * (rect.z1 - rect.z0));
+		break;
+	}
+	case HittableXZRect: {
+		const XZRect& rect = static_cast<const XZRect&>(object);
+		AABB box;
+		rect.boundingBox(0, 1, box);
+		addLight(&rect, rect.mat_ptr, box, Vec3(0, 1, 0), 1, true, (rect.x1 - rect.x0) * (rect.z1 - rect.z0));
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+void LightBVH::addLight(const Hittable* shape, const shared_ptr<Material>& material, const AABB& box, const Vec3& axis,
+	float cosTheta, bool twoSided, float area) {
+	if (!material || material->kind != MaterialDiffuseLight || area <= 0) return;
+
+	// The emission at the middle stands for the whole emitter; a textured
+	// one is only picked less well, never missed.
+	Point3 center = 0.5 * (box.min() + box.max());
+	Color radiance = dispatchEmitted(*material, 0.5f, 0.5f, center);
+	float brightness = (radiance.x() + radiance.y() + radiance.z()) / 3;
+	if (!(brightness > 0)) return;
+
+	Light light;
+	light.shape = shape;
+	light.area = area;
+	light.bounds.box = box;
+	light.bounds.axis = axis;
+	light.bounds.cosTheta = cosTheta;
+	light.bounds.twoSided = twoSided;
+	light.bounds.power = brightness * area * (twoSided ? 2 : 1);
+	lightIndex[shape] = int(lights.size());
+	lights.push_back(light);
+}
+
+float LightBVH::splitCost(const LightBounds& bounds) {
+	// Solid angle of the cone widened by the pi / 2 diffuse emitters reach
+	// past it (the M_Omega of Conty Estevez and Kulla).
+	float thetaO = acosf(fmax(-1.0f, fmin(bounds.cosTheta, 1.0f)));
+	float thetaW = fmin(thetaO + PI / 2, PI);
+	float sinO = sinf(thetaO);
+	float solidAngle = 2 * PI * (1 - bounds.cosTheta)
+		+ PI / 2 * (2 * thetaW * sinO - cosf(thetaO - 2 * thetaW) - 2 * thetaO * sinO + bounds.cosTheta);
+	if (bounds.twoSided) solidAngle = fmin(2 * solidAngle, 4 * PI);
+	return bounds.power * bounds.box.surfaceArea() * solidAngle;
+}
+
+int LightBVH::buildNode(vector<int>& order, size_t start, size_t end, int parent) {
+	int index = int(nodes.size());
+	nodes.push_back(Node());
+	nodes[index].parent = parent;
+
+	LightBounds bounds;
+	for (size_t ii = start; ii < end; ii++) bounds = uniteBounds(bounds, lights[order[ii]].bounds);
+	nodes[index].bounds = bounds;
+	if (end - start == 1) {
+		nodes[index].light = order[start];
+		lights[order[start]].node = index;
+		return index;
+	}
+
+	// Bucketed split over the emitter centers, on the axis and bucket
+	// boundary of least splitCost(). Long axes are preferred so that the
+	// children do not come out as slabs.
+	Point3 lo(INF, INF, INF), hi(-INF, -INF, -INF);
+	for (size_t ii = start; ii < end; ii++) {
+		const AABB& box = lights[order[ii]].bounds.box;
+		Point3 center = 0.5 * (box.min() + box.max());
+		for (int axis = 0; axis < 3; axis++) {
+			lo[axis] = fmin(lo[axis], center[axis]);
+			hi[axis] = fmax(hi[axis], center[axis]);
+		}
+	}
+	Vec3 boxExtent = bounds.box.max() - bounds.box.min();
+	float maxExtent = fmax(boxExtent.x(), fmax(boxExtent.y(), boxExtent.z()));
+
+	auto bucketOf = [&](int light, int axis) {
+		const AABB& box = lights[light].bounds.box;
+		float center = 0.5f * (box.min()[axis] + box.max()[axis]);
+		return min(splitBuckets - 1, int(splitBuckets * (center - lo[axis]) / (hi[axis] - lo[axis])));
+	};
+
+	float bestCost = INF;
+	int bestAxis = -1, bestBucket = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		if (hi[axis] <= lo[axis]) continue;
+
+		LightBounds buckets[splitBuckets];
+		for (size_t ii = start; ii < end; ii++) {
+			int bucket = bucketOf(order[ii], axis);
+			buckets[bucket] = uniteBounds(buckets[bucket], lights[order[ii]].bounds);
+		}
+
+		float regularization = boxExtent[axis] > 0 ? maxExtent / boxExtent[axis] : 1;
+		for (int split = 1; split < splitBuckets; split++) {
+			LightBounds below, above;
+			for (int bucket = 0; bucket < split; bucket++) below = uniteBounds(below, buckets[bucket]);
+			for (int bucket = split; bucket < splitBuckets; bucket++) above = uniteBounds(above, buckets[bucket]);
+			if (below.power <= 0 || above.power <= 0) continue;
+
+			float cost = regularization * (splitCost(below) + splitCost(above));
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBucket = split;
+			}
+		}
+	}
+
+	size_t mid = (start + end) / 2;
+	if (bestAxis >= 0) {
+		auto below = [&](int light) { return bucketOf(light, bestAxis) < bestBucket; };
+		mid = partition(order.begin() + start, order.begin() + end, below) - order.begin();
+	}
+	if (mid == start || mid == end) mid = (start + end) / 2;
+
+	buildNode(order, start, mid, index);
+	int second = buildNode(order, mid, end, index);
+	nodes[index].secondChild = second;
+	return index;
+}
+
+bool LightBVH::sample(const Point3& p, const Vec3& normal, float time, float u, Sample2D uPoint, LightSample& lightSample) const {
+	if (nodes.empty() || nodes[0].bounds.importance(p, normal) <= 0) return false;
+
+	// Walk down, reusing u for every choice.
+	const float oneMinusEpsilon = 0x1.fffffep-1f;
+	float pmf = 1;
+	int index = 0;
+	while (nodes[index].light < 0) {
+		float first = nodes[index + 1].bounds.importance(p, normal);
+		float second = nodes[nodes[index].secondChild].bounds.importance(p, normal);
+		if (first + second <= 0) return false;
+
+		float pFirst = first / (first + second);
+		if (u < pFirst) {
+			index = index + 1;
+			u = fmin(u / pFirst, oneMinusEpsilon);
+			pmf *= pFirst;
+		}
+		else {
+			index = nodes[index].secondChild;
+			u = fmin((u - pFirst) / (1 - pFirst), oneMinusEpsilon);
+			pmf *= second / (first + second);
+		}
+	}
+
+	if (!sampleShape(lights[nodes[index].light], p, time, uPoint, lightSample)) return false;
+	lightSample.pdf *= pmf;
+	return true;
+}
+
+float LightBVH::pdf(const Point3& p, const Vec3& normal, const SurfaceHit& surfaceHit, const HitRecord& hitRecord) const {
+	// Instances and transforms of an emitter are not sampled, only the
+	// emitter itself.
+	if (surfaceHit.transformCount > 0) return 0;
+	auto found = lightIndex.find(surfaceHit.primitive);
+	if (found == lightIndex.end()) return 0;
+
+	const Light& light = lights[found->second];
+	float pick = pickProbability(p, normal, found->second);
+	return pick > 0 ? pick * shapePdf(light, p, hitRecord) : 0;
+}
+
+float LightBVH::pickProbability(const Point3& p, const Vec3& normal, int light) const {
+	// The choices sample() makes on the way down, taken from the leaf up.
+	if (nodes[0].bounds.importance(p, normal) <= 0) return 0;
+	float pmf = 1;
+	for (int index = lights[light].node; index != 0; index = nodes[index].parent) {
+		const Node& parent = nodes[nodes[index].parent];
+		float first = nodes[nodes[index].parent + 1].bounds.importance(p, normal);
+		float second = nodes[parent.secondChild].bounds.importance(p, normal);
+		if (first + second <= 0) return 0;
+		pmf *= (index == parent.secondChild ? second : first) / (first + second);
+	}
+	return pmf;
+}
+
+bool LightBVH::sampleShape(const Light& light, const Point3& p, float time, Sample2D u, LightSample& lightSample) const {
+	const Hittable& shape = *light.shape;
+	Point3 target;
+
+	switch (shape.kind) {
+	case HittableSphere: {
+		const Sphere& sphere = static_cast<const Sphere&>(shape);
+		Vec3 toCenter = sphere.center - p;
+		float distance2 = toCenter.length2();
+		float radius2 = sphere.radius * sphere.radius;
+		if (distance2 > radius2) {
+			// Uniform over the cone the sphere fills, seen from p.
+			float sin2Max = radius2 / distance2;
+			float oneMinusCosMax = sin2Max / (1 + sqrtf(1 - sin2Max));
+			target = p + Frame(toCenter / sqrtf(distance2)).toWorld(sampleUniformConeGap(u, oneMinusCosMax));
+		}
+		else {
+			// From inside, every point of the sphere is in sight.
+			target = sphere.center + sphere.radius * sampleUniformSphere(u);
+		}
+		break;
+	}
+	case HittableXYRect: {
+		const XYRect& rect = static_cast<const XYRect&>(shape);
+		target = Point3(rect.x0 + u.x * (rect.x1 - rect.x0), rect.y0 + u.y * (rect.y1 - rect.y0), rect.k);
+		break;
+	}
+	case HittableYZRect: {
+		const YZRect& rect = static_cast<const YZRect&>(shape);
+		target = Point3(rect.k, rect.y0 + u.x * (rect.y1 - rect.y0), rect.z0 + u.y * (rect.z1 - rect.z0));
+		break;
+	}
+	case HittableXZRect: {
+		const XZRect& rect = static_cast<const XZRect&>(shape);
+		target = Point3(rect.x0 + u.x * (rect.x1 - rect.x0), rect.k, rect.z0 + u.y * (rect.z1 - rect.z0));
+		break;
+	}
+	default:
+		return false;
+	}
+
+	Vec3 toTarget = target - p;
+	float length = toTarget.length();
+	if (length <= 0) return false;
+	Vec3 direction = toTarget / length;
+
+	// The emitter's own hit gives the point, its normal and the texture
+	// coordinates of the emission.
+	HitRecord hitRecord;
+	if (!dispatchHit(shape, Ray(p, direction, time), 0, INF, hitRecord)) return false;
+	float pdf = shapePdf(light, p, hitRecord);
+	if (!(pdf > 0 && pdf < INF)) return false;
+
+	lightSample.direction = direction;
+	lightSample.distance = hitRecord.t;
+	lightSample.radiance = dispatchEmitted(*hitRecord.materialPtr, hitRecord.u, hitRecord.v, hitRecord.p);
+	lightSample.pdf = pdf;
+	return true;
+}
+
+float LightBVH::shapePdf(const Light& light, const Point3& p, const HitRecord& hitRecord) const {
+	if (light.shape->kind == HittableSphere) {
+		const Sphere& sphere = static_cast<const Sphere&>(*light.shape);
+		float distance2 = (sphere.center - p).length2();
+		float radius2 = sphere.radius * sphere.radius;
+		if (distance2 > radius2) {
+			float sin2Max = radius2 / distance2;
+			return 1 / (2 * PI * sin2Max / (1 + sqrtf(1 - sin2Max)));
+		}
+	}
+
+	// Uniform over the area, converted to solid angle.
+	Vec3 toPoint = hitRecord.p - p;
+	float distance2 = toPoint.length2();
+	float cosLight = fabsf(dot(hitRecord.normal, toPoint)) / sqrtf(distance2);
+	return cosLight > 0 ? distance2 / (cosLight * light.area) : 0;
+}
+
+bool LightBVH::samplePhoton(float u, Sample2D uPoint, Sample2D uDirection, float time, Ray& ray, Color& flux) const {
+	if (lights.empty()) return false;
+
+	const float oneMinusEpsilon = 0x1.fffffep-1f;
+	float target = u * powerSums.back();
+	size_t index = min(size_t(upper_bound(powerSums.begin(), powerSums.end(), target) - powerSums.begin()), lights.size() - 1);
+	const Light& light = lights[index];
+	float below = index > 0 ? powerSums[index - 1] : 0;
+	float pick = light.bounds.power / powerSums.back();
+	// What is left of u picks the side of a two-sided emitter.
+	float uSide = fmin((target - below) / light.bounds.power, oneMinusEpsilon);
+
+	const Hittable& shape = *light.shape;
+	Point3 point;
+	Vec3 normal = light.bounds.axis;
+	switch (shape.kind) {
+	case HittableSphere: {
+		const Sphere& sphere = static_cast<const Sphere&>(shape);
+		normal = sampleUniformSphere(uPoint);
+		point = sphere.center + sphere.radius * normal;
+		break;
+	}
+	case HittableXYRect: {
+		const XYRect& rect = static_cast<const XYRect&>(shape);
+		point = Point3(rect.x0 + uPoint.x * (rect.x1 - rect.x0), rect.y0 + uPoint.y * (rect.y1 - rect.y0), rect.k);
+		break;
+	}
+	case HittableYZRect: {
+		const YZRect& rect = static_cast<const YZRect&>(shape);
+		point = Point3(rect.k, rect.y0 + uPoint.x * (rect.y1 - rect.y0), rect.z0 + uPoint.y * (rect.z1 - rect.z0));
+		break;
+	}
+	case HittableXZRect: {
+		const XZRect& rect = static_cast<const XZRect&>(shape);
+		point = Point3(rect.x0 + uPoint.x * (rect.x1 - rect.x0), rect.k, rect.z0 + uPoint.y * (rect.z1 - rect.z0));
+		break;
+	}
+	default:
+		return false;
+	}
+	if (light.bounds.twoSided && uSide < 0.5f) normal = -1 * normal;
+
+	// The emitter's own hit, from just off the chosen side, gives the texture
+	// coordinates of the emission.
+	HitRecord hitRecord;
+	if (!dispatchHit(shape, Ray(point + normal, -1 * normal, time), 0, INF, hitRecord)) return false;
+	Color radiance = dispatchEmitted(*hitRecord.materialPtr, hitRecord.u, hitRecord.v, hitRecord.p);
+
+	// Radiance times cos over (1 / area) (cos / pi) (1 / sides) pick.
+	ray = Ray(hitRecord.p, Frame(normal).toWorld(sampleCosineHemisphere(uDirection)), time);
+	flux = (PI * light.area * (light.bounds.twoSided ? 2 : 1) / pick) * radiance;
+	return true;
+}
+
+// Emitters of the scene being rendered; whoever loads the scene builds them
+// before rendering, as main does.
+inline LightBVH& sceneLights() {
+	static LightBVH lights;
+	return lights;
+}
+
+#endif // !LIGHT_BVH_H
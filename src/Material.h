@@ -8,32 +8,45 @@
 #include "Hittable.h"
 #include "Color.h"
 #include "Texture.h"
+#include "Sampler.h"
+#include "Sampling.h"
+
+// Concrete materials known to dispatchScatter()/dispatchEmitted(); extensions keep MaterialUser.
+enum MaterialKind {
+	MaterialUser,
+	MaterialLambertian,
+	MaterialMetal,
+	MaterialDielectric,
+	MaterialDiffuseLight,
+	MaterialIsotropic
+};
 
 class Material {
 public:
+	explicit Material(MaterialKind k = MaterialUser) : kind(k) {}
+
 	virtual bool scatter(const Ray& ray_in, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay) const = 0;
 	
 	virtual Color emitted(float u, float v, const Point3& p) const {
 		return Color(0, 0, 0);
 	}
+
+	MaterialKind kind;
 };
 
-class Lambertian : public Material {
+class Lambertian final : public Material {
 public:
-	Lambertian(Color c) : albedo(make_shared<SolidColor>(c)) {}
-	Lambertian(shared_ptr<Texture> texure) : albedo(texure) {}
+	Lambertian(Color c) : Material(MaterialLambertian), albedo(make_shared<SolidColor>(c)) {}
+	Lambertian(shared_ptr<Texture> texure) : Material(MaterialLambertian), albedo(texure) {}
 
 	bool scatter(const Ray& ray_in, const HitRecord& hitRecord, Color& attenuation, Ray& scatter) const override {
 
-		Vec3 reflectedVector = Vec3::randomInHemisphere(hitRecord.normal);
-		//Vec3 reflectedVector = hitRecord.normal + randomUnitVector();
-		if (reflectedVector.nearZero()) {
-			reflectedVector = hitRecord.normal;
-		}
+		// Cosine-weighted around the normal, which is the Lambertian BRDF times
+		// the cosine term, so the albedo is the whole weight.
+		Vec3 reflectedVector = Frame(hitRecord.normal).toWorld(sampleCosineHemisphere(sample2D()));
 
-		reflectedVector = unitVector(reflectedVector);
 		scatter = Ray(hitRecord.p, reflectedVector, ray_in.time());
-		attenuation = albedo->value(hitRecord.u, hitRecord.v, hitRecord.p);
+		attenuation = dispatchValue(*albedo, hitRecord.u, hitRecord.v, hitRecord.p);
 		//if (Vec3::isNan(reflectedVector))
 		//	cout << "Lambertian" << endl;
 		return true;
@@ -42,11 +55,12 @@ public:
 	shared_ptr<Texture> albedo;
 };
 
-class Metal : public Material {
+class Metal final : public Material {
 public:
-	Metal(Color c, float f) : albedo(c), fuzzy(f < 1? f: 1) {}
+	Metal(Color c, float f) : Material(MaterialMetal), albedo(c), fuzzy(f < 1? f: 1) {}
 	bool scatter(const Ray& ray_in, const HitRecord& hitRecord, Color& attenuation, Ray& scatter) const override {
-		Vec3 reflectedVector = reflect(ray_in.direction(), hitRecord.normal) + fuzzy * Vec3::randomInUnitSphere();
+		Sample2D u = sample2D();
+		Vec3 reflectedVector = reflect(ray_in.direction(), hitRecord.normal) + fuzzy * sampleUniformBall(u, sample1D());
 
 		if (dot(reflectedVector, hitRecord.normal) < 0) return false;
 
@@ -63,9 +77,9 @@ public:
 };
 
 
-class Dielectric : public Material {
+class Dielectric final : public Material {
 public:
-	Dielectric(float indexOfRefraction) : ir(indexOfRefraction) {}
+	Dielectric(float indexOfRefraction) : Material(MaterialDielectric), ir(indexOfRefraction) {}
 	bool scatter(const Ray& ray_in, const HitRecord& hitRecord, Color& attenuation, Ray& scatter) const override {
 		Vec3 refractedVector;
 		float n1, n2;
@@ -82,7 +96,7 @@ public:
 		float sinTheta = sqrtf(1 - cosTheta * cosTheta);
 		
 		bool can_not_refract = n1 / n2 * sinTheta > 1;
-		if (can_not_refract || reflectanceCoef(cosTheta, n1, n2) > random_float()) {
+		if (can_not_refract || reflectanceCoef(cosTheta, n1, n2) > sample1D()) {
 			// Must Reflect
 			refractedVector = reflect(ray_in.direction(), hitRecord.normal);
 		}
@@ -103,44 +117,75 @@ public:
 private:
 	float reflectanceCoef(float cosTheta, float n1, float n2) const {
 		// Use Schilick's Approximation
-		float r0 = powf((n1 - n2) / (n1 + n2), 2);
-		return r0 + (1 - r0) * (1 - powf(cosTheta, 5));
+		float r0 = (n1 - n2) / (n1 + n2);
+		r0 *= r0;
+		float cos2 = cosTheta * cosTheta;
+		return r0 + (1 - r0) * (1 - cos2 * cos2 * cosTheta);
 	}
 };
 
-class DiffuseLight : public Material {
+class DiffuseLight final : public Material {
 public:
-	DiffuseLight(shared_ptr<Texture> texture) : emit(texture){}
-	DiffuseLight(Color c) : emit(make_shared<SolidColor>(c)) {}
+	DiffuseLight(shared_ptr<Texture> texture) : Material(MaterialDiffuseLight), emit(texture){}
+	DiffuseLight(Color c) : Material(MaterialDiffuseLight), emit(make_shared<SolidColor>(c)) {}
 
 	virtual bool scatter(const Ray& ray_in, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay) const override {
 		return false;
 	}
 
 	virtual Color emitted(float u, float v, const Point3& p) const override {
-		return emit->value(u, v, p);
+		return dispatchValue(*emit, u, v, p);
 	}
 private:
+	friend class SceneCache;
 	shared_ptr<Texture> emit;
 };
 
-class Isotropic : public Material {
+class Isotropic final : public Material {
 public:
-	Isotropic(Color a) : abedo(make_shared<SolidColor>(a)) {}
-	Isotropic(shared_ptr<Texture> a) : abedo(a) {}
+	Isotropic(Color a) : Material(MaterialIsotropic), abedo(make_shared<SolidColor>(a)) {}
+	Isotropic(shared_ptr<Texture> a) : Material(MaterialIsotropic), abedo(a) {}
 
 	virtual bool scatter(
 		const Ray& ray_in, const HitRecord& hitRecord, 
 		Color& attenuation, Ray& scatteredRay) const override 
 	{
-		scatteredRay = Ray(hitRecord.p, randomUnitVector(), ray_in.time());
-		attenuation = abedo->value(hitRecord.u, hitRecord.v, hitRecord.p);
+		scatteredRay = Ray(hitRecord.p, sampleUniformSphere(sample2D()), ray_in.time());
+		attenuation = dispatchValue(*abedo, hitRecord.u, hitRecord.v, hitRecord.p);
 		//if (Vec3::isNan(scatteredRay.direction()))
 		//	cout << "Isotropic" << endl;
 		return true;
 	}
 private:
+	friend class SceneCache;
 	shared_ptr<Texture> abedo;
 };
 
+// Same as mat.scatter() and mat.emitted(), but calls the built-in materials
+// directly when RTNW_STATIC_DISPATCH is defined.
+inline bool dispatchScatter(const Material& mat, const Ray& ray_in, const HitRecord& hitRecord, Color& attenuation, Ray& scatteredRay) {
+#ifdef RTNW_STATIC_DISPATCH
+	switch (mat.kind) {
+	case MaterialLambertian: return static_cast<const Lambertian&>(mat).scatter(ray_in, hitRecord, attenuation, scatteredRay);
+	case MaterialMetal: return static_cast<const Metal&>(mat).scatter(ray_in, hitRecord, attenuation, scatteredRay);
+	case MaterialDielectric: return static_cast<const Dielectric&>(mat).scatter(ray_in, hitRecord, attenuation, scatteredRay);
+	case MaterialDiffuseLight: return false;
+	case MaterialIsotropic: return static_cast<const Isotropic&>(mat).scatter(ray_in, hitRecord, attenuation, scatteredRay);
+	default: break;
+	}
+#endif
+	return mat.scatter(ray_in, hitRecord, attenuation, scatteredRay);
+}
+
+inline Color dispatchEmitted(const Material& mat, float u, float v, const Point3& p) {
+#ifdef RTNW_STATIC_DISPATCH
+	switch (mat.kind) {
+	case MaterialDiffuseLight: return static_cast<const DiffuseLight&>(mat).emitted(u, v, p);
+	case MaterialUser: break;
+	default: return Color(0, 0, 0);
+	}
+#endif
+	return mat.emitted(u, v, p);
+}
+
 #endif // !MATERIAL_H
@@ -0,0 +1,216 @@
+#pragma once
+
+#ifndef MOTION_BVH_NODE_H
+#define MOTION_BVH_NODE_H
+
+// BVH for scenes with moving objects.
+//
+// BVHNode bounds every object by its box swept over the whole shutter, which
+// for fast-moving objects is much larger than the object at any single time.
+// A MotionBVHNode instead stores its bounds at shutter open and close and tests
+// rays against the box interpolated at ray.time(). Interpolating the end boxes
+// is conservative as long as objects move linearly, which MovingSphere does and
+// static objects trivially do.
+//
+// The builder can additionally make temporal splits: the node then keeps two
+// subtrees over the same objects, one for each half of its time range, and a
+// ray only descends into the one containing its time. Every temporal split
+// duplicates a subtree, so their number per root-to-leaf path is bounded.
+
+#include "RTNW.h"
+#include "HittableList.h"
+#include "Stats.h"
+#include "SceneArena.h"
+#include <algorithm>
+
+class MotionBVHNode final : public Hittable {
+public:
+	// A temporal split is made when the halves' swept boxes have on average at
+	// most this fraction of the surface area of the node's swept box.
+	static constexpr float temporalSplitThreshold = 0.6f;
+
+	MotionBVHNode() : Hittable(HittableMotionBVHNode) {}
+
+	// temporalSplits is the maximum number of temporal splits along any path.
+	MotionBVHNode(HittableList& list, float time0, float time1, int temporalSplits = 0)
+		: MotionBVHNode(list.objects, 0, list.objects.size(), time0, time1, temporalSplits) {};
+
+	// Same, but the nodes are allocated from arena; see the BVHNode constructor.
+	MotionBVHNode(HittableList& list, float time0, float time1, int temporalSplits, SceneArena& arena)
+		: MotionBVHNode(list.objects, 0, list.objects.size(), time0, time1, temporalSplits, &arena) {};
+
+	MotionBVHNode(vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t end, float time0, float time1,
+		int temporalSplits, SceneArena* arena = nullptr);
+
+	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
+
+	virtual bool boundingBox(float time0, float time1, AABB& outBBox) const override;
+
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override;
+
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
+
+	AABB boundsAt(float time) const {
+		if (time1 <= time0) return bbox0;
+		float s = (time - time0) / (time1 - time0);
+		return lerpBox(bbox0, bbox1, s < 0 ? 0 : (s > 1 ? 1 : s));
+	}
+
+private:
+	// Child for a ray at time; only used by temporal nodes.
+	const Hittable& temporalChild(float time) const {
+		return time < splitTime ? *leftNode : *rightNode;
+	}
+
+	shared_ptr<Hittable> leftNode;
+	shared_ptr<Hittable> rightNode;
+	AABB bbox0, bbox1; // bounds at time0 and time1
+	float time0, time1;
+	bool temporal;
+	float splitTime;
+	int axis = 0; // spatial nodes: the children are ordered along this axis
+};
+
+bool MotionBVHNode::boundingBox(float t0, float t1, AABB& outBBox) const {
+	outBBox = surroundingBox(boundsAt(t0), boundsAt(t1));
+	return true;
+}
+
+bool MotionBVHNode::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+
+	if (!boundsAt(ray.time()).hit(ray, tMin, tMax)) return false;
+
+	if (temporal) return dispatchHit(temporalChild(ray.time()), ray, tMin, tMax, hitRecord);
+
+	bool hitLeft = dispatchHit(*leftNode, ray, tMin, tMax, hitRecord);
+	bool hitRight = dispatchHit(*rightNode, ray, tMin, hitLeft ? hitRecord.t : tMax, hitRecord);
+
+	return hitLeft || hitRight;
+}
+
+bool MotionBVHNode::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+
+	if (!boundsAt(ray.time()).hit(ray, tMin, tMax)) return false;
+
+	if (temporal) return dispatchIntersect(temporalChild(ray.time()), ray, tMin, tMax, surfaceHit);
+
+	bool hitLeft = dispatchIntersect(*leftNode, ray, tMin, tMax, surfaceHit);
+	bool hitRight = dispatchIntersect(*rightNode, ray, tMin, hitLeft ? surfaceHit.t : tMax, surfaceHit);
+
+	return hitLeft || hitRight;
+}
+
+bool MotionBVHNode::occluded(const Ray& ray, float tMin, float tMax) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+
+	if (!boundsAt(ray.time()).hit(ray, tMin, tMax)) return false;
+
+	if (temporal) return dispatchOccluded(temporalChild(ray.time()), ray, tMin, tMax);
+
+	// Closer child first, as in BVHNode::occluded().
+	const Hittable& first = ray.direction()[axis] < 0 ? *rightNode : *leftNode;
+	const Hittable& second = ray.direction()[axis] < 0 ? *leftNode : *rightNode;
+
+	if (dispatchOccluded(first, ray, tMin, tMax)) return true;
+	return &second != &first && dispatchOccluded(second, ray, tMin, tMax);
+}
+
+int MotionBVHNode::intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const {
+	RTNW_STATS_INC(bvhNodesVisited);
+	if (!boundsAt(ray.time()).hit(ray, tMin, tMax)) return 0;
+
+	if (temporal) return temporalChild(ray.time()).intervals(ray, tMin, tMax, out, maxIntervals);
+
+	int count = leftNode->intervals(ray, tMin, tMax, out, maxIntervals);
+	if (rightNode == leftNode) return count;
+	count += rightNode->intervals(ray, tMin, tMax, out + count, maxIntervals - count);
+	return mergeIntervals(out, count);
+}
+
+// Union of the boxes of srcObjects[start, end) at a single time.
+inline AABB boundsAtTime(const vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t end, float time) {
+	AABB result, bbox;
+	for (size_t ii = start; ii < end; ii++) {
+		if (!srcObjects[ii]->boundingBox(time, time, bbox)) {
+			cout << "NO bounding box is created in MotionBVHNode constructor\n";
+		}
+		result = ii == start ? bbox : surroundingBox(result, bbox);
+	}
+	return result;
+}
+
+MotionBVHNode::MotionBVHNode(vector<shared_ptr<Hittable>>& srcObjects, size_t start, size_t end, float t0, float t1,
+	int temporalSplits, SceneArena* arena)
+	: Hittable(HittableMotionBVHNode), time0(t0), time1(t1), temporal(false), splitTime(t1) {
+	bbox0 = boundsAtTime(srcObjects, start, end, time0);
+	bbox1 = boundsAtTime(srcObjects, start, end, time1);
+
+	size_t range = end - start;
+
+	auto leaf = [arena](const shared_ptr<Hittable>& obj) {
+		return arena ? shared_ptr<Hittable>(shared_ptr<void>(), obj.get()) : obj;
+	};
+	auto node = [arena, &srcObjects](size_t first, size_t last, float childTime0, float childTime1, int splits) {
+		if (arena) return static_pointer_cast<Hittable>(arena->make<MotionBVHNode>(srcObjects, first, last, childTime0, childTime1, splits, arena));
+		return static_pointer_cast<Hittable>(make_shared<MotionBVHNode>(srcObjects, first, last, childTime0, childTime1, splits));
+	};
+
+	if (range == 1) {
+		leftNode = rightNode = leaf(srcObjects[start]);
+		return;
+	}
+
+	// Temporal split: compare the boxes swept over each half of the time range with the full one.
+	if (temporalSplits > 0 && range > 2) {
+		float tMid = 0.5f * (time0 + time1);
+		AABB bboxMid = boundsAtTime(srcObjects, start, end, tMid);
+		float fullArea = surroundingBox(bbox0, bbox1).surfaceArea();
+		float halvesArea = surroundingBox(bbox0, bboxMid).surfaceArea() + surroundingBox(bboxMid, bbox1).surfaceArea();
+		if (halvesArea < 2 * temporalSplitThreshold * fullArea) {
+			temporal = true;
+			splitTime = tMid;
+			leftNode = node(start, end, time0, tMid, temporalSplits - 1);
+			rightNode = node(start, end, tMid, time1, temporalSplits - 1);
+			return;
+		}
+	}
+
+	// Spatial split at the median of the centroids at mid-shutter, along their longest axis.
+	float tMid = 0.5f * (time0 + time1);
+	Point3 cMin(INF, INF, INF), cMax(-INF, -INF, -INF);
+	vector<Point3> centroids(range);
+	for (size_t ii = 0; ii < range; ii++) {
+		AABB bbox;
+		srcObjects[start + ii]->boundingBox(tMid, tMid, bbox);
+		centroids[ii] = 0.5f * (bbox.min() + bbox.max());
+		for (int c = 0; c < 3; c++) {
+			cMin[c] = fmin(cMin[c], centroids[ii][c]);
+			cMax[c] = fmax(cMax[c], centroids[ii][c]);
+		}
+	}
+	Vec3 extent = cMax - cMin;
+	axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+
+	vector<size_t> order(range);
+	for (size_t ii = 0; ii < range; ii++) order[ii] = ii;
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return centroids[a][axis] < centroids[b][axis]; });
+	vector<shared_ptr<Hittable>> sorted(range);
+	for (size_t ii = 0; ii < range; ii++) sorted[ii] = srcObjects[start + order[ii]];
+	std::copy(sorted.begin(), sorted.end(), srcObjects.begin() + start);
+
+	if (range == 2) {
+		leftNode = leaf(srcObjects[start]);
+		rightNode = leaf(srcObjects[start + 1]);
+		return;
+	}
+
+	auto mid = start + range / 2;
+	leftNode = node(start, mid, time0, time1, temporalSplits);
+	rightNode = node(mid, end, time0, time1, temporalSplits);
+}
+
+#endif // !MOTION_BVH_NODE_H
@@ -5,17 +5,24 @@
 
 #include "RTNW.h"
 #include "Hittable.h"
+#include "Stats.h"
 
-class MovingSphere : public Hittable {
+class MovingSphere final : public Hittable {
 public:
 	MovingSphere(Point3 c0, Point3 c1, float tm0, float tm1, float r, shared_ptr<Material> mat)
-		: center0(c0), center1(c1), time0(tm0), time1(tm1), radius(r), materialPtr(mat) {}
+		: Hittable(HittableMovingSphere), center0(c0), center1(c1), time0(tm0), time1(tm1), radius(r), materialPtr(mat) {}
 
 	bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
-		Point3 c = center(ray.time());
+		SurfaceHit surfaceHit;
+		if (!intersect(ray, tMin, tMax, surfaceHit)) return false;
+		resolve(ray, surfaceHit, 0, hitRecord);
+		return true;
+	}
 
-		Vec3 oc = ray.origin() - c;
-		Point3 o = ray.origin();
+	bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override {
+		RTNW_STATS_PRIMITIVE(StatsMovingSphere);
+
+		Vec3 oc = ray.origin() - center(ray.time());
 		Vec3 d = ray.direction();
 
 		float A = d.length2();
@@ -25,23 +32,61 @@ public:
 		float delta = halfB * halfB - A * C;
 		if (delta < 0)
 			return false;
-		else {
-			float t = (-halfB - sqrtf(delta)) / A;
-			if (t < tMin || t > tMax) {
-				t = (-halfB + sqrtf(delta)) / A;
-				if (t < tMin || t > tMax) return false;
-			}
-
-			Point3 intersectionPoint = ray.at(t);
-			Vec3 outwardNormal = unitVector(intersectionPoint - c);
-
-			hitRecord.p = intersectionPoint;
-			hitRecord.t = t;
-			setNormal(hitRecord, ray, outwardNormal);
-			hitRecord.materialPtr = materialPtr;
-
-			return true;
+
+		float t = (-halfB - sqrtf(delta)) / A;
+		if (t < tMin || t > tMax) {
+			t = (-halfB + sqrtf(delta)) / A;
+			if (t < tMin || t > tMax) return false;
 		}
+
+		setSurfaceHit(surfaceHit, this, t);
+		return true;
+	}
+
+	void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override {
+		Point3 intersectionPoint = ray.at(surfaceHit.t);
+		Vec3 outwardNormal = unitVector(intersectionPoint - center(ray.time()));
+
+		hitRecord.p = intersectionPoint;
+		hitRecord.t = surfaceHit.t;
+		setNormal(hitRecord, ray, outwardNormal);
+		hitRecord.materialPtr = materialPtr;
+	}
+
+	int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		Vec3 oc = ray.origin() - center(ray.time());
+		Vec3 d = ray.direction();
+
+		float A = d.length2();
+		float halfB = dot(oc, d);
+		float C = oc.length2() - radius * radius;
+
+		float delta = halfB * halfB - A * C;
+		if (delta <= 0) return 0;
+
+		float sqrtDelta = sqrtf(delta);
+		return appendInterval((-halfB - sqrtDelta) / A, (-halfB + sqrtDelta) / A, tMin, tMax, out, 0, maxIntervals);
+	}
+
+	// Any root in [tMin, tMax]; no hit record is filled.
+	bool occluded(const Ray& ray, float tMin, float tMax) const override {
+		RTNW_STATS_PRIMITIVE(StatsMovingSphere);
+
+		Vec3 oc = ray.origin() - center(ray.time());
+		Vec3 d = ray.direction();
+
+		float A = d.length2();
+		float halfB = dot(oc, d);
+		float C = oc.length2() - radius * radius;
+
+		float delta = halfB * halfB - A * C;
+		if (delta < 0) return false;
+
+		float sqrtDelta = sqrtf(delta);
+		float t = (-halfB - sqrtDelta) / A;
+		if (t >= tMin && t <= tMax) return true;
+		t = (-halfB + sqrtDelta) / A;
+		return t >= tMin && t <= tMax;
 	}
 
 	bool boundingBox(float time0, float time1, AABB& bbox) const {
@@ -62,6 +107,7 @@ public:
 	}
 
 private:
+	friend class SceneCache;
 	Point3 center0, center1;
 	float time0, time1;
 	float radius;
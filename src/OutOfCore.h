@@ -0,0 +1,577 @@
+#pragma once
+
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+// Out-of-core spheres: sphere sets larger than memory, kept in a chunked
+// binary file and paged in on demand.
+//
+// The file holds the spheres in spatially coherent chunks (a few thousand
+// spheres each) and a table with every chunk's bounds. OutOfCoreSpheres maps
+// the file and keeps only the table and a BVH over the chunk bounds resident.
+// A ray that enters a chunk's bounds makes the chunk resident: its records
+// are decoded into Sphere objects with a QuantizedBVH over them, and the
+// mapped pages are dropped again. Resident chunks live in an LRU cache of
+// OutOfCoreOptions::budgetBytes; past the budget the least recently used
+// ones are released. A chunk in use by a ray on another thread is freed when
+// that ray is done with it. Rays find resident chunks under a shared lock;
+// a chunk is decoded outside the lock, by the first ray that needs it, while
+// other rays that need the same chunk wait for it. The budget bounds the
+// decoded geometry; memory outside it is the chunk table and the top-level
+// BVH, about 100 bytes per chunk.
+//
+// File layout, little-endian, written by SphereChunkWriter:
+//
+//   SphereChunkFileHeader
+//   chunk 0 records, chunk 1 records, ...  (SphereRecord each)
+//   SphereChunkEntry per chunk             (at header.tableOffset)
+//
+// Materials are not stored: a record holds an index into the palette the
+// file is opened with. Meshes are not supported; the renderer has no
+// triangle primitive yet.
+
+#include "RTNW.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "Sphere.h"
+#include "BVHNode.h"
+#include "QuantizedBVH.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+struct SphereRecord {
+	float center[3];
+	float radius;
+	uint32_t material; // index into the palette
+};
+
+struct SphereChunkEntry {
+	float lo[3], hi[3]; // bounds of the chunk's spheres
+	uint64_t offset;    // of the first record, from the start of the file
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct SphereChunkFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t chunkCount;
+	uint64_t sphereCount;
+	uint64_t tableOffset;
+};
+
+const char sphereChunkMagic[8] = { 'R', 'T', 'N', 'W', 'S', 'P', 'H', 'C' };
+const uint32_t sphereChunkVersion = 1;
+
+// Settings for out-of-core geometry opened afterwards; main sets them from the
+// command line before the scene is loaded.
+struct OutOfCoreOptions {
+	size_t budgetBytes = size_t(64) << 20; // decoded chunks kept resident
+};
+
+inline OutOfCoreOptions& outOfCoreOptions() {
+	static OutOfCoreOptions options;
+	return options;
+}
+
+// ----------------------------------------
+// Writing
+
+// Streams chunks to a file, so a generator only needs one chunk in memory.
+// The file appears under its name when finish() succeeds; until then it is
+// written to a temporary file next to it, one per writer, so processes that
+// write the same file at once do not mix their chunks.
+class SphereChunkWriter {
+public:
+	bool open(const string& path);
+
+	// Append one chunk; its spheres should be close together.
+	bool addChunk(const vector<SphereRecord>& spheres);
+
+	bool finish();
+
+private:
+	string finalPath;
+	string tmpPath;
+	ofstream out;
+	vector<SphereChunkEntry> entries;
+	uint64_t sphereCount = 0;
+};
+
+bool SphereChunkWriter::open(const string& path) {
+	finalPath = path;
+	tmpPath = path + "." + to_string(random_device()()) + ".tmp";
+	out.open(tmpPath, ios::binary | ios::trunc);
+	entries.clear();
+	sphereCount = 0;
+
+	SphereChunkFileHeader header = {};
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header)); // rewritten by finish()
+	return bool(out);
+}
+
+bool SphereChunkWriter::addChunk(const vector<SphereRecord>& spheres) {
+	if (spheres.empty()) return bool(out);
+
+	SphereChunkEntry entry = {};
+	entry.offset = uint64_t(out.tellp());
+	entry.count = uint32_t(spheres.size());
+	for (int ii = 0; ii < 3; ii++) {
+		entry.lo[ii] = INF;
+		entry.hi[ii] = -INF;
+	}
+	for (const SphereRecord& sphere : spheres) {
+		for (int ii = 0; ii < 3; ii++) {
+			entry.lo[ii] = min(entry.lo[ii], sphere.center[ii] - sphere.radius);
+			entry.hi[ii] = max(entry.hi[ii], sphere.center[ii] + sphere.radius);
+		}
+	}
+	entries.push_back(entry);
+	sphereCount += spheres.size();
+
+	out.write(reinterpret_cast<const char*>(spheres.data()), spheres.size() * sizeof(SphereRecord));
+	return bool(out);
+}
+
+bool SphereChunkWriter::finish() {
+	SphereChunkFileHeader header = {};
+	memcpy(header.magic, sphereChunkMagic, sizeof(header.magic));
+	header.version = sphereChunkVersion;
+	header.chunkCount = uint32_t(entries.size());
+	header.sphereCount = sphereCount;
+	header.tableOffset = uint64_t(out.tellp());
+
+	out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(SphereChunkEntry));
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.close();
+	if (!out) return false;
+
+#ifdef _WIN32
+	remove(finalPath.c_str()); // rename() does not replace on Windows
+#endif
+	return rename(tmpPath.c_str(), finalPath.c_str()) == 0;
+}
+
+// Split spheres into chunks of at most chunkSize by recursive median splits
+// along the longest axis, and write them to path.
+bool writeSphereChunks(const string& path, vector<SphereRecord> spheres, size_t chunkSize) {
+	SphereChunkWriter writer;
+	if (!writer.open(path)) return false;
+
+	struct Range { size_t start, end; };
+	vector<Range> pending = { Range{ 0, spheres.size() } };
+	vector<SphereRecord> chunk;
+	while (!pending.empty()) {
+		Range range = pending.back();
+		pending.pop_back();
+
+		if (range.end - range.start <= chunkSize) {
+			chunk.assign(spheres.begin() + range.start, spheres.begin() + range.end);
+			if (!writer.addChunk(chunk)) return false;
+			continue;
+		}
+
+		float lo[3] = { INF, INF, INF }, hi[3] = { -INF, -INF, -INF };
+		for (size_t ii = range.start; ii < range.end; ii++) {
+			for (int axis = 0; axis < 3; axis++) {
+				lo[axis] = min(lo[axis], spheres[ii].center[axis]);
+				hi[axis] = max(hi[axis], spheres[ii].center[axis]);
+			}
+		}
+		int axis = 0;
+		if (hi[1] - lo[1] > hi[axis] - lo[axis]) axis = 1;
+		if (hi[2] - lo[2] > hi[axis] - lo[axis]) axis = 2;
+
+		size_t mid = range.start + (range.end - range.start) / 2;
+		nth_element(spheres.begin() + range.start, spheres.begin() + mid, spheres.begin() + range.end,
+			[axis](const SphereRecord& a, const SphereRecord& b) { return a.center[axis] < b.center[axis]; });
+		pending.push_back(Range{ mid, range.end });
+		pending.push_back(Range{ range.start, mid });
+	}
+	return writer.finish();
+}
+
+// ----------------------------------------
+// Reading
+
+// Read-only view of a file. Mapped where the platform allows it, otherwise
+// read piecewise into a buffer.
+class ChunkFile {
+public:
+	ChunkFile() {}
+	ChunkFile(const ChunkFile&) = delete;
+	ChunkFile& operator=(const ChunkFile&) = delete;
+	~ChunkFile() { close(); }
+
+	bool open(const string& path);
+	void close();
+
+	uint64_t size() const { return fileSize; }
+
+	// Bytes [offset, offset + count); buffer is used where the file is not mapped.
+	const uint8_t* data(uint64_t offset, size_t count, vector<uint8_t>& buffer);
+
+	// Give the pages of [offset, offset + count) back to the system.
+	void release(uint64_t offset, size_t count);
+
+private:
+	uint64_t fileSize = 0;
+#ifndef _WIN32
+	int fd = -1;
+	uint8_t* mapped = nullptr;
+#else
+	ifstream in;
+	mutex readMutex; // one read at a time through in
+#endif
+};
+
+#ifndef _WIN32
+bool ChunkFile::open(const string& path) {
+	close();
+	fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close();
+		return false;
+	}
+	fileSize = uint64_t(info.st_size);
+	void* address = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED) {
+		close();
+		return false;
+	}
+	mapped = static_cast<uint8_t*>(address);
+	return true;
+}
+
+void ChunkFile::close() {
+	if (mapped) munmap(mapped, fileSize);
+	if (fd >= 0) ::close(fd);
+	mapped = nullptr;
+	fd = -1;
+	fileSize = 0;
+}
+
+const uint8_t* ChunkFile::data(uint64_t offset, size_t count, vector<uint8_t>& buffer) {
+	return mapped + offset;
+}
+
+void ChunkFile::release(uint64_t offset, size_t count) {
+	// madvise needs a page-aligned start; round inwards so neighbours keep theirs.
+	uint64_t page = uint64_t(sysconf(_SC_PAGESIZE));
+	uint64_t start = (offset + page - 1) / page * page;
+	uint64_t end = (offset + count) / page * page;
+	if (end > start) madvise(mapped + start, end - start, MADV_DONTNEED);
+}
+#else
+bool ChunkFile::open(const string& path) {
+	close();
+	in.open(path, ios::binary | ios::ate);
+	if (!in) return false;
+	fileSize = uint64_t(in.tellg());
+	return fileSize > 0;
+}
+
+void ChunkFile::close() {
+	if (in.is_open()) in.close();
+	fileSize = 0;
+}
+
+const uint8_t* ChunkFile::data(uint64_t offset, size_t count, vector<uint8_t>& buffer) {
+	lock_guard<mutex> lock(readMutex);
+	buffer.resize(count);
+	in.clear();
+	in.seekg(offset);
+	in.read(reinterpret_cast<char*>(buffer.data()), count);
+	return buffer.data();
+}
+
+void ChunkFile::release(uint64_t offset, size_t count) {}
+#endif
+
+// Spheres of one chunk, decoded.
+struct ResidentSphereChunk {
+	vector<Sphere> spheres;
+	HittableList list; // non-owning references into spheres
+	unique_ptr<QuantizedBVH> bvh;
+	size_t bytes = 0;
+};
+
+class OutOfCoreSpheres;
+
+// Stand-in for one chunk in the top-level BVH; pages the chunk in when a ray
+// enters its bounds.
+class SphereChunk final : public Hittable {
+public:
+	SphereChunk(OutOfCoreSpheres* o, uint32_t i, const AABB& b) : Hittable(HittableSphereChunk), owner(o), index(i), bounds(b) {}
+
+	// intersect() keeps the default, which fills the record right away: the
+	// chunk's spheres may be gone by the time the closest hit is resolved.
+	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override;
+
+	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override {
+		bbox = bounds;
+		return true;
+	}
+
+private:
+	OutOfCoreSpheres* owner;
+	uint32_t index;
+	AABB bounds;
+};
+
+class OutOfCoreSpheres final : public Hittable {
+public:
+	OutOfCoreSpheres() : Hittable(HittableOutOfCoreSpheres) {}
+	OutOfCoreSpheres(const OutOfCoreSpheres&) = delete;
+	OutOfCoreSpheres& operator=(const OutOfCoreSpheres&) = delete;
+
+	// Open a file written by SphereChunkWriter. Record material i is palette[i];
+	// out-of-range indices get the last entry. False, with a message, if the
+	// file is missing or malformed.
+	bool open(const string& path, const vector<shared_ptr<Material>>& palette, size_t budgetBytes = outOfCoreOptions().budgetBytes);
+
+	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override {
+		return top && dispatchHit(*top, ray, tMin, tMax, hitRecord);
+	}
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override {
+		return top && dispatchIntersect(*top, ray, tMin, tMax, surfaceHit);
+	}
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override {
+		return top && dispatchOccluded(*top, ray, tMin, tMax);
+	}
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		return top ? top->intervals(ray, tMin, tMax, out, maxIntervals) : 0;
+	}
+	virtual bool boundingBox(float time0, float time1, AABB& bbox) const override {
+		return top && top->boundingBox(time0, time1, bbox);
+	}
+
+	// Chunk index, decoded and resident until the returned pointer is released.
+	shared_ptr<ResidentSphereChunk> acquire(uint32_t index);
+
+	size_t chunkCount() const { return entries.size(); }
+	uint64_t sphereCount() const { return totalSpheres; }
+	size_t residentBytes() const { return resident; }
+	long long chunkLoads() const { return loads; }
+	long long chunkEvictions() const { return evictions; }
+
+private:
+	friend class SceneCache;
+
+	struct Slot {
+		shared_ptr<ResidentSphereChunk> chunk;
+		bool loading = false;           // being decoded by some thread
+		atomic<uint64_t> lastUse{ 0 }; // useClock at the last acquire()
+	};
+
+	shared_ptr<ResidentSphereChunk> load(uint32_t index);
+	void touch(Slot& slot) { slot.lastUse.store(useClock.fetch_add(1, memory_order_relaxed), memory_order_relaxed); }
+
+	ChunkFile file;
+	string filePath;
+	vector<SphereChunkEntry> entries;
+	vector<shared_ptr<Material>> materials;
+	uint64_t totalSpheres = 0;
+	HittableList chunks; // the SphereChunk stand-ins
+	shared_ptr<Hittable> top;
+
+	// cacheMutex guards the slots' chunks and loading flags, residentChunks
+	// and resident; lookups take it shared, loads and evictions exclusive.
+	size_t budget = 0;
+	shared_mutex cacheMutex;
+	condition_variable_any chunkLoaded;
+	vector<Slot> slots;
+	vector<uint32_t> residentChunks;
+	size_t resident = 0;
+	atomic<uint64_t> useClock{ 0 };
+	atomic<long long> loads{ 0 };
+	atomic<long long> evictions{ 0 };
+};
+
+bool OutOfCoreSpheres::open(const string& path, const vector<shared_ptr<Material>>& palette, size_t budgetBytes) {
+	if (palette.empty()) {
+		cerr << "Out-of-core spheres need at least one material.\n";
+		return false;
+	}
+	if (!file.open(path)) return false;
+
+	SphereChunkFileHeader header;
+	vector<uint8_t> buffer;
+	bool valid = file.size() >= sizeof(header);
+	if (valid) {
+		memcpy(&header, file.data(0, sizeof(header), buffer), sizeof(header));
+		valid = memcmp(header.magic, sphereChunkMagic, sizeof(header.magic)) == 0 && header.version == sphereChunkVersion
+			&& header.tableOffset <= file.size()
+			&& (file.size() - header.tableOffset) / sizeof(SphereChunkEntry) >= header.chunkCount;
+	}
+	if (valid) {
+		entries.resize(header.chunkCount);
+		memcpy(entries.data(), file.data(header.tableOffset, entries.size() * sizeof(SphereChunkEntry), buffer),
+			entries.size() * sizeof(SphereChunkEntry));
+		uint64_t spheres = 0;
+		for (const SphereChunkEntry& entry : entries) {
+			valid = valid && entry.count > 0 && entry.offset >= sizeof(header) && entry.offset <= header.tableOffset
+				&& (header.tableOffset - entry.offset) / sizeof(SphereRecord) >= entry.count;
+			spheres += entry.count;
+		}
+		valid = valid && spheres == header.sphereCount && !entries.empty();
+	}
+	if (!valid) {
+		cerr << path << " is not a sphere chunk file of version " << sphereChunkVersion << ".\n";
+		entries.clear();
+		file.close();
+		return false;
+	}
+
+	filePath = path;
+	materials = palette;
+	totalSpheres = header.sphereCount;
+	budget = budgetBytes;
+	slots = vector<Slot>(entries.size());
+	residentChunks.clear();
+
+	chunks.clear();
+	for (uint32_t ii = 0; ii < entries.size(); ii++) {
+		const SphereChunkEntry& entry = entries[ii];
+		AABB bounds(Point3(entry.lo[0], entry.lo[1], entry.lo[2]), Point3(entry.hi[0], entry.hi[1], entry.hi[2]));
+		chunks.add(make_shared<SphereChunk>(this, ii, bounds));
+	}
+	top = make_shared<BVHNode>(chunks, 0, 1);
+	return true;
+}
+
+shared_ptr<ResidentSphereChunk> OutOfCoreSpheres::load(uint32_t index) {
+	const SphereChunkEntry& entry = entries[index];
+	size_t bytes = size_t(entry.count) * sizeof(SphereRecord);
+	vector<uint8_t> buffer;
+	const uint8_t* data = file.data(entry.offset, bytes, buffer);
+
+	shared_ptr<ResidentSphereChunk> chunk = make_shared<ResidentSphereChunk>();
+	chunk->spheres.reserve(entry.count); // no reallocation: list points into it
+	chunk->list.objects.reserve(entry.count);
+	for (uint32_t ii = 0; ii < entry.count; ii++) {
+		SphereRecord record;
+		memcpy(&record, data + size_t(ii) * sizeof(SphereRecord), sizeof(record));
+		const shared_ptr<Material>& material = materials[min(size_t(record.material), materials.size() - 1)];
+		chunk->spheres.emplace_back(Point3(record.center[0], record.center[1], record.center[2]), record.radius, material);
+		chunk->list.add(shared_ptr<Hittable>(shared_ptr<void>(), &chunk->spheres.back()));
+	}
+	file.release(entry.offset, bytes);
+
+	// The BVH build draws random split axes. Draw them from a generator seeded
+	// with the chunk, so a chunk paged in again gets the same tree and the
+	// image does not depend on the budget, and leave the caller's sequence alone.
+	RandomGenerator saved = threadRandomGenerator();
+	seedRandom(index);
+	chunk->bvh.reset(new QuantizedBVH(chunk->list, 0, 1));
+	threadRandomGenerator() = saved;
+	chunk->bytes = sizeof(ResidentSphereChunk) + chunk->spheres.capacity() * sizeof(Sphere)
+		+ chunk->list.objects.capacity() * sizeof(shared_ptr<Hittable>) + chunk->bvh->memoryBytes();
+	return chunk;
+}
+
+shared_ptr<ResidentSphereChunk> OutOfCoreSpheres::acquire(uint32_t index) {
+	Slot& slot = slots[index];
+	{
+		shared_lock<shared_mutex> lock(cacheMutex);
+		if (slot.chunk) {
+			touch(slot);
+			return slot.chunk;
+		}
+	}
+
+	// Not resident: the first thread here decodes it, later ones wait.
+	unique_lock<shared_mutex> lock(cacheMutex);
+	chunkLoaded.wait(lock, [&slot]() { return !slot.loading; });
+	if (slot.chunk) {
+		touch(slot);
+		return slot.chunk;
+	}
+	slot.loading = true;
+	lock.unlock();
+
+	shared_ptr<ResidentSphereChunk> chunk;
+	try {
+		chunk = load(index);
+	}
+	catch (...) {
+		lock.lock();
+		slot.loading = false;
+		lock.unlock();
+		chunkLoaded.notify_all();
+		throw;
+	}
+
+	lock.lock();
+	slot.loading = false;
+	slot.chunk = chunk;
+	touch(slot);
+	residentChunks.push_back(index);
+	resident += chunk->bytes;
+	loads++;
+
+	// Keep at least the chunk just loaded, even if it alone exceeds the budget.
+	while (resident > budget && residentChunks.size() > 1) {
+		size_t oldest = residentChunks[0] == index ? 1 : 0;
+		for (size_t ii = oldest + 1; ii < residentChunks.size(); ii++) {
+			if (residentChunks[ii] != index && slots[residentChunks[ii]].lastUse < slots[residentChunks[oldest]].lastUse) oldest = ii;
+		}
+		Slot& victim = slots[residentChunks[oldest]];
+		resident -= victim.chunk->bytes;
+		victim.chunk.reset();
+		residentChunks[oldest] = residentChunks.back();
+		residentChunks.pop_back();
+		evictions++;
+	}
+	lock.unlock();
+	chunkLoaded.notify_all();
+	return chunk;
+}
+
+bool SphereChunk::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	if (!bounds.hit(ray, tMin, tMax)) return false;
+	shared_ptr<ResidentSphereChunk> chunk = owner->acquire(index);
+	return chunk->bvh->hit(ray, tMin, tMax, hitRecord);
+}
+
+bool SphereChunk::occluded(const Ray& ray, float tMin, float tMax) const {
+	if (!bounds.hit(ray, tMin, tMax)) return false;
+	shared_ptr<ResidentSphereChunk> chunk = owner->acquire(index);
+	return chunk->bvh->occluded(ray, tMin, tMax);
+}
+
+int SphereChunk::intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const {
+	if (!bounds.hit(ray, tMin, tMax)) return 0;
+	shared_ptr<ResidentSphereChunk> chunk = owner->acquire(index);
+	return chunk->bvh->intervals(ray, tMin, tMax, out, maxIntervals);
+}
+
+#endif // !OUT_OF_CORE_H
@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef PATH_GUIDING_H
+#define PATH_GUIDING_H
+
+// Guided render: learn where the light comes from, then render with it.
+//
+// Training passes of 1, 2, 4, ... samples per pixel trace the image with the
+// guide recording, each sampling from what the passes before it learned (see
+// SDTree.h), and are thrown away. The final pass renders samplesPerPixel
+// samples, with the same sample indices as a normal render, guided by the
+// last training pass. Rows are traced by a ThreadPool; its threads record
+// into the guide together.
+//
+// Guiding helps where the light arrives through a small or indirect opening
+// that BSDF sampling rarely finds: the caustics of glass spheres, rooms lit
+// through a gap, media lit by a bright spot.
+
+#include "RTNW.h"
+#include "Camera.h"
+#include "Color.h"
+#include "Render.h"
+#include "Sampler.h"
+#include "SDTree.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+struct GuidingOptions {
+	int trainingPasses = 4; // of 1, 2, 4, ... samples per pixel
+	int threadCount = 0;    // <= 0: one per hardware thread
+};
+
+// Render samplesPerPixel samples per pixel into pixels (sums, as samplePixel
+// returns them) after training scenePathGuide() on world.
+void renderGuided(const Camera& camera, const Hittable& world, const Color& backgroundColor,
+	int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth, SamplerType sampler,
+	const GuidingOptions& options, vector<Color>& pixels) {
+	using Clock = chrono::steady_clock;
+	Clock::time_point start = Clock::now();
+	auto milliseconds = [&]() { return chrono::duration<double, milli>(Clock::now() - start).count(); };
+
+	AABB bounds(Point3(-1000, -1000, -1000), Point3(1000, 1000, 1000));
+	world.boundingBox(0, 1, bounds);
+	PathGuide& guide = scenePathGuide();
+	guide.reset(bounds);
+
+	ThreadPool pool(options.threadCount);
+	pixels.assign(size_t(imageWidth) * imageHeight, Color());
+	for (int pass = 0; pass < options.trainingPasses; pass++) {
+		int passSamples = 1 << pass;
+		renderPass(pool, camera, world, backgroundColor, imageWidth, imageHeight, passSamples, maxDepth,
+			sampler, uint32_t(pass + 1), pixels);
+		guide.finishPass(passSamples);
+		cout << "Guiding pass " << pass + 1 << "/" << options.trainingPasses << ": " << passSamples << " spp, "
+			<< guide.regionCount() << " regions, " << milliseconds() << " ms" << endl;
+	}
+
+	guide.setRecording(false);
+	renderPass(pool, camera, world, backgroundColor, imageWidth, imageHeight, samplesPerPixel, maxDepth,
+		sampler, 0, pixels);
+	cout << "Guided render: " << samplesPerPixel << " spp, " << milliseconds() << " ms" << endl;
+	guide.disable();
+}
+
+#endif // !PATH_GUIDING_H
@@ -65,6 +65,7 @@ public:
 		return fabs(accum);
 	}
 private:
+	friend class SceneCache;
 	static const int pointCount = 256;
 	Vec3* randVecs;
 
@@ -0,0 +1,286 @@
+#pragma once
+
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+// Caustic photon map (Jensen, "Global Illumination Using Photon Maps", 1996).
+//
+// Light that reaches a diffuse surface through glass or off a mirror, a
+// caustic, is nearly out of reach of paths from the camera: they find it only
+// if a bounce off the diffuse surface happens to leave the specular one
+// towards an emitter. Photons traced from the emitters find it easily. A
+// photon is stored where it first lands on a Lambertian surface after one or
+// more Metal or Dielectric bounces; photons that land on one straight from
+// the emitter, or enter a medium, are dropped. The renderer then takes the
+// light of exactly those paths from the photons around its diffuse shading
+// points, a density estimate over a disk of the map's radius, instead of from
+// the emitters its bounces hit (see rayColor()).
+//
+// The photons are kept in a balanced kd-tree laid out in one array: a range
+// of the array holds its median photon in the middle, the photons below the
+// split to its left and the ones above to its right, so the tree needs no
+// pointers and a query walks memory mostly in order.
+//
+// The density estimate is biased by the size of the disk. The progressive
+// render in PhotonMapping.h makes it consistent by tracing a new map per pass
+// and shrinking the radius between passes (see there).
+
+#include "RTNW.h"
+#include "Vec3.h"
+#include "Ray.h"
+#include "Color.h"
+#include "Hittable.h"
+#include "Material.h"
+#include "Sampler.h"
+#include "LightBVH.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+using namespace std;
+
+struct Photon {
+	Point3 position;
+	Vec3 direction; // unit, back towards where the photon came from
+	Color power;
+	int axis = 0;   // split axis of its kd-tree node
+};
+
+class PhotonMap {
+public:
+	// Take photons and arrange them into the tree.
+	void build(vector<Photon>&& stored);
+
+	void clear() { photons.clear(); }
+	bool empty() const { return photons.empty(); }
+	size_t size() const { return photons.size(); }
+	const Photon& operator[](size_t index) const { return photons[index]; }
+
+	// Call visit(photon) for every photon within radius of p.
+	template <typename Visit>
+	void gather(const Point3& p, float radius, Visit visit) const;
+
+	// Distance from p to its k-th nearest photon; INF with fewer photons.
+	float nearestDistance(const Point3& p, int k) const;
+
+private:
+	void buildNode(size_t start, size_t end);
+
+	vector<Photon> photons;
+};
+
+void PhotonMap::build(vector<Photon>&& stored) {
+	photons = move(stored);
+	buildNode(0, photons.size());
+}
+
+void PhotonMap::buildNode(size_t start, size_t end) {
+	if (end - start < 2) return;
+
+	// Split at the median along the longest side of the photons' box.
+	Point3 lo(INF, INF, INF), hi(-INF, -INF, -INF);
+	for (size_t ii = start; ii < end; ii++) {
+		for (int axis = 0; axis < 3; axis++) {
+			lo[axis] = fmin(lo[axis], photons[ii].position[axis]);
+			hi[axis] = fmax(hi[axis], photons[ii].position[axis]);
+		}
+	}
+	Vec3 extent = hi - lo;
+	int axis = extent.x() > extent.y() && extent.x() > extent.z() ? 0 : (extent.y() > extent.z() ? 1 : 2);
+
+	size_t mid = (start + end) / 2;
+	nth_element(photons.begin() + start, photons.begin() + mid, photons.begin() + end,
+		[axis](const Photon& a, const Photon& b) { return a.position[axis] < b.position[axis]; });
+	photons[mid].axis = axis;
+	buildNode(start, mid);
+	buildNode(mid + 1, end);
+}
+
+template <typename Visit>
+void PhotonMap::gather(const Point3& p, float radius, Visit visit) const {
+	// A node pops once and pushes at most its two children, so the stack
+	// grows by at most one per level.
+	struct Range {
+		size_t start, end;
+	};
+	Range stack[64];
+	int top = 0;
+	if (!photons.empty()) stack[top++] = Range{ 0, photons.size() };
+	float radius2 = radius * radius;
+	while (top > 0) {
+		Range range = stack[--top];
+		size_t mid = (range.start + range.end) / 2;
+		const Photon& photon = photons[mid];
+		if ((photon.position - p).length2() <= radius2) visit(photon);
+		if (range.end - range.start == 1) continue;
+
+		float offset = p[photon.axis] - photon.position[photon.axis];
+		if (offset <= radius && mid > range.start) stack[top++] = Range{ range.start, mid };
+		if (offset >= -radius && mid + 1 < range.end) stack[top++] = Range{ mid + 1, range.end };
+	}
+}
+
+float PhotonMap::nearestDistance(const Point3& p, int k) const {
+	if (k <= 0 || photons.size() < size_t(k)) return INF;
+
+	// The k nearest so far, farthest on top; the query radius shrinks to it
+	// once there are k. Near sides are walked first so it shrinks early.
+	priority_queue<float> nearest;
+	auto visit = [&](size_t start, size_t end, auto& self) -> void {
+		if (start >= end) return;
+		size_t mid = (start + end) / 2;
+		const Photon& photon = photons[mid];
+		float distance2 = (photon.position - p).length2();
+		if (nearest.size() < size_t(k)) nearest.push(distance2);
+		else if (distance2 < nearest.top()) {
+			nearest.pop();
+			nearest.push(distance2);
+		}
+
+		float offset = p[photon.axis] - photon.position[photon.axis];
+		bool belowFirst = offset <= 0;
+		self(belowFirst ? start : mid + 1, belowFirst ? mid : end, self);
+		if (nearest.size() < size_t(k) || offset * offset < nearest.top())
+			self(belowFirst ? mid + 1 : start, belowFirst ? end : mid, self);
+	};
+	visit(0, photons.size(), visit);
+	return sqrtf(nearest.top());
+}
+
+// Caustic photons of the scene being rendered, and the radius they are
+// gathered over.
+class CausticPhotons {
+public:
+	// While enabled, rayColor() takes the caustic paths' light from the map.
+	bool enabled() const { return active; }
+	void disable() {
+		active = false;
+		map.clear();
+	}
+
+	const PhotonMap& photons() const { return map; }
+	float radius() const { return gatherRadius; }
+	void setRadius(float radius) { gatherRadius = radius; }
+
+	// Replace the map with the caustic photons of photonCount photons emitted
+	// from sceneLights() into world, traced on pool for at most maxDepth
+	// bounces. seed decorrelates the maps of the passes. Enables the map.
+	void trace(const Hittable& world, int photonCount, int maxDepth, uint32_t seed, ThreadPool& pool);
+
+	// Light arriving at a surface at p from the side normal faces, per unit
+	// area, from the photons within radius().
+	Color irradiance(const Point3& p, const Vec3& normal) const;
+
+	// Median distance from a photon to its k-th nearest, over a spread of up to
+	// count photons: a radius that takes some k photons where the caustics
+	// are. Zero without photons.
+	float typicalRadius(int k = 32, int count = 256) const;
+
+private:
+	static const int photonsPerTask = 4096;
+
+	PhotonMap map;
+	float gatherRadius = 0;
+	bool active = false;
+};
+
+void CausticPhotons::trace(const Hittable& world, int photonCount, int maxDepth, uint32_t seed, ThreadPool& pool) {
+	const LightBVH& lights = sceneLights();
+	int taskCount = (photonCount + photonsPerTask - 1) / photonsPerTask;
+	vector<vector<Photon>> stored(taskCount);
+	int tasksLeft = taskCount;
+	mutex doneMutex;
+	condition_variable done;
+	for (int task = 0; task < taskCount; task++) {
+		pool.submit([&, task]() {
+			seedRandom((uint64_t(seed) << 32) | uint32_t(task));
+			useSampler(SamplerIndependent, seed);
+			int first = task * photonsPerTask, last = min(photonCount, first + photonsPerTask);
+			for (int ii = first; ii < last; ii++) {
+				float u = sample1D();
+				Sample2D uPoint = sample2D(), uDirection = sample2D();
+				Ray ray;
+				Color flux;
+				if (!lights.samplePhoton(u, uPoint, uDirection, sample1D(), ray, flux)) continue;
+				flux /= float(photonCount);
+
+				bool specular = false;
+				for (int depth = 0; depth < maxDepth; depth++) {
+					HitRecord hitRecord;
+					SurfaceHit surfaceHit;
+					surfaceHit.record = &hitRecord;
+					if (!dispatchIntersect(world, ray, 0.001, INF, surfaceHit)) break;
+					resolveHit(ray, surfaceHit, hitRecord);
+
+					const Material& material = *hitRecord.materialPtr;
+					if (material.kind == MaterialLambertian) {
+						if (specular) {
+							Photon photon;
+							photon.position = hitRecord.p;
+							photon.direction = -1 * unitVector(ray.direction());
+							photon.power = flux;
+							stored[task].push_back(photon);
+						}
+						break;
+					}
+					if (material.kind != MaterialMetal && material.kind != MaterialDielectric) break;
+
+					Color attenuation;
+					Ray scattered;
+					if (!dispatchScatter(material, ray, hitRecord, attenuation, scattered)) break;
+					flux = flux * attenuation;
+					ray = scattered;
+					specular = true;
+				}
+			}
+			lock_guard<mutex> lock(doneMutex);
+			if (--tasksLeft == 0) done.notify_all();
+		});
+	}
+	{
+		unique_lock<mutex> lock(doneMutex);
+		done.wait(lock, [&]() { return tasksLeft == 0; });
+	}
+
+	vector<Photon> photons;
+	for (const vector<Photon>& taskPhotons : stored) photons.insert(photons.end(), taskPhotons.begin(), taskPhotons.end());
+	map.build(move(photons));
+	active = true;
+}
+
+Color CausticPhotons::irradiance(const Point3& p, const Vec3& normal) const {
+	if (map.empty() || gatherRadius <= 0) return Color(0, 0, 0);
+	Color sum;
+	map.gather(p, gatherRadius, [&](const Photon& photon) {
+		if (dot(photon.direction, normal) > 0) sum += photon.power;
+	});
+	return sum / (PI * gatherRadius * gatherRadius);
+}
+
+float CausticPhotons::typicalRadius(int k, int count) const {
+	if (map.empty()) return 0;
+	k = min(k, int(map.size()));
+	size_t step = max(size_t(1), map.size() / size_t(count));
+	vector<float> distances;
+	for (size_t ii = 0; ii < map.size(); ii += step) {
+		float distance = map.nearestDistance(map[ii].position, k);
+		if (distance < INF) distances.push_back(distance);
+	}
+	if (distances.empty()) return 0;
+	nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+	return distances[distances.size() / 2];
+}
+
+// Caustic photons of the scene being rendered; the photon-mapped render
+// traces them before each pass and disables them when done.
+inline CausticPhotons& sceneCaustics() {
+	static CausticPhotons caustics;
+	return caustics;
+}
+
+#endif // !PHOTON_MAP_H
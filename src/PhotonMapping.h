@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef PHOTON_MAPPING_H
+#define PHOTON_MAPPING_H
+
+// Photon-mapped render: caustics from a photon map, the rest path traced.
+//
+// Each pass traces a fresh caustic photon map (see PhotonMap.h) and then its
+// share of the samples per pixel, continuing the sample indices of the pass
+// before. With one pass this is a plain photon map, whose caustics are
+// blurred over the gather radius. With several, the radius shrinks after
+// pass i as r^2 <- r^2 (i + alpha) / (i + 1) (Knaus and Zwicker, "Progressive
+// Photon Mapping: A Probabilistic Approach", 2011): slowly enough that the
+// noise of the passes still averages out, while their blur goes to zero.
+// Photons and rows are traced by a ThreadPool.
+
+#include "RTNW.h"
+#include "Camera.h"
+#include "Color.h"
+#include "Render.h"
+#include "Sampler.h"
+#include "PhotonMap.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+struct PhotonOptions {
+	int photonsPerPass = 200000; // emitted, not stored
+	int passes = 1;              // > 1: progressive
+	float radius = 0;            // gather radius of the first pass; <= 0: from the photons' spacing
+	float alpha = 2.0f / 3;      // share of the photons a pass keeps in the shrinking radius
+	int threadCount = 0;         // <= 0: one per hardware thread
+};
+
+// Render samplesPerPixel samples per pixel into pixels (sums, as samplePixel
+// returns them) with caustics from sceneCaustics().
+void renderPhotonMapped(const Camera& camera, const Hittable& world, const Color& backgroundColor,
+	int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth, SamplerType sampler,
+	const PhotonOptions& options, vector<Color>& pixels) {
+	using Clock = chrono::steady_clock;
+	Clock::time_point start = Clock::now();
+	auto milliseconds = [&]() { return chrono::duration<double, milli>(Clock::now() - start).count(); };
+
+	CausticPhotons& caustics = sceneCaustics();
+	ThreadPool pool(options.threadCount);
+	int passes = max(1, min(options.passes, samplesPerPixel));
+	pixels.assign(size_t(imageWidth) * imageHeight, Color());
+	vector<Color> passPixels(pixels.size());
+	float radius2 = options.radius * options.radius;
+	for (int pass = 0; pass < passes; pass++) {
+		caustics.trace(world, options.photonsPerPass, maxDepth, uint32_t(pass), pool);
+		if (pass == 0 && options.radius <= 0) {
+			float radius = caustics.typicalRadius();
+			radius2 = radius * radius;
+		}
+		caustics.setRadius(sqrtf(radius2));
+
+		int firstSample = samplesPerPixel * pass / passes;
+		int passSamples = samplesPerPixel * (pass + 1) / passes - firstSample;
+		renderPass(pool, camera, world, backgroundColor, imageWidth, imageHeight, passSamples, maxDepth,
+			sampler, 0, passPixels, firstSample);
+		for (size_t ii = 0; ii < pixels.size(); ii++) pixels[ii] += passPixels[ii];
+		cout << "Photon pass " << pass + 1 << "/" << passes << ": " << caustics.photons().size()
+			<< " caustic photons, radius " << caustics.radius() << ", " << passSamples << " spp, "
+			<< milliseconds() << " ms" << endl;
+
+		radius2 *= (pass + 1 + options.alpha) / (pass + 2);
+	}
+	caustics.disable();
+}
+
+#endif // !PHOTON_MAPPING_H
@@ -0,0 +1,162 @@
+#pragma once
+
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+// Progressive preview: a coarse image after a few milliseconds, refined in
+// stages up to the full render, so a bad camera or material shows before the
+// full sample count has been paid for.
+//
+// The first stages trace one path per block of pixels, 4x4 (1/16 of the
+// pixels) and then 2x2, and fill the block with it. From then on every pixel
+// is traced, and each stage doubles the samples per pixel until the requested
+// count. The full-resolution stages continue each other's sample indices, so
+// the last stage holds exactly the samples of a normal render; only the
+// coarse stages are extra work, under half a sample per pixel.
+//
+// After every stage the image is written to PreviewOutput::imagePath through
+// a temporary file and a rename, so a viewer that reloads it never reads half
+// an image, and appended as a binary PPM frame to PreviewOutput::pipePath,
+// e.g. a FIFO read by `ffplay -f image2pipe -i <fifo>`.
+
+#include "RTNW.h"
+#include "Color.h"
+#include "Render.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct PreviewStage {
+	int blockSize;   // pixels per block side; 1 traces every pixel
+	int firstSample; // sample index the stage starts at
+	int samples;     // samples per block or pixel in this stage
+};
+
+struct PreviewOutput {
+	string imagePath; // rewritten after every stage; empty for none
+	string pipePath;  // one P6 frame per stage; empty for none
+};
+
+// Stages for a final image of samplesPerPixel samples.
+vector<PreviewStage> previewStages(int samplesPerPixel) {
+	vector<PreviewStage> stages;
+	for (int blockSize = 4; blockSize > 1; blockSize /= 2)
+		stages.push_back(PreviewStage{ blockSize, 0, 1 });
+
+	int done = 0;
+	while (done < samplesPerPixel) {
+		int samples = min(max(done, 1), samplesPerPixel - done);
+		stages.push_back(PreviewStage{ 1, done, samples });
+		done += samples;
+	}
+	return stages;
+}
+
+// Run stage over the image. Coarse stages and the first full-resolution stage
+// overwrite sums; later stages add to them.
+void renderPreviewStage(const Camera& camera, const Hittable& world, const Color& backgroundColor,
+	const PreviewStage& stage, int imageWidth, int imageHeight, int maxDepth, vector<Color>& sums) {
+	int block = stage.blockSize;
+	for (int h0 = 0; h0 < imageHeight; h0 += block) {
+		for (int w0 = 0; w0 < imageWidth; w0 += block) {
+			if (block == 1) {
+				Color color = samplePixel(camera, world, backgroundColor, w0, h0,
+					imageWidth, imageHeight, stage.samples, maxDepth, stage.firstSample);
+				Color& sum = sums[h0 * imageWidth + w0];
+				if (stage.firstSample == 0) sum = color; // replaces the coarse stages
+				else sum += color;
+				continue;
+			}
+
+			// Trace the block's center pixel, or the nearest one inside the image.
+			int w = min(w0 + block / 2, imageWidth - 1);
+			int h = min(h0 + block / 2, imageHeight - 1);
+			Color color = samplePixel(camera, world, backgroundColor, w, h,
+				imageWidth, imageHeight, stage.samples, maxDepth, stage.firstSample);
+			for (int y = h0; y < min(h0 + block, imageHeight); y++)
+				for (int x = w0; x < min(w0 + block, imageWidth); x++)
+					sums[y * imageWidth + x] = color;
+		}
+	}
+}
+
+// Replace path with the image, through a temporary file.
+bool writePreviewImage(const string& path, const vector<Color>& sums, int imageWidth, int imageHeight, int samplesPerPixel) {
+	string tmpPath = path + ".tmp";
+	{
+		ofstream imageFile(tmpPath);
+		if (!imageFile) return false;
+		imageFile << "P3\n" << imageWidth << " " << imageHeight << "\n" << "255\n" << endl;
+		for (const Color& pixelColor : sums) writeColor(imageFile, pixelColor, samplesPerPixel);
+		if (!imageFile) return false;
+	}
+#ifdef _WIN32
+	remove(path.c_str()); // rename() does not replace on Windows
+#endif
+	return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+void writePreviewFrame(ostream& out, const vector<Color>& sums, int imageWidth, int imageHeight, int samplesPerPixel) {
+	out << "P6\n" << imageWidth << " " << imageHeight << "\n255\n";
+	for (const Color& pixelColor : sums) writeColorBytes(out, pixelColor, samplesPerPixel);
+	out.flush();
+}
+
+// Render progressively into sums, which end up as a normal render's sums of
+// samplesPerPixel samples. False if an output could not be written.
+bool renderPreview(const Camera& camera, const Hittable& world, const Color& backgroundColor,
+	int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth,
+	const PreviewOutput& output, vector<Color>& sums) {
+	using Clock = chrono::steady_clock;
+	Clock::time_point start = Clock::now();
+
+	ofstream pipe;
+	if (!output.pipePath.empty()) {
+		// Opening a FIFO blocks until the viewer opens its end.
+		pipe.open(output.pipePath, ios::binary);
+		if (!pipe) {
+			cerr << "Cannot open preview pipe " << output.pipePath << "\n";
+			return false;
+		}
+#ifndef _WIN32
+		// A closed viewer should end the stream, not the render.
+		signal(SIGPIPE, SIG_IGN);
+#endif
+	}
+
+	sums.assign(imageWidth * imageHeight, Color());
+	vector<PreviewStage> stages = previewStages(samplesPerPixel);
+	for (size_t ii = 0; ii < stages.size(); ii++) {
+		const PreviewStage& stage = stages[ii];
+		renderPreviewStage(camera, world, backgroundColor, stage, imageWidth, imageHeight, maxDepth, sums);
+
+		int samplesSoFar = stage.blockSize > 1 ? stage.samples : stage.firstSample + stage.samples;
+		if (!output.imagePath.empty() && !writePreviewImage(output.imagePath, sums, imageWidth, imageHeight, samplesSoFar)) {
+			cerr << "Cannot write preview image " << output.imagePath << "\n";
+			return false;
+		}
+		if (pipe.is_open()) {
+			writePreviewFrame(pipe, sums, imageWidth, imageHeight, samplesSoFar);
+			if (!pipe) {
+				cerr << "Preview pipe closed; rendering on without it.\n";
+				pipe.close();
+			}
+		}
+
+		double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+		cout << "Preview stage " << ii + 1 << "/" << stages.size() << ": "
+			<< (imageWidth + stage.blockSize - 1) / stage.blockSize << "x"
+			<< (imageHeight + stage.blockSize - 1) / stage.blockSize << ", "
+			<< samplesSoFar << " spp, " << ms << " ms" << endl;
+	}
+	return true;
+}
+
+#endif // !PREVIEW_H
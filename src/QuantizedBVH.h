@@ -0,0 +1,424 @@
+#pragma once
+
+#ifndef QUANTIZED_BVH_H
+#define QUANTIZED_BVH_H
+
+// BVH with compressed nodes, for scenes whose tree does not fit in cache.
+//
+// A BVHNode is a heap object of about 90 bytes: a vtable pointer, two
+// shared_ptrs and a full-precision box, plus a control block unless it comes
+// from a SceneArena. QuantizedBVH flattens such a tree into one array of
+// 16-byte nodes, four per cache line. A node stores the boxes of its two
+// children as 8-bit offsets in 1/255ths of its own box, rounded outwards, and
+// one 32-bit link that, with two flag bits, locates both children:
+//
+//   left child   a node: the next one in the array; a leaf: primitives[index]
+//   right child  a node: the next one if the left child is a leaf, else
+//                nodes[index]; a leaf: primitives[index + 1] if the left child
+//                is a leaf too, else primitives[index]
+//
+// Only the root box is kept in full precision. Traversal decodes each child
+// box from its parent's, with the same arithmetic the build used, so the
+// decoded boxes always contain the exact ones. Children are visited nearest
+// first, and subtrees behind the closest hit so far are skipped.
+//
+// The topology is that of the BVHNode the tree is made from; moving
+// primitives need a new QuantizedBVH (see BVHNode::refit for the alternative).
+
+#include "RTNW.h"
+#include "Hittable.h"
+#include "BVHNode.h"
+#include "Stats.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+struct QuantizedBVHNode {
+	uint8_t lo[2][3]; // child bounds per axis, 0 = this node's min, 255 = its max
+	uint8_t hi[2][3];
+	uint32_t link;    // flags above, index below, see the header comment
+
+	static constexpr uint32_t leftLeaf = 1u << 31;
+	static constexpr uint32_t rightLeaf = 1u << 30;
+	static constexpr uint32_t singleChild = 1u << 29; // one leaf, primitives[index]; only at the root
+	static constexpr uint32_t indexMask = singleChild - 1;
+};
+
+// Box of a node, in which its children's bounds are quantized.
+struct QuantizedFrame {
+	float origin[3];
+	float scale[3]; // a step of the 8-bit grid
+
+	QuantizedFrame() {}
+
+	// The step is widened by a small fraction of the coordinates' magnitude, so
+	// that 255 steps from lo reach at least hi despite rounding.
+	QuantizedFrame(const float lo[3], const float hi[3]) {
+		for (int ii = 0; ii < 3; ii++) {
+			origin[ii] = lo[ii];
+			scale[ii] = (hi[ii] - lo[ii]) * (1.0f / 255) + (fabsf(lo[ii]) + fabsf(hi[ii])) * (1.0f / 255 / 65536);
+		}
+	}
+
+	float decode(int axis, uint8_t q) const { return origin[axis] + q * scale[axis]; }
+
+	void decodeChild(const QuantizedBVHNode& node, int child, float lo[3], float hi[3]) const {
+		for (int ii = 0; ii < 3; ii++) {
+			lo[ii] = decode(ii, node.lo[child][ii]);
+			hi[ii] = decode(ii, node.hi[child][ii]);
+		}
+	}
+};
+
+class QuantizedBVH final : public Hittable {
+public:
+	// Deepest tree traversal supports; BVHNode's median splits stay far below.
+	static const int maxDepth = 64;
+
+	// Build a BVHNode over list and compress it. Like arena BVHNodes, the tree
+	// only keeps non-owning references to the primitives: list has to keep
+	// them alive.
+	QuantizedBVH(HittableList& list, float time0, float time1);
+
+	// Compress an existing tree. Refers to root's primitives, not to root.
+	QuantizedBVH(const BVHNode& root, float time0, float time1);
+
+	// Use nodeCount nodes stored elsewhere, e.g. in a mapped scene cache; they
+	// must outlive the tree. Leaf indices refer to primitives.
+	QuantizedBVH(const QuantizedBVHNode* nodes, size_t nodeCount, vector<const Hittable*> primitives, const AABB& bbox);
+
+	virtual bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const override;
+	virtual bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override;
+	virtual bool occluded(const Ray& ray, float tMin, float tMax) const override;
+	virtual int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override;
+
+	virtual bool boundingBox(float time0, float time1, AABB& outBBox) const override {
+		outBBox = bbox;
+		return true;
+	}
+
+	size_t nodeCount() const { return nodeTotal; }
+
+	// Heap and object bytes of the tree, without the primitives themselves.
+	size_t memoryBytes() const {
+		return sizeof(*this) + nodes.capacity() * sizeof(QuantizedBVHNode) + primitives.capacity() * sizeof(const Hittable*);
+	}
+
+private:
+	friend class SceneCache;
+	struct StackEntry {
+		uint32_t node;
+		float tEnter;
+		QuantizedFrame frame;
+	};
+
+	void build(const BVHNode& root, float time0, float time1);
+
+	// BVHNode stores a lone primitive as a node with both children equal; skip those.
+	static const shared_ptr<Hittable>& collapse(const shared_ptr<Hittable>& child);
+
+	// Append node (a BVHNode) and its subtree, with its children quantized in frame.
+	void flatten(const BVHNode& node, const QuantizedFrame& frame, float time0, float time1);
+
+	// Entry of the ray into box [lo, hi] clipped to [tMin, tMax]; false if it misses.
+	static bool slab(const float lo[3], const float hi[3], const Ray& ray, const Vec3& invD, float tMin, float tMax, float& tEnter);
+
+	vector<QuantizedBVHNode> nodes; // empty when the nodes are stored elsewhere
+	const QuantizedBVHNode* nodeArray = nullptr;
+	size_t nodeTotal = 0;
+	vector<const Hittable*> primitives;
+	AABB bbox;
+	QuantizedFrame rootFrame;
+};
+
+QuantizedBVH::QuantizedBVH(HittableList& list, float time0, float time1) : Hittable(HittableQuantizedBVH) {
+	BVHNode root(list, time0, time1);
+	build(root, time0, time1);
+}
+
+QuantizedBVH::QuantizedBVH(const BVHNode& root, float time0, float time1) : Hittable(HittableQuantizedBVH) {
+	build(root, time0, time1);
+}
+
+QuantizedBVH::QuantizedBVH(const QuantizedBVHNode* storedNodes, size_t nodeCount, vector<const Hittable*> leaves, const AABB& box)
+	: Hittable(HittableQuantizedBVH), nodeArray(storedNodes), nodeTotal(nodeCount), primitives(move(leaves)), bbox(box) {
+	float lo[3], hi[3];
+	for (int ii = 0; ii < 3; ii++) {
+		lo[ii] = bbox.min()[ii];
+		hi[ii] = bbox.max()[ii];
+	}
+	rootFrame = QuantizedFrame(lo, hi);
+}
+
+const shared_ptr<Hittable>& QuantizedBVH::collapse(const shared_ptr<Hittable>& child) {
+	const shared_ptr<Hittable>* current = &child;
+	while ((*current)->kind == HittableBVHNode) {
+		const BVHNode& node = static_cast<const BVHNode&>(**current);
+		if (node.leftNode != node.rightNode) break;
+		current = &node.leftNode;
+	}
+	return *current;
+}
+
+void QuantizedBVH::build(const BVHNode& root, float time0, float time1) {
+	root.boundingBox(time0, time1, bbox);
+	float lo[3], hi[3];
+	for (int ii = 0; ii < 3; ii++) {
+		lo[ii] = bbox.min()[ii];
+		hi[ii] = bbox.max()[ii];
+	}
+	rootFrame = QuantizedFrame(lo, hi);
+	flatten(root, rootFrame, time0, time1);
+	nodes.shrink_to_fit();
+	primitives.shrink_to_fit();
+	nodeArray = nodes.data();
+	nodeTotal = nodes.size();
+}
+
+void QuantizedBVH::flatten(const BVHNode& node, const QuantizedFrame& frame, float time0, float time1) {
+	size_t index = nodes.size();
+	nodes.push_back(QuantizedBVHNode());
+
+	const shared_ptr<Hittable>* children[2] = { &collapse(node.leftNode), &collapse(node.rightNode) };
+	bool single = node.leftNode == node.rightNode;
+	QuantizedFrame childFrames[2];
+	for (int child = 0; child < (single ? 1 : 2); child++) {
+		AABB box;
+		if (!(*children[child])->boundingBox(time0, time1, box)) {
+			cout << "NO bounding box is created in QuantizedBVH constructor\n";
+		}
+
+		// Round outwards, then step further out wherever the decoded value
+		// still lies inside the exact bound.
+		QuantizedBVHNode& quantized = nodes[index];
+		for (int ii = 0; ii < 3; ii++) {
+			float scale = frame.scale[ii] > 0 ? frame.scale[ii] : 1;
+			float qLo = floorf((box.min()[ii] - frame.origin[ii]) / scale);
+			float qHi = ceilf((box.max()[ii] - frame.origin[ii]) / scale);
+			int lo = int(fmin(fmax(qLo, 0.0f), 255.0f));
+			int hi = int(fmin(fmax(qHi, 0.0f), 255.0f));
+			while (lo > 0 && frame.decode(ii, uint8_t(lo)) > box.min()[ii]) lo--;
+			while (hi < 255 && frame.decode(ii, uint8_t(hi)) < box.max()[ii]) hi++;
+			quantized.lo[child][ii] = uint8_t(lo);
+			quantized.hi[child][ii] = uint8_t(hi);
+		}
+
+		float decodedLo[3], decodedHi[3];
+		frame.decodeChild(quantized, child, decodedLo, decodedHi);
+		childFrames[child] = QuantizedFrame(decodedLo, decodedHi);
+	}
+
+	if (single) {
+		nodes[index].lo[1][0] = nodes[index].lo[1][1] = nodes[index].lo[1][2] = 0;
+		nodes[index].hi[1][0] = nodes[index].hi[1][1] = nodes[index].hi[1][2] = 0;
+		nodes[index].link = QuantizedBVHNode::leftLeaf | QuantizedBVHNode::rightLeaf | QuantizedBVHNode::singleChild | uint32_t(primitives.size());
+		primitives.push_back(children[0]->get());
+		return;
+	}
+
+	bool isLeaf[2];
+	for (int child = 0; child < 2; child++) isLeaf[child] = (*children[child])->kind != HittableBVHNode;
+
+	uint32_t flags = (isLeaf[0] ? QuantizedBVHNode::leftLeaf : 0) | (isLeaf[1] ? QuantizedBVHNode::rightLeaf : 0);
+	uint32_t link = 0;
+	if (isLeaf[0]) {
+		link = uint32_t(primitives.size());
+		primitives.push_back(children[0]->get());
+		if (isLeaf[1]) primitives.push_back(children[1]->get());
+		else flatten(static_cast<const BVHNode&>(**children[1]), childFrames[1], time0, time1);
+	}
+	else {
+		flatten(static_cast<const BVHNode&>(**children[0]), childFrames[0], time0, time1);
+		if (isLeaf[1]) {
+			link = uint32_t(primitives.size());
+			primitives.push_back(children[1]->get());
+		}
+		else {
+			link = uint32_t(nodes.size());
+			flatten(static_cast<const BVHNode&>(**children[1]), childFrames[1], time0, time1);
+		}
+	}
+	assert(link <= QuantizedBVHNode::indexMask);
+	nodes[index].link = flags | link;
+}
+
+bool QuantizedBVH::slab(const float lo[3], const float hi[3], const Ray& ray, const Vec3& invD, float tMin, float tMax, float& tEnter) {
+	for (int ii = 0; ii < 3; ii++) {
+		float t0 = (lo[ii] - ray.origin()[ii]) * invD[ii];
+		float t1 = (hi[ii] - ray.origin()[ii]) * invD[ii];
+		if (invD[ii] < 0) swap(t0, t1);
+
+		tMin = t0 > tMin ? t0 : tMin;
+		tMax = t1 < tMax ? t1 : tMax;
+		if (tMax <= tMin) return false;
+	}
+	tEnter = tMin;
+	return true;
+}
+
+bool QuantizedBVH::hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+	SurfaceHit surfaceHit;
+	surfaceHit.record = &hitRecord;
+	if (!intersect(ray, tMin, tMax, surfaceHit)) return false;
+	resolveHit(ray, surfaceHit, hitRecord);
+	return true;
+}
+
+bool QuantizedBVH::intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const {
+	Vec3 invD(1 / ray.direction().x(), 1 / ray.direction().y(), 1 / ray.direction().z());
+
+	float rootLo[3] = { bbox.min().x(), bbox.min().y(), bbox.min().z() };
+	float rootHi[3] = { bbox.max().x(), bbox.max().y(), bbox.max().z() };
+	StackEntry current;
+	if (!slab(rootLo, rootHi, ray, invD, tMin, tMax, current.tEnter)) return false;
+	current.node = 0;
+	current.frame = rootFrame;
+
+	StackEntry stack[maxDepth];
+	int stackSize = 0;
+	bool hitAnything = false;
+	while (true) {
+		RTNW_STATS_INC(bvhNodesVisited);
+		const QuantizedBVHNode& node = nodeArray[current.node];
+		uint32_t index = node.link & QuantizedBVHNode::indexMask;
+		int childCount = node.link & QuantizedBVHNode::singleChild ? 1 : 2;
+
+		// Leaves first, so their hits can cull the subtrees.
+		StackEntry next[2];
+		int nextCount = 0;
+		for (int child = 0; child < childCount; child++) {
+			float lo[3], hi[3], tEnter;
+			current.frame.decodeChild(node, child, lo, hi);
+			if (!slab(lo, hi, ray, invD, tMin, tMax, tEnter)) continue;
+
+			bool leaf = node.link & (child == 0 ? QuantizedBVHNode::leftLeaf : QuantizedBVHNode::rightLeaf);
+			if (leaf) {
+				uint32_t primitive = child == 1 && (node.link & QuantizedBVHNode::leftLeaf) ? index + 1 : index;
+				if (dispatchIntersect(*primitives[primitive], ray, tMin, tMax, surfaceHit)) {
+					hitAnything = true;
+					tMax = surfaceHit.t;
+				}
+			}
+			else {
+				StackEntry& entry = next[nextCount++];
+				entry.node = child == 0 || (node.link & QuantizedBVHNode::leftLeaf) ? current.node + 1 : index;
+				entry.tEnter = tEnter;
+				entry.frame = QuantizedFrame(lo, hi);
+			}
+		}
+
+		if (nextCount == 2 && next[1].tEnter < next[0].tEnter) swap(next[0], next[1]);
+		if (nextCount == 2 && next[1].tEnter < tMax) {
+			assert(stackSize < maxDepth);
+			stack[stackSize++] = next[1];
+		}
+		if (nextCount > 0 && next[0].tEnter < tMax) {
+			current = next[0];
+			continue;
+		}
+
+		do {
+			if (stackSize == 0) return hitAnything;
+			current = stack[--stackSize];
+		} while (current.tEnter >= tMax);
+	}
+}
+
+bool QuantizedBVH::occluded(const Ray& ray, float tMin, float tMax) const {
+	Vec3 invD(1 / ray.direction().x(), 1 / ray.direction().y(), 1 / ray.direction().z());
+
+	float rootLo[3] = { bbox.min().x(), bbox.min().y(), bbox.min().z() };
+	float rootHi[3] = { bbox.max().x(), bbox.max().y(), bbox.max().z() };
+	StackEntry current;
+	if (!slab(rootLo, rootHi, ray, invD, tMin, tMax, current.tEnter)) return false;
+	current.node = 0;
+	current.frame = rootFrame;
+
+	StackEntry stack[maxDepth];
+	int stackSize = 0;
+	while (true) {
+		RTNW_STATS_INC(bvhNodesVisited);
+		const QuantizedBVHNode& node = nodeArray[current.node];
+		uint32_t index = node.link & QuantizedBVHNode::indexMask;
+		int childCount = node.link & QuantizedBVHNode::singleChild ? 1 : 2;
+
+		StackEntry next[2];
+		int nextCount = 0;
+		for (int child = 0; child < childCount; child++) {
+			float lo[3], hi[3], tEnter;
+			current.frame.decodeChild(node, child, lo, hi);
+			if (!slab(lo, hi, ray, invD, tMin, tMax, tEnter)) continue;
+
+			bool leaf = node.link & (child == 0 ? QuantizedBVHNode::leftLeaf : QuantizedBVHNode::rightLeaf);
+			if (leaf) {
+				uint32_t primitive = child == 1 && (node.link & QuantizedBVHNode::leftLeaf) ? index + 1 : index;
+				if (dispatchOccluded(*primitives[primitive], ray, tMin, tMax)) return true;
+			}
+			else {
+				StackEntry& entry = next[nextCount++];
+				entry.node = child == 0 || (node.link & QuantizedBVHNode::leftLeaf) ? current.node + 1 : index;
+				entry.tEnter = tEnter;
+				entry.frame = QuantizedFrame(lo, hi);
+			}
+		}
+
+		// Nearest first, as in intersect(): shadow rays are usually blocked
+		// near one of their ends.
+		if (nextCount == 2 && next[1].tEnter < next[0].tEnter) swap(next[0], next[1]);
+		if (nextCount == 2) {
+			assert(stackSize < maxDepth);
+			stack[stackSize++] = next[1];
+		}
+		if (nextCount > 0) current = next[0];
+		else if (stackSize > 0) current = stack[--stackSize];
+		else return false;
+	}
+}
+
+int QuantizedBVH::intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const {
+	Vec3 invD(1 / ray.direction().x(), 1 / ray.direction().y(), 1 / ray.direction().z());
+
+	float rootLo[3] = { bbox.min().x(), bbox.min().y(), bbox.min().z() };
+	float rootHi[3] = { bbox.max().x(), bbox.max().y(), bbox.max().z() };
+	StackEntry current;
+	if (!slab(rootLo, rootHi, ray, invD, tMin, tMax, current.tEnter)) return 0;
+	current.node = 0;
+	current.frame = rootFrame;
+
+	StackEntry stack[maxDepth];
+	int stackSize = 0;
+	int count = 0;
+	while (true) {
+		RTNW_STATS_INC(bvhNodesVisited);
+		const QuantizedBVHNode& node = nodeArray[current.node];
+		uint32_t index = node.link & QuantizedBVHNode::indexMask;
+		int childCount = node.link & QuantizedBVHNode::singleChild ? 1 : 2;
+
+		for (int child = 0; child < childCount; child++) {
+			float lo[3], hi[3], tEnter;
+			current.frame.decodeChild(node, child, lo, hi);
+			if (!slab(lo, hi, ray, invD, tMin, tMax, tEnter)) continue;
+
+			bool leaf = node.link & (child == 0 ? QuantizedBVHNode::leftLeaf : QuantizedBVHNode::rightLeaf);
+			if (leaf) {
+				uint32_t primitive = child == 1 && (node.link & QuantizedBVHNode::leftLeaf) ? index + 1 : index;
+				count += primitives[primitive]->intervals(ray, tMin, tMax, out + count, maxIntervals - count);
+			}
+			else {
+				assert(stackSize < maxDepth);
+				StackEntry& entry = stack[stackSize++];
+				entry.node = child == 0 || (node.link & QuantizedBVHNode::leftLeaf) ? current.node + 1 : index;
+				entry.frame = QuantizedFrame(lo, hi);
+			}
+		}
+
+		if (stackSize == 0) break;
+		current = stack[--stackSize];
+	}
+	return mergeIntervals(out, count);
+}
+
+#endif // !QUANTIZED_BVH_H
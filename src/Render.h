@@ -0,0 +1,272 @@
+#pragma once
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "RTNW.h"
+#include "Ray.h"
+#include "Hittable.h"
+#include "Material.h"
+#include "Color.h"
+#include "Camera.h"
+#include "Stats.h"
+#include "Dispatch.h"
+#include "Sampler.h"
+#include "LightBVH.h"
+#include "EnvironmentMap.h"
+#include "SDTree.h"
+#include "PhotonMap.h"
+#include "ThreadPool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// Surface a path left after sampling the emitters and the environment at
+// it: what weighing the light its bounce then finds takes.
+struct LightSampledVertex {
+	Point3 p;
+	Vec3 normal;
+	float bouncePdf; // solid angle density of the bounce
+};
+
+// Where a path stands towards the caustic photon map: the emitters a path
+// finds by bouncing off a diffuse surface and then only off specular ones
+// are the light the photons bring (see PhotonMap.h).
+enum CausticPath {
+	CausticNone,     // from the camera, or from a medium
+	CausticDiffuse,  // straight from a diffuse surface
+	CausticSpecular  // from a diffuse surface, then only off Metal and Dielectric
+};
+
+// Balance between two strategies for the same light, by the power heuristic.
+inline float powerHeuristic(float pdf, float otherPdf) {
+	float a = pdf * pdf, b = otherPdf * otherPdf;
+	return a + b > 0 ? a / (a + b) : 0;
+}
+
+// Share of the bounces at a guided vertex drawn from the learned light
+// rather than the BSDF.
+const float guideFraction = 0.5f;
+
+// Density of a Lambertian surface's bounce taking direction (unit length),
+// mixed with guide's when the bounce is guided.
+inline float lambertianBouncePdf(const DirectionalTree* guide, const Vec3& direction, float cosTheta) {
+	float pdf = cosineHemispherePdf(cosTheta);
+	return guide ? guideFraction * guide->pdf(direction) + (1 - guideFraction) * pdf : pdf;
+}
+
+// Redraw bounce, which the material sampled, from the mixture of the BSDF
+// and guide. For Lambertian surfaces and isotropic media the BSDF times the
+// cosine is the albedo times the BSDF's own density, so the bounce's weight
+// relative to the albedo is that density over the mixture's. Returns the
+// mixture's density, 0 if the bounce carries no light.
+inline float guideBounce(const DirectionalTree& guide, const HitRecord& hitRecord, bool lambertian, Ray& bounce, float& weight) {
+	Vec3 direction;
+	float guidePdf;
+	if (sample1D() < guideFraction) {
+		direction = guide.sample(sample2D(), guidePdf);
+		bounce = Ray(hitRecord.p, direction, bounce.time());
+	}
+	else {
+		direction = unitVector(bounce.direction());
+		guidePdf = guide.pdf(direction);
+	}
+	float bsdfPdf = lambertian ? cosineHemispherePdf(dot(direction, hitRecord.normal)) : uniformSpherePdf();
+	float pdf = guideFraction * guidePdf + (1 - guideFraction) * bsdfPdf;
+	weight = pdf > 0 ? bsdfPdf / pdf : 0;
+	return weight > 0 ? pdf : 0;
+}
+
+// Light reaching a Lambertian surface at hitRecord from one emitter picked by
+// sceneLights(), times the cosine and the BRDF's 1 / pi, over the sample's
+// density. Weighted against finding the emitter with the bounce, which
+// region guides if it has learned anything; recorded into region when the
+// guide is learning. The caller multiplies by the albedo.
+inline Color sampleDirectLight(const Hittable& world, const HitRecord& hitRecord, float time,
+	const GuideRegion* region = nullptr) {
+	float u = sample1D();
+	Sample2D uPoint = sample2D();
+	LightSample lightSample;
+	if (!sceneLights().sample(hitRecord.p, hitRecord.normal, time, u, uPoint, lightSample)) return Color(0, 0, 0);
+
+	float cosTheta = dot(lightSample.direction, hitRecord.normal);
+	if (cosTheta <= 0) return Color(0, 0, 0);
+
+	RTNW_STATS_INC(shadowRays);
+	Ray shadowRay(hitRecord.p, lightSample.direction, time);
+	if (dispatchOccluded(world, shadowRay, 0.001, 0.999f * lightSample.distance)) return Color(0, 0, 0);
+	if (!sceneShadowMedia().empty()) {
+		lightSample.radiance *= sceneShadowMedia().transmittance(shadowRay, 0.001, 0.999f * lightSample.distance);
+	}
+	const DirectionalTree* guide = region ? region->samplingTree() : nullptr;
+	float weight = powerHeuristic(lightSample.pdf, lambertianBouncePdf(guide, lightSample.direction, cosTheta));
+	if (region && scenePathGuide().recording())
+		region->record(lightSample.direction, weight * brightness(lightSample.radiance), lightSample.pdf);
+	return weight * cosTheta / (PI * lightSample.pdf) * lightSample.radiance;
+}
+
+// Same for the light of sceneEnvironment(), drawn from its alias table.
+inline Color sampleEnvironmentLight(const Hittable& world, const HitRecord& hitRecord, float time,
+	const GuideRegion* region = nullptr) {
+	Sample2D u = sample2D();
+	Vec3 direction;
+	Color radiance;
+	float pdf;
+	if (!sceneEnvironment().sample(u, direction, radiance, pdf)) return Color(0, 0, 0);
+
+	float cosTheta = dot(direction, hitRecord.normal);
+	if (cosTheta <= 0) return Color(0, 0, 0);
+
+	RTNW_STATS_INC(shadowRays);
+	Ray shadowRay(hitRecord.p, direction, time);
+	if (dispatchOccluded(world, shadowRay, 0.001, INF)) return Color(0, 0, 0);
+	if (!sceneShadowMedia().empty()) radiance *= sceneShadowMedia().transmittance(shadowRay, 0.001, INF);
+	const DirectionalTree* guide = region ? region->samplingTree() : nullptr;
+	float weight = powerHeuristic(pdf, lambertianBouncePdf(guide, direction, cosTheta));
+	if (region && scenePathGuide().recording()) region->record(direction, weight * brightness(radiance), pdf);
+	return weight * cosTheta / (PI * pdf) * radiance;
+}
+
+// bounce counts the segments traced before this one along the path (0 for camera rays).
+// from is the surface the ray leaves if that sampled the emitters and the environment.
+// caustic is what the path bounced off last, for the photon map.
+Color rayColor(const Ray& ray, const Color& backgroundColor, const Hittable& world, int depth, int bounce = 0,
+	const LightSampledVertex* from = nullptr, CausticPath caustic = CausticNone) {
+	if (depth <= 0) {
+		RTNW_STATS_INC(pathsTerminatedByDepth);
+		return Color(0, 0, 0);
+	}
+	RTNW_STATS_RAY(bounce);
+	
+	//if (Vec3::isNan(ray.direction()) || Point3::isNan(ray.origin()))
+	//	return Color(0, 0, 0);
+
+	// Traversal keeps only the closest hit's t and primitive; the record is
+	// made once, after it.
+	HitRecord hitRecord;
+	SurfaceHit surfaceHit;
+	surfaceHit.record = &hitRecord;
+	if (!dispatchIntersect(world, ray, 0.001, INF, surfaceHit)) {
+		RTNW_STATS_INC(pathsEscaped);
+		const EnvironmentMap& environment = sceneEnvironment();
+		if (environment.empty()) return backgroundColor;
+		Color sky = environment.lookup(ray.direction());
+		if (from) sky *= powerHeuristic(from->bouncePdf, environment.pdf(unitVector(ray.direction())));
+		return sky;
+	}
+	resolveHit(ray, surfaceHit, hitRecord);
+
+	Ray reflectedRay;
+	Color attenuation;
+	const Material& material = *hitRecord.materialPtr;
+	Color emitted = dispatchEmitted(material, hitRecord.u, hitRecord.v, hitRecord.p);
+	// An emitter the last surface could also have sampled shares its light
+	// with that sample.
+	if (from && material.kind == MaterialDiffuseLight) {
+		emitted *= powerHeuristic(from->bouncePdf, sceneLights().pdf(from->p, from->normal, surfaceHit, hitRecord));
+	}
+	// That of a caustic path is in the photon map.
+	const CausticPhotons& caustics = sceneCaustics();
+	if (caustic == CausticSpecular && caustics.enabled() && material.kind == MaterialDiffuseLight
+		&& sceneLights().contains(surfaceHit)) {
+		emitted = Color(0, 0, 0);
+	}
+
+	if (!dispatchScatter(material, ray, hitRecord, attenuation, reflectedRay)) {
+		RTNW_STATS_INC(pathsAbsorbed);
+		return emitted;
+	}
+
+	// In a guided render, diffuse surfaces and media look up what their region
+	// of the scene has learned, draw their bounce from it part of the time,
+	// and record what they find (see SDTree.h).
+	bool lambertian = material.kind == MaterialLambertian;
+	const PathGuide& guide = scenePathGuide();
+	const GuideRegion* region = nullptr;
+	const DirectionalTree* guideTree = nullptr;
+	float bounceWeight = 1, bouncePdf = 0;
+	if (guide.enabled() && (lambertian || material.kind == MaterialIsotropic)) {
+		region = &guide.regionAt(hitRecord.p);
+		guideTree = region->samplingTree();
+		if (guideTree) bouncePdf = guideBounce(*guideTree, hitRecord, lambertian, reflectedRay, bounceWeight);
+		else bouncePdf = lambertian ? cosineHemispherePdf(dot(unitVector(reflectedRay.direction()), hitRecord.normal)) : uniformSpherePdf();
+	}
+
+	// Diffuse surfaces also sample the emitters and the environment for their
+	// direct light, and gather the caustic photons around them.
+	bool hasLights = !sceneLights().empty(), hasEnvironment = !sceneEnvironment().empty();
+	if (lambertian && (hasLights || hasEnvironment)) {
+		Color direct;
+		if (hasLights) direct += sampleDirectLight(world, hitRecord, ray.time(), region);
+		if (hasEnvironment) direct += sampleEnvironmentLight(world, hitRecord, ray.time(), region);
+		if (caustics.enabled()) direct += caustics.irradiance(hitRecord.p, hitRecord.normal) / PI;
+		if (bounceWeight <= 0) return emitted + attenuation * direct;
+		Vec3 direction = unitVector(reflectedRay.direction());
+		LightSampledVertex vertex{ hitRecord.p, hitRecord.normal,
+			region ? bouncePdf : cosineHemispherePdf(dot(direction, hitRecord.normal)) };
+		Color incoming = rayColor(reflectedRay, backgroundColor, world, depth - 1, bounce + 1, &vertex, CausticDiffuse);
+		if (region && guide.recording()) region->record(direction, brightness(incoming), bouncePdf);
+		return emitted + attenuation * (direct + bounceWeight * incoming);
+	}
+
+	if (bounceWeight <= 0) return emitted;
+	bool specular = material.kind == MaterialMetal || material.kind == MaterialDielectric;
+	CausticPath next = specular && caustic != CausticNone ? CausticSpecular : (lambertian ? CausticDiffuse : CausticNone);
+	Color incoming = rayColor(reflectedRay, backgroundColor, world, depth - 1, bounce + 1, nullptr, next);
+	if (region && guide.recording()) region->record(unitVector(reflectedRay.direction()), brightness(incoming), bouncePdf);
+	return emitted + attenuation * bounceWeight * incoming;
+}
+
+// Sum of samplesPerPixel camera paths through pixel (w, h), rows counted from the top.
+// The caller divides by the sample count (see writeColor). Samples come from
+// the calling thread's sampler (see useSampler), starting at sample index
+// firstSample so a pixel can be refined in several calls.
+Color samplePixel(const Camera& camera, const Hittable& world, const Color& backgroundColor,
+	int w, int h, int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth, int firstSample = 0) {
+	Color pixelColor;
+	Sampler& sampler = threadSampler();
+	for (int ii = firstSample; ii < firstSample + samplesPerPixel; ii++) {
+		sampler.startPixelSample(w, h, ii);
+		Sample2D jitter = sampler.get2D();
+		float v = 1 - (h + jitter.y) / (imageHeight - 1.0);
+		float u = (w + jitter.x) / (imageWidth - 1.0);
+
+		Ray ray = camera.getRay(u, v);
+		pixelColor += rayColor(ray, backgroundColor, world, maxDepth);
+	}
+	return pixelColor;
+}
+
+// Trace samplesPerPixel samples per pixel, from sample index firstSample, of
+// the image into pixels (sums, as samplePixel returns them) with threads from
+// pool. seed decorrelates passes that restart the sample indices.
+void renderPass(ThreadPool& pool, const Camera& camera, const Hittable& world, const Color& backgroundColor,
+	int imageWidth, int imageHeight, int samplesPerPixel, int maxDepth, SamplerType sampler, uint32_t seed,
+	vector<Color>& pixels, int firstSample = 0) {
+	int rowsLeft = imageHeight;
+	mutex doneMutex;
+	condition_variable done;
+	for (int h = 0; h < imageHeight; h++) {
+		pool.submit([&, h]() {
+			// Seeded per row and pass, so the independent sampler does not
+			// repeat a pass that continues the sample indices of another.
+			// What the rows add to shared state, such as the path guide's
+			// sums, still comes in whatever order the threads do.
+			seedRandom((uint64_t(hashCombine(seed, uint32_t(firstSample))) << 32) | uint32_t(h));
+			useSampler(sampler, seed);
+			for (int w = 0; w < imageWidth; w++) {
+				pixels[size_t(h) * imageWidth + w] = samplePixel(camera, world, backgroundColor, w, h,
+					imageWidth, imageHeight, samplesPerPixel, maxDepth, firstSample);
+			}
+			// Counted under the lock: the waiter may not return, and end the
+			// mutex's life, before the last row has let go of it.
+			lock_guard<mutex> lock(doneMutex);
+			if (--rowsLeft == 0) done.notify_all();
+		});
+	}
+	unique_lock<mutex> lock(doneMutex);
+	done.wait(lock, [&]() { return rowsLeft == 0; });
+}
+
+#endif // !RENDER_H
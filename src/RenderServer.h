@@ -0,0 +1,425 @@
+#pragma once
+
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+// Long-running render server.
+//
+// The scene, its textures and its BVH are built once; render requests then
+// only pay for the pixels. Requests are rendered row by row on one shared
+// thread pool, so concurrent requests share the cores instead of fighting
+// over them.
+//
+// Clients connect to a unix or tcp socket (addresses as in Distributed.h)
+// and send one command per line; every reply is one line as well.
+//
+//   render [width=px] [height=px] [spp=n] [depth=n] [from=x,y,z] [at=x,y,z]
+//          [vfov=degrees] [aperture=a] [focus=distance] [sampler=name] [seed=n]
+//          [output=file.ppm]
+//       Replies "job <id>" at once, then "done <id> ..." with the job's
+//       timing, or "cancelled <id>". Unset values come from the scene.
+//       Equal requests give equal images. Images are at most
+//       maxImageSide pixels on a side and maxImagePixels in all; spp and
+//       depth are capped too, so a request cannot take the server down.
+//   cancel <id>     Stops a queued or running job; rows already started finish.
+//   metrics         Throughput counters since the server started.
+//   shutdown        Cancels all jobs and stops the server.
+//
+// Every connection is served by its own thread and a render blocks only its
+// own connection, so cancel a job from a second connection.
+
+#ifndef _WIN32
+
+#include "RTNW.h"
+#include "Color.h"
+#include "Distributed.h"
+#include "Render.h"
+#include "Scenes.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+struct ServerJob {
+	ServerJob(int jobId, const SceneSettings& s, int w, int h, uint32_t randomSeed, const string& path)
+		: id(jobId), settings(s), width(w), height(h), seed(randomSeed), output(path), camera(sceneCamera(s)),
+		pixels(size_t(w) * h), rowsLeft(h) {}
+
+	int id;
+	SceneSettings settings;
+	int width, height;
+	uint32_t seed;
+	string output;
+	Camera camera;
+	vector<Color> pixels;
+
+	atomic<bool> cancelled{ false };
+	atomic<int> rowsLeft;
+	atomic<long long> startNanoseconds{ 0 }; // when the first row started, since the server started
+
+	mutex doneMutex;
+	condition_variable doneChanged;
+	bool finished = false;
+};
+
+class RenderServer {
+public:
+	static constexpr int maxImageSide = 16384;
+	static constexpr long long maxImagePixels = 1 << 26;
+	static constexpr int maxSamplesPerPixel = 1 << 20;
+	static constexpr int maxPathDepth = 1024;
+
+	// environmentPath and environmentScale are as for useEnvironment(); run()
+	// fails if the environment map cannot be read.
+	RenderServer(int sceneId, bool motionBVH, int temporalSplits, bool quantizedBVH, int threadCount,
+		const string& environmentPath = string(), float environmentScale = 1);
+
+	// Serve address until a client sends shutdown. Returns the exit code.
+	int run(const string& address);
+
+private:
+	using Clock = chrono::steady_clock;
+
+	void serveConnection(int fd);
+	string handleCommand(int fd, const string& line);
+	string handleRender(int fd, istringstream& args);
+	void renderRow(const shared_ptr<ServerJob>& job, int h);
+	long long nanosecondsSinceStart() const {
+		return chrono::duration_cast<chrono::nanoseconds>(Clock::now() - startTime).count();
+	}
+
+	SceneArena arena;
+	HittableList world;
+	HittableList scene;
+	SceneSettings sceneSettings;
+	ThreadPool pool;
+	Clock::time_point startTime;
+	bool sceneReady = false;
+
+	mutex jobsMutex;
+	map<int, shared_ptr<ServerJob>> jobs; // queued or running
+	int nextJobId = 1;
+
+	mutex clientsMutex;
+	set<int> clients;
+	atomic<int> openConnections{ 0 };
+	atomic<bool> stopping{ false };
+
+	atomic<long long> jobsDone{ 0 };
+	atomic<long long> jobsCancelled{ 0 };
+	atomic<long long> samplesRendered{ 0 };
+	atomic<long long> busyNanoseconds{ 0 }; // summed over pool threads
+};
+
+RenderServer::RenderServer(int sceneId, bool motionBVH, int temporalSplits, bool quantizedBVH, int threadCount,
+	const string& environmentPath, float environmentScale)
+	: pool(threadCount) {
+	loadScene(sceneId, world, sceneSettings, arena);
+	scene.add(buildSceneBVH(world, arena, motionBVH, temporalSplits, quantizedBVH));
+	sceneLights().build(world);
+	sceneShadowMedia().collect(world);
+	sceneReady = useEnvironment(sceneSettings, environmentPath, environmentScale);
+	startTime = Clock::now();
+}
+
+int RenderServer::run(const string& address) {
+	if (!sceneReady) return 1;
+	int listenFd = openSocket(address, false);
+	if (listenFd < 0) {
+		cerr << "ERROR: Server could not listen on " << address << ".\n";
+		return 1;
+	}
+	cout << "Serving on " << address << " with " << pool.size() << " threads.\n" << flush;
+
+	while (!stopping) {
+		pollfd pfd{ listenFd, POLLIN, 0 };
+		if (poll(&pfd, 1, 200) <= 0) continue;
+
+		int fd = accept(listenFd, nullptr, nullptr);
+		if (fd < 0) continue;
+		{
+			lock_guard<mutex> lock(clientsMutex);
+			clients.insert(fd);
+		}
+		openConnections++;
+		thread([this, fd]() { serveConnection(fd); }).detach();
+	}
+
+	// Wake up connection threads blocked in recv() and wait for them.
+	{
+		lock_guard<mutex> lock(clientsMutex);
+		for (int fd : clients) ::shutdown(fd, SHUT_RDWR);
+	}
+	while (openConnections > 0) this_thread::sleep_for(chrono::milliseconds(10));
+
+	close(listenFd);
+	bool isUnix;
+	string host, port;
+	if (parseAddress(address, isUnix, host, port) && isUnix) unlink(host.c_str());
+	return 0;
+}
+
+void RenderServer::serveConnection(int fd) {
+	string buffer;
+	char chunk[4096];
+	bool open = true;
+	while (open && !stopping) {
+		size_t newline;
+		while ((newline = buffer.find('\n')) == string::npos) {
+			ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+			if (received <= 0) {
+				open = false;
+				break;
+			}
+			buffer.append(chunk, received);
+		}
+		if (!open) break;
+
+		string line = buffer.substr(0, newline);
+		buffer.erase(0, newline + 1);
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty()) continue;
+
+		string reply = handleCommand(fd, line) + "\n";
+		open = sendAll(fd, reply.data(), reply.size());
+	}
+
+	{
+		lock_guard<mutex> lock(clientsMutex);
+		clients.erase(fd);
+	}
+	close(fd);
+	openConnections--;
+}
+
+string RenderServer::handleCommand(int fd, const string& line) {
+	istringstream args(line);
+	string command;
+	args >> command;
+
+	if (command == "render") return handleRender(fd, args);
+
+	if (command == "cancel") {
+		int id = 0;
+		args >> id;
+		lock_guard<mutex> lock(jobsMutex);
+		auto it = jobs.find(id);
+		if (it == jobs.end()) return "error unknown job " + to_string(id);
+		it->second->cancelled = true;
+		return "ok";
+	}
+
+	if (command == "metrics") {
+		double uptime = nanosecondsSinceStart() * 1e-9;
+		double busy = busyNanoseconds * 1e-9;
+		size_t active;
+		{
+			lock_guard<mutex> lock(jobsMutex);
+			active = jobs.size();
+		}
+		ostringstream out;
+		out << "metrics uptime_seconds=" << uptime
+			<< " threads=" << pool.size()
+			<< " jobs_active=" << active
+			<< " jobs_done=" << jobsDone
+			<< " jobs_cancelled=" << jobsCancelled
+			<< " samples=" << samplesRendered
+			<< " samples_per_sec=" << (uptime > 0 ? samplesRendered / uptime : 0)
+			<< " samples_per_thread_sec=" << (busy > 0 ? samplesRendered / busy : 0)
+			<< " utilization=" << (uptime > 0 ? busy / (uptime * pool.size()) : 0);
+		return out.str();
+	}
+
+	if (command == "shutdown") {
+		lock_guard<mutex> lock(jobsMutex);
+		for (auto& entry : jobs) entry.second->cancelled = true;
+		stopping = true;
+		return "ok";
+	}
+
+	return "error unknown command '" + command + "'";
+}
+
+// Parse "x,y,z".
+inline bool parseVec3(const string& text, Vec3& v) {
+	float x, y, z;
+	char c1, c2;
+	istringstream in(text);
+	if (!(in >> x >> c1 >> y >> c2 >> z) || c1 != ',' || c2 != ',') return false;
+	v = Vec3(x, y, z);
+	return true;
+}
+
+string RenderServer::handleRender(int fd, istringstream& args) {
+	SceneSettings settings = sceneSettings;
+	int width = settings.imageWidth;
+	int height = 0;
+	uint32_t seed = 0;
+	string output;
+
+	string token;
+	while (args >> token) {
+		size_t eq = token.find('=');
+		if (eq == string::npos) return "error expected key=value, got '" + token + "'";
+		string key = token.substr(0, eq);
+		string value = token.substr(eq + 1);
+
+		bool valid = true;
+		if (key == "width") valid = (width = atoi(value.c_str())) > 0 && width <= maxImageSide;
+		else if (key == "height") valid = (height = atoi(value.c_str())) > 0 && height <= maxImageSide;
+		else if (key == "spp") valid = (settings.samplesPerPixel = atoi(value.c_str())) > 0 && settings.samplesPerPixel <= maxSamplesPerPixel;
+		else if (key == "depth") valid = (settings.maxDepth = atoi(value.c_str())) > 0 && settings.maxDepth <= maxPathDepth;
+		else if (key == "from") valid = parseVec3(value, settings.lookFrom);
+		else if (key == "at") valid = parseVec3(value, settings.lookAt);
+		else if (key == "vfov") valid = (settings.vFOV = atof(value.c_str())) > 0;
+		else if (key == "aperture") settings.aperture = atof(value.c_str());
+		else if (key == "focus") valid = (settings.focalDistance = atof(value.c_str())) > 0;
+		else if (key == "sampler") valid = parseSamplerType(value, settings.sampler);
+		else if (key == "seed") seed = (uint32_t)strtoul(value.c_str(), nullptr, 10);
+		else if (key == "output") output = value;
+		else return "error unknown key '" + key + "'";
+		if (!valid) return "error bad value for " + key;
+	}
+	if (height == 0) height = min(maxImageSide, max(1, (int)(width / settings.aspectRatio)));
+	if ((long long)width * height > maxImagePixels) return "error image larger than " + to_string(maxImagePixels) + " pixels";
+	settings.imageWidth = width;
+	settings.aspectRatio = float(width) / height;
+
+	shared_ptr<ServerJob> job;
+	{
+		lock_guard<mutex> lock(jobsMutex);
+		if (stopping) return "error shutting down";
+		// An uncaught exception on a connection thread would end the server
+		// and every job in it.
+		try {
+			job = make_shared<ServerJob>(nextJobId++, settings, width, height, seed, output);
+			jobs[job->id] = job;
+		}
+		catch (const bad_alloc&) {
+			return "error out of memory";
+		}
+	}
+
+	string accepted = "job " + to_string(job->id) + "\n";
+	sendAll(fd, accepted.data(), accepted.size());
+
+	long long submitted = nanosecondsSinceStart();
+	for (int h = 0; h < height; h++) {
+		pool.submit([this, job, h]() { renderRow(job, h); });
+	}
+
+	{
+		unique_lock<mutex> lock(job->doneMutex);
+		job->doneChanged.wait(lock, [&]() { return job->finished; });
+	}
+	{
+		lock_guard<mutex> lock(jobsMutex);
+		jobs.erase(job->id);
+	}
+
+	if (job->cancelled) {
+		jobsCancelled++;
+		return "cancelled " + to_string(job->id);
+	}
+
+	if (!output.empty()) {
+		ofstream imageFile(output);
+		imageFile << "P3\n" << width << " " << height << "\n" << "255\n" << endl;
+		for (const Color& pixelColor : job->pixels) writeColor(imageFile, pixelColor, settings.samplesPerPixel);
+		if (!imageFile) return "error could not write " + output;
+	}
+	jobsDone++;
+
+	long long finished = nanosecondsSinceStart();
+	double seconds = (finished - job->startNanoseconds) * 1e-9;
+	double samples = double(width) * height * settings.samplesPerPixel;
+	ostringstream out;
+	out << "done " << job->id
+		<< " queued_seconds=" << (job->startNanoseconds - submitted) * 1e-9
+		<< " render_seconds=" << seconds
+		<< " samples_per_sec=" << (seconds > 0 ? samples / seconds : 0);
+	if (!output.empty()) out << " output=" << output;
+	return out.str();
+}
+
+void RenderServer::renderRow(const shared_ptr<ServerJob>& job, int h) {
+	long long start = nanosecondsSinceStart();
+	long long expected = 0;
+	job->startNanoseconds.compare_exchange_strong(expected, start);
+
+	if (!job->cancelled) {
+		// Seeded per row, so an image does not depend on which thread rendered what.
+		seedRandom((uint64_t(job->seed) << 32) | uint32_t(h));
+		const SceneSettings& settings = job->settings;
+		useSampler(settings.sampler, job->seed);
+		for (int w = 0; w < job->width; w++) {
+			job->pixels[size_t(h) * job->width + w] = samplePixel(job->camera, scene, settings.backgroundColor,
+				w, h, job->width, job->height, settings.samplesPerPixel, settings.maxDepth);
+		}
+		samplesRendered += (long long)job->width * settings.samplesPerPixel;
+		busyNanoseconds += nanosecondsSinceStart() - start;
+	}
+
+	if (--job->rowsLeft == 0) {
+		lock_guard<mutex> lock(job->doneMutex);
+		job->finished = true;
+		job->doneChanged.notify_all();
+	}
+}
+
+// ----------------------------------------
+
+// Send one command to the server at address and print the replies until the
+// final one. Returns 0 unless the server reported an error.
+int runClient(const string& address, const string& command) {
+	int fd = openSocket(address, true);
+	if (fd < 0) {
+		cerr << "ERROR: Could not connect to " << address << ".\n";
+		return 1;
+	}
+
+	string line = command + "\n";
+	if (!sendAll(fd, line.data(), line.size())) {
+		close(fd);
+		return 1;
+	}
+
+	string buffer;
+	char chunk[4096];
+	int status = 1;
+	while (true) {
+		size_t newline = buffer.find('\n');
+		if (newline == string::npos) {
+			ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+			if (received <= 0) break;
+			buffer.append(chunk, received);
+			continue;
+		}
+
+		string reply = buffer.substr(0, newline);
+		buffer.erase(0, newline + 1);
+		cout << reply << endl;
+		if (reply.compare(0, 4, "job ") != 0) {
+			status = reply.compare(0, 6, "error ") == 0 ? 1 : 0;
+			break;
+		}
+	}
+
+	close(fd);
+	return status;
+}
+
+#endif // !_WIN32
+
+#endif // !RENDER_SERVER_H
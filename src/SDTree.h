@@ -0,0 +1,389 @@
+#pragma once
+
+#ifndef SD_TREE_H
+#define SD_TREE_H
+
+// Spatial-directional tree for path guiding (Müller, Gross and Novák,
+// "Practical Path Guiding for Efficient Light-Transport Simulation", 2017).
+//
+// A binary tree splits the scene's box in half along x, y and z in turn. Each
+// leaf, a GuideRegion, holds a quadtree over the directions, a
+// DirectionalTree, that estimates how much light arrives at the region from
+// where. Directions map to the unit square by the cylindrical (cos theta, phi)
+// projection, which keeps areas, so a quadtree cell's share of the light is
+// also its share of the sphere's solid angle.
+//
+// Every region has two directional trees: the one learned in the last pass,
+// which paths sample from, and the one being recorded into in this pass.
+// Recording is lock free, with atomic adds, so render threads share the
+// tree. Between passes, finishPass() splits regions that saw many paths and
+// rebuilds each quadtree around the light it learned: cells with more than
+// 1% of a region's light are subdivided, dimmer ones merged.
+
+#include "RTNW.h"
+#include "Vec3.h"
+#include "AABB.h"
+#include "Sampling.h"
+#include "FastMath.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Float that several threads add to.
+inline void atomicAdd(atomic<float>& target, float value) {
+	float current = target.load(memory_order_relaxed);
+	while (!target.compare_exchange_weak(current, current + value, memory_order_relaxed)) {}
+}
+
+// Unit direction to the unit square and back: x = (cos theta + 1) / 2 around +z, y = phi / 2 pi.
+inline Sample2D directionToSquare(const Vec3& direction) {
+	const float oneMinusEpsilon = 0x1.fffffep-1f;
+	float cosTheta = fmin(1.0f, fmax(-1.0f, direction.z()));
+	float phi = fastAtan2(direction.y(), direction.x());
+	if (phi < 0) phi += 2 * PI;
+	return Sample2D{ fmin((cosTheta + 1) / 2, oneMinusEpsilon), fmin(phi / (2 * PI), oneMinusEpsilon) };
+}
+
+inline Vec3 squareToDirection(Sample2D point) {
+	float cosTheta = 2 * point.x - 1;
+	float sinTheta = sqrtf(fmax(0.0f, 1 - cosTheta * cosTheta));
+	float phi = 2 * PI * point.y;
+	return Vec3(sinTheta * fastSin(phi + PI / 2), sinTheta * fastSin(phi), cosTheta);
+}
+
+// ----------------------------------------
+
+class DirectionalTree {
+public:
+	DirectionalTree() : nodes(1) {}
+
+	// Add weight to the cell holding direction (unit length).
+	void record(const Vec3& direction, float weight);
+
+	// Total the recorded weights up the tree; call before sampling the tree.
+	void finishRecording();
+
+	// The tree's total weight; nothing can be sampled while it is zero.
+	float energy() const { return totalEnergy; }
+
+	// Unit direction drawn in proportion to the recorded weights, and its
+	// density as pdf() gives it.
+	Vec3 sample(Sample2D u, float& pdf) const;
+
+	// Solid angle density of sample() drawing direction (unit length).
+	float pdf(const Vec3& direction) const;
+
+	// Empty tree with cells fitted to this one's recorded light: a cell with
+	// more than threshold of the energy is split, up to maxDepth levels.
+	DirectionalTree refined(float threshold = 0.01f, int maxDepth = 20) const;
+
+	int nodeCount() const { return (int)nodes.size(); }
+
+private:
+	// Four quadrants, (x, y) in {0, 1}^2 at index x + 2 y. A quadrant is a
+	// leaf cell or holds a node of its own; children follow their parent.
+	struct Node {
+		atomic<float> sums[4];
+		uint32_t children[4]; // 0: leaf cell
+
+		Node() {
+			for (int q = 0; q < 4; q++) {
+				sums[q].store(0, memory_order_relaxed);
+				children[q] = 0;
+			}
+		}
+		Node(const Node& other) { *this = other; }
+		Node& operator=(const Node& other) {
+			for (int q = 0; q < 4; q++) {
+				sums[q].store(other.sums[q].load(memory_order_relaxed), memory_order_relaxed);
+				children[q] = other.children[q];
+			}
+			return *this;
+		}
+
+		float sum(int q) const { return sums[q].load(memory_order_relaxed); }
+		float total() const { return sum(0) + sum(1) + sum(2) + sum(3); }
+	};
+
+	// Quadrant of point, which is then rescaled to the quadrant.
+	static int quadrant(Sample2D& point) {
+		int x = point.x >= 0.5f, y = point.y >= 0.5f;
+		point.x = 2 * point.x - x;
+		point.y = 2 * point.y - y;
+		return x + 2 * y;
+	}
+
+	vector<Node> nodes;
+	float totalEnergy = 0;
+};
+
+void DirectionalTree::record(const Vec3& direction, float weight) {
+	Sample2D point = directionToSquare(direction);
+	uint32_t node = 0;
+	while (true) {
+		int q = quadrant(point);
+		if (nodes[node].children[q] == 0) {
+			atomicAdd(nodes[node].sums[q], weight);
+			return;
+		}
+		node = nodes[node].children[q];
+	}
+}
+
+void DirectionalTree::finishRecording() {
+	for (size_t ii = nodes.size(); ii-- > 0;) {
+		Node& node = nodes[ii];
+		for (int q = 0; q < 4; q++) {
+			if (node.children[q]) node.sums[q].store(nodes[node.children[q]].total(), memory_order_relaxed);
+		}
+	}
+	totalEnergy = nodes[0].total();
+}
+
+Vec3 DirectionalTree::sample(Sample2D u, float& pdf) const {
+	// Pick the column of quadrants with u.x and the quadrant in it with u.y,
+	// rescaling each to reuse it one level down.
+	const float oneMinusEpsilon = 0x1.fffffep-1f;
+	Sample2D origin{ 0, 0 };
+	float size = 1;
+	float density = 1; // over the unit square
+	uint32_t node = 0;
+	while (true) {
+		const Node& n = nodes[node];
+		float sums[4] = { n.sum(0), n.sum(1), n.sum(2), n.sum(3) };
+		float left = sums[0] + sums[2];
+		float total = left + sums[1] + sums[3];
+		float scaled = u.x * total;
+		int x = scaled >= left && total > left;
+		u.x = x ? (scaled - left) / (total - left) : scaled / left;
+
+		float column = sums[x] + sums[x + 2];
+		scaled = u.y * column;
+		int y = scaled >= sums[x] && column > sums[x];
+		u.y = y ? (scaled - sums[x]) / (column - sums[x]) : scaled / sums[x];
+		u.x = fmin(u.x, oneMinusEpsilon);
+		u.y = fmin(u.y, oneMinusEpsilon);
+
+		size /= 2;
+		origin.x += x * size;
+		origin.y += y * size;
+		int q = x + 2 * y;
+		density *= 4 * sums[q] / total;
+		if (n.children[q] == 0) {
+			pdf = density / (4 * PI);
+			return squareToDirection(Sample2D{ origin.x + u.x * size, origin.y + u.y * size });
+		}
+		node = n.children[q];
+	}
+}
+
+float DirectionalTree::pdf(const Vec3& direction) const {
+	if (!(totalEnergy > 0)) return 0;
+	Sample2D point = directionToSquare(direction);
+	float density = 1; // over the unit square
+	uint32_t node = 0;
+	while (true) {
+		const Node& n = nodes[node];
+		int q = quadrant(point);
+		float total = n.total();
+		if (!(total > 0)) return 0;
+		density *= 4 * n.sum(q) / total;
+		if (n.children[q] == 0) return density / (4 * PI);
+		node = n.children[q];
+	}
+}
+
+DirectionalTree DirectionalTree::refined(float threshold, int maxDepth) const {
+	DirectionalTree result;
+	if (!(totalEnergy > 0)) return result;
+
+	// Depth first from the root; a cell of this tree that is split further
+	// down lends its quadrants' energies, else the energy is taken as even.
+	const uint32_t noSource = ~0u;
+	struct Pending {
+		uint32_t target;
+		uint32_t source; // node of this tree at the same cell; noSource below its leaves
+		float energies[4];
+		int depth;
+	};
+	vector<Pending> stack;
+	Pending root{ 0, 0, { nodes[0].sum(0), nodes[0].sum(1), nodes[0].sum(2), nodes[0].sum(3) }, 1 };
+	stack.push_back(root);
+	while (!stack.empty()) {
+		Pending item = stack.back();
+		stack.pop_back();
+		if (item.depth >= maxDepth) continue;
+		for (int q = 0; q < 4; q++) {
+			if (item.energies[q] <= threshold * totalEnergy) continue;
+
+			uint32_t child = (uint32_t)result.nodes.size();
+			result.nodes.emplace_back();
+			result.nodes[item.target].children[q] = child;
+
+			Pending next{ child, noSource, {}, item.depth + 1 };
+			if (item.source != noSource && nodes[item.source].children[q] != 0) {
+				next.source = nodes[item.source].children[q];
+				for (int c = 0; c < 4; c++) next.energies[c] = nodes[next.source].sum(c);
+			}
+			else {
+				for (int c = 0; c < 4; c++) next.energies[c] = item.energies[q] / 4;
+			}
+			stack.push_back(next);
+		}
+	}
+	return result;
+}
+
+// ----------------------------------------
+
+// Leaf of the spatial tree: the light learned around one box of the scene.
+class GuideRegion {
+public:
+	// Learned in the last pass; null until there is something to sample.
+	const DirectionalTree* samplingTree() const { return sampling.energy() > 0 ? &sampling : nullptr; }
+
+	// Add a path's estimate of the light arriving from direction (unit
+	// length): its radiance over the density the direction was drawn with.
+	void record(const Vec3& direction, float radiance, float pdf) const {
+		float weight = radiance / pdf;
+		if (!(weight > 0) || !isfinite(weight)) return;
+		building.record(direction, weight);
+		samples.fetch_add(1, memory_order_relaxed);
+	}
+
+	GuideRegion() {}
+	GuideRegion(const GuideRegion& other) { *this = other; }
+	GuideRegion& operator=(const GuideRegion& other) {
+		sampling = other.sampling;
+		building = other.building;
+		samples.store(other.samples.load(memory_order_relaxed), memory_order_relaxed);
+		return *this;
+	}
+
+private:
+	friend class PathGuide;
+
+	DirectionalTree sampling;
+	mutable DirectionalTree building;
+	mutable atomic<uint32_t> samples{ 0 };
+};
+
+class PathGuide {
+public:
+	// Start learning afresh over bounds, the scene's box.
+	void reset(const AABB& bounds);
+
+	// Paths consult the guide only while it is enabled.
+	bool enabled() const { return !nodes.empty(); }
+	void disable() { nodes.clear(); regions.clear(); }
+
+	// Whether paths record what they find; off for the final pass.
+	bool recording() const { return isRecording; }
+	void setRecording(bool record) { isRecording = record; }
+
+	const GuideRegion& regionAt(const Point3& p) const;
+
+	// End a pass of samplesPerPixel samples: split the regions that recorded
+	// many paths and make what every region recorded the one to sample.
+	void finishPass(int samplesPerPixel);
+
+	int regionCount() const { return (int)regions.size(); }
+
+	// Paths a region records in a 1 spp pass before it is split; Müller et
+	// al. use 12000 and scale it with the square root of the samples per pixel.
+	static constexpr float splitThreshold = 12000;
+
+private:
+	// Split at the middle of the node's box along axis; the children are
+	// firstChild and firstChild + 1, the lower half first.
+	struct Node {
+		int axis;
+		uint32_t firstChild; // 0: leaf
+		uint32_t region;
+	};
+
+	void split(uint32_t node, uint32_t threshold);
+
+	AABB box;
+	vector<Node> nodes;
+	vector<GuideRegion> regions;
+	bool isRecording = false;
+};
+
+void PathGuide::reset(const AABB& bounds) {
+	// A little larger, so points on the box's faces fall inside.
+	Vec3 margin = 0.001f * (bounds.max() - bounds.min()) + Vec3(1e-4f, 1e-4f, 1e-4f);
+	box = AABB(bounds.min() - margin, bounds.max() + margin);
+	nodes.assign(1, Node{ 0, 0, 0 });
+	regions.assign(1, GuideRegion());
+	isRecording = true;
+}
+
+const GuideRegion& PathGuide::regionAt(const Point3& p) const {
+	Point3 lo = box.min(), hi = box.max();
+	uint32_t node = 0;
+	while (nodes[node].firstChild) {
+		int axis = nodes[node].axis;
+		float middle = (lo[axis] + hi[axis]) / 2;
+		if (p[axis] < middle) {
+			hi[axis] = middle;
+			node = nodes[node].firstChild;
+		}
+		else {
+			lo[axis] = middle;
+			node = nodes[node].firstChild + 1;
+		}
+	}
+	return regions[nodes[node].region];
+}
+
+void PathGuide::split(uint32_t node, uint32_t threshold) {
+	uint32_t regionIndex = nodes[node].region;
+	uint32_t samples = regions[regionIndex].samples.load(memory_order_relaxed);
+	if (samples <= threshold) return;
+
+	// Both halves start from the whole region's light, each credited with
+	// half its paths, so the recursion ends.
+	regions[regionIndex].samples.store(samples / 2, memory_order_relaxed);
+	GuideRegion upper = regions[regionIndex];
+	uint32_t upperRegion = (uint32_t)regions.size();
+	regions.push_back(upper);
+
+	uint32_t lower = (uint32_t)nodes.size();
+	int childAxis = (nodes[node].axis + 1) % 3;
+	nodes.push_back(Node{ childAxis, 0, regionIndex });
+	nodes.push_back(Node{ childAxis, 0, upperRegion });
+	nodes[node].firstChild = lower;
+	split(lower, threshold);
+	split(lower + 1, threshold);
+}
+
+void PathGuide::finishPass(int samplesPerPixel) {
+	for (GuideRegion& region : regions) region.building.finishRecording();
+
+	uint32_t threshold = uint32_t(splitThreshold * sqrtf(float(samplesPerPixel)));
+	size_t leafCount = nodes.size();
+	for (uint32_t node = 0; node < leafCount; node++) {
+		if (nodes[node].firstChild == 0) split(node, threshold);
+	}
+
+	for (GuideRegion& region : regions) {
+		// A region no path reached keeps what it knew.
+		if (region.building.energy() > 0) region.sampling = region.building;
+		region.building = region.sampling.refined();
+		region.samples.store(0, memory_order_relaxed);
+	}
+}
+
+// Guide of the scene being rendered; disabled unless the render is guided
+// (see PathGuiding.h).
+inline PathGuide& scenePathGuide() {
+	static PathGuide guide;
+	return guide;
+}
+
+#endif // !SD_TREE_H
@@ -0,0 +1,390 @@
+#pragma once
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+// Sample generators for the Monte Carlo estimate of a pixel.
+//
+// Every random decision along a camera path (pixel position, lens position,
+// shutter time, then per bounce the scattered direction, the Fresnel choice
+// and so on) is one dimension of a sample. Drawing those dimensions from
+// independent random numbers converges at the plain Monte Carlo rate; the
+// samplers below instead give well-stratified points per dimension, so a
+// pixel needs fewer samples for the same noise.
+//
+// The renderer starts each pixel sample with startPixelSample() on the
+// calling thread's sampler and then draws the dimensions, in path order,
+// with sample1D() and sample2D(). A 2D sample uses one dimension, so the
+// two components are stratified against each other.
+//
+//   independent  random_float() for everything, the old behaviour.
+//   halton       Radical inverse in a different prime base per dimension,
+//                rotated per pixel (Cranley-Patterson). Dimensions past the
+//                prime table fall back to hashed, uncorrelated values.
+//   sobol        Sobol (0, 2)-sequence, Owen-scrambled and shuffled with a
+//                hash of the pixel, the dimension and the seed, so every
+//                dimension of every pixel is an independent randomization.
+//   bluenoise    The same shuffled Sobol points for every pixel, rotated per
+//                pixel by a blue-noise tile. The remaining error is spread
+//                as blue noise over the image instead of white noise.
+//
+// Except for independent, a sample depends only on the pixel, the sample
+// index, the dimension and the seed, so images do not depend on how the
+// work was split over threads or machines.
+
+#include "RTNW.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum SamplerType {
+	SamplerIndependent,
+	SamplerHalton,
+	SamplerSobol,
+	SamplerBlueNoise
+};
+
+inline const char* samplerName(SamplerType type) {
+	switch (type) {
+	case SamplerIndependent: return "independent";
+	case SamplerHalton: return "halton";
+	case SamplerSobol: return "sobol";
+	case SamplerBlueNoise: return "bluenoise";
+	}
+	return "unknown";
+}
+
+inline bool parseSamplerType(const string& name, SamplerType& type) {
+	for (SamplerType t : { SamplerIndependent, SamplerHalton, SamplerSobol, SamplerBlueNoise }) {
+		if (name == samplerName(t)) {
+			type = t;
+			return true;
+		}
+	}
+	return false;
+}
+
+struct Sample2D {
+	float x, y;
+};
+
+// ----------------------------------------
+// Bit mixing
+
+// Largest float below 1.
+const float oneMinusEpsilon = 0.99999994f;
+
+inline float uintToUnitFloat(uint32_t bits) {
+	return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// 32-bit integer hash with good avalanche (Wellons' "lowbias32").
+inline uint32_t hashUint(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+inline uint32_t hashCombine(uint32_t seed, uint32_t value) {
+	return hashUint(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t reverseBits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Owen scrambling of the bits of x: every bit is flipped depending on the
+// bits above it. Hash-based variant of the Laine-Karras permutation (Burley,
+// "Practical Hash-based Owen Scrambling", 2020).
+inline uint32_t owenScramble(uint32_t x, uint32_t seed) {
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverseBits(x);
+}
+
+// First two dimensions of the Sobol sequence, as 0.32 fixed point.
+inline uint32_t sobolDimension0(uint32_t index) {
+	return reverseBits(index);
+}
+
+inline uint32_t sobolDimension1(uint32_t index) {
+	uint32_t result = 0;
+	for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+		if (index & 1) result ^= v;
+	}
+	return result;
+}
+
+// Point index of a shuffled, Owen-scrambled Sobol (0, 2)-sequence; the seed
+// selects one of its randomizations.
+inline Sample2D scrambledSobol2D(uint32_t index, uint32_t seed) {
+	index = owenScramble(index, hashUint(seed));
+	uint32_t x = owenScramble(sobolDimension0(index), hashCombine(seed, 1));
+	uint32_t y = owenScramble(sobolDimension1(index), hashCombine(seed, 2));
+	return Sample2D{ uintToUnitFloat(x), uintToUnitFloat(y) };
+}
+
+inline float radicalInverse(uint32_t base, uint32_t index) {
+	float invBase = 1.0f / base;
+	float invBaseN = 1;
+	uint32_t reversed = 0;
+	while (index) {
+		uint32_t next = index / base;
+		reversed = reversed * base + (index - next * base);
+		invBaseN *= invBase;
+		index = next;
+	}
+	return fmin(reversed * invBaseN, oneMinusEpsilon);
+}
+
+inline float rotateSample(float x, float offset) {
+	x += offset;
+	return x >= 1 ? x - 1 : x;
+}
+
+// ----------------------------------------
+// Blue noise
+
+// Tile of blueNoiseSize^2 values in (0, 1), each value used once, whose
+// spectrum has little energy at low frequencies. Made by Ulichney's
+// void-and-cluster method on first use.
+const int blueNoiseSize = 64;
+
+inline vector<float> makeBlueNoiseTile() {
+	const int size = blueNoiseSize;
+	const int mask = size - 1;
+	const int count = size * size;
+	const float sigma = 1.5f;
+
+	// Toroidal Gaussian energy of a point at the origin.
+	vector<float> kernel(count);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			int dx = min(x, size - x);
+			int dy = min(y, size - y);
+			kernel[y * size + x] = expf(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+		}
+	}
+
+	auto splat = [&](vector<float>& energy, int p, float sign) {
+		int px = p % size, py = p / size;
+		for (int y = 0; y < size; y++) {
+			const float* row = &kernel[((y - py) & mask) * size];
+			float* dst = &energy[y * size];
+			for (int x = 0; x < size; x++) dst[x] += sign * row[(x - px) & mask];
+		}
+	};
+	// Tightest cluster among the set points, or largest void among the unset ones.
+	auto extreme = [&](const vector<float>& energy, const vector<char>& set, bool cluster) {
+		int best = -1;
+		for (int p = 0; p < count; p++) {
+			if (set[p] != cluster) continue;
+			if (best < 0 || (cluster ? energy[p] > energy[best] : energy[p] < energy[best])) best = p;
+		}
+		return best;
+	};
+
+	// Random initial pattern, relaxed until moving the tightest cluster to the largest void changes nothing.
+	RandomGenerator generator;
+	vector<char> initial(count, 0);
+	vector<float> initialEnergy(count, 0);
+	int initialPoints = 0;
+	while (initialPoints < count / 10) {
+		int p = generator.next() % count;
+		if (initial[p]) continue;
+		initial[p] = 1;
+		splat(initialEnergy, p, 1);
+		initialPoints++;
+	}
+	while (true) {
+		int cluster = extreme(initialEnergy, initial, true);
+		initial[cluster] = 0;
+		splat(initialEnergy, cluster, -1);
+		int hole = extreme(initialEnergy, initial, false);
+		initial[hole] = 1;
+		splat(initialEnergy, hole, 1);
+		if (hole == cluster) break;
+	}
+
+	vector<int> rank(count);
+
+	// Lower ranks: take out the tightest clusters of the initial pattern.
+	vector<char> set = initial;
+	vector<float> energy = initialEnergy;
+	for (int r = initialPoints - 1; r >= 0; r--) {
+		int cluster = extreme(energy, set, true);
+		set[cluster] = 0;
+		splat(energy, cluster, -1);
+		rank[cluster] = r;
+	}
+
+	// Higher ranks: fill the largest voids.
+	set = initial;
+	energy = initialEnergy;
+	for (int r = initialPoints; r < count; r++) {
+		int hole = extreme(energy, set, false);
+		set[hole] = 1;
+		splat(energy, hole, 1);
+		rank[hole] = r;
+	}
+
+	vector<float> tile(count);
+	for (int p = 0; p < count; p++) tile[p] = (rank[p] + 0.5f) / count;
+	return tile;
+}
+
+inline const vector<float>& blueNoiseTile() {
+	static const vector<float> tile = makeBlueNoiseTile();
+	return tile;
+}
+
+// ----------------------------------------
+// Samplers
+
+class Sampler {
+public:
+	virtual ~Sampler() {}
+
+	void setSeed(uint32_t s) { seed = s; }
+
+	// Start sample index of pixel (x, y); the next draw is dimension 0.
+	void startPixelSample(int x, int y, uint32_t index) {
+		pixelX = x;
+		pixelY = y;
+		sampleIndex = index;
+		dimension = 0;
+		pixelSeed = hashCombine(hashCombine(seed, uint32_t(x)), uint32_t(y));
+	}
+
+	virtual float get1D() = 0;
+	virtual Sample2D get2D() = 0;
+
+protected:
+	uint32_t seed = 0;
+	uint32_t pixelSeed = 0; // hash of seed and pixel
+	int pixelX = 0, pixelY = 0;
+	uint32_t sampleIndex = 0;
+	uint32_t dimension = 0;
+};
+
+class IndependentSampler final : public Sampler {
+public:
+	float get1D() override { return random_float(); }
+	Sample2D get2D() override {
+		float x = random_float();
+		return Sample2D{ x, random_float() };
+	}
+};
+
+class HaltonSampler final : public Sampler {
+public:
+	float get1D() override {
+		uint32_t d = dimension++;
+		if (d >= primeCount) return uintToUnitFloat(hashCombine(hashCombine(pixelSeed, d), sampleIndex));
+		return rotateSample(radicalInverse(primes[d], sampleIndex), uintToUnitFloat(hashCombine(pixelSeed, d)));
+	}
+
+	Sample2D get2D() override {
+		float x = get1D();
+		return Sample2D{ x, get1D() };
+	}
+
+private:
+	static constexpr uint32_t primeCount = 64;
+	static constexpr uint32_t primes[primeCount] = {
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+		59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+		137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+		227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+	};
+};
+
+class SobolSampler final : public Sampler {
+public:
+	float get1D() override { return get2D().x; }
+
+	Sample2D get2D() override {
+		return scrambledSobol2D(sampleIndex, hashCombine(pixelSeed, dimension++));
+	}
+};
+
+class BlueNoiseSampler final : public Sampler {
+public:
+	float get1D() override { return get2D().x; }
+
+	Sample2D get2D() override {
+		uint32_t d = dimension++;
+		uint32_t dimensionSeed = hashCombine(seed, d);
+		Sample2D s = scrambledSobol2D(sampleIndex, dimensionSeed);
+
+		// Every dimension and component reads the tile at its own toroidal offset.
+		const vector<float>& tile = blueNoiseTile();
+		const int mask = blueNoiseSize - 1;
+		uint32_t offsets = hashUint(dimensionSeed);
+		int x = pixelX + int(offsets & 0xff), y = pixelY + int((offsets >> 8) & 0xff);
+		s.x = rotateSample(s.x, tile[(y & mask) * blueNoiseSize + (x & mask)]);
+		x += int((offsets >> 16) & 0xff);
+		y += int(offsets >> 24);
+		s.y = rotateSample(s.y, tile[(y & mask) * blueNoiseSize + (x & mask)]);
+		return s;
+	}
+};
+
+// ----------------------------------------
+// Per-thread sampler
+
+struct ThreadSamplers {
+	IndependentSampler independent;
+	HaltonSampler halton;
+	SobolSampler sobol;
+	BlueNoiseSampler blueNoise;
+	Sampler* active = &independent;
+};
+
+inline ThreadSamplers& threadSamplers() {
+	static thread_local ThreadSamplers samplers;
+	return samplers;
+}
+
+inline Sampler& threadSampler() {
+	return *threadSamplers().active;
+}
+
+// Make type the calling thread's sampler. The seed selects another
+// randomization of the same sequence.
+inline void useSampler(SamplerType type, uint32_t seed = 0) {
+	ThreadSamplers& samplers = threadSamplers();
+	switch (type) {
+	case SamplerHalton: samplers.active = &samplers.halton; break;
+	case SamplerSobol: samplers.active = &samplers.sobol; break;
+	case SamplerBlueNoise: samplers.active = &samplers.blueNoise; break;
+	default: samplers.active = &samplers.independent; break;
+	}
+	samplers.active->setSeed(seed);
+}
+
+// Next dimension(s) of the current pixel sample, in [0, 1).
+inline float sample1D() {
+	return threadSampler().get1D();
+}
+
+inline Sample2D sample2D() {
+	return threadSampler().get2D();
+}
+
+#endif // !SAMPLER_H
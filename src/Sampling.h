@@ -0,0 +1,183 @@
+#pragma once
+
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+// Warps from uniform samples in [0,1)^2 to the distributions the camera and
+// the materials draw directions and points from.
+//
+// Every warp is closed form and branch free: no rejection loop, a fixed
+// amount of work per sample, and a stratified input stays stratified. All of
+// them start from Shirley and Chiu's concentric disk mapping. It only needs
+// the sine and cosine of angles in [-pi/4, pi/4], where short polynomials
+// are accurate to a few ulps, so the batch variants below vectorize without
+// a vector libm. The scalar and batch forms share those polynomials and
+// return the same values.
+//
+// Directions are in a local frame around +z; Frame maps them to world space.
+
+#include "RTNW.h"
+#include "Vec3.h"
+#include "Sampler.h"
+
+#include <algorithm>
+
+// ----------------------------------------
+// Scalar warps
+
+// sin(x) and cos(x) for |x| <= pi/4, absolute error below 3e-7.
+inline float sinQuarterPi(float x) {
+	float x2 = x * x;
+	return x * (1 + x2 * (-1.0f / 6 + x2 * (1.0f / 120 + x2 * (-1.0f / 5040))));
+}
+
+inline float cosQuarterPi(float x) {
+	float x2 = x * x;
+	return 1 + x2 * (-0.5f + x2 * (1.0f / 24 + x2 * (-1.0f / 720 + x2 * (1.0f / 40320))));
+}
+
+// Uniform point in the unit disk (z = 0), concentric mapping.
+inline void concentricDisk(float u1, float u2, float& x, float& y) {
+	float a = 2 * u1 - 1;
+	float b = 2 * u2 - 1;
+	bool aMajor = fabsf(a) > fabsf(b);
+	float r = aMajor ? a : b;
+	float ratio = (aMajor ? b : a) / (r != 0 ? r : 1);
+	float s = sinQuarterPi(PI / 4 * ratio);
+	float c = cosQuarterPi(PI / 4 * ratio);
+	x = r * (aMajor ? c : s);
+	y = r * (aMajor ? s : c);
+}
+
+inline Vec3 sampleConcentricDisk(Sample2D u) {
+	float x, y;
+	concentricDisk(u.x, u.y, x, y);
+	return Vec3(x, y, 0);
+}
+
+// Direction with density cos(theta) / pi around +z.
+inline Vec3 sampleCosineHemisphere(Sample2D u) {
+	float x, y;
+	concentricDisk(u.x, u.y, x, y);
+	return Vec3(x, y, sqrtf(max(0.0f, 1 - x * x - y * y)));
+}
+
+inline float cosineHemispherePdf(float cosTheta) {
+	return cosTheta > 0 ? cosTheta / PI : 0;
+}
+
+// Uniform direction within cosThetaMax of +z. The disk radius r maps to
+// 1 - z = r^2 (1 - cosThetaMax), which keeps areas proportional. The cone is
+// given by 1 - cosThetaMax, which stays accurate for narrow cones whose
+// cosine rounds to 1.
+inline Vec3 sampleUniformConeGap(Sample2D u, float oneMinusCosThetaMax) {
+	float x, y;
+	concentricDisk(u.x, u.y, x, y);
+	float k = oneMinusCosThetaMax;
+	float r2 = x * x + y * y;
+	float scale = sqrtf(max(0.0f, k * (2 - r2 * k)));
+	return Vec3(x * scale, y * scale, 1 - r2 * k);
+}
+
+inline Vec3 sampleUniformCone(Sample2D u, float cosThetaMax) {
+	return sampleUniformConeGap(u, 1 - cosThetaMax);
+}
+
+inline float uniformConePdf(float cosThetaMax) {
+	return 1 / (2 * PI * (1 - cosThetaMax));
+}
+
+inline Vec3 sampleUniformHemisphere(Sample2D u) {
+	return sampleUniformCone(u, 0);
+}
+
+inline Vec3 sampleUniformSphere(Sample2D u) {
+	return sampleUniformCone(u, -1);
+}
+
+inline float uniformSpherePdf() {
+	return 1 / (4 * PI);
+}
+
+// Uniform point in the unit ball; u3 picks the radius.
+inline Vec3 sampleUniformBall(Sample2D u, float u3) {
+	return cbrtf(u3) * sampleUniformSphere(u);
+}
+
+// Orthonormal frame around a unit normal, without branches (Duff et al.,
+// "Building an Orthonormal Basis, Revisited", 2017).
+struct Frame {
+	explicit Frame(const Vec3& n) : normal(n) {
+		float sign = copysignf(1.0f, n.z());
+		float a = -1 / (sign + n.z());
+		float b = n.x() * n.y() * a;
+		tangent = Vec3(1 + sign * n.x() * n.x() * a, sign * b, -sign * n.x());
+		bitangent = Vec3(b, sign + n.y() * n.y() * a, -n.y());
+	}
+
+	Vec3 toWorld(const Vec3& v) const {
+		return v.x() * tangent + v.y() * bitangent + v.z() * normal;
+	}
+
+	Vec3 tangent, bitangent, normal;
+};
+
+// ----------------------------------------
+// Batch warps
+//
+// Structure-of-arrays versions of the warps above for count samples. The
+// loops have no branches or calls, so the compiler vectorizes them (GCC only
+// with -fno-trapping-math, which CMakeLists.txt sets).
+
+inline void concentricDiskBatch(const float* u1, const float* u2, int count, float* x, float* y) {
+	for (int ii = 0; ii < count; ii++) concentricDisk(u1[ii], u2[ii], x[ii], y[ii]);
+}
+
+inline void cosineHemisphereBatch(const float* u1, const float* u2, int count, float* x, float* y, float* z) {
+	for (int ii = 0; ii < count; ii++) {
+		float dx, dy;
+		concentricDisk(u1[ii], u2[ii], dx, dy);
+		x[ii] = dx;
+		y[ii] = dy;
+		z[ii] = sqrtf(max(0.0f, 1 - dx * dx - dy * dy));
+	}
+}
+
+inline void uniformConeBatch(const float* u1, const float* u2, int count, float cosThetaMax, float* x, float* y, float* z) {
+	float k = 1 - cosThetaMax;
+	for (int ii = 0; ii < count; ii++) {
+		float dx, dy;
+		concentricDisk(u1[ii], u2[ii], dx, dy);
+		float r2 = dx * dx + dy * dy;
+		float scale = sqrtf(max(0.0f, k * (2 - r2 * k)));
+		x[ii] = dx * scale;
+		y[ii] = dy * scale;
+		z[ii] = 1 - r2 * k;
+	}
+}
+
+inline void uniformSphereBatch(const float* u1, const float* u2, int count, float* x, float* y, float* z) {
+	uniformConeBatch(u1, u2, count, -1, x, y, z);
+}
+
+// ----------------------------------------
+// Random helpers, drawing from random_float()
+
+inline Sample2D randomSample2D() {
+	float x = random_float();
+	return Sample2D{ x, random_float() };
+}
+
+inline Vec3 randomUnitVector() {
+	return sampleUniformSphere(randomSample2D());
+}
+
+inline Vec3 randomInUnitSphere() {
+	return sampleUniformBall(randomSample2D(), random_float());
+}
+
+inline Vec3 randomInUnitDisk() {
+	return sampleConcentricDisk(randomSample2D());
+}
+
+#endif // !SAMPLING_H
@@ -0,0 +1,148 @@
+#pragma once
+
+#ifndef SCENE_ARENA_H
+#define SCENE_ARENA_H
+
+// Arena that owns all objects of a scene.
+//
+// Objects are constructed in contiguous blocks, one pool per type, so that
+// e.g. all BVH nodes or all spheres end up next to each other in memory.
+// make<T>() is a bump allocation and returns a non-owning shared_ptr: it has
+// no control block, so copying it never touches an atomic reference count.
+// Everything is released together when the arena is destroyed; the arena must
+// therefore outlive every Hittable/Material/Texture graph built from it.
+//
+// Types listed with ArenaTrivialTeardown are not destroyed one by one, because
+// their destructors would only release shared_ptrs into the arena. That makes
+// teardown of primitives and BVH nodes a matter of freeing a few blocks.
+// Other types (those owning heap memory, or materials/textures that allocate
+// their own SolidColor through make_shared) still get their destructor called.
+//
+// Not thread-safe: build the scene from one thread.
+
+#include "RTNW.h"
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+class Sphere;
+class MovingSphere;
+class XYRect;
+class YZRect;
+class XZRect;
+class BVHNode;
+class MotionBVHNode;
+class Translate;
+class RotateY;
+class Instance;
+class Metal;
+class Dielectric;
+class SolidColor;
+
+template <typename T> struct ArenaTrivialTeardown : is_trivially_destructible<T> {};
+template <> struct ArenaTrivialTeardown<Sphere> : true_type {};
+template <> struct ArenaTrivialTeardown<MovingSphere> : true_type {};
+template <> struct ArenaTrivialTeardown<XYRect> : true_type {};
+template <> struct ArenaTrivialTeardown<YZRect> : true_type {};
+template <> struct ArenaTrivialTeardown<XZRect> : true_type {};
+template <> struct ArenaTrivialTeardown<BVHNode> : true_type {};
+template <> struct ArenaTrivialTeardown<MotionBVHNode> : true_type {};
+template <> struct ArenaTrivialTeardown<Translate> : true_type {};
+template <> struct ArenaTrivialTeardown<RotateY> : true_type {};
+template <> struct ArenaTrivialTeardown<Instance> : true_type {};
+template <> struct ArenaTrivialTeardown<Metal> : true_type {};
+template <> struct ArenaTrivialTeardown<Dielectric> : true_type {};
+template <> struct ArenaTrivialTeardown<SolidColor> : true_type {};
+
+class SceneArena {
+public:
+	SceneArena() {}
+	SceneArena(const SceneArena&) = delete;
+	SceneArena& operator=(const SceneArena&) = delete;
+
+	template <typename T, typename... Args>
+	shared_ptr<T> make(Args&&... args) {
+		T* obj = pool<T>().allocate();
+		new (obj) T(forward<Args>(args)...);
+		pool<T>().constructed++;
+		return shared_ptr<T>(shared_ptr<void>(), obj);
+	}
+
+	// Bytes reserved by all blocks.
+	size_t bytesReserved() const {
+		size_t total = 0;
+		for (const auto& p : pools) {
+			if (p) total += p->bytesReserved();
+		}
+		return total;
+	}
+
+private:
+	struct PoolBase {
+		virtual ~PoolBase() {}
+		virtual size_t bytesReserved() const = 0;
+	};
+
+	template <typename T>
+	struct Pool : PoolBase {
+		static_assert(alignof(T) <= alignof(max_align_t), "over-aligned types are not supported");
+
+		// Roughly 64 KiB per block, at least 16 objects.
+		static const size_t objectsPerBlock = sizeof(T) * 16 > 65536 ? 16 : 65536 / sizeof(T);
+
+		vector<T*> blocks;
+		size_t used = objectsPerBlock; // objects taken from the last block
+		size_t constructed = 0;
+
+		T* allocate() {
+			if (used == objectsPerBlock) {
+				blocks.push_back(static_cast<T*>(::operator new(objectsPerBlock * sizeof(T))));
+				used = 0;
+			}
+			return blocks.back() + used++;
+		}
+
+		size_t bytesReserved() const override {
+			return blocks.size() * objectsPerBlock * sizeof(T);
+		}
+
+		~Pool() {
+			if (!ArenaTrivialTeardown<T>::value) {
+				for (size_t ii = constructed; ii > 0; ii--) {
+					size_t index = ii - 1;
+					blocks[index / objectsPerBlock][index % objectsPerBlock].~T();
+				}
+			}
+			for (T* block : blocks) ::operator delete(block);
+		}
+	};
+
+	static size_t nextTypeIndex() {
+		static size_t counter = 0;
+		return counter++;
+	}
+
+	template <typename T>
+	static size_t typeIndex() {
+		static const size_t index = nextTypeIndex();
+		return index;
+	}
+
+	template <typename T>
+	Pool<T>& pool() {
+		size_t index = typeIndex<T>();
+		if (index >= pools.size()) pools.resize(index + 1);
+		if (!pools[index]) pools[index].reset(new Pool<T>());
+		return static_cast<Pool<T>&>(*pools[index]);
+	}
+
+	vector<unique_ptr<PoolBase>> pools;
+};
+
+#endif // !SCENE_ARENA_H
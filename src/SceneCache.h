@@ -0,0 +1,835 @@
+#pragma once
+
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+// Binary cache of a built scene: primitives, materials, textures with their
+// pixel, noise and voxel data, and the acceleration structure, so a scene is
+// built once and later runs only map the file.
+//
+// Layout, all little-endian:
+//
+//   SceneCacheHeader
+//   SceneCacheRecord[textureCount]
+//   SceneCacheRecord[materialCount]
+//   SceneCacheRecord[hittableCount]
+//   SceneCacheInput[inputCount]
+//   blobs: variable-size data, each 16-byte aligned
+//
+// Objects refer to each other by index into their table, and to their blob by
+// offset into the blob section, so the file holds no pointers and can be
+// mapped anywhere. Every record comes after the records it refers to, which
+// makes loading one pass over the tables. Records still become objects, since
+// they need vtables, but that is a constructor call each: no sorting, no
+// bounds computation, no image decoding. Bulk data is used where it is mapped:
+// QuantizedBVH nodes and image pixels are not copied at all.
+//
+// A cache file belongs to one key, a hash of the cache version, the scene id,
+// the BVH options and the scene file options (SceneCache::key()), so a scene
+// keeps its file name across builds and a new save replaces the old file. It
+// also lists the files the scene read (images, voxel grids, sphere chunk
+// files) with the hash of their contents; the cache is stale as soon as one
+// of them changes, appears or disappears.
+//
+// Not every scene can be stored: MotionBVHNode and user-defined types are not
+// known to the cache, and save() turns such scenes down.
+
+#include "RTNW.h"
+#include "Scenes.h"
+#include "OutOfCore.h"
+#include "Utils.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+const char sceneCacheMagic[8] = { 'R', 'T', 'N', 'W', 'S', 'C', 'N', 'C' };
+// Bump when the record layout or the code that builds a scene changes: the
+// key does not cover the build, so old files would still be taken.
+const uint32_t sceneCacheVersion = 2;
+
+// Reference to no record, e.g. an instance that keeps its geometry's materials.
+const uint32_t noRecord = 0xffffffffu;
+
+// One texture, material or hittable. What the fields hold depends on kind,
+// see SceneCache::saveTexture() and friends.
+struct SceneCacheRecord {
+	uint32_t kind;      // TextureKind, MaterialKind or HittableKind
+	uint32_t refs[3];   // indices of other records
+	uint32_t ints[4];   // sizes and flags
+	float values[12];
+	uint64_t blob;      // offset into the blob section
+	uint64_t blobSize;
+};
+
+// A file the scene was built from.
+struct SceneCacheInput {
+	uint64_t name;       // blob holding the path
+	uint32_t nameLength;
+	uint32_t present;    // 0: the file did not exist
+	uint64_t size;
+	uint64_t hash;
+};
+
+struct SceneCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t sceneId;
+	uint64_t key;
+	uint64_t fileSize;
+	uint64_t randomState; // generator of the building thread, after the build
+
+	SceneSettings settings;
+
+	uint32_t textureCount, materialCount, hittableCount, inputCount;
+	uint32_t worldCount; // the world list is a blob of hittable indices
+	uint32_t top;        // hittable index of the acceleration structure
+	uint64_t world;
+	uint64_t recordOffset;
+	uint64_t blobOffset;
+};
+
+static_assert(is_trivially_copyable<SceneCacheHeader>::value, "the header is written as is");
+static_assert(sizeof(QuantizedBVHNode) == 16, "quantized nodes are mapped as is");
+
+class SceneCache {
+public:
+	SceneCache() {}
+	SceneCache(const SceneCache&) = delete;
+	SceneCache& operator=(const SceneCache&) = delete;
+
+	// Hash of everything besides input files that the built scene depends on.
+	static uint64_t key(int sceneId, bool motionBVH, int temporalSplits, bool quantizedBVH);
+
+	// Cache file for key in directory.
+	static string path(const string& directory, uint64_t key);
+
+	// Write world and top, the acceleration structure over it, to path
+	// through a temporary file. False if the scene holds types the cache
+	// does not know, or if the file cannot be written.
+	static bool save(const string& path, int sceneId, uint64_t key, const SceneSettings& settings,
+		const HittableList& world, const Hittable& top);
+
+	// Rebuild the scene saved at path into arena, world and top. False if there
+	// is no valid cache for key and its inputs; world may then hold part of the
+	// scene. The objects point into this SceneCache, which must outlive them.
+	bool load(const string& path, uint64_t key, SceneArena& arena, HittableList& world, shared_ptr<Hittable>& top,
+		SceneSettings& settings);
+
+	// Hash of the file contents; false if it cannot be read.
+	static bool hashFile(const string& path, uint64_t& size, uint64_t& hash);
+
+private:
+	// Saving: each returns the index of the object's record, appending it
+	// (after the records it refers to) the first time the object is seen.
+	uint32_t saveTexture(const Texture* texture);
+	uint32_t saveMaterial(const Material* material);
+	uint32_t saveHittable(const Hittable* hittable);
+	uint64_t beginBlob();
+	void appendBytes(const void* data, size_t size);
+	uint64_t appendBlob(const void* data, size_t size) {
+		uint64_t offset = beginBlob();
+		appendBytes(data, size);
+		return offset;
+	}
+	void addInput(const string& name);
+
+	vector<SceneCacheRecord> textureRecords, materialRecords, hittableRecords;
+	unordered_map<const void*, uint32_t> savedIndices;
+	vector<uint8_t> blobs;
+	vector<string> inputNames;
+	bool supported = true;
+
+	// Loading
+	bool decode(const string& path, uint64_t key, SceneArena& arena, HittableList& world, shared_ptr<Hittable>& top,
+		SceneSettings& settings);
+	shared_ptr<Texture> loadTexture(const SceneCacheRecord& record, SceneArena& arena);
+	shared_ptr<Material> loadMaterial(const SceneCacheRecord& record, SceneArena& arena);
+	shared_ptr<Hittable> loadHittable(const SceneCacheRecord& record, SceneArena& arena);
+	const uint8_t* blob(const SceneCacheRecord& record) const { return blobBase + record.blob; }
+	bool blobHolds(const SceneCacheRecord& record, uint64_t bytes) const {
+		return record.blobSize >= bytes && record.blob <= blobSize && blobSize - record.blob >= record.blobSize;
+	}
+
+	ChunkFile file;
+	vector<uint8_t> buffer; // the file, where it is not mapped
+	const uint8_t* blobBase = nullptr;
+	uint64_t blobSize = 0;
+	vector<shared_ptr<Texture>> textures;
+	vector<shared_ptr<Material>> materials;
+	vector<shared_ptr<Hittable>> hittables;
+	bool valid = true;
+};
+
+// FNV-1a, a word at a time; the shift carries the high bits of each word
+// down, which the multiplication alone would not.
+inline uint64_t sceneCacheHash(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+	const uint64_t prime = 1099511628211ULL;
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	size_t words = size / 8;
+	for (size_t ii = 0; ii < words; ii++) {
+		uint64_t word;
+		memcpy(&word, bytes + ii * 8, 8);
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 32;
+	}
+	for (size_t ii = words * 8; ii < size; ii++) hash = (hash ^ bytes[ii]) * prime;
+	return hash;
+}
+
+uint64_t SceneCache::key(int sceneId, bool motionBVH, int temporalSplits, bool quantizedBVH) {
+	int32_t options[] = { int32_t(sceneCacheVersion), int32_t(sizeof(SceneCacheRecord)), int32_t(sizeof(SceneCacheHeader)),
+		sceneId, motionBVH ? 1 : 0, temporalSplits, quantizedBVH ? 1 : 0 };
+	const SceneFileOptions& files = sceneFileOptions();
+	uint64_t hash = sceneCacheHash(options, sizeof(options));
+	hash = sceneCacheHash(files.cloudGrid.c_str(), files.cloudGrid.size() + 1, hash);
+	return sceneCacheHash(files.sphereField.c_str(), files.sphereField.size() + 1, hash);
+}
+
+string SceneCache::path(const string& directory, uint64_t key) {
+	char name[40];
+	snprintf(name, sizeof(name), "scene-%016llx.rtnwscene", (unsigned long long)key);
+	if (directory.empty()) return name;
+	char last = directory.back();
+	return last == '/' || last == '\\' ? directory + name : directory + "/" + name;
+}
+
+bool SceneCache::hashFile(const string& path, uint64_t& size, uint64_t& hash) {
+	FILE* in = fopen(path.c_str(), "rb");
+	if (in == nullptr) return false;
+
+	// Chunks are a multiple of 8 bytes, so the hash does not depend on them.
+	vector<uint8_t> chunk(1 << 20);
+	size = 0;
+	hash = 14695981039346656037ULL;
+	size_t read;
+	while ((read = fread(chunk.data(), 1, chunk.size(), in)) > 0) {
+		hash = sceneCacheHash(chunk.data(), read, hash);
+		size += read;
+	}
+	bool ok = !ferror(in);
+	fclose(in);
+	return ok;
+}
+
+uint64_t SceneCache::beginBlob() {
+	blobs.resize((blobs.size() + 15) / 16 * 16);
+	return blobs.size();
+}
+
+void SceneCache::appendBytes(const void* data, size_t size) {
+	blobs.insert(blobs.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+}
+
+void SceneCache::addInput(const string& name) {
+	for (const string& known : inputNames) {
+		if (known == name) return;
+	}
+	inputNames.push_back(name);
+}
+
+uint32_t SceneCache::saveTexture(const Texture* texture) {
+	auto saved = savedIndices.find(texture);
+	if (saved != savedIndices.end()) return saved->second;
+
+	SceneCacheRecord record = {};
+	record.kind = texture->kind;
+	switch (texture->kind) {
+	case TextureSolidColor: {
+		const Color& color = static_cast<const SolidColor*>(texture)->colorValue;
+		for (int ii = 0; ii < 3; ii++) record.values[ii] = color[ii];
+		break;
+	}
+	case TextureChecker: {
+		const CheckerTexture* checker = static_cast<const CheckerTexture*>(texture);
+		record.refs[0] = saveTexture(checker->odd.get());
+		record.refs[1] = saveTexture(checker->even.get());
+		break;
+	}
+	case TextureNoise: {
+		const NoiseTexture* noise = static_cast<const NoiseTexture*>(texture);
+		const Perlin& perlin = noise->noise;
+		record.values[0] = noise->scale;
+		record.ints[0] = Perlin::pointCount;
+		record.blob = beginBlob();
+		appendBytes(perlin.randVecs, Perlin::pointCount * sizeof(Vec3));
+		appendBytes(perlin.xPermutaion, Perlin::pointCount * sizeof(int));
+		appendBytes(perlin.yPermutaion, Perlin::pointCount * sizeof(int));
+		appendBytes(perlin.zPermutaion, Perlin::pointCount * sizeof(int));
+		record.blobSize = blobs.size() - record.blob;
+		break;
+	}
+	case TextureImage: {
+		const ImageTexture* image = static_cast<const ImageTexture*>(texture);
+		if (!image->sourceName.empty()) addInput(image->sourceName);
+		if (image->data == nullptr) break;
+		record.ints[0] = uint32_t(image->width);
+		record.ints[1] = uint32_t(image->height);
+		record.ints[2] = uint32_t(image->bytes_per_scanline);
+		record.blobSize = uint64_t(image->height) * image->bytes_per_scanline;
+		record.blob = appendBlob(image->data, size_t(record.blobSize));
+		break;
+	}
+	default:
+		supported = false;
+		break;
+	}
+
+	textureRecords.push_back(record);
+	return savedIndices[texture] = uint32_t(textureRecords.size() - 1);
+}
+
+uint32_t SceneCache::saveMaterial(const Material* material) {
+	auto saved = savedIndices.find(material);
+	if (saved != savedIndices.end()) return saved->second;
+
+	SceneCacheRecord record = {};
+	record.kind = material->kind;
+	switch (material->kind) {
+	case MaterialLambertian:
+		record.refs[0] = saveTexture(static_cast<const Lambertian*>(material)->albedo.get());
+		break;
+	case MaterialMetal: {
+		const Metal* metal = static_cast<const Metal*>(material);
+		for (int ii = 0; ii < 3; ii++) record.values[ii] = metal->albedo[ii];
+		record.values[3] = metal->fuzzy;
+		break;
+	}
+	case MaterialDielectric:
+		record.values[0] = static_cast<const Dielectric*>(material)->ir;
+		break;
+	case MaterialDiffuseLight:
+		record.refs[0] = saveTexture(static_cast<const DiffuseLight*>(material)->emit.get());
+		break;
+	case MaterialIsotropic:
+		record.refs[0] = saveTexture(static_cast<const Isotropic*>(material)->abedo.get());
+		break;
+	default:
+		supported = false;
+		break;
+	}
+
+	materialRecords.push_back(record);
+	return savedIndices[material] = uint32_t(materialRecords.size() - 1);
+}
+
+inline void storeBox(const AABB& box, float* values) {
+	for (int ii = 0; ii < 3; ii++) {
+		values[ii] = box.min()[ii];
+		values[3 + ii] = box.max()[ii];
+	}
+}
+
+inline AABB loadBox(const float* values) {
+	return AABB(Point3(values[0], values[1], values[2]), Point3(values[3], values[4], values[5]));
+}
+
+uint32_t SceneCache::saveHittable(const Hittable* hittable) {
+	auto saved = savedIndices.find(hittable);
+	if (saved != savedIndices.end()) return saved->second;
+
+	SceneCacheRecord record = {};
+	record.kind = hittable->kind;
+	float* values = record.values;
+	switch (hittable->kind) {
+	case HittableSphere: {
+		const Sphere* sphere = static_cast<const Sphere*>(hittable);
+		record.refs[0] = saveMaterial(sphere->materialPtr.get());
+		for (int ii = 0; ii < 3; ii++) values[ii] = sphere->center[ii];
+		values[3] = sphere->radius;
+		break;
+	}
+	case HittableMovingSphere: {
+		const MovingSphere* sphere = static_cast<const MovingSphere*>(hittable);
+		record.refs[0] = saveMaterial(sphere->materialPtr.get());
+		for (int ii = 0; ii < 3; ii++) {
+			values[ii] = sphere->center0[ii];
+			values[3 + ii] = sphere->center1[ii];
+		}
+		values[6] = sphere->time0;
+		values[7] = sphere->time1;
+		values[8] = sphere->radius;
+		break;
+	}
+	case HittableXYRect: {
+		const XYRect* rect = static_cast<const XYRect*>(hittable);
+		record.refs[0] = saveMaterial(rect->mat_ptr.get());
+		float rectValues[] = { rect->x0, rect->x1, rect->y0, rect->y1, rect->k };
+		memcpy(values, rectValues, sizeof(rectValues));
+		break;
+	}
+	case HittableYZRect: {
+		const YZRect* rect = static_cast<const YZRect*>(hittable);
+		record.refs[0] = saveMaterial(rect->mat_ptr.get());
+		float rectValues[] = { rect->y0, rect->y1, rect->z0, rect->z1, rect->k };
+		memcpy(values, rectValues, sizeof(rectValues));
+		break;
+	}
+	case HittableXZRect: {
+		const XZRect* rect = static_cast<const XZRect*>(hittable);
+		record.refs[0] = saveMaterial(rect->mat_ptr.get());
+		float rectValues[] = { rect->x0, rect->x1, rect->z0, rect->z1, rect->k };
+		memcpy(values, rectValues, sizeof(rectValues));
+		break;
+	}
+	case HittableBox: {
+		// The sides share one material; the box rebuilds them.
+		const Box* box = static_cast<const Box*>(hittable);
+		record.refs[0] = saveMaterial(static_cast<const XYRect*>(box->sides.objects[0].get())->mat_ptr.get());
+		storeBox(AABB(box->pMin, box->pMax), values);
+		break;
+	}
+	case HittableConstantMedium: {
+		const ConstantMedium* medium = static_cast<const ConstantMedium*>(hittable);
+		record.refs[0] = saveHittable(medium->boundary.get());
+		record.refs[1] = saveMaterial(medium->phase_function.get());
+		values[0] = medium->negInvDensity;
+		break;
+	}
+	case HittableGridMedium: {
+		const GridMedium* medium = static_cast<const GridMedium*>(hittable);
+		const VoxelGrid& grid = *medium->grid;
+		record.refs[0] = saveMaterial(medium->phase_function.get());
+		storeBox(medium->bounds, values);
+		values[6] = medium->densityScale;
+		for (int ii = 0; ii < 3; ii++) record.ints[ii] = uint32_t(grid.n[ii]);
+		record.ints[3] = grid.sparse ? 1 : 0;
+		if (!grid.sourceName.empty()) addInput(grid.sourceName);
+
+		record.blob = beginBlob();
+		if (grid.sparse) {
+			appendBytes(grid.brickIndex.data(), grid.brickIndex.size() * sizeof(int));
+			appendBytes(grid.brickData.data(), grid.brickData.size() * sizeof(float));
+		}
+		else {
+			appendBytes(grid.dense.data(), grid.dense.size() * sizeof(float));
+		}
+		record.blobSize = blobs.size() - record.blob;
+		break;
+	}
+	case HittableListKind: {
+		const HittableList* list = static_cast<const HittableList*>(hittable);
+		vector<uint32_t> children;
+		for (const auto& object : list->objects) children.push_back(saveHittable(object.get()));
+		record.ints[0] = uint32_t(children.size());
+		record.blobSize = children.size() * sizeof(uint32_t);
+		record.blob = appendBlob(children.data(), size_t(record.blobSize));
+		break;
+	}
+	case HittableBVHNode: {
+		const BVHNode* node = static_cast<const BVHNode*>(hittable);
+		record.refs[0] = saveHittable(node->leftNode.get());
+		record.refs[1] = saveHittable(node->rightNode.get());
+		record.ints[0] = uint32_t(node->axis);
+		record.ints[1] = node->isLeaf ? 1 : 0;
+		storeBox(node->bbox, values);
+		values[6] = node->cost;
+		values[7] = node->builtCost;
+		break;
+	}
+	case HittableTranslate: {
+		const Translate* translate = static_cast<const Translate*>(hittable);
+		record.refs[0] = saveHittable(translate->obj.get());
+		for (int ii = 0; ii < 3; ii++) values[ii] = translate->offset[ii];
+		break;
+	}
+	case HittableRotateY: {
+		const RotateY* rotate = static_cast<const RotateY*>(hittable);
+		record.refs[0] = saveHittable(rotate->obj.get());
+		record.ints[0] = rotate->hasBox ? 1 : 0;
+		storeBox(rotate->bbox, values);
+		values[6] = rotate->cos_theta;
+		values[7] = rotate->sin_theta;
+		break;
+	}
+	case HittableQuantizedBVH: {
+		const QuantizedBVH* bvh = static_cast<const QuantizedBVH*>(hittable);
+		vector<uint32_t> leaves;
+		for (const Hittable* primitive : bvh->primitives) leaves.push_back(saveHittable(primitive));
+		storeBox(bvh->bbox, values);
+		record.ints[0] = uint32_t(bvh->nodeTotal);
+		record.ints[1] = uint32_t(leaves.size());
+		record.blob = beginBlob();
+		appendBytes(bvh->nodeArray, bvh->nodeTotal * sizeof(QuantizedBVHNode));
+		appendBytes(leaves.data(), leaves.size() * sizeof(uint32_t));
+		record.blobSize = blobs.size() - record.blob;
+		break;
+	}
+	case HittableInstance: {
+		const Instance* instance = static_cast<const Instance*>(hittable);
+		record.refs[0] = saveHittable(instance->geometry.get());
+		record.refs[1] = instance->material ? saveMaterial(instance->material.get()) : noRecord;
+		record.ints[0] = instance->hasBox ? 1 : 0;
+		memcpy(values, instance->worldToLocal.m, sizeof(instance->worldToLocal.m));
+		float box[6];
+		storeBox(instance->bbox, box);
+		record.blobSize = sizeof(box);
+		record.blob = appendBlob(box, sizeof(box));
+		break;
+	}
+	case HittableOutOfCoreSpheres: {
+		// Only the chunk file and its palette; the spheres stay in the chunk file.
+		const OutOfCoreSpheres* spheres = static_cast<const OutOfCoreSpheres*>(hittable);
+		vector<uint32_t> palette;
+		for (const auto& material : spheres->materials) palette.push_back(saveMaterial(material.get()));
+		addInput(spheres->filePath);
+		record.ints[0] = uint32_t(palette.size());
+		record.ints[1] = uint32_t(spheres->filePath.size());
+		record.blob = beginBlob();
+		appendBytes(palette.data(), palette.size() * sizeof(uint32_t));
+		appendBytes(spheres->filePath.data(), spheres->filePath.size());
+		record.blobSize = blobs.size() - record.blob;
+		break;
+	}
+	default:
+		supported = false;
+		break;
+	}
+
+	hittableRecords.push_back(record);
+	return savedIndices[hittable] = uint32_t(hittableRecords.size() - 1);
+}
+
+bool SceneCache::save(const string& path, int sceneId, uint64_t key, const SceneSettings& settings,
+	const HittableList& world, const Hittable& top) {
+	SceneCache cache;
+	vector<uint32_t> worldIndices;
+	for (const auto& object : world.objects) worldIndices.push_back(cache.saveHittable(object.get()));
+	uint32_t topIndex = cache.saveHittable(&top);
+	if (!cache.supported) return false;
+
+	SceneCacheHeader header = {};
+	memcpy(header.magic, sceneCacheMagic, sizeof(header.magic));
+	header.version = sceneCacheVersion;
+	header.sceneId = uint32_t(sceneId);
+	header.key = key;
+	header.randomState = threadRandomGenerator().state;
+	header.settings = settings;
+	header.textureCount = uint32_t(cache.textureRecords.size());
+	header.materialCount = uint32_t(cache.materialRecords.size());
+	header.hittableCount = uint32_t(cache.hittableRecords.size());
+	header.worldCount = uint32_t(worldIndices.size());
+	header.top = topIndex;
+	header.world = cache.appendBlob(worldIndices.data(), worldIndices.size() * sizeof(uint32_t));
+
+	vector<SceneCacheInput> inputs;
+	for (const string& name : cache.inputNames) {
+		SceneCacheInput input = {};
+		input.name = cache.appendBlob(name.data(), name.size());
+		input.nameLength = uint32_t(name.size());
+		input.present = hashFile(name, input.size, input.hash) ? 1 : 0;
+		inputs.push_back(input);
+	}
+	header.inputCount = uint32_t(inputs.size());
+
+	size_t recordCount = cache.textureRecords.size() + cache.materialRecords.size() + cache.hittableRecords.size();
+	header.recordOffset = sizeof(header);
+	uint64_t recordsEnd = header.recordOffset + recordCount * sizeof(SceneCacheRecord) + inputs.size() * sizeof(SceneCacheInput);
+	header.blobOffset = (recordsEnd + 63) / 64 * 64;
+	header.fileSize = header.blobOffset + cache.blobs.size();
+
+	string tmpPath = path + ".tmp";
+	{
+		ofstream out(tmpPath, ios::binary | ios::trunc);
+		if (!out) return false;
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const vector<SceneCacheRecord>* table : { &cache.textureRecords, &cache.materialRecords, &cache.hittableRecords })
+			out.write(reinterpret_cast<const char*>(table->data()), table->size() * sizeof(SceneCacheRecord));
+		out.write(reinterpret_cast<const char*>(inputs.data()), inputs.size() * sizeof(SceneCacheInput));
+		vector<char> padding(size_t(header.blobOffset - recordsEnd), 0);
+		out.write(padding.data(), padding.size());
+		out.write(reinterpret_cast<const char*>(cache.blobs.data()), cache.blobs.size());
+		if (!out) {
+			out.close();
+			remove(tmpPath.c_str());
+			return false;
+		}
+	}
+#ifdef _WIN32
+	remove(path.c_str()); // rename() does not replace on Windows
+#endif
+	return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+shared_ptr<Texture> SceneCache::loadTexture(const SceneCacheRecord& record, SceneArena& arena) {
+	auto texture = [&](uint32_t index) -> shared_ptr<Texture> {
+		if (index < textures.size()) return textures[index];
+		valid = false;
+		return nullptr;
+	};
+
+	switch (record.kind) {
+	case TextureSolidColor:
+		return arena.make<SolidColor>(record.values[0], record.values[1], record.values[2]);
+	case TextureChecker:
+		return arena.make<CheckerTexture>(texture(record.refs[1]), texture(record.refs[0]));
+	case TextureNoise: {
+		const size_t count = Perlin::pointCount;
+		if (record.ints[0] != count || !blobHolds(record, count * sizeof(Vec3) + 3 * count * sizeof(int))) break;
+		auto noise = arena.make<NoiseTexture>(record.values[0]);
+		Perlin& perlin = noise->noise;
+		const uint8_t* data = blob(record);
+		memcpy(perlin.randVecs, data, count * sizeof(Vec3));
+		data += count * sizeof(Vec3);
+		for (int* permutation : { perlin.xPermutaion, perlin.yPermutaion, perlin.zPermutaion }) {
+			memcpy(permutation, data, count * sizeof(int));
+			data += count * sizeof(int);
+		}
+		return noise;
+	}
+	case TextureImage: {
+		auto image = arena.make<ImageTexture>();
+		uint64_t bytes = uint64_t(record.ints[1]) * record.ints[2];
+		if (record.blobSize == 0) return image; // the image could not be loaded either
+		if (record.ints[2] < 3 * uint64_t(record.ints[0]) || !blobHolds(record, bytes)) break;
+		image->data = const_cast<unsigned char*>(blob(record));
+		image->borrowed = true;
+		image->width = int(record.ints[0]);
+		image->height = int(record.ints[1]);
+		image->bytes_per_scanline = int(record.ints[2]);
+		return image;
+	}
+	default:
+		break;
+	}
+	valid = false;
+	return nullptr;
+}
+
+shared_ptr<Material> SceneCache::loadMaterial(const SceneCacheRecord& record, SceneArena& arena) {
+	shared_ptr<Texture> texture;
+	if (record.refs[0] < textures.size()) texture = textures[record.refs[0]];
+	const float* values = record.values;
+
+	switch (record.kind) {
+	case MaterialLambertian:
+		if (!texture) break;
+		return arena.make<Lambertian>(texture);
+	case MaterialMetal:
+		return arena.make<Metal>(Color(values[0], values[1], values[2]), values[3]);
+	case MaterialDielectric:
+		return arena.make<Dielectric>(values[0]);
+	case MaterialDiffuseLight:
+		if (!texture) break;
+		return arena.make<DiffuseLight>(texture);
+	case MaterialIsotropic:
+		if (!texture) break;
+		return arena.make<Isotropic>(texture);
+	default:
+		break;
+	}
+	valid = false;
+	return nullptr;
+}
+
+shared_ptr<Hittable> SceneCache::loadHittable(const SceneCacheRecord& record, SceneArena& arena) {
+	auto material = [&](uint32_t index) -> shared_ptr<Material> {
+		if (index < materials.size()) return materials[index];
+		valid = false;
+		return nullptr;
+	};
+	auto hittable = [&](uint32_t index) -> shared_ptr<Hittable> {
+		if (index < hittables.size()) return hittables[index];
+		valid = false;
+		return nullptr;
+	};
+	const float* values = record.values;
+
+	switch (record.kind) {
+	case HittableSphere:
+		return arena.make<Sphere>(Point3(values[0], values[1], values[2]), values[3], material(record.refs[0]));
+	case HittableMovingSphere:
+		return arena.make<MovingSphere>(Point3(values[0], values[1], values[2]), Point3(values[3], values[4], values[5]),
+			values[6], values[7], values[8], material(record.refs[0]));
+	case HittableXYRect:
+		return arena.make<XYRect>(values[0], values[1], values[2], values[3], values[4], material(record.refs[0]));
+	case HittableYZRect:
+		return arena.make<YZRect>(values[0], values[1], values[2], values[3], values[4], material(record.refs[0]));
+	case HittableXZRect:
+		return arena.make<XZRect>(values[0], values[1], values[2], values[3], values[4], material(record.refs[0]));
+	case HittableBox: {
+		AABB box = loadBox(values);
+		return arena.make<Box>(box.min(), box.max(), material(record.refs[0]));
+	}
+	case HittableConstantMedium: {
+		shared_ptr<Hittable> boundary = hittable(record.refs[0]);
+		if (!valid) break;
+		auto medium = arena.make<ConstantMedium>(boundary, -1 / values[0], material(record.refs[1]));
+		medium->negInvDensity = values[0];
+		return medium;
+	}
+	case HittableGridMedium: {
+		int n[3] = { int(record.ints[0]), int(record.ints[1]), int(record.ints[2]) };
+		if (n[0] <= 0 || n[1] <= 0 || n[2] <= 0) break;
+		auto grid = make_shared<VoxelGrid>(n[0], n[1], n[2], vector<float>());
+		const uint8_t* data = blob(record);
+		size_t voxels = size_t(n[0]) * n[1] * n[2];
+		if (record.ints[3]) {
+			grid->sparse = true;
+			for (int ii = 0; ii < 3; ii++) grid->bricks[ii] = (n[ii] + VoxelGrid::brickSize - 1) / VoxelGrid::brickSize;
+			size_t brickCount = size_t(grid->bricks[0]) * grid->bricks[1] * grid->bricks[2];
+			if (!blobHolds(record, brickCount * sizeof(int))) break;
+			size_t dataCount = size_t(record.blobSize - brickCount * sizeof(int)) / sizeof(float);
+			grid->brickIndex.assign(reinterpret_cast<const int*>(data), reinterpret_cast<const int*>(data) + brickCount);
+			const float* brickData = reinterpret_cast<const float*>(data + brickCount * sizeof(int));
+			grid->brickData.assign(brickData, brickData + dataCount);
+
+			const int brickVoxels = VoxelGrid::brickSize * VoxelGrid::brickSize * VoxelGrid::brickSize;
+			for (int brick : grid->brickIndex) {
+				if (brick >= 0 && size_t(brick + 1) * brickVoxels > dataCount) valid = false;
+			}
+			if (!valid) break;
+		}
+		else {
+			if (!blobHolds(record, voxels * sizeof(float))) break;
+			grid->dense.assign(reinterpret_cast<const float*>(data), reinterpret_cast<const float*>(data) + voxels);
+		}
+		return arena.make<GridMedium>(grid, loadBox(values), values[6], material(record.refs[0]));
+	}
+	case HittableListKind: {
+		if (!blobHolds(record, uint64_t(record.ints[0]) * sizeof(uint32_t))) break;
+		auto list = arena.make<HittableList>();
+		const uint32_t* children = reinterpret_cast<const uint32_t*>(blob(record));
+		for (uint32_t ii = 0; ii < record.ints[0]; ii++) list->add(hittable(children[ii]));
+		return list;
+	}
+	case HittableBVHNode: {
+		auto node = arena.make<BVHNode>();
+		node->leftNode = hittable(record.refs[0]);
+		node->rightNode = hittable(record.refs[1]);
+		node->axis = int(record.ints[0]);
+		node->isLeaf = record.ints[1] != 0;
+		node->bbox = loadBox(values);
+		node->cost = values[6];
+		node->builtCost = values[7];
+		return node;
+	}
+	case HittableTranslate: {
+		shared_ptr<Hittable> object = hittable(record.refs[0]);
+		if (!valid) break;
+		return arena.make<Translate>(object, Vec3(values[0], values[1], values[2]));
+	}
+	case HittableRotateY: {
+		shared_ptr<Hittable> object = hittable(record.refs[0]);
+		if (!valid) break;
+		auto rotate = arena.make<RotateY>(object, 0);
+		rotate->hasBox = record.ints[0] != 0;
+		rotate->bbox = loadBox(values);
+		rotate->cos_theta = values[6];
+		rotate->sin_theta = values[7];
+		return rotate;
+	}
+	case HittableQuantizedBVH: {
+		// The nodes stay where they are mapped; only the leaves need pointers.
+		size_t nodeCount = record.ints[0], leafCount = record.ints[1];
+		size_t nodeBytes = nodeCount * sizeof(QuantizedBVHNode);
+		if (nodeCount == 0 || !blobHolds(record, nodeBytes + leafCount * sizeof(uint32_t))) break;
+		const uint32_t* leaves = reinterpret_cast<const uint32_t*>(blob(record) + nodeBytes);
+		vector<const Hittable*> primitives(leafCount);
+		for (size_t ii = 0; ii < leafCount; ii++) primitives[ii] = hittable(leaves[ii]).get();
+		if (!valid) break;
+		return arena.make<QuantizedBVH>(reinterpret_cast<const QuantizedBVHNode*>(blob(record)), nodeCount,
+			move(primitives), loadBox(values));
+	}
+	case HittableInstance: {
+		shared_ptr<Hittable> geometry = hittable(record.refs[0]);
+		shared_ptr<Material> replacement = record.refs[1] == noRecord ? nullptr : material(record.refs[1]);
+		if (!valid || !blobHolds(record, 6 * sizeof(float))) break;
+		auto instance = arena.make<Instance>(geometry, Affine(), replacement);
+		memcpy(instance->worldToLocal.m, values, sizeof(instance->worldToLocal.m));
+		instance->hasBox = record.ints[0] != 0;
+		instance->bbox = loadBox(reinterpret_cast<const float*>(blob(record)));
+		return instance;
+	}
+	case HittableOutOfCoreSpheres: {
+		size_t paletteBytes = record.ints[0] * sizeof(uint32_t);
+		if (!blobHolds(record, paletteBytes + record.ints[1])) break;
+		const uint32_t* indices = reinterpret_cast<const uint32_t*>(blob(record));
+		vector<shared_ptr<Material>> palette;
+		for (uint32_t ii = 0; ii < record.ints[0]; ii++) palette.push_back(material(indices[ii]));
+		string chunkPath(reinterpret_cast<const char*>(blob(record) + paletteBytes), record.ints[1]);
+		if (!valid) break;
+
+		auto spheres = arena.make<OutOfCoreSpheres>();
+		if (!spheres->open(chunkPath, palette)) break;
+		return spheres;
+	}
+	default:
+		break;
+	}
+	valid = false;
+	return nullptr;
+}
+
+bool SceneCache::load(const string& path, uint64_t key, SceneArena& arena, HittableList& world, shared_ptr<Hittable>& top,
+	SceneSettings& settings) {
+	// Textures draw random numbers while they are constructed; a build after
+	// a failed load must start from the same state as without the cache.
+	uint64_t randomState = threadRandomGenerator().state;
+	if (decode(path, key, arena, world, top, settings)) return true;
+	threadRandomGenerator().state = randomState;
+	file.close();
+	return false;
+}
+
+bool SceneCache::decode(const string& path, uint64_t key, SceneArena& arena, HittableList& world, shared_ptr<Hittable>& top,
+	SceneSettings& settings) {
+	textures.clear();
+	materials.clear();
+	hittables.clear();
+	valid = true;
+	if (!file.open(path) || file.size() < sizeof(SceneCacheHeader)) return false;
+
+	SceneCacheHeader header;
+	const uint8_t* base = file.data(0, size_t(file.size()), buffer);
+	memcpy(&header, base, sizeof(header));
+	if (memcmp(header.magic, sceneCacheMagic, sizeof(header.magic)) != 0 || header.version != sceneCacheVersion
+		|| header.key != key || header.fileSize != file.size()) return false;
+
+	uint64_t recordCount = uint64_t(header.textureCount) + header.materialCount + header.hittableCount;
+	uint64_t recordsEnd = header.recordOffset + recordCount * sizeof(SceneCacheRecord) + uint64_t(header.inputCount) * sizeof(SceneCacheInput);
+	if (header.recordOffset < sizeof(header) || recordsEnd > header.blobOffset || header.blobOffset > file.size()) return false;
+	blobBase = base + header.blobOffset;
+	blobSize = file.size() - header.blobOffset;
+
+	const SceneCacheRecord* records = reinterpret_cast<const SceneCacheRecord*>(base + header.recordOffset);
+	const SceneCacheInput* inputs = reinterpret_cast<const SceneCacheInput*>(records + recordCount);
+
+	// Stale if any input changed since the cache was written.
+	for (uint32_t ii = 0; ii < header.inputCount; ii++) {
+		const SceneCacheInput& input = inputs[ii];
+		if (input.name > blobSize || blobSize - input.name < input.nameLength) return false;
+		string name(reinterpret_cast<const char*>(blobBase + input.name), input.nameLength);
+		uint64_t size = 0, hash = 0;
+		bool present = hashFile(name, size, hash);
+		if (present != (input.present != 0) || (present && (size != input.size || hash != input.hash))) return false;
+	}
+
+	for (uint32_t ii = 0; ii < header.textureCount && valid; ii++) textures.push_back(loadTexture(*records++, arena));
+	for (uint32_t ii = 0; ii < header.materialCount && valid; ii++) materials.push_back(loadMaterial(*records++, arena));
+	for (uint32_t ii = 0; ii < header.hittableCount && valid; ii++) hittables.push_back(loadHittable(*records++, arena));
+	if (!valid || header.top >= hittables.size()) return false;
+	if (header.world > blobSize || (blobSize - header.world) / sizeof(uint32_t) < header.worldCount) return false;
+
+	world.clear();
+	const uint32_t* worldIndices = reinterpret_cast<const uint32_t*>(blobBase + header.world);
+	for (uint32_t ii = 0; ii < header.worldCount; ii++) {
+		if (worldIndices[ii] >= hittables.size()) return false;
+		world.add(hittables[worldIndices[ii]]);
+	}
+	top = hittables[header.top];
+	settings = header.settings;
+
+	// Continue the random sequence where the build left it.
+	threadRandomGenerator().state = header.randomState;
+	return true;
+}
+
+#endif // !SCENE_CACHE_H
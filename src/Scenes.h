@@ -0,0 +1,681 @@
+#pragma once
+
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "RTNW.h"
+#include "Camera.h"
+#include "HittableList.h"
+#include "Sphere.h"
+#include "Material.h"
+#include "MovingSphere.h"
+#include "Texture.h"
+#include "AARect.h"
+#include "Box.h"
+#include "ConstantMedium.h"
+#include "GridMedium.h"
+#include "BVHNode.h"
+#include "MotionBVHNode.h"
+#include "QuantizedBVH.h"
+#include "OutOfCore.h"
+#include "Instance.h"
+#include "EnvironmentMap.h"
+#include "Sampler.h"
+#include "SceneArena.h"
+
+// Camera and image parameters that go together with a built-in scene.
+struct SceneSettings {
+	float aspectRatio = 16.0 / 9.0;
+	int imageWidth = 400;
+	int samplesPerPixel = 100;
+	int maxDepth = 50;
+	SamplerType sampler = SamplerSobol;
+	Color backgroundColor = Color(0, 0, 0);
+	// With sunIntensity > 0 a daylight sky (EnvironmentMap::makeDaylight())
+	// lights the scene in place of backgroundColor.
+	Vec3 sunDirection = Vec3(0, 1, 0);
+	float sunIntensity = 0;
+
+	Point3 lookFrom = Point3(13, 2, 3);
+	Point3 lookAt = Point3(0, 0, 0);
+	Vec3 upVector = Vec3(0, 1, 0);
+	float vFOV = 20.0; // Vertical Field of View
+	float focalDistance = 10.0;
+	float aperture = 0;
+
+	int imageHeight() const { return (int)(imageWidth / aspectRatio); }
+};
+
+// Files the built-in scenes read; main sets them from the command line
+// before a scene is loaded, and workers get them from the coordinator.
+struct SceneFileOptions {
+	string cloudGrid;   // raw grid of the cloud scene; empty: generated in memory
+	string sphereField; // chunk file of the sphere field, written if missing; empty: in the temporary directory
+};
+
+inline SceneFileOptions& sceneFileOptions() {
+	static SceneFileOptions options;
+	return options;
+}
+
+// Path of a file called name in the system's temporary directory.
+inline string temporaryFilePath(const string& name) {
+#ifdef _WIN32
+	const char* directory = getenv("TEMP");
+	string path = directory && *directory ? directory : ".";
+#else
+	const char* directory = getenv("TMPDIR");
+	string path = directory && *directory ? directory : "/tmp";
+#endif
+	char last = path.back();
+	return last == '/' || last == '\\' ? path + name : path + "/" + name;
+}
+
+// Camera for settings; the shutter is open during [0, 1].
+inline Camera sceneCamera(const SceneSettings& settings) {
+	return Camera(settings.lookFrom, settings.lookAt, settings.upVector, settings.vFOV, settings.aspectRatio,
+		settings.focalDistance, settings.aperture, 0, 1);
+}
+
+// Set up sceneEnvironment() for settings: the image at environmentPath,
+// scaled by environmentScale, if there is one, else the scene's own sky, if
+// it has one. False when the image cannot be read.
+inline bool useEnvironment(const SceneSettings& settings, const string& environmentPath = string(), float environmentScale = 1) {
+	EnvironmentMap& environment = sceneEnvironment();
+	if (!environmentPath.empty()) {
+		if (environment.load(environmentPath, environmentScale)) return true;
+		cerr << "ERROR: Could not load environment map '" << environmentPath << "'.\n";
+		return false;
+	}
+	if (settings.sunIntensity > 0) environment.makeDaylight(settings.sunDirection, settings.sunIntensity);
+	else environment.clear();
+	return true;
+}
+
+// Top-level BVH over world, allocated from arena.
+inline shared_ptr<Hittable> buildSceneBVH(HittableList& world, SceneArena& arena, bool motionBVH = false, int temporalSplits = 0,
+	bool quantizedBVH = false) {
+	if (motionBVH) return arena.make<MotionBVHNode>(world, 0, 1, temporalSplits, arena);
+	if (quantizedBVH) return arena.make<QuantizedBVH>(world, 0, 1);
+	return arena.make<BVHNode>(world, 0, 1, arena);
+}
+
+void createRandomScene(HittableList& world, SceneArena& arena) {
+	world.clear();
+	auto checker = arena.make<CheckerTexture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
+	auto groundMaterial = arena.make<Lambertian>(checker);
+	world.add(arena.make<Sphere>(Point3(0, -1000, 0), 1000, groundMaterial));
+
+	float sRadius = 0.2;
+	for (int x = -11; x < 11; x++) {
+		for (int z = -11; z < 11; z++) {
+			auto mat = random_float();
+			
+			Point3 center(x + 0.9 * random_float(), sRadius, z + 0.9 * random_float());
+
+			if ((center - Point3(4, 0.2, 0)).length() <= 0.9) continue;
+
+			if (mat < 0.8) {
+				Color albedo = Color(random_float(0.5, 1), random_float(0.5, 1), random_float(0.5, 1));
+				Point3 center2 = center + Vec3(0, random_float(0, 0.5), 0);
+				auto sphereMaterial = arena.make<Lambertian>(albedo);
+				world.add(arena.make<MovingSphere>(center, center2, 0, 1, 0.2, sphereMaterial));
+			}
+			else if (mat < 0.85) {
+				Color albedo = Color::random(0.5, 1);
+				float fuzzy = random_float(0, 0.3);
+				auto sphereMaterial = arena.make<Metal>(albedo, fuzzy);
+				world.add(arena.make<Sphere>(center, 0.2, sphereMaterial));	
+			}
+			else {
+				auto sphereMaterial = arena.make<Dielectric>(1.5);
+				world.add(arena.make<Sphere>(center, 0.2, sphereMaterial));
+			}
+		}
+	}
+
+	auto material1 = arena.make<Dielectric>(1.5);
+	world.add(arena.make<Sphere>(Point3(0, 1, 0), 1.0, material1));
+
+	auto material2 = arena.make<Lambertian>(Color(0.4, 0.2, 0.1));
+	world.add(arena.make<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+
+	auto material3 = arena.make<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+	world.add(arena.make<Sphere>(Point3(4, 1, 0), 1.0, material3));
+
+}
+
+void twoPerlinSpheres(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto pertext = arena.make<NoiseTexture>(4);
+	world.add(arena.make<Sphere>(Point3(0, -1000, 0), 1000, arena.make<Lambertian>(pertext)));
+	world.add(arena.make<Sphere>(Point3(0, 2, 0), 2, arena.make<Lambertian>(pertext)));
+}
+
+void earth(HittableList& world, SceneArena& arena) {
+	world.clear();
+	
+	auto earth_texture = arena.make<ImageTexture>("E:\\Personal\\Blog\\RTNW\\img\\earthmap.jpg");
+	auto earth_surface = arena.make<Lambertian>(earth_texture);
+	auto globe = arena.make<Sphere>(Point3(0, 0, 0), 2, earth_surface);
+
+	world.add(globe);
+}
+
+void simpleLight(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto pertext = arena.make<NoiseTexture>(4);
+	world.add(arena.make<Sphere>(Point3(0, -1000, 0), 1000, arena.make<Lambertian>(pertext)));
+	world.add(arena.make<Sphere>(Point3(0, 2, 0), 2, arena.make<Lambertian>(pertext)));
+
+	auto difflight = arena.make<DiffuseLight>(Color(4, 4, 4));
+	world.add(arena.make<XYRect>(3, 5, 1, 3, -2, difflight));
+}
+
+void cornellBox(HittableList& world, SceneArena& arena) {
+	world.clear();
+	auto red = arena.make<Lambertian>(Color(.65, .05, .05));
+	auto white = arena.make<Lambertian>(Color(.73, .73, .73));
+	auto green = arena.make<Lambertian>(Color(.12, .45, .15));
+	auto light = arena.make<DiffuseLight>(Color(15, 15, 15));
+
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 555, green));
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 0, red));
+	world.add(arena.make<XZRect>(213, 343, 227, 332, 554, light));
+	world.add(arena.make<XZRect>(0, 555, 0, 555, 0, white));
+	world.add(arena.make<XZRect>(0, 555, 0, 555, 555, white));
+	world.add(arena.make<XYRect>(0, 555, 0, 555, 555, white));
+
+	shared_ptr<Hittable> box1 = arena.make<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+	box1 = arena.make<RotateY>(box1, 15);
+	box1 = arena.make<Translate>(box1, Vec3(265, 0, 295));
+	world.add(box1);
+
+	shared_ptr<Hittable> box2 = arena.make<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+	box2 = arena.make<RotateY>(box2, -18);
+	box2 = arena.make<Translate>(box2, Vec3(130, 0, 65));
+	world.add(box2);
+}
+
+void cornellSmoke(HittableList& world, SceneArena& arena) {
+
+	auto red = arena.make<Lambertian>(Color(.65, .05, .05));
+	auto white = arena.make<Lambertian>(Color(.73, .73, .73));
+	auto green = arena.make<Lambertian>(Color(.12, .45, .15));
+	auto light = arena.make<DiffuseLight>(Color(7, 7, 7));
+
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 555, green));
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 0, red));
+	world.add(arena.make<XZRect>(113, 443, 127, 432, 554, light));
+	world.add(arena.make<XZRect>(0, 555, 0, 555, 555, white));
+	world.add(arena.make<XZRect>(0, 555, 0, 555, 0, white));
+	world.add(arena.make<XYRect>(0, 555, 0, 555, 555, white));
+
+	shared_ptr<Hittable> box1 = arena.make<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
+	box1 = arena.make<RotateY>(box1, 15);
+	box1 = arena.make<Translate>(box1, Vec3(265, 0, 295));
+
+	shared_ptr<Hittable> box2 = arena.make<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
+	box2 = arena.make<RotateY>(box2, -18);
+	box2 = arena.make<Translate>(box2, Vec3(130, 0, 65));
+
+	world.add(arena.make<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
+	world.add(arena.make<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
+}
+
+void finalScene(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto red = arena.make<Lambertian>(Color(.65, .05, .05));
+	auto white = arena.make<Lambertian>(Color(.73, .73, .73));
+	auto green = arena.make<Lambertian>(Color(.12, .45, .15));
+	auto light = arena.make<DiffuseLight>(Color(15, 15, 15));
+
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 555, green));
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 0, red));
+	world.add(arena.make<XZRect>(213, 343, 227, 332, 554, light));
+	world.add(arena.make<XZRect>(0, 555, 0, 555, 0, white));
+	world.add(arena.make<XZRect>(0, 555, 0, 555, 555, white));
+	world.add(arena.make<XYRect>(0, 555, 0, 555, 555, white));
+
+	auto center1 = Point3(80, 50, 70);
+	auto center2 = center1 + Vec3(0, 30, 0);
+	auto moving_sphere_material = arena.make<Lambertian>(Color(0.7, 0.3, 0.1));
+	world.add(arena.make<MovingSphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+	world.add(arena.make<Sphere>(Point3(400, 50, 90), 50, arena.make<Dielectric>(1.5)));
+
+	world.add(arena.make<Sphere>(
+		Point3(300, 50, 210), 70, arena.make<Metal>(Color(0.8, 0.8, 0.9), 1.0)
+		));
+
+	auto boundary = arena.make<Sphere>(Point3(250, 50, 70), 50, arena.make<Dielectric>(1.5));
+	world.add(boundary);
+	world.add(arena.make<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
+
+	auto emat = arena.make<Lambertian>(arena.make<ImageTexture>("E:\\Personal\\Blog\\RTNW\\img\\earthmap.jpg"));
+	world.add(arena.make<Sphere>(Point3(400, 100, 400), 100, emat));
+
+	auto pertext = arena.make<NoiseTexture>(0.1);
+	world.add(arena.make<Sphere>(Point3(150, 80, 350), 80, arena.make<Lambertian>(pertext)));
+
+	//HittableList boxes2;
+	//auto white = arena.make<Lambertian>(Color(.73, .73, .73));
+	//int ns = 1000;
+	//for (int j = 0; j < ns; j++) {
+	//	boxes2.add(arena.make<Sphere>(Point3::random(0, 165), 10, white));
+	//}
+
+	//world.add(arena.make<Translate>(
+	//	arena.make<RotateY>(
+	//		arena.make<BVHNode>(boxes2, 0.0, 1.0, arena), 15),
+	//	Vec3(-100, 270, 395)
+	//	)
+	//);
+
+}
+
+// Procedural cumulus-like cloud: a noisy ellipsoid in a voxel grid, over a
+// ground plane and lit by a daylight sky. With sceneFileOptions().cloudGrid
+// set, the grid is read from that file instead, sparse, by
+// VoxelGrid::loadRaw(): raw float32 voxels of cloudGridSize, such as the ones
+// writeRawGrid() saves for proceduralCloud().
+const int cloudGridSize[3] = { 96, 48, 64 };
+
+vector<float> proceduralCloud(int nx, int ny, int nz) {
+	Perlin perlin;
+	vector<float> values(size_t(nx) * ny * nz, 0);
+	for (int z = 0; z < nz; z++) {
+		for (int y = 0; y < ny; y++) {
+			for (int x = 0; x < nx; x++) {
+				Point3 p((x + 0.5f) / nx, (y + 0.5f) / ny, (z + 0.5f) / nz);
+				Vec3 q = 2 * p - Point3(1, 1, 1);
+				float falloff = 1 - q.length2();
+				if (falloff <= 0) continue;
+
+				float density = falloff * (0.3f + 2 * perlin.turb(8 * p, 5)) - 0.2f;
+				values[(size_t(z) * ny + y) * nx + x] = density > 0 ? density : 0;
+			}
+		}
+	}
+	return values;
+}
+
+// Write values as raw float32. The file appears under its name only once it
+// is complete; until then it is written to path + ".tmp".
+bool writeRawGrid(const string& path, const vector<float>& values) {
+	string tmpPath = path + ".tmp";
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = fwrite(values.data(), sizeof(float), values.size(), file) == values.size();
+	if (fclose(file) != 0 || !written) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	remove(path.c_str()); // rename() does not replace on Windows
+#endif
+	return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+void cloudScene(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto groundMaterial = arena.make<Lambertian>(Color(0.4, 0.45, 0.35));
+	world.add(arena.make<Sphere>(Point3(0, -1000, 0), 1000, groundMaterial));
+
+	const int nx = cloudGridSize[0], ny = cloudGridSize[1], nz = cloudGridSize[2];
+	const string& gridPath = sceneFileOptions().cloudGrid;
+	shared_ptr<VoxelGrid> grid;
+	if (!gridPath.empty()) grid = VoxelGrid::loadRaw(gridPath, nx, ny, nz, true);
+	if (!grid) grid = make_shared<VoxelGrid>(nx, ny, nz, proceduralCloud(nx, ny, nz), true);
+
+	AABB bounds(Point3(-3, 0.5, -2), Point3(3, 3.5, 2));
+	world.add(arena.make<GridMedium>(grid, bounds, 15.0, Color(0.95, 0.95, 0.95)));
+}
+
+// A million pebbles on a plane, too many to keep resident comfortably: they
+// are written once to sceneFileOptions().sphereField, or to a file in the
+// temporary directory, in one chunk per 4x4 tile, and paged in from there
+// (see OutOfCore.h). Positions come from a hash of the tile and sphere index,
+// so every process writes the same file.
+inline string sphereFieldPath() {
+	const string& path = sceneFileOptions().sphereField;
+	return path.empty() ? temporaryFilePath("rtnw-sphere-field.rtnwsph") : path;
+}
+
+bool writeSphereField(const string& path, int tiles, int spheresPerTile, uint32_t materialCount) {
+	const float tileSize = 4;
+	SphereChunkWriter writer;
+	if (!writer.open(path)) return false;
+
+	vector<SphereRecord> chunk(spheresPerTile);
+	for (int tz = 0; tz < tiles; tz++) {
+		for (int tx = 0; tx < tiles; tx++) {
+			uint32_t tileSeed = hashCombine(uint32_t(tz), uint32_t(tx));
+			for (int ii = 0; ii < spheresPerTile; ii++) {
+				uint32_t h = hashCombine(tileSeed, uint32_t(ii));
+				float radius = 0.03f + 0.1f * uintToUnitFloat(hashUint(h + 1));
+				SphereRecord& sphere = chunk[ii];
+				sphere.center[0] = (tx - tiles / 2 + uintToUnitFloat(h)) * tileSize;
+				sphere.center[1] = radius;
+				sphere.center[2] = (tz - tiles / 2 + uintToUnitFloat(hashUint(h + 2))) * tileSize;
+				sphere.radius = radius;
+				sphere.material = hashUint(h + 3) % materialCount;
+			}
+			if (!writer.addChunk(chunk)) return false;
+		}
+	}
+	return writer.finish();
+}
+
+void sphereField(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto groundMaterial = arena.make<Lambertian>(Color(0.5, 0.5, 0.45));
+	world.add(arena.make<Sphere>(Point3(0, -10000, 0), 10000, groundMaterial));
+
+	vector<shared_ptr<Material>> palette = {
+		arena.make<Lambertian>(Color(0.8, 0.3, 0.2)),
+		arena.make<Lambertian>(Color(0.2, 0.5, 0.8)),
+		arena.make<Lambertian>(Color(0.9, 0.8, 0.3)),
+		arena.make<Lambertian>(Color(0.3, 0.7, 0.3)),
+		arena.make<Metal>(Color(0.9, 0.9, 0.9), 0.1),
+		arena.make<Dielectric>(1.5)
+	};
+
+	string path = sphereFieldPath();
+	auto pebbles = arena.make<OutOfCoreSpheres>();
+	if (!pebbles->open(path, palette)) {
+		cout << "Writing " << path << "\n";
+		if (!writeSphereField(path, 32, 1024, uint32_t(palette.size())) || !pebbles->open(path, palette)) {
+			cerr << "Cannot write " << path << "; the field stays empty.\n";
+			return;
+		}
+	}
+	world.add(pebbles);
+}
+
+// A park of 40000 instances of three assets, the sphere cluster of the
+// final scene among them. Each asset has its own BVH, built once; the
+// instances give every copy a transform and a material of its own.
+void instancedPark(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto groundMaterial = arena.make<Lambertian>(Color(0.45, 0.5, 0.4));
+	world.add(arena.make<Sphere>(Point3(0, -10000, 0), 10000, groundMaterial));
+
+	// Assets fill [-0.5, 0.5]^3 or so; their own material shows where no
+	// instance replaces it.
+	auto white = arena.make<Lambertian>(Color(.73, .73, .73));
+	HittableList cluster;
+	for (int ii = 0; ii < 1000; ii++) {
+		cluster.add(arena.make<Sphere>(Point3::random(-0.44, 0.44), 0.06, white));
+	}
+	vector<shared_ptr<Hittable>> assets = {
+		arena.make<BVHNode>(cluster, 0, 1, arena),
+		arena.make<Box>(Point3(-0.5, -0.5, -0.5), Point3(0.5, 0.5, 0.5), white),
+		arena.make<Sphere>(Point3(0, 0, 0), 0.5, white)
+	};
+
+	vector<shared_ptr<Material>> palette = {
+		arena.make<Lambertian>(Color(0.8, 0.3, 0.2)),
+		arena.make<Lambertian>(Color(0.2, 0.5, 0.8)),
+		arena.make<Lambertian>(Color(0.9, 0.8, 0.3)),
+		arena.make<Lambertian>(Color(0.3, 0.7, 0.3)),
+		arena.make<Metal>(Color(0.9, 0.9, 0.9), 0.05),
+		nullptr // keep the asset's material
+	};
+
+	const int side = 200;
+	const float spacing = 1.2f;
+	for (int ii = 0; ii < side; ii++) {
+		for (int jj = 0; jj < side; jj++) {
+			float scale = random_float(0.4f, 0.9f);
+			Point3 position((ii - side / 2 + random_float(-0.2f, 0.2f)) * spacing, 0.5f * scale,
+				(jj - side / 2 + random_float(-0.2f, 0.2f)) * spacing);
+			Affine toWorld = Affine::translation(position) * Affine::rotation(Vec3(0, 1, 0), random_float(0, 90))
+				* Affine::scaling(scale);
+
+			auto asset = assets[random_int(0, int(assets.size()) - 1)];
+			auto material = palette[random_int(0, int(palette.size()) - 1)];
+			world.add(arena.make<Instance>(asset, toWorld, material));
+		}
+	}
+}
+
+// A night plaza lit only by 4096 small lanterns of many colors, hanging
+// between pillars and spheres. Each lantern lights little of the scene, so
+// paths need the light BVH to find the ones that matter.
+void lanternPlaza(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto groundMaterial = arena.make<Lambertian>(Color(0.5, 0.5, 0.5));
+	world.add(arena.make<Sphere>(Point3(0, -10000, 0), 10000, groundMaterial));
+
+	auto stone = arena.make<Lambertian>(Color(0.7, 0.65, 0.6));
+	for (int ii = -4; ii <= 4; ii++) {
+		for (int jj = -4; jj <= 4; jj++) {
+			if ((ii + jj) % 2 != 0) continue;
+			Point3 base(ii * 4.5f, 0, jj * 4.5f);
+			world.add(arena.make<Box>(base - Vec3(0.4, 0, 0.4), base + Vec3(0.4, random_float(2, 5), 0.4), stone));
+		}
+	}
+	for (int ii = 0; ii < 40; ii++) {
+		float radius = random_float(0.4f, 1.2f);
+		Point3 center(random_float(-18, 18), radius, random_float(-18, 18));
+		shared_ptr<Material> material = random_float() < 0.3f
+			? shared_ptr<Material>(arena.make<Metal>(Color(0.8, 0.8, 0.8), 0.2))
+			: shared_ptr<Material>(arena.make<Lambertian>(Color::random(0.2, 0.9)));
+		world.add(arena.make<Sphere>(center, radius, material));
+	}
+
+	for (int ii = 0; ii < 4096; ii++) {
+		Point3 center(random_float(-20, 20), random_float(0.5f, 6), random_float(-20, 20));
+		world.add(arena.make<Sphere>(center, 0.06, arena.make<DiffuseLight>(10 * Color::random(0.2, 1))));
+	}
+}
+
+// Look-development set under a daylight sky: diffuse, metal and glass
+// spheres and a box on a ground plane. Nearly all the light comes from the
+// small sun, which random bounces rarely find.
+void lookDev(HittableList& world, SceneArena& arena) {
+	world.clear();
+
+	auto groundMaterial = arena.make<Lambertian>(arena.make<CheckerTexture>(Color(0.3, 0.3, 0.3), Color(0.8, 0.8, 0.8)));
+	world.add(arena.make<Sphere>(Point3(0, -1000, 0), 1000, groundMaterial));
+
+	world.add(arena.make<Sphere>(Point3(-2.2, 1, 0), 1, arena.make<Lambertian>(Color(0.8, 0.3, 0.2))));
+	world.add(arena.make<Sphere>(Point3(0, 1, 0), 1, arena.make<Metal>(Color(0.9, 0.85, 0.8), 0.1)));
+	world.add(arena.make<Sphere>(Point3(2.2, 1, 0), 1, arena.make<Dielectric>(1.5)));
+	world.add(arena.make<Sphere>(Point3(1.2, 0.4, 1.8), 0.4, arena.make<Lambertian>(Color(0.2, 0.5, 0.8))));
+
+	shared_ptr<Hittable> box = arena.make<Box>(Point3(-0.6, 0, -0.6), Point3(0.6, 1.2, 0.6), arena.make<Lambertian>(Color(0.73, 0.73, 0.73)));
+	box = arena.make<RotateY>(box, 30);
+	box = arena.make<Translate>(box, Vec3(-1.2, 0, -2.5));
+	world.add(box);
+}
+
+// Cornell box lit by a small ceiling light, with a glass and a mirror
+// sphere. Most of the floor's light near the spheres is caustic: it reaches
+// the light only through a specular bounce, which BSDF sampling finds by
+// chance and the light samples of a diffuse surface never do.
+void cornellCaustics(HittableList& world, SceneArena& arena) {
+	world.clear();
+	auto red = arena.make<Lambertian>(Color(.65, .05, .05));
+	auto white = arena.make<Lambertian>(Color(.73, .73, .73));
+	auto green = arena.make<Lambertian>(Color(.12, .45, .15));
+	auto light = arena.make<DiffuseLight>(Color(60, 60, 60));
+
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 555, green));
+	world.add(arena.make<YZRect>(0, 555, 0, 555, 0, red));
+	world.add(arena.make<XZRect>(0, 555, 0, 555, 0, white));
+	world.add(arena.make<XYRect>(0, 555, 0, 555, 555, white));
+	// The light fills a hole in the ceiling, so what it sends upwards leaves
+	// the box instead of lighting the ceiling from up close.
+	world.add(arena.make<XZRect>(243, 313, 243, 313, 555, light));
+	world.add(arena.make<XZRect>(0, 243, 0, 555, 555, white));
+	world.add(arena.make<XZRect>(313, 555, 0, 555, 555, white));
+	world.add(arena.make<XZRect>(243, 313, 0, 243, 555, white));
+	world.add(arena.make<XZRect>(243, 313, 313, 555, 555, white));
+
+	world.add(arena.make<Sphere>(Point3(370, 110, 220), 110, arena.make<Dielectric>(1.5)));
+	world.add(arena.make<Sphere>(Point3(160, 90, 360), 90, arena.make<Metal>(Color(0.9, 0.9, 0.9), 0)));
+}
+
+// Ids of the scenes understood by loadScene(), in menu order.
+const int builtinSceneIds[] = { 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14 };
+
+inline const char* sceneName(int sceneId) {
+	switch (sceneId) {
+	case 1: return "randomScene";
+	case 2: return "twoPerlinSpheres";
+	case 3: return "earth";
+	case 4: return "simpleLight";
+	case 5: return "cornellBox";
+	case 6: return "cornellSmoke";
+	case 9: return "cloud";
+	case 10: return "sphereField";
+	case 11: return "instancedPark";
+	case 12: return "lanternPlaza";
+	case 13: return "lookDev";
+	case 14: return "cornellCaustics";
+	default:
+	case 8: return "finalScene";
+	}
+}
+
+// Fill world with a built-in scene and set the matching camera/image settings.
+// All objects are allocated from arena, which must outlive world.
+// Unknown ids fall back to the final scene.
+void loadScene(int sceneId, HittableList& world, SceneSettings& settings, SceneArena& arena) {
+	settings = SceneSettings();
+
+	switch (sceneId)
+	{
+	case 1:
+		createRandomScene(world, arena);
+		settings.backgroundColor = Color(0.70, 0.80, 1.00);
+		settings.lookFrom = Point3(13, 2, 3);
+		settings.lookAt = Point3(0, 0, 0);
+		settings.vFOV = 20.0;
+		settings.aperture = 0.01;
+		break;
+	case 2:
+		twoPerlinSpheres(world, arena);
+		settings.backgroundColor = Color(0.70, 0.80, 1.00);
+		settings.lookFrom = Point3(13, 2, 3);
+		settings.lookAt = Point3(0, 0, 0);
+		settings.vFOV = 20.0;
+		settings.aperture = 0.01;
+		break;
+	case 3:
+		earth(world, arena);
+		settings.backgroundColor = Color(0.70, 0.80, 1.00);
+		settings.lookFrom = Point3(13, 2, 3);
+		settings.lookAt = Point3(0, 0, 0);
+		settings.vFOV = 20.0;
+		settings.aperture = 0.01;
+		break;
+	case 4:
+		simpleLight(world, arena);
+		settings.backgroundColor = Color(0, 0, 0);
+		//settings.samplesPerPixel = 400;
+		settings.lookFrom = Point3(26, 3, 6);
+		settings.lookAt = Point3(0, 2, 0);
+		settings.vFOV = 20.0;
+		break;
+	case 5:
+		cornellBox(world, arena);
+		settings.aspectRatio = 1.0;
+		settings.imageWidth = 400;
+		settings.samplesPerPixel = 200;
+		settings.backgroundColor = Color(0, 0, 0);
+		settings.lookFrom = Point3(278, 278, -800);
+		settings.lookAt = Point3(278, 278, 0);
+		settings.vFOV = 40.0;
+		break;
+	case 6:
+		cornellSmoke(world, arena);
+		settings.aspectRatio = 1.0;
+		settings.imageWidth = 200;
+		settings.samplesPerPixel = 100;
+		settings.lookFrom = Point3(278, 278, -800);
+		settings.lookAt = Point3(278, 278, 0);
+		settings.vFOV = 40.0;
+		break;
+	case 9:
+		cloudScene(world, arena);
+		settings.imageWidth = 400;
+		settings.samplesPerPixel = 100;
+		settings.backgroundColor = Color(0.70, 0.80, 1.00);
+		settings.sunDirection = Vec3(0.3, 0.8, 0.5);
+		settings.sunIntensity = 2000;
+		settings.lookFrom = Point3(0, 1, 10);
+		settings.lookAt = Point3(0, 2, 0);
+		settings.vFOV = 30.0;
+		break;
+	case 10:
+		sphereField(world, arena);
+		settings.imageWidth = 400;
+		settings.samplesPerPixel = 64;
+		settings.backgroundColor = Color(0.70, 0.80, 1.00);
+		settings.lookFrom = Point3(0, 5, 66);
+		settings.lookAt = Point3(0, 0, 30);
+		settings.vFOV = 40.0;
+		break;
+	case 11:
+		instancedPark(world, arena);
+		settings.imageWidth = 400;
+		settings.samplesPerPixel = 64;
+		settings.backgroundColor = Color(0.70, 0.80, 1.00);
+		settings.lookFrom = Point3(-20, 8, 30);
+		settings.lookAt = Point3(0, 0, 0);
+		settings.vFOV = 40.0;
+		break;
+	case 12:
+		lanternPlaza(world, arena);
+		settings.imageWidth = 400;
+		settings.samplesPerPixel = 64;
+		settings.backgroundColor = Color(0, 0, 0);
+		settings.lookFrom = Point3(0, 7, 26);
+		settings.lookAt = Point3(0, 1.5, 0);
+		settings.vFOV = 45.0;
+		break;
+	case 13:
+		lookDev(world, arena);
+		settings.imageWidth = 400;
+		settings.samplesPerPixel = 64;
+		settings.sunDirection = Vec3(0.6, 0.5, 0.4);
+		settings.sunIntensity = 2000;
+		settings.lookFrom = Point3(0, 2.5, 9);
+		settings.lookAt = Point3(0, 0.8, 0);
+		settings.vFOV = 35.0;
+		break;
+	case 14:
+		cornellCaustics(world, arena);
+		settings.aspectRatio = 1.0;
+		settings.imageWidth = 400;
+		settings.samplesPerPixel = 200;
+		settings.backgroundColor = Color(0, 0, 0);
+		settings.lookFrom = Point3(278, 278, -800);
+		settings.lookAt = Point3(278, 278, 0);
+		settings.vFOV = 40.0;
+		break;
+	default:
+	case 8:
+		finalScene(world, arena);
+		settings.aspectRatio = 1.0;
+		settings.imageWidth = 200;
+		settings.samplesPerPixel = 100;
+		settings.lookFrom = Point3(278, 278, -800);
+		settings.lookAt = Point3(278, 278, 0);
+		settings.vFOV = 40.0;
+		break;
+	}
+}
+
+#endif // !SCENES_H
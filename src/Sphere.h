@@ -7,17 +7,28 @@
 #include "Vec3.h"
 #include "Hittable.h"
 #include "Ray.h"
+#include "Stats.h"
+#include "FastMath.h"
 
-class Sphere : public Hittable{
+class Sphere final : public Hittable {
 public:
-	Sphere(){}
-	Sphere(Point3 c, float r, shared_ptr<Material> material) : center(c), radius(r), materialPtr(material) {};
+	Sphere() : Hittable(HittableSphere) {}
+	Sphere(Point3 c, float r, shared_ptr<Material> material) : Hittable(HittableSphere), center(c), radius(r), materialPtr(material) {};
 
 	// Solve a quaratic equation and save the result to hitRecord
 	// Return true if the intersection point is valid, in the range [tMin, tMax], and false otherwise
 	bool hit(const Ray& ray, float tMin, float tMax, HitRecord& hitRecord) const {
+		SurfaceHit surfaceHit;
+		if (!intersect(ray, tMin, tMax, surfaceHit)) return false;
+		resolve(ray, surfaceHit, 0, hitRecord);
+		return true;
+	}
+
+	// The root only; the point, normal and UV wait for resolve().
+	bool intersect(const Ray& ray, float tMin, float tMax, SurfaceHit& surfaceHit) const override {
+		RTNW_STATS_PRIMITIVE(StatsSphere);
+
 		Vec3 oc = ray.origin() - center;
-		Point3 o = ray.origin();
 		Vec3 d = ray.direction();
 
 		float A = d.length2();
@@ -27,27 +38,66 @@ public:
 		float delta = halfB * halfB - A * C;
 		if (delta < 0)
 			return false;
-		else {
-			float t = (-halfB - sqrtf(delta)) / A;
-			if (t < tMin || t > tMax) {
-				t = (-halfB + sqrtf(delta)) / A;
-				if (t < tMin || t > tMax) return false;
-			}
-
-			Point3 intersectionPoint = ray.at(t);
-			Vec3 outwardNormal = unitVector(intersectionPoint - center);
-			
-			hitRecord.p = intersectionPoint;
-			hitRecord.t = t;
-			setNormal(hitRecord, ray, outwardNormal);
-			hitRecord.materialPtr = materialPtr;
-
-			getSphereUV(outwardNormal, hitRecord.u, hitRecord.v);
-
-			if (Vec3::isNan(hitRecord.p))
-				cout << "Sphere" << endl;
-			return true;
+
+		float t = (-halfB - sqrtf(delta)) / A;
+		if (t < tMin || t > tMax) {
+			t = (-halfB + sqrtf(delta)) / A;
+			if (t < tMin || t > tMax) return false;
 		}
+
+		setSurfaceHit(surfaceHit, this, t);
+		return true;
+	}
+
+	void resolve(const Ray& ray, const SurfaceHit& surfaceHit, int level, HitRecord& hitRecord) const override {
+		Point3 intersectionPoint = ray.at(surfaceHit.t);
+		Vec3 outwardNormal = unitVector(intersectionPoint - center);
+
+		hitRecord.p = intersectionPoint;
+		hitRecord.t = surfaceHit.t;
+		setNormal(hitRecord, ray, outwardNormal);
+		hitRecord.materialPtr = materialPtr;
+
+		getSphereUV(outwardNormal, hitRecord.u, hitRecord.v);
+
+		if (Vec3::isNan(hitRecord.p))
+			cout << "Sphere" << endl;
+	}
+
+	int intervals(const Ray& ray, float tMin, float tMax, HitInterval* out, int maxIntervals) const override {
+		Vec3 oc = ray.origin() - center;
+		Vec3 d = ray.direction();
+
+		float A = d.length2();
+		float halfB = dot(oc, d);
+		float C = oc.length2() - radius * radius;
+
+		float delta = halfB * halfB - A * C;
+		if (delta <= 0) return 0;
+
+		float sqrtDelta = sqrtf(delta);
+		return appendInterval((-halfB - sqrtDelta) / A, (-halfB + sqrtDelta) / A, tMin, tMax, out, 0, maxIntervals);
+	}
+
+	// Any root in [tMin, tMax]; no hit record is filled.
+	bool occluded(const Ray& ray, float tMin, float tMax) const override {
+		RTNW_STATS_PRIMITIVE(StatsSphere);
+
+		Vec3 oc = ray.origin() - center;
+		Vec3 d = ray.direction();
+
+		float A = d.length2();
+		float halfB = dot(oc, d);
+		float C = oc.length2() - radius * radius;
+
+		float delta = halfB * halfB - A * C;
+		if (delta < 0) return false;
+
+		float sqrtDelta = sqrtf(delta);
+		float t = (-halfB - sqrtDelta) / A;
+		if (t >= tMin && t <= tMax) return true;
+		t = (-halfB + sqrtDelta) / A;
+		return t >= tMin && t <= tMax;
 	}
 
 	bool boundingBox(float time0, float time1, AABB& bbox) const {
@@ -65,8 +115,8 @@ public:
 		//     <1 0 0> yields <0.50 0.50>       <-1  0  0> yields <0.00 0.50>
 		//     <0 1 0> yields <0.50 1.00>       < 0 -1  0> yields <0.50 0.00>
 		//     <0 0 1> yields <0.25 0.50>       < 0  0 -1> yields <0.75 0.50>
-		float theta = acosf(-p.y());
-		float phi = atan2f(-p.z(), p.x()) + PI;
+		float theta = fastAcos(-p.y());
+		float phi = fastAtan2(-p.z(), p.x()) + PI;
 
 		u = phi / (2 * PI);
 		v = theta / PI;
@@ -0,0 +1,225 @@
+#pragma once
+
+#ifndef STATS_H
+#define STATS_H
+
+// Render statistics counters.
+//
+// Counters live in a thread-local RenderStats so that incrementing them never
+// touches shared memory. mergedStats() sums the counters of every thread that
+// has recorded anything (including threads that already exited) and
+// writeStatsJson() exports the result.
+//
+// Everything here is compiled out unless RTNW_ENABLE_STATS is defined
+// (CMake option RTNW_ENABLE_STATS); the RTNW_STATS_* macros then expand to
+// nothing, so instrumented code pays nothing in regular builds.
+
+#include "RTNW.h"
+
+#ifdef RTNW_ENABLE_STATS
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+using namespace std;
+
+enum StatsPrimitive {
+	StatsSphere,
+	StatsMovingSphere,
+	StatsXYRect,
+	StatsYZRect,
+	StatsXZRect,
+	StatsBox,
+	StatsConstantMedium,
+	StatsGridMedium,
+	StatsPrimitiveCount
+};
+
+enum StatsPhase {
+	StatsPhaseSceneBuild,
+	StatsPhaseBVHBuild,
+	StatsPhaseRender,
+	StatsPhaseOutput,
+	StatsPhaseCount
+};
+
+inline const char* statsPrimitiveName(int type) {
+	static const char* names[StatsPrimitiveCount] = {
+		"Sphere", "MovingSphere", "XYRect", "YZRect", "XZRect", "Box", "ConstantMedium", "GridMedium" };
+	return names[type];
+}
+
+inline const char* statsPhaseName(int phase) {
+	static const char* names[StatsPhaseCount] = { "scene_build", "bvh_build", "render", "output" };
+	return names[phase];
+}
+
+struct RenderStats {
+	// Rays traced at each bounce; bounce 0 is the camera ray. Deeper bounces
+	// are accumulated in the last slot.
+	static const int maxTrackedDepth = 64;
+	long long raysPerDepth[maxTrackedDepth] = {};
+
+	long long bvhNodesVisited = 0;
+	long long primitiveTests[StatsPrimitiveCount] = {};
+	long long mediumScatterEvents = 0;
+	long long mediumNullCollisions = 0; // rejected delta tracking collisions in GridMedium
+	long long shadowRays = 0;           // light samples tested for visibility
+
+	// How paths ended: ran out of depth, left the scene, or the material
+	// stopped scattering (lights, absorbed metal rays).
+	long long pathsTerminatedByDepth = 0;
+	long long pathsEscaped = 0;
+	long long pathsAbsorbed = 0;
+
+	long long phaseNanoseconds[StatsPhaseCount] = {};
+
+	void merge(const RenderStats& other) {
+		for (int ii = 0; ii < maxTrackedDepth; ii++) raysPerDepth[ii] += other.raysPerDepth[ii];
+		bvhNodesVisited += other.bvhNodesVisited;
+		for (int ii = 0; ii < StatsPrimitiveCount; ii++) primitiveTests[ii] += other.primitiveTests[ii];
+		mediumScatterEvents += other.mediumScatterEvents;
+		mediumNullCollisions += other.mediumNullCollisions;
+		shadowRays += other.shadowRays;
+		pathsTerminatedByDepth += other.pathsTerminatedByDepth;
+		pathsEscaped += other.pathsEscaped;
+		pathsAbsorbed += other.pathsAbsorbed;
+		for (int ii = 0; ii < StatsPhaseCount; ii++) phaseNanoseconds[ii] += other.phaseNanoseconds[ii];
+	}
+
+	long long totalRays() const {
+		long long total = 0;
+		for (int ii = 0; ii < maxTrackedDepth; ii++) total += raysPerDepth[ii];
+		return total;
+	}
+};
+
+// Keeps track of the per-thread counters so they can be merged at the end.
+class StatsRegistry {
+public:
+	static StatsRegistry& instance() {
+		static StatsRegistry registry;
+		return registry;
+	}
+
+	void attach(RenderStats* stats) {
+		lock_guard<mutex> lock(guard);
+		live.push_back(stats);
+	}
+
+	// Called when a thread exits: fold its counters into the retired total.
+	void detach(RenderStats* stats) {
+		lock_guard<mutex> lock(guard);
+		retired.merge(*stats);
+		for (size_t ii = 0; ii < live.size(); ii++) {
+			if (live[ii] == stats) {
+				live.erase(live.begin() + ii);
+				break;
+			}
+		}
+	}
+
+	// Only consistent while no other thread is recording.
+	RenderStats merged() {
+		lock_guard<mutex> lock(guard);
+		RenderStats total = retired;
+		for (RenderStats* stats : live) total.merge(*stats);
+		return total;
+	}
+
+	void reset() {
+		lock_guard<mutex> lock(guard);
+		retired = RenderStats();
+		for (RenderStats* stats : live) *stats = RenderStats();
+	}
+
+private:
+	mutex guard;
+	vector<RenderStats*> live;
+	RenderStats retired;
+};
+
+class ThreadStats {
+public:
+	ThreadStats() { StatsRegistry::instance().attach(&stats); }
+	~ThreadStats() { StatsRegistry::instance().detach(&stats); }
+
+	RenderStats stats;
+};
+
+inline RenderStats& localStats() {
+	thread_local ThreadStats threadStats;
+	return threadStats.stats;
+}
+
+inline RenderStats mergedStats() {
+	return StatsRegistry::instance().merged();
+}
+
+inline void resetStats() {
+	StatsRegistry::instance().reset();
+}
+
+// Adds the lifetime of the object to one of the render phases.
+class ScopedPhaseTimer {
+public:
+	ScopedPhaseTimer(StatsPhase p) : phase(p), start(chrono::steady_clock::now()) {}
+	~ScopedPhaseTimer() {
+		localStats().phaseNanoseconds[phase] +=
+			chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+	}
+private:
+	StatsPhase phase;
+	chrono::steady_clock::time_point start;
+};
+
+inline void writeStatsJson(ostream& out, const RenderStats& stats) {
+	int lastDepth = RenderStats::maxTrackedDepth - 1;
+	while (lastDepth > 0 && stats.raysPerDepth[lastDepth] == 0) lastDepth--;
+
+	out << "{\n";
+	out << "  \"total_rays\": " << stats.totalRays() << ",\n";
+	out << "  \"rays_per_depth\": [";
+	for (int ii = 0; ii <= lastDepth; ii++) out << (ii ? ", " : "") << stats.raysPerDepth[ii];
+	out << "],\n";
+	out << "  \"bvh_nodes_visited\": " << stats.bvhNodesVisited << ",\n";
+	out << "  \"primitive_tests\": {";
+	for (int ii = 0; ii < StatsPrimitiveCount; ii++) {
+		out << (ii ? ", " : "") << "\"" << statsPrimitiveName(ii) << "\": " << stats.primitiveTests[ii];
+	}
+	out << "},\n";
+	out << "  \"medium_scatter_events\": " << stats.mediumScatterEvents << ",\n";
+	out << "  \"medium_null_collisions\": " << stats.mediumNullCollisions << ",\n";
+	out << "  \"shadow_rays\": " << stats.shadowRays << ",\n";
+	out << "  \"paths\": {\"terminated_by_depth\": " << stats.pathsTerminatedByDepth
+		<< ", \"escaped\": " << stats.pathsEscaped
+		<< ", \"absorbed\": " << stats.pathsAbsorbed << "},\n";
+	out << "  \"phase_seconds\": {";
+	for (int ii = 0; ii < StatsPhaseCount; ii++) {
+		out << (ii ? ", " : "") << "\"" << statsPhaseName(ii) << "\": " << stats.phaseNanoseconds[ii] * 1e-9;
+	}
+	out << "}\n";
+	out << "}\n";
+}
+
+#define RTNW_STATS_CONCAT_(a, b) a##b
+#define RTNW_STATS_CONCAT(a, b) RTNW_STATS_CONCAT_(a, b)
+
+#define RTNW_STATS_INC(field) (localStats().field++)
+#define RTNW_STATS_RAY(bounce) \
+	(localStats().raysPerDepth[(bounce) < RenderStats::maxTrackedDepth ? (bounce) : RenderStats::maxTrackedDepth - 1]++)
+#define RTNW_STATS_PRIMITIVE(type) (localStats().primitiveTests[type]++)
+#define RTNW_STATS_PHASE(phase) ScopedPhaseTimer RTNW_STATS_CONCAT(phaseTimer, __LINE__)(phase)
+
+#else
+
+#define RTNW_STATS_INC(field) ((void)0)
+#define RTNW_STATS_RAY(bounce) ((void)0)
+#define RTNW_STATS_PRIMITIVE(type) ((void)0)
+#define RTNW_STATS_PHASE(phase) ((void)0)
+
+#endif // RTNW_ENABLE_STATS
+
+#endif // !STATS_H
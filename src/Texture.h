@@ -6,63 +6,86 @@
 #include "Color.h"
 #include "Vec3.h"
 #include "Perlin.h"
+#include "FastMath.h"
 #include "rtnw_stb_image.h"
 
+#include <string>
+
+// Concrete textures known to dispatchValue(); extensions keep TextureUser.
+enum TextureKind {
+	TextureUser,
+	TextureSolidColor,
+	TextureChecker,
+	TextureNoise,
+	TextureImage
+};
+
 class Texture {
 public:
+	explicit Texture(TextureKind k = TextureUser) : kind(k) {}
+
 	virtual Color value(float u, float v, const Point3& p) const = 0;
+
+	TextureKind kind;
 };
 
-class SolidColor : public Texture {
+// Same as texture.value(), but calls the built-in textures directly when
+// RTNW_STATIC_DISPATCH is defined.
+inline Color dispatchValue(const Texture& texture, float u, float v, const Point3& p);
+
+class SolidColor final : public Texture {
 public:
-	SolidColor() {};
-	SolidColor(Color c) : colorValue(c) {};
-	SolidColor(float red, float green, float blue) : colorValue(Color(red, green, blue)) {};
+	SolidColor() : Texture(TextureSolidColor) {};
+	SolidColor(Color c) : Texture(TextureSolidColor), colorValue(c) {};
+	SolidColor(float red, float green, float blue) : Texture(TextureSolidColor), colorValue(Color(red, green, blue)) {};
 	
 	virtual Color value(float u, float v, const Point3& p) const override {
 		return colorValue;
 	}
 private:
+	friend class SceneCache;
 	Color colorValue;
 };
 
-class CheckerTexture : public Texture {
+class CheckerTexture final : public Texture {
 public:
-	CheckerTexture() {};
+	CheckerTexture() : Texture(TextureChecker) {};
 	CheckerTexture(shared_ptr<Texture> e, shared_ptr<Texture> o) 
-		: even(e), odd(o) {};
+		: Texture(TextureChecker), even(e), odd(o) {};
 	CheckerTexture(Color c1, Color c2) 
-		: even(make_shared<SolidColor>(c1)), odd(make_shared<SolidColor>(c2)) {}
+		: Texture(TextureChecker), even(make_shared<SolidColor>(c1)), odd(make_shared<SolidColor>(c2)) {}
 	
 	virtual Color value(float u, float v, const Point3& p) const override {
-		float sines = sinf(10 * p.x()) * sinf(10 * p.y()) * sinf(10 * p.z());
-		if (sines < 0) return odd->value(u, v, p);
-		return even->value(u, v, p);
+		float sines = fastSin(10 * p.x()) * fastSin(10 * p.y()) * fastSin(10 * p.z());
+		if (sines < 0) return dispatchValue(*odd, u, v, p);
+		return dispatchValue(*even, u, v, p);
 	}
 private:
+	friend class SceneCache;
 	shared_ptr<Texture> odd;
 	shared_ptr<Texture> even;
 };
 
-class NoiseTexture : public Texture {
+class NoiseTexture final : public Texture {
 public:
-	NoiseTexture() : scale(1) {}
-	NoiseTexture(float s) : scale(s) {}
+	NoiseTexture() : Texture(TextureNoise), scale(1) {}
+	NoiseTexture(float s) : Texture(TextureNoise), scale(s) {}
 	virtual Color value(float u, float v, const Point3& p) const override {
-		return Color(1, 1, 1) * 0.5 * (1 + sinf(scale * p.z() + 10 * noise.turb(scale * p)));
+		return Color(1, 1, 1) * 0.5 * (1 + fastSin(scale * p.z() + 10 * noise.turb(scale * p)));
 	}
 private:
+	friend class SceneCache;
 	Perlin noise;
 	float scale;
 };
 
-class ImageTexture : public Texture {
+class ImageTexture final : public Texture {
 public:
 	const static int bytes_per_pixel = 3;
 
-	ImageTexture() : data(nullptr), width(0), height(0), bytes_per_scanline(0) {};
+	ImageTexture() : Texture(TextureImage), data(nullptr), width(0), height(0), bytes_per_scanline(0) {};
 
-	ImageTexture(const char* fileName) {
+	ImageTexture(const char* fileName) : Texture(TextureImage), sourceName(fileName) {
 		auto components_per_pixel = bytes_per_pixel;
 		data = stbi_load(fileName, &width, &height, &components_per_pixel, components_per_pixel);
 
@@ -74,7 +97,7 @@ public:
 		bytes_per_scanline = bytes_per_pixel * width;
 	}
 
-	~ImageTexture() { delete data; }
+	~ImageTexture() { if (!borrowed) delete data; }
 
 	virtual Color value(float u, float v, const Point3& p) const override {
 
@@ -101,9 +124,25 @@ public:
 	}
 
 private:
+	friend class SceneCache;
 	unsigned char* data;
 	int width, height;
 	int bytes_per_scanline;
+	string sourceName;
+	bool borrowed = false; // data belongs to someone else, e.g. a mapped scene cache
 };
 
+inline Color dispatchValue(const Texture& texture, float u, float v, const Point3& p) {
+#ifdef RTNW_STATIC_DISPATCH
+	switch (texture.kind) {
+	case TextureSolidColor: return static_cast<const SolidColor&>(texture).value(u, v, p);
+	case TextureChecker: return static_cast<const CheckerTexture&>(texture).value(u, v, p);
+	case TextureNoise: return static_cast<const NoiseTexture&>(texture).value(u, v, p);
+	case TextureImage: return static_cast<const ImageTexture&>(texture).value(u, v, p);
+	default: break;
+	}
+#endif
+	return texture.value(u, v, p);
+}
+
 #endif // !TEXTURE_H
@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Fixed set of threads running tasks from one FIFO queue.
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool {
+public:
+	// threadCount <= 0 uses one thread per hardware thread.
+	explicit ThreadPool(int threadCount = 0) {
+		if (threadCount <= 0) threadCount = max(1u, thread::hardware_concurrency());
+		for (int ii = 0; ii < threadCount; ii++) threads.emplace_back([this]() { workerLoop(); });
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Runs the tasks still queued, then joins the threads.
+	~ThreadPool() {
+		{
+			lock_guard<mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueChanged.notify_all();
+		for (thread& t : threads) t.join();
+	}
+
+	void submit(function<void()> task) {
+		{
+			lock_guard<mutex> lock(queueMutex);
+			tasks.push(move(task));
+		}
+		queueChanged.notify_one();
+	}
+
+	int size() const { return (int)threads.size(); }
+
+private:
+	void workerLoop() {
+		while (true) {
+			function<void()> task;
+			{
+				unique_lock<mutex> lock(queueMutex);
+				queueChanged.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (tasks.empty()) return;
+				task = move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+
+	vector<thread> threads;
+	queue<function<void()>> tasks;
+	mutex queueMutex;
+	condition_variable queueChanged;
+	bool stopping = false;
+};
+
+#endif // !THREAD_POOL_H
@@ -3,6 +3,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
 #include <limits>
 
 const float INF = std::numeric_limits<float>::infinity();
@@ -12,12 +13,37 @@ inline float degrees2radian(float degrees) {
     return degrees * PI / 180;
 }
 
+// PCG32 generator. Every thread has its own, so render threads neither share
+// nor lock any state. All threads start from the same seed; reseed with
+// seedRandom() to decorrelate them or to reproduce a sequence.
+struct RandomGenerator {
+    uint64_t state = 0x853c49e6748fea9bULL;
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+        uint32_t xorShifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = uint32_t(old >> 59u);
+        return (xorShifted >> rot) | (xorShifted << ((32 - rot) & 31));
+    }
+};
+
+inline RandomGenerator& threadRandomGenerator() {
+    static thread_local RandomGenerator generator;
+    return generator;
+}
+
+inline void seedRandom(uint64_t seed) {
+    RandomGenerator& generator = threadRandomGenerator();
+    generator.state = 0;
+    generator.next();
+    generator.state += seed;
+    generator.next();
+}
+
 inline float random_float() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
-    //static std::uniform_real_distribution<float> distribution(0.0, 1.0);
-    //static std::mt19937 generator;
-    //return distribution(generator);
+    return (threadRandomGenerator().next() >> 8) * (1.0f / 16777216.0f);
 }
 
 inline float random_float(float min, float max) {
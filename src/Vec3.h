@@ -23,17 +23,6 @@ public:
 		return Vec3(random_float(min, max), random_float(min, max), random_float(min, max));
 	}
 
-	inline static Vec3 randomInUnitSphere() {
-		while (true) {
-			Vec3 v = Vec3::random(-1, 1);
-			float len = v.length();
-			if (len >= 1) continue;
-			return v;
-		}
-	}
-	
-	inline static Vec3 randomInHemisphere(const Vec3& normal);
-
 	inline static bool isNan(const Vec3& v) {
 		return isnan(v[0]) || isnan(v[1]) || isnan(v[2]);
 	}
@@ -145,27 +134,6 @@ inline Vec3 unitVector(const Vec3& v) {
 	return v / v.length();
 }
 
-inline static Vec3 randomUnitVector() {
-	return unitVector(Vec3::randomInUnitSphere());
-}
-
-inline Vec3 Vec3::randomInHemisphere(const Vec3& normal) {
-	Vec3 v = randomInUnitSphere();
-	if (dot(normal, v) > 0) return v;
-	else return -1 * v;
-}
-
-inline Vec3 randomInUnitDisk() {
-	while (true)
-	{
-		Vec3 p(random_float(-1, 1), random_float(-1, 1), 0);
-		if (p.length() >= 1) continue;
-		return p;
-	}
-	
-	
-}
-
 inline static Vec3 reflect(const Vec3& incident, const Vec3& normal) {
 	Vec3 i = incident;
 	Vec3 n = unitVector(normal);
@@ -6,329 +6,357 @@
 #include "Ray.h"
 #include "HittableList.h"
 #include "Color.h"
-#include "Sphere.h"
-#include "Material.h"
-#include "MovingSphere.h"
-#include "Texture.h"
-#include "AARect.h"
+#include "Scenes.h"
+#include "Render.h"
+#include "Stats.h"
+#include "Heatmap.h"
+#include "Distributed.h"
+#include "RenderServer.h"
+#include "Preview.h"
+#include "SceneCache.h"
+#include "PathGuiding.h"
+#include "PhotonMapping.h"
 #include <iostream>
 #include <fstream>
-#include "Box.h"
-#include "ConstantMedium.h"
-#include "BVHNode.h"
+#include <string>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
-Color rayColor(const Ray& ray, const Color& backgroundColor, const Hittable& world, int depth);
-
-void createRandomScene(HittableList& world) {
-	world.clear();
-	auto checker = make_shared<CheckerTexture>(Color(0.2, 0.3, 0.1), Color(0.9, 0.9, 0.9));
-	auto groundMaterial = make_shared<Lambertian>(checker);
-	world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, groundMaterial));
-
-	float sRadius = 0.2;
-	for (int x = -11; x < 11; x++) {
-		for (int z = -11; z < 11; z++) {
-			auto mat = random_float();
-			
-			Point3 center(x + 0.9 * random_float(), sRadius, z + 0.9 * random_float());
-
-			if ((center - Point3(4, 0.2, 0)).length() <= 0.9) continue;
+void printUsage() {
+	cerr << "Usage: RTNW [--scene id] [--sampler independent|halton|sobol|bluenoise] [--spp n]\n"
+		<< "            [--stats file.json] [--motion-bvh] [--temporal-splits n] [--quantized-bvh]\n"
+		<< "            [--heatmap nodes|prims] [--heatmap-all-bounces] [--heatmap-max cost]\n"
+		<< "            [--workers n] [--listen address] [--tile-size px] [--tile-timeout s]\n"
+		<< "            [--preview] [--preview-pipe path] [--ooc-budget MB] [--scene-cache dir]\n"
+		<< "            [--environment file.hdr|file.pfm] [--environment-scale k]\n"
+		<< "            [--guide] [--guide-passes n] [--threads n]\n"
+		<< "            [--photons n] [--photon-passes n] [--photon-radius r]\n"
+		<< "            [--cloud-grid file.raw] [--sphere-field file.rtnwsph]\n"
+		<< "       RTNW --worker address\n"
+		<< "       RTNW --serve address [--scene id] [--motion-bvh] [--quantized-bvh] [--threads n]\n"
+		<< "            [--environment file] [--environment-scale k]\n"
+		<< "       RTNW --request address \"command\"\n"
+		<< "       RTNW --write-cloud-grid file.raw\n"
+		<< "Addresses are unix:path or tcp:host:port.\n";
+}
 
-			if (mat < 0.8) {
-				Color albedo = Color(random_float(0.5, 1), random_float(0.5, 1), random_float(0.5, 1));
-				Point3 center2 = center + Vec3(0, random_float(0, 0.5), 0);
-				auto sphereMaterial = make_shared<Lambertian>(albedo);
-				world.add(make_shared<MovingSphere>(center, center2, 0, 1, 0.2, sphereMaterial));
-			}
-			else if (mat < 0.85) {
-				Color albedo = Color::random(0.5, 1);
-				float fuzzy = random_float(0, 0.3);
-				auto sphereMaterial = make_shared<Metal>(albedo, fuzzy);
-				world.add(make_shared<Sphere>(center, 0.2, sphereMaterial));	
-			}
+int main(int argc, char** argv)
+{	
+	int sceneId = 8;
+	string samplerArg;
+	int sppOverride = 0;
+	string statsPath;
+	bool heatmap = false;
+	[[maybe_unused]] HeatmapMetric heatmapMetric = HeatmapNodes; // the heatmap options need RTNW_ENABLE_STATS
+	[[maybe_unused]] bool heatmapAllBounces = false;
+	[[maybe_unused]] float heatmapMax = 0;
+	bool motionBVH = false;
+	int temporalSplits = 0;
+	bool quantizedBVH = false;
+	string workerAddress;
+	int localWorkers = 0;
+	string listenAddress;
+	int tileSize = 32;
+	float tileTimeout = 0;
+	string serveAddress;
+	int threadCount = 0;
+	string requestAddress;
+	string requestCommand;
+	bool preview = false;
+	PreviewOutput previewOutput;
+	string sceneCacheDir;
+	string environmentPath;
+	string cloudGridOutput;
+	float environmentScale = 1;
+	bool guided = false;
+	GuidingOptions guidingOptions;
+	bool photonMapped = false;
+	PhotonOptions photonOptions;
+
+	for (int ii = 1; ii < argc; ii++) {
+		string arg = argv[ii];
+		bool hasValue = ii + 1 < argc;
+		if (arg == "--scene" && hasValue) sceneId = atoi(argv[++ii]);
+		else if (arg == "--sampler" && hasValue) samplerArg = argv[++ii];
+		else if (arg == "--spp" && hasValue) sppOverride = atoi(argv[++ii]);
+		else if (arg == "--stats" && hasValue) statsPath = argv[++ii];
+		else if (arg == "--heatmap" && hasValue) {
+			string metric = argv[++ii];
+			heatmap = true;
+			if (metric == "nodes") heatmapMetric = HeatmapNodes;
+			else if (metric == "prims") heatmapMetric = HeatmapPrimitives;
 			else {
-				auto sphereMaterial = make_shared<Dielectric>(1.5);
-				world.add(make_shared<Sphere>(center, 0.2, sphereMaterial));
+				printUsage();
+				return 1;
 			}
 		}
+		else if (arg == "--heatmap-all-bounces") heatmapAllBounces = true;
+		else if (arg == "--heatmap-max" && hasValue) heatmapMax = atof(argv[++ii]);
+		else if (arg == "--motion-bvh") motionBVH = true;
+		else if (arg == "--temporal-splits" && hasValue) {
+			motionBVH = true;
+			temporalSplits = atoi(argv[++ii]);
+		}
+		else if (arg == "--quantized-bvh") quantizedBVH = true;
+		else if (arg == "--scene-cache" && hasValue) sceneCacheDir = argv[++ii];
+		else if (arg == "--environment" && hasValue) environmentPath = argv[++ii];
+		else if (arg == "--environment-scale" && hasValue) environmentScale = atof(argv[++ii]);
+		else if (arg == "--guide") guided = true;
+		else if (arg == "--guide-passes" && hasValue) {
+			guided = true;
+			guidingOptions.trainingPasses = max(0, atoi(argv[++ii]));
+		}
+		else if (arg == "--photons" && hasValue) {
+			photonMapped = true;
+			photonOptions.photonsPerPass = max(1, atoi(argv[++ii]));
+		}
+		else if (arg == "--photon-passes" && hasValue) {
+			photonMapped = true;
+			photonOptions.passes = max(1, atoi(argv[++ii]));
+		}
+		else if (arg == "--photon-radius" && hasValue) {
+			photonMapped = true;
+			photonOptions.radius = atof(argv[++ii]);
+		}
+		else if (arg == "--cloud-grid" && hasValue) sceneFileOptions().cloudGrid = argv[++ii];
+		else if (arg == "--sphere-field" && hasValue) sceneFileOptions().sphereField = argv[++ii];
+		else if (arg == "--write-cloud-grid" && hasValue) cloudGridOutput = argv[++ii];
+		else if (arg == "--ooc-budget" && hasValue) outOfCoreOptions().budgetBytes = size_t(max(1, atoi(argv[++ii]))) << 20;
+		else if (arg == "--worker" && hasValue) workerAddress = argv[++ii];
+		else if (arg == "--workers" && hasValue) localWorkers = atoi(argv[++ii]);
+		else if (arg == "--listen" && hasValue) listenAddress = argv[++ii];
+		else if (arg == "--tile-size" && hasValue) tileSize = max(1, atoi(argv[++ii]));
+		else if (arg == "--tile-timeout" && hasValue) tileTimeout = atof(argv[++ii]);
+		else if (arg == "--serve" && hasValue) serveAddress = argv[++ii];
+		else if (arg == "--threads" && hasValue) threadCount = atoi(argv[++ii]);
+		else if (arg == "--preview") preview = true;
+		else if (arg == "--preview-pipe" && hasValue) {
+			preview = true;
+			previewOutput.pipePath = argv[++ii];
+		}
+		else if (arg == "--request" && ii + 2 < argc) {
+			requestAddress = argv[++ii];
+			requestCommand = argv[++ii];
+		}
+		else {
+			printUsage();
+			return 1;
+		}
 	}
 
-	auto material1 = make_shared<Dielectric>(1.5);
-	world.add(make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-	auto material2 = make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-	world.add(make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
-
-	auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
-
-}
-
-void twoPerlinSpheres(HittableList& world) {
-	world.clear();
-
-	auto pertext = make_shared<NoiseTexture>(4);
-	world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, make_shared<Lambertian>(pertext)));
-	world.add(make_shared<Sphere>(Point3(0, 2, 0), 2, make_shared<Lambertian>(pertext)));
-}
-
-void earth(HittableList& world) {
-	world.clear();
-	
-	auto earth_texture = make_shared<ImageTexture>("E:\\Personal\\Blog\\RTNW\\img\\earthmap.jpg");
-	auto earth_surface = make_shared<Lambertian>(earth_texture);
-	auto globe = make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
-
-	world.add(globe);
-}
-
-void simpleLight(HittableList& world) {
-	world.clear();
-
-	auto pertext = make_shared<NoiseTexture>(4);
-	world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, make_shared<Lambertian>(pertext)));
-	world.add(make_shared<Sphere>(Point3(0, 2, 0), 2, make_shared<Lambertian>(pertext)));
-
-	auto difflight = make_shared<DiffuseLight>(Color(4, 4, 4));
-	world.add(make_shared<XYRect>(3, 5, 1, 3, -2, difflight));
-}
-
-void cornellBox(HittableList& world) {
-	world.clear();
-	auto red = make_shared<Lambertian>(Color(.65, .05, .05));
-	auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-	auto green = make_shared<Lambertian>(Color(.12, .45, .15));
-	auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
-
-	world.add(make_shared<YZRect>(0, 555, 0, 555, 555, green));
-	world.add(make_shared<YZRect>(0, 555, 0, 555, 0, red));
-	world.add(make_shared<XZRect>(213, 343, 227, 332, 554, light));
-	world.add(make_shared<XZRect>(0, 555, 0, 555, 0, white));
-	world.add(make_shared<XZRect>(0, 555, 0, 555, 555, white));
-	world.add(make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-	shared_ptr<Hittable> box1 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
-	box1 = make_shared<RotateY>(box1, 15);
-	box1 = make_shared<Translate>(box1, Vec3(265, 0, 295));
-	world.add(box1);
-
-	shared_ptr<Hittable> box2 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
-	box2 = make_shared<RotateY>(box2, -18);
-	box2 = make_shared<Translate>(box2, Vec3(130, 0, 65));
-	world.add(box2);
-}
-
-void cornellSmoke(HittableList& world) {
-
-	auto red = make_shared<Lambertian>(Color(.65, .05, .05));
-	auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-	auto green = make_shared<Lambertian>(Color(.12, .45, .15));
-	auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
-
-	world.add(make_shared<YZRect>(0, 555, 0, 555, 555, green));
-	world.add(make_shared<YZRect>(0, 555, 0, 555, 0, red));
-	world.add(make_shared<XZRect>(113, 443, 127, 432, 554, light));
-	world.add(make_shared<XZRect>(0, 555, 0, 555, 555, white));
-	world.add(make_shared<XZRect>(0, 555, 0, 555, 0, white));
-	world.add(make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-	shared_ptr<Hittable> box1 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 330, 165), white);
-	box1 = make_shared<RotateY>(box1, 15);
-	box1 = make_shared<Translate>(box1, Vec3(265, 0, 295));
-
-	shared_ptr<Hittable> box2 = make_shared<Box>(Point3(0, 0, 0), Point3(165, 165, 165), white);
-	box2 = make_shared<RotateY>(box2, -18);
-	box2 = make_shared<Translate>(box2, Vec3(130, 0, 65));
-
-	world.add(make_shared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
-	world.add(make_shared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
-}
-
-void finalScene(HittableList& world) {
-	world.clear();
-
-	auto red = make_shared<Lambertian>(Color(.65, .05, .05));
-	auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-	auto green = make_shared<Lambertian>(Color(.12, .45, .15));
-	auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
-
-	world.add(make_shared<YZRect>(0, 555, 0, 555, 555, green));
-	world.add(make_shared<YZRect>(0, 555, 0, 555, 0, red));
-	world.add(make_shared<XZRect>(213, 343, 227, 332, 554, light));
-	world.add(make_shared<XZRect>(0, 555, 0, 555, 0, white));
-	world.add(make_shared<XZRect>(0, 555, 0, 555, 555, white));
-	world.add(make_shared<XYRect>(0, 555, 0, 555, 555, white));
-
-	auto center1 = Point3(80, 50, 70);
-	auto center2 = center1 + Vec3(0, 30, 0);
-	auto moving_sphere_material = make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
-	world.add(make_shared<MovingSphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-	world.add(make_shared<Sphere>(Point3(400, 50, 90), 50, make_shared<Dielectric>(1.5)));
-
-	world.add(make_shared<Sphere>(
-		Point3(300, 50, 210), 70, make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)
-		));
-
-	auto boundary = make_shared<Sphere>(Point3(250, 50, 70), 50, make_shared<Dielectric>(1.5));
-	world.add(boundary);
-	world.add(make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
-
-	auto emat = make_shared<Lambertian>(make_shared<ImageTexture>("E:\\Personal\\Blog\\RTNW\\img\\earthmap.jpg"));
-	world.add(make_shared<Sphere>(Point3(400, 100, 400), 100, emat));
+#ifndef RTNW_ENABLE_STATS
+	if (!statsPath.empty()) {
+		cerr << "Statistics are disabled in this build; reconfigure with -DRTNW_ENABLE_STATS=ON.\n";
+	}
+	if (heatmap) {
+		cerr << "The heatmap needs the statistics counters; reconfigure with -DRTNW_ENABLE_STATS=ON.\n";
+		return 1;
+	}
+#endif
 
-	auto pertext = make_shared<NoiseTexture>(0.1);
-	world.add(make_shared<Sphere>(Point3(150, 80, 350), 80, make_shared<Lambertian>(pertext)));
+	if (motionBVH && quantizedBVH) {
+		cerr << "--quantized-bvh compresses the static BVH; it cannot be combined with --motion-bvh.\n";
+		return 1;
+	}
 
-	//HittableList boxes2;
-	//auto white = make_shared<Lambertian>(Color(.73, .73, .73));
-	//int ns = 1000;
-	//for (int j = 0; j < ns; j++) {
-	//	boxes2.add(make_shared<Sphere>(Point3::random(0, 165), 10, white));
-	//}
+	if (!cloudGridOutput.empty()) {
+		if (!writeRawGrid(cloudGridOutput, proceduralCloud(cloudGridSize[0], cloudGridSize[1], cloudGridSize[2]))) {
+			cerr << "Cannot write " << cloudGridOutput << ".\n";
+			return 1;
+		}
+		cout << "Wrote the " << cloudGridSize[0] << "x" << cloudGridSize[1] << "x" << cloudGridSize[2]
+			<< " cloud grid to " << cloudGridOutput << "\n";
+		return 0;
+	}
 
-	//world.add(make_shared<Translate>(
-	//	make_shared<RotateY>(
-	//		make_shared<BVHNode>(boxes2, 0.0, 1.0), 15),
-	//	Vec3(-100, 270, 395)
-	//	)
-	//);
+	bool distributed = localWorkers > 0 || !listenAddress.empty();
+#ifdef _WIN32
+	if (distributed || !workerAddress.empty() || !serveAddress.empty() || !requestAddress.empty()) {
+		cerr << "Distributed rendering and the render server are not available on Windows.\n";
+		return 1;
+	}
+#else
+	if (!workerAddress.empty()) return runWorker(workerAddress);
+	if (!requestAddress.empty()) return runClient(requestAddress, requestCommand);
+	if (!serveAddress.empty()) {
+		RenderServer server(sceneId, motionBVH, temporalSplits, quantizedBVH, threadCount, environmentPath, environmentScale);
+		return server.run(serveAddress);
+	}
+	if (distributed && heatmap) {
+		cerr << "The heatmap cannot be rendered on workers.\n";
+		return 1;
+	}
+	if (distributed && preview) {
+		cerr << "The preview cannot be rendered on workers.\n";
+		return 1;
+	}
+	if (distributed && guided) {
+		cerr << "Guided renders cannot be split across workers.\n";
+		return 1;
+	}
+	if (distributed && photonMapped) {
+		cerr << "Photon-mapped renders cannot be split across workers.\n";
+		return 1;
+	}
+#endif
+	if (heatmap && preview) {
+		cerr << "The heatmap has no preview.\n";
+		return 1;
+	}
+	if (guided && (heatmap || preview)) {
+		cerr << "Guided renders have no heatmap or preview.\n";
+		return 1;
+	}
+	if (photonMapped && (heatmap || preview)) {
+		cerr << "Photon-mapped renders have no heatmap or preview.\n";
+		return 1;
+	}
+	if (photonMapped && guided) {
+		cerr << "--photons cannot be combined with --guide.\n";
+		return 1;
+	}
+	guidingOptions.threadCount = threadCount;
+	photonOptions.threadCount = threadCount;
 
-}
+	// Mapped cache file that a cached scene's objects point into.
+	SceneCache sceneCache;
 
-int main()
-{	
-	float aspectRatio = 16.0 / 9.0;
-	
-	Point3 lookFrom(13, 2, 3);
-	Point3 lookAt(0, 0, 0);
-	Vec3 upVector(0, 1, 0);
-	float focalDistance = 10.0;
-	float aperture = 0;
-	float vFOV = 20.0; // Vertical Field of View
-	Color backgroundColor(0, 0, 0);
-	
-	// Image Size
-	int imageWidth = 400;
-	int samplesPerPixel = 100;
-	int maxDepth = 50;
+	// Owns every scene object; declared first so it outlives the world.
+	SceneArena arena;
 
 	// World space
 	HittableList world;
-
-	switch (0)
-	{
-	case 1:
-		createRandomScene(world);
-		backgroundColor = Color(0.70, 0.80, 1.00);
-		lookFrom = Point3(13, 2, 3);
-		lookAt = Point3(0, 0, 0);
-		vFOV = 20.0;
-		aperture = 0.01;
-		break;
-	case 2:
-		twoPerlinSpheres(world);
-		backgroundColor = Color(0.70, 0.80, 1.00);
-		lookFrom = Point3(13, 2, 3);
-		lookAt = Point3(0, 0, 0);
-		vFOV = 20.0;
-		aperture = 0.01;
-		break;
-	case 3:
-		earth(world);
-		backgroundColor = Color(0.70, 0.80, 1.00);
-		lookFrom = Point3(13, 2, 3);
-		lookAt = Point3(0, 0, 0);
-		vFOV = 20.0;
-		aperture = 0.01;
-		break;
-	case 4:
-		simpleLight(world);
-		backgroundColor = Color(0, 0, 0);
-		//samplesPerPixel = 400;
-		lookFrom = Point3(26, 3, 6);
-		lookAt = Point3(0, 2, 0);
-		vFOV = 20.0;
-		break;
-	case 5:
-		cornellBox(world);
-		aspectRatio = 1.0;
-		imageWidth = 400;
-		samplesPerPixel = 200;
-		backgroundColor = Color(0, 0, 0);
-		lookFrom = Point3(278, 278, -800);
-		lookAt = Point3(278, 278, 0);
-		vFOV = 40.0;
-		break;
-	case 6:
-		cornellSmoke(world);
-		aspectRatio = 1.0;
-		imageWidth = 200;
-		samplesPerPixel = 100;
-		lookFrom = Point3(278, 278, -800);
-		lookAt = Point3(278, 278, 0);
-		vFOV = 40.0;
-		break;
-	default:
-	case 8:
-		finalScene(world);
-		aspectRatio = 1.0;
-		imageWidth = 200;
-		samplesPerPixel = 100;
-		lookFrom = Point3(278, 278, -800);
-		lookAt = Point3(278, 278, 0);
-		vFOV = 40.0;
-		break;
+	SceneSettings settings;
+	shared_ptr<Hittable> top;
+	uint64_t sceneCacheKey = SceneCache::key(sceneId, motionBVH, temporalSplits, quantizedBVH);
+	string sceneCachePath = sceneCacheDir.empty() ? string() : SceneCache::path(sceneCacheDir, sceneCacheKey);
+	bool cached = false;
+	if (!sceneCachePath.empty()) {
+		RTNW_STATS_PHASE(StatsPhaseSceneBuild);
+		cached = sceneCache.load(sceneCachePath, sceneCacheKey, arena, world, top, settings);
+		if (cached) cout << "Loaded scene " << sceneId << " from " << sceneCachePath << "\n";
 	}
-	int imageHeight = (int)(imageWidth / aspectRatio);
+	if (!cached) {
+		{
+			RTNW_STATS_PHASE(StatsPhaseSceneBuild);
+			loadScene(sceneId, world, settings, arena);
+		}
+		{
+			RTNW_STATS_PHASE(StatsPhaseBVHBuild);
+			top = buildSceneBVH(world, arena, motionBVH, temporalSplits, quantizedBVH);
+		}
+		if (!sceneCachePath.empty() && !SceneCache::save(sceneCachePath, sceneId, sceneCacheKey, settings, world, *top)) {
+			cerr << "Scene " << sceneId << " is not cached: it holds types the scene cache does not know, or "
+				<< sceneCachePath << " cannot be written.\n";
+		}
+	}
+	if (!samplerArg.empty() && !parseSamplerType(samplerArg, settings.sampler)) {
+		printUsage();
+		return 1;
+	}
+	if (sppOverride > 0) settings.samplesPerPixel = sppOverride;
+
+	HittableList scene(top);
+	sceneLights().build(world);
+	sceneShadowMedia().collect(world);
+	if (!useEnvironment(settings, environmentPath, environmentScale)) return 1;
 
-	Camera camera(lookFrom, lookAt, upVector, vFOV, aspectRatio, focalDistance, aperture, 0, 1);
+	int imageWidth = settings.imageWidth;
+	int imageHeight = settings.imageHeight();
+	int samplesPerPixel = settings.samplesPerPixel;
+	int maxDepth = settings.maxDepth;
+	Color backgroundColor = settings.backgroundColor;
 
-	ofstream imageFile("image.ppm");
-	
-	imageFile << "P3\n" << imageWidth << " " << imageHeight << "\n" << "255\n" << endl;
-	int kkk = 0;
-	for (int h = 0; h < imageHeight; h++) {
-		cout << "\rScanlines remaining: " << imageHeight - h << " " << flush;
-		for (int w = 0; w < imageWidth; w++) {
-			
-			Color pixelColor;
-			for (int ii = 0; ii < samplesPerPixel; ii++) {
-				float v = 1 - (h + random_float()) / (imageHeight - 1.0);
-				float u = (w +random_float()) / (imageWidth - 1.0);
+	Camera camera = sceneCamera(settings);
 
-				Ray ray = camera.getRay(u, v);
-				pixelColor += rayColor(ray, backgroundColor, world, maxDepth);	
+	vector<Color> pixels(imageWidth * imageHeight);
+	useSampler(settings.sampler);
+	{
+		RTNW_STATS_PHASE(StatsPhaseRender);
+#ifndef _WIN32
+		if (distributed) {
+			DistributedOptions options;
+			options.sceneId = sceneId;
+			options.motionBVH = motionBVH;
+			options.temporalSplits = temporalSplits;
+			options.quantizedBVH = quantizedBVH;
+			options.localWorkers = localWorkers;
+			options.listenAddress = listenAddress;
+			options.executable = argv[0];
+			options.tileSize = tileSize;
+			options.tileTimeout = tileTimeout;
+			options.sampler = settings.sampler;
+			options.samplesPerPixel = settings.samplesPerPixel;
+			options.environmentPath = environmentPath;
+			options.environmentScale = environmentScale;
+			if (!renderDistributed(options, imageWidth, imageHeight, pixels)) return 1;
+		}
+		else
+#endif
+#ifdef RTNW_ENABLE_STATS
+		if (heatmap) {
+			vector<float> costs(imageWidth * imageHeight);
+			float totalCost = 0;
+			for (int h = 0; h < imageHeight; h++) {
+				cout << "\rScanlines remaining: " << imageHeight - h << " " << flush;
+				for (int w = 0; w < imageWidth; w++) {
+					costs[h * imageWidth + w] = heatmapPixel(camera, scene, backgroundColor, w, h, imageWidth, imageHeight,
+						samplesPerPixel, maxDepth, heatmapMetric, heatmapAllBounces);
+					totalCost += costs[h * imageWidth + w];
+				}
+			}
+			heatmapToColors(costs, heatmapMax, pixels);
+			cout << "\nAverage " << (heatmapMetric == HeatmapNodes ? "BVH nodes" : "primitive tests")
+				<< " per " << (heatmapAllBounces ? "path" : "camera ray") << ": " << totalCost / costs.size()
+				<< ", max: " << *max_element(costs.begin(), costs.end());
+		}
+		else
+#endif
+		if (guided) {
+			renderGuided(camera, scene, backgroundColor, imageWidth, imageHeight, samplesPerPixel, maxDepth,
+				settings.sampler, guidingOptions, pixels);
+		}
+		else
+		if (photonMapped) {
+			renderPhotonMapped(camera, scene, backgroundColor, imageWidth, imageHeight, samplesPerPixel, maxDepth,
+				settings.sampler, photonOptions, pixels);
+		}
+		else
+		if (preview) {
+			previewOutput.imagePath = "image.ppm";
+			if (!renderPreview(camera, scene, backgroundColor, imageWidth, imageHeight, samplesPerPixel, maxDepth,
+				previewOutput, pixels)) return 1;
+		}
+		else
+		for (int h = 0; h < imageHeight; h++) {
+			cout << "\rScanlines remaining: " << imageHeight - h << " " << flush;
+			for (int w = 0; w < imageWidth; w++) {
+				pixels[h * imageWidth + w] = samplePixel(camera, scene, backgroundColor, w, h, imageWidth, imageHeight, samplesPerPixel, maxDepth);
 			}
-		
-			writeColor(imageFile, pixelColor, samplesPerPixel);
 		}
 	}
-	cout << "\nDone.\n";
-	imageFile.close();
-
-	return 0;
-}
-
-Color rayColor(const Ray& ray, const Color& backgroundColor, const Hittable& world, int depth) {
-	if (depth <= 0) return Color(0, 0, 0);
-	
-	//if (Vec3::isNan(ray.direction()) || Point3::isNan(ray.origin()))
-	//	return Color(0, 0, 0);
 
-	HitRecord hitRecord;
-	if (!world.hit(ray, 0.001, INF, hitRecord))
-		return backgroundColor;
+	{
+		RTNW_STATS_PHASE(StatsPhaseOutput);
+		ofstream imageFile("image.ppm");
 
-	Ray reflectedRay;
-	Color attenuation;
-	Color emitted = hitRecord.materialPtr->emitted(hitRecord.u, hitRecord.v, hitRecord.p);
+		imageFile << "P3\n" << imageWidth << " " << imageHeight << "\n" << "255\n" << endl;
+		for (const Color& pixelColor : pixels) {
+			if (heatmap) writeDisplayColor(imageFile, pixelColor);
+			else writeColor(imageFile, pixelColor, samplesPerPixel);
+		}
+		imageFile.close();
+	}
+	cout << "\nDone.\n";
 
-	if (!hitRecord.materialPtr->scatter(ray, hitRecord, attenuation, reflectedRay)) {
-		return emitted;
+#ifdef RTNW_ENABLE_STATS
+	if (!statsPath.empty()) {
+		ofstream statsFile(statsPath);
+		writeStatsJson(statsFile, mergedStats());
 	}
+#endif
 
-	return emitted + attenuation * rayColor(reflectedRay, backgroundColor, world, depth - 1);
+	return 0;
 }